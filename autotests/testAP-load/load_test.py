@@ -0,0 +1,67 @@
+#! /usr/bin/python3
+
+import unittest
+import time
+
+from iwd import IWD
+from hwsim import Hwsim
+from config import ctx
+
+# Number of client radios associating to the single iwd AP
+NUM_STATIONS = 200
+
+class Test(unittest.TestCase):
+    def test_association_throughput(self):
+        ns0 = ctx.get_namespace('ns0')
+
+        wd_ap = IWD(True, namespace=ns0)
+
+        ap_dev = wd_ap.list_devices(1)[0]
+        ap_dev.start_ap('TestAPLoad')
+
+        IWD.copy_to_storage('TestAPLoad.psk')
+
+        # Client radios are created after iwd starts and autoconnect
+        wd = IWD(True)
+
+        for i in range(NUM_STATIONS):
+            self.radios.append(self.hwsim.radios.create(name='load%i' % i))
+
+        start = time.time()
+
+        devices = wd.list_devices(NUM_STATIONS, max_wait=300)
+
+        for dev in devices:
+            condition = 'obj.state == DeviceState.connected'
+            wd.wait_for_object_condition(dev, condition, max_wait=300)
+
+        elapsed = time.time() - start
+
+        print('%i stations associated in %.2f s (%.1f assoc/s)' %
+                (NUM_STATIONS, elapsed, NUM_STATIONS / elapsed))
+
+        for dev in devices:
+            dev.disconnect()
+
+        ap_dev.stop_ap()
+
+    def setUp(self):
+        self.hwsim = Hwsim()
+        self.radios = []
+
+    def tearDown(self):
+        for radio in self.radios:
+            radio.remove()
+
+        self.radios = []
+
+    @classmethod
+    def setUpClass(cls):
+        IWD.copy_to_ap('TestAPLoad.ap')
+
+    @classmethod
+    def tearDownClass(cls):
+        IWD.clear_storage()
+
+if __name__ == '__main__':
+    unittest.main(exit=True)
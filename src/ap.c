@@ -24,7 +24,9 @@
 #include <config.h>
 #endif
 
+#include <ctype.h>
 #include <errno.h>
+#include <time.h>
 #include <linux/if_ether.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -53,6 +55,7 @@
 #include "src/wscutil.h"
 #include "src/eap-wsc.h"
 #include "src/ip-pool.h"
+#include "src/lease-db.h"
 #include "src/netconfig.h"
 #include "src/ap.h"
 #include "src/storage.h"
@@ -60,6 +63,19 @@
 #include "src/band.h"
 #include "src/common.h"
 
+/* 802.11-2020 9.4.1.8: AID values 1 through 2007 are usable */
+#define AP_MAX_AID 2007
+
+#define AP_PROBE_RECORDS	16
+#define AP_PROBE_COALESCE_TIME	20000	/* usec */
+#define AP_DEFAULT_LEASE_TIME	(12 * 60 * 60)	/* ell default */
+#define AP_GTK_TX_TIMEOUT	5	/* seconds */
+
+struct ap_probe_record {
+	uint8_t addr[6];
+	uint64_t timestamp;
+};
+
 struct ap_state {
 	struct netdev *netdev;
 	struct l_genl_family *nl80211;
@@ -81,6 +97,7 @@ struct ap_state {
 	unsigned int ciphers;
 	enum ie_rsn_cipher_suite group_cipher;
 	uint32_t beacon_interval;
+	uint32_t dtim_period;
 	struct l_uintset *rates;
 	uint32_t start_stop_cmd_id;
 	uint32_t mlme_watch;
@@ -90,12 +107,18 @@ struct ap_state {
 	struct l_timeout *wsc_pbc_timeout;
 	uint16_t wsc_dpid;
 	uint8_t wsc_uuid_r[16];
+	uint8_t *pr_template;
+	size_t pr_template_len;
+	struct ap_probe_record probe_records[AP_PROBE_RECORDS];
 
-	uint16_t last_aid;
+	struct l_uintset *aids;
 	struct l_queue *sta_states;
+	struct l_hashmap *sta_map;
 
 	struct l_dhcp_server *netconfig_dhcp;
 	struct l_rtnl_address *netconfig_addr4;
+	struct lease_db *leases;
+	unsigned int lease_time;
 	uint32_t rtnl_add_cmd;
 	uint32_t rtnl_get_gateway4_mac_cmd;
 	uint32_t rtnl_get_dns4_mac_cmd;
@@ -108,6 +131,9 @@ struct ap_state {
 
 	struct l_timeout *rekey_timeout;
 	unsigned int rekey_time;
+	uint64_t gtk_rekey_time;
+	uint64_t gtk_rekey_deadline;
+	struct l_timeout *gtk_tx_timeout;
 
 	bool started : 1;
 	bool gtk_set : 1;
@@ -144,6 +170,7 @@ struct sta_state {
 
 	bool ht_support : 1;
 	bool ht_greenfield : 1;
+	bool gtk_pending : 1;
 };
 
 struct ap_wsc_pbc_probe_record {
@@ -161,6 +188,7 @@ struct ap_network {
 static char **global_addr4_strs;
 static uint32_t netdev_watch;
 static struct l_netlink *rtnl;
+static struct l_queue *ap_list;
 
 static bool network_match_ssid(const void *a, const void *b)
 {
@@ -252,6 +280,12 @@ static void ap_stop_handshake_work(struct l_idle *idle, void *user_data)
 	ap_stop_handshake(sta);
 }
 
+static void ap_invalidate_templates(struct ap_state *ap)
+{
+	l_free(l_steal_ptr(ap->pr_template));
+	ap->pr_template_len = 0;
+}
+
 static void ap_sta_free(void *data)
 {
 	struct sta_state *sta = data;
@@ -272,6 +306,9 @@ static void ap_sta_free(void *data)
 		l_dhcp_server_lease_remove(ap->netconfig_dhcp,
 						sta->ip_alloc_lease);
 
+	if (sta->aid && ap->aids)
+		l_uintset_take(ap->aids, sta->aid);
+
 	ap_stop_handshake(sta);
 
 	l_free(sta);
@@ -281,6 +318,8 @@ static void ap_reset(struct ap_state *ap)
 {
 	struct netdev *netdev = ap->netdev;
 
+	l_queue_remove(ap_list, ap);
+
 	explicit_bzero(ap->passphrase, sizeof(ap->passphrase));
 	explicit_bzero(ap->psk, sizeof(ap->psk));
 
@@ -316,14 +355,21 @@ static void ap_reset(struct ap_state *ap)
 		ap->rtnl_get_dns4_mac_cmd = 0;
 	}
 
+	l_hashmap_destroy(l_steal_ptr(ap->sta_map), NULL);
 	l_queue_destroy(l_steal_ptr(ap->sta_states), ap_sta_free);
 
+	if (ap->aids)
+		l_uintset_free(l_steal_ptr(ap->aids));
+
 	if (ap->rates)
 		l_uintset_free(l_steal_ptr(ap->rates));
 
 	l_queue_destroy(l_steal_ptr(ap->wsc_pbc_probes), l_free);
 	l_timeout_remove(ap->wsc_pbc_timeout);
 
+	ap_invalidate_templates(ap);
+	memset(ap->probe_records, 0, sizeof(ap->probe_records));
+
 	ap->started = false;
 
 	/* Delete IP if one was set by IWD */
@@ -340,6 +386,8 @@ static void ap_reset(struct ap_state *ap)
 		ap->netconfig_dhcp = NULL;
 	}
 
+	lease_db_free(l_steal_ptr(ap->leases));
+
 	if (ap->scan_id) {
 		scan_cancel(netdev_get_wdev_id(ap->netdev), ap->scan_id);
 		ap->scan_id = 0;
@@ -354,6 +402,9 @@ static void ap_reset(struct ap_state *ap)
 		l_timeout_remove(ap->rekey_timeout);
 		ap->rekey_timeout = NULL;
 	}
+
+	ap->gtk_rekey_deadline = 0;
+	l_timeout_remove(l_steal_ptr(ap->gtk_tx_timeout));
 }
 
 static bool ap_event_done(struct ap_state *ap, bool prev_in_event)
@@ -387,6 +438,7 @@ static bool ap_event(struct ap_state *ap, enum ap_event_type event,
 }
 
 static void ap_check_rekeys(struct ap_state *ap);
+static void ap_gtk_sta_done(struct ap_state *ap, struct sta_state *sta);
 
 static void ap_del_station(struct sta_state *sta, uint16_t reason,
 				bool disassociate)
@@ -404,6 +456,7 @@ static void ap_del_station(struct sta_state *sta, uint16_t reason,
 	l_genl_family_send(ap->nl80211, msg, NULL, NULL, NULL);
 
 	sta->associated = false;
+	ap_invalidate_templates(ap);
 
 	if (sta->rsna) {
 		if (ap->ops->handle_event) {
@@ -427,6 +480,7 @@ static void ap_del_station(struct sta_state *sta, uint16_t reason,
 	}
 
 	ap_stop_handshake(sta);
+	ap_gtk_sta_done(ap, sta);
 
 	/*
 	 * If the event handler tears the AP down, we've made sure above that
@@ -471,9 +525,162 @@ static void ap_start_rekey(struct ap_state *ap, struct sta_state *sta)
 {
 	l_debug("Rekey STA "MAC, MAC_STR(sta->addr));
 
+	/* Set again on HANDSHAKE_EVENT_REKEY_COMPLETE */
+	sta->rekey_time = 0;
+
 	eapol_start(sta->sm);
 }
 
+static void ap_gtk_op_cb(struct l_genl_msg *msg, void *user_data)
+{
+	if (l_genl_msg_get_error(msg) < 0) {
+		uint8_t cmd = l_genl_msg_get_command(msg);
+		const char *cmd_name =
+			cmd == NL80211_CMD_NEW_KEY ? "NEW_KEY" :
+			cmd == NL80211_CMD_SET_KEY ? "SET_KEY" :
+			"DEL_KEY";
+
+		l_error("%s failed for the GTK: %i",
+			cmd_name, l_genl_msg_get_error(msg));
+	}
+}
+
+/*
+ * Make the new GTK the default for group transmissions once all stations
+ * that were sent it have installed it, failed or left, or when
+ * AP_GTK_TX_TIMEOUT runs out.
+ */
+static void ap_gtk_set_tx(struct ap_state *ap)
+{
+	const struct l_queue_entry *e;
+	struct l_genl_msg *msg;
+
+	l_timeout_remove(l_steal_ptr(ap->gtk_tx_timeout));
+
+	for (e = l_queue_get_entries(ap->sta_states); e; e = e->next) {
+		struct sta_state *sta = e->data;
+
+		sta->gtk_pending = false;
+	}
+
+	l_debug("Transmitting with GTK index %u", ap->gtk_index);
+
+	msg = nl80211_build_set_key(netdev_get_ifindex(ap->netdev),
+					ap->gtk_index);
+	if (!l_genl_family_send(ap->nl80211, msg, ap_gtk_op_cb, NULL, NULL)) {
+		l_genl_msg_unref(msg);
+		l_error("Issuing SET_KEY failed");
+	}
+}
+
+static void ap_gtk_tx_timeout(struct l_timeout *timeout, void *user_data)
+{
+	struct ap_state *ap = user_data;
+
+	l_debug("Not all stations installed the new GTK in time");
+	ap_gtk_set_tx(ap);
+}
+
+/* @sta has installed the new GTK or won't be waited for any longer */
+static void ap_gtk_sta_done(struct ap_state *ap, struct sta_state *sta)
+{
+	const struct l_queue_entry *e;
+
+	if (!sta->gtk_pending)
+		return;
+
+	sta->gtk_pending = false;
+
+	for (e = l_queue_get_entries(ap->sta_states); e; e = e->next) {
+		struct sta_state *other = e->data;
+
+		if (other->gtk_pending)
+			return;
+	}
+
+	ap_gtk_set_tx(ap);
+}
+
+/*
+ * The authenticator side of EAPoL has no Group Key Handshake so the new GTK
+ * is installed under the other key index and handed to each station through
+ * a new 4-Way Handshake.  A newly installed key starts with a zero Tx RSC.
+ * The old key stays the default for transmissions until ap_gtk_set_tx() so
+ * that stations still waiting for the new one can decrypt group traffic.
+ */
+static void ap_gtk_rekey(struct ap_state *ap)
+{
+	enum crypto_cipher group_cipher =
+		ie_rsn_cipher_suite_to_cipher(ap->group_cipher);
+	int gtk_len = crypto_cipher_key_len(group_cipher);
+	uint32_t ifindex = netdev_get_ifindex(ap->netdev);
+	uint8_t gtk[CRYPTO_MAX_GTK_LEN];
+	uint8_t gtk_index = ap->gtk_index == 1 ? 2 : 1;
+	static const uint8_t zero_gtk_rsc[6];
+	const struct l_queue_entry *e;
+	struct l_genl_msg *msg;
+	uint64_t now = l_time_now();
+	bool pending = false;
+
+	/*
+	 * Keep to the multiples of the rekey period so that the APs sharing
+	 * this radio stay in step even if the timer fired late.
+	 */
+	while (!l_time_before(now, ap->gtk_rekey_deadline))
+		ap->gtk_rekey_deadline += ap->gtk_rekey_time;
+
+	/* Only possible with a very short GroupRekeyTimeout */
+	if (ap->gtk_tx_timeout)
+		ap_gtk_set_tx(ap);
+
+	l_debug("Rekey GTK, new key index %u", gtk_index);
+
+	l_getrandom(gtk, gtk_len);
+
+	msg = nl80211_build_new_key_group(ifindex, group_cipher, gtk_index,
+						gtk, gtk_len, NULL, 0, NULL);
+	if (!l_genl_family_send(ap->nl80211, msg, ap_gtk_op_cb, NULL, NULL)) {
+		l_genl_msg_unref(msg);
+		l_error("Issuing NEW_KEY failed");
+		goto done;
+	}
+
+	memcpy(ap->gtk, gtk, gtk_len);
+	ap->gtk_index = gtk_index;
+
+	for (e = l_queue_get_entries(ap->sta_states); e; e = e->next) {
+		struct sta_state *sta = e->data;
+
+		/* Also covers any 4-Way Handshake still in progress */
+		if (sta->hs)
+			handshake_state_set_gtk(sta->hs, ap->gtk,
+						ap->gtk_index, zero_gtk_rsc);
+
+		if (sta->associated && sta->rsna && sta->sm) {
+			sta->gtk_pending = true;
+			pending = true;
+		}
+	}
+
+	if (!pending) {
+		ap_gtk_set_tx(ap);
+		goto done;
+	}
+
+	ap->gtk_tx_timeout = l_timeout_create(AP_GTK_TX_TIMEOUT,
+						ap_gtk_tx_timeout, ap, NULL);
+
+	for (e = l_queue_get_entries(ap->sta_states); e; e = e->next) {
+		struct sta_state *sta = e->data;
+
+		if (sta->gtk_pending)
+			ap_start_rekey(ap, sta);
+	}
+
+done:
+	explicit_bzero(gtk, sizeof(gtk));
+}
+
 static void ap_rekey_timeout(struct l_timeout *timeout, void *user_data)
 {
 	struct ap_state *ap = user_data;
@@ -482,20 +689,57 @@ static void ap_rekey_timeout(struct l_timeout *timeout, void *user_data)
 }
 
 /*
- * Used to check/start any rekeys which are due and reset the rekey timer to the
- * next soonest station needing a rekey.
- *
- * TODO: Could adapt this to also take into account the next GTK rekey and
- * service that as well. But GTK rekeys are not yet supported in AP mode.
+ * Reset the rekey timer to the next soonest station needing a rekey or the
+ * next GTK rekey, whichever comes first, or remove it if there is neither.
  */
-static void ap_check_rekeys(struct ap_state *ap)
+static void ap_update_rekey_timer(struct ap_state *ap)
 {
 	const struct l_queue_entry *e;
 	uint64_t now = l_time_now();
-	uint64_t next = 0;
+	uint64_t next = ap->gtk_rekey_deadline;
+	uint64_t ms = 0;
 
-	if (!ap->rekey_time)
+	for (e = l_queue_get_entries(ap->sta_states); e; e = e->next) {
+		struct sta_state *sta = e->data;
+
+		if (!sta->associated || !sta->rsna || sta->rekey_time == 0)
+			continue;
+
+		if (!next || l_time_before(sta->rekey_time, next))
+			next = sta->rekey_time;
+	}
+
+	if (!next) {
+		l_timeout_remove(ap->rekey_timeout);
+		ap->rekey_timeout = NULL;
 		return;
+	}
+
+	if (l_time_before(now, next))
+		ms = l_time_to_msecs(l_time_diff(now, next));
+
+	/* A zero timeout would disarm the timer */
+	ms = L_MAX(ms, 1U);
+
+	if (ap->rekey_timeout)
+		l_timeout_modify_ms(ap->rekey_timeout, ms);
+	else
+		ap->rekey_timeout = l_timeout_create_ms(ms, ap_rekey_timeout,
+							ap, NULL);
+}
+
+/*
+ * Used to check/start any rekeys which are due, both the GTK rekey and the
+ * per-station PTK rekeys, and reset the rekey timer to the next one needed.
+ */
+static void ap_check_rekeys(struct ap_state *ap)
+{
+	const struct l_queue_entry *e;
+	uint64_t now = l_time_now();
+
+	if (ap->gtk_rekey_deadline &&
+			!l_time_before(now, ap->gtk_rekey_deadline))
+		ap_gtk_rekey(ap);
 
 	/* Find the station(s) that need a rekey and start it */
 	for (e = l_queue_get_entries(ap->sta_states); e; e = e->next) {
@@ -504,30 +748,13 @@ static void ap_check_rekeys(struct ap_state *ap)
 		if (!sta->associated || !sta->rsna || sta->rekey_time == 0)
 			continue;
 
-		if (l_time_before(now, sta->rekey_time)) {
-			uint64_t diff = l_time_diff(now, sta->rekey_time);
-
-			/* Finding the next rekey time */
-			if (next < diff)
-				next = diff;
-
+		if (l_time_before(now, sta->rekey_time))
 			continue;
-		}
 
 		ap_start_rekey(ap, sta);
 	}
 
-	/*
-	 * Set the next rekey to the station needing it the soonest, or remove
-	 * if a single station and wait until the rekey is complete to reset
-	 * the timer.
-	 */
-	if (next)
-		l_timeout_modify(ap->rekey_timeout, l_time_to_secs(next));
-	else {
-		l_timeout_remove(ap->rekey_timeout);
-		ap->rekey_timeout = NULL;
-	}
+	ap_update_rekey_timer(ap);
 }
 
 static void ap_set_sta_rekey_timer(struct ap_state *ap, struct sta_state *sta)
@@ -536,31 +763,98 @@ static void ap_set_sta_rekey_timer(struct ap_state *ap, struct sta_state *sta)
 		return;
 
 	sta->rekey_time = l_time_now() + ap->rekey_time - 1;
+	ap_update_rekey_timer(ap);
+}
 
-	/*
-	 * First/only station authenticated, set rekey timer. Any more stations
-	 * will just set their rekey time and be serviced by the single callback
-	 */
-	if (!ap->rekey_timeout)
-		ap->rekey_timeout = l_timeout_create(
-						l_time_to_secs(ap->rekey_time),
-						ap_rekey_timeout, ap, NULL);
+/*
+ * All BSSes on a radio rekey their GTKs at the same time so that the new
+ * group keys go out in a single burst.  Follow the schedule of another AP
+ * on this wiphy if it uses the same GroupRekeyTimeout.
+ */
+static void ap_start_gtk_rekey_timer(struct ap_state *ap)
+{
+	struct wiphy *wiphy = netdev_get_wiphy(ap->netdev);
+	const struct l_queue_entry *e;
+
+	if (!ap->gtk_rekey_time)
+		return;
+
+	ap->gtk_rekey_deadline = l_time_now() + ap->gtk_rekey_time;
+
+	for (e = l_queue_get_entries(ap_list); e; e = e->next) {
+		struct ap_state *peer = e->data;
+
+		if (peer == ap || netdev_get_wiphy(peer->netdev) != wiphy ||
+				!peer->gtk_rekey_deadline ||
+				peer->gtk_rekey_time != ap->gtk_rekey_time)
+			continue;
+
+		ap->gtk_rekey_deadline = peer->gtk_rekey_deadline;
+		break;
+	}
+
+	ap_update_rekey_timer(ap);
 }
 
-static bool ap_sta_match_addr(const void *a, const void *b)
+static struct sta_state *ap_sta_find(struct ap_state *ap, const uint8_t *addr)
 {
-	const struct sta_state *sta = a;
+	return l_hashmap_lookup(ap->sta_map, addr);
+}
 
-	return !memcmp(sta->addr, b, 6);
+/*
+ * Stations are kept both in the sta_states queue, which preserves the order
+ * in which they were added for iteration, and in sta_map keyed by the MAC
+ * address so that per-frame lookups don't scan every station.
+ */
+static void ap_sta_add(struct ap_state *ap, struct sta_state *sta)
+{
+	if (!ap->sta_states) {
+		ap->sta_states = l_queue_new();
+		ap->sta_map = l_hashmap_new();
+		l_hashmap_set_hash_function(ap->sta_map, util_address_hash);
+		l_hashmap_set_compare_function(ap->sta_map,
+						util_address_compare);
+	}
+
+	l_queue_push_tail(ap->sta_states, sta);
+	l_hashmap_insert(ap->sta_map, sta->addr, sta);
+}
+
+static bool ap_sta_unlink(struct ap_state *ap, struct sta_state *sta)
+{
+	if (!l_queue_remove(ap->sta_states, sta))
+		return false;
+
+	l_hashmap_remove(ap->sta_map, sta->addr);
+	return true;
+}
+
+/* Returns the lowest free AID, or 0 if all 2007 are in use */
+static uint16_t ap_alloc_aid(struct ap_state *ap)
+{
+	uint32_t aid;
+
+	if (!ap->aids)
+		ap->aids = l_uintset_new_from_range(1, AP_MAX_AID);
+
+	aid = l_uintset_find_unused_min(ap->aids);
+	if (aid > AP_MAX_AID)
+		return 0;
+
+	l_uintset_put(ap->aids, aid);
+	return aid;
 }
 
 static void ap_remove_sta(struct sta_state *sta)
 {
-	if (!l_queue_remove(sta->ap->sta_states, sta)) {
+	struct ap_state *ap = sta->ap;
+
+	if (!ap_sta_unlink(ap, sta)) {
 		l_error("tried to remove station that doesn't exist");
 		return;
 	}
 
+	ap_gtk_sta_done(ap, sta);
 	ap_sta_free(sta);
 }
 
@@ -813,27 +1107,8 @@ static size_t ap_write_wsc_ie(struct ap_state *ap,
 	size_t len = 0;
 
 	/* WSC IE */
-	if (type == MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE && client_frame) {
-		const uint8_t *from = client_frame->address_2;
+	if (type == MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE) {
 		struct wsc_probe_response wsc_pr = {};
-		const struct mmpdu_probe_request *req =
-			mmpdu_body(client_frame);
-		size_t req_ies_len = (void *) client_frame + client_frame_len -
-			(void *) req->ies;
-		ssize_t req_wsc_data_size;
-
-		/*
-		 * Process the client Probe Request WSC IE first as it may
-		 * cause us to exit "active PBC mode" and that will be
-		 * immediately reflected in our Probe Response WSC IE.
-		 */
-		wsc_data = ie_tlv_extract_wsc_payload(req->ies, req_ies_len,
-							&req_wsc_data_size);
-		if (wsc_data) {
-			ap_process_wsc_probe_req(ap, from, wsc_data,
-							req_wsc_data_size);
-			l_free(wsc_data);
-		}
 
 		wsc_pr.version2 = true;
 		wsc_pr.state = WSC_STATE_CONFIGURED;
@@ -879,8 +1154,7 @@ static size_t ap_write_wsc_ie(struct ap_state *ap,
 			MPDU_MANAGEMENT_SUBTYPE_REASSOCIATION_RESPONSE)) {
 		const uint8_t *from = client_frame->address_2;
 		struct wsc_association_response wsc_resp = {};
-		struct sta_state *sta =
-			l_queue_find(ap->sta_states, ap_sta_match_addr, from);
+		struct sta_state *sta = ap_sta_find(ap, from);
 
 		if (!sta || sta->assoc_rsne)
 			return 0;
@@ -1272,12 +1546,13 @@ no_space:
 	return 0;
 }
 
-/* Beacon / Probe Response frame portion after the TIM IE */
-static size_t ap_build_beacon_pr_tail(struct ap_state *ap,
+/*
+ * Beacon / Probe Response IEs after the TIM IE that only depend on our own
+ * configuration and state, i.e. everything except the ap->ops extra IEs.
+ */
+static size_t ap_build_beacon_pr_own_ies(struct ap_state *ap,
 					enum mpdu_management_subtype stype,
-					const struct mmpdu_header *req,
-					size_t req_len, uint8_t *out_buf,
-					size_t buf_len)
+					uint8_t *out_buf, size_t buf_len)
 {
 	size_t len;
 	struct ie_rsn_info rsn;
@@ -1290,10 +1565,101 @@ static size_t ap_build_beacon_pr_tail(struct ap_state *ap,
 		return 0;
 	len += 2 + out_buf[len + 1];
 
-	len += ap_write_extra_ies(ap, stype, req, req_len, out_buf + len);
+	len += ap_write_wsc_ie(ap, stype, NULL, 0, out_buf + len);
+
+	if (ap->supports_ht)
+		len += ap_write_wmm_ies(ap, out_buf + len);
+
 	return len;
 }
 
+/* Beacon / Probe Response frame portion after the TIM IE */
+static size_t ap_build_beacon_pr_tail(struct ap_state *ap,
+					enum mpdu_management_subtype stype,
+					const struct mmpdu_header *req,
+					size_t req_len, uint8_t *out_buf,
+					size_t buf_len)
+{
+	size_t len;
+
+	len = ap_build_beacon_pr_own_ies(ap, stype, out_buf, buf_len);
+	if (!len)
+		return 0;
+
+	if (ap->ops->write_extra_ies)
+		len += ap->ops->write_extra_ies(stype, req, req_len,
+						out_buf + len, ap->user_data);
+
+	return len;
+}
+
+/*
+ * Except for the destination address and the ap->ops extra IEs, the Probe
+ * Responses we send are identical for every client.  Keep a prebuilt copy,
+ * addressed to 00:00:00:00:00:00, so that answering a Probe Request doesn't
+ * require rebuilding all the IEs.  The template is dropped whenever anything
+ * it depends on changes, which is also when the beacon is updated.
+ */
+static bool ap_build_probe_resp_template(struct ap_state *ap)
+{
+	static const uint8_t zero_addr[6] = { 0 };
+	size_t buf_len = 512 + ap_get_wsc_ie_len(ap,
+					MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
+					NULL, 0) + 50;
+	uint8_t *buf = l_malloc(buf_len);
+	size_t head_len;
+	size_t tail_len;
+
+	head_len = ap_build_beacon_pr_head(ap,
+					MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
+					zero_addr, buf, buf_len);
+	tail_len = ap_build_beacon_pr_own_ies(ap,
+					MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
+					buf + head_len, buf_len - head_len);
+	if (L_WARN_ON(!head_len || !tail_len)) {
+		l_free(buf);
+		return false;
+	}
+
+	ap->pr_template = buf;
+	ap->pr_template_len = head_len + tail_len;
+	return true;
+}
+
+/*
+ * Build the Probe Response the driver sends on our behalf when it supports
+ * probe response offload.  There's no client frame in this case so the
+ * ap->ops extra IEs are built as for a NULL request.
+ */
+static uint8_t *ap_build_offload_probe_resp(struct ap_state *ap,
+						size_t *out_len)
+{
+	uint8_t *buf;
+	size_t len;
+
+	if (!ap->pr_template && !ap_build_probe_resp_template(ap))
+		return NULL;
+
+	len = ap->pr_template_len;
+
+	if (ap->ops->get_extra_ies_len)
+		len += ap->ops->get_extra_ies_len(
+					MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
+					NULL, 0, ap->user_data);
+
+	buf = l_malloc(len);
+	memcpy(buf, ap->pr_template, ap->pr_template_len);
+	len = ap->pr_template_len;
+
+	if (ap->ops->write_extra_ies)
+		len += ap->ops->write_extra_ies(
+					MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
+					NULL, 0, buf + len, ap->user_data);
+
+	*out_len = len;
+	return buf;
+}
+
 static void ap_set_beacon_cb(struct l_genl_msg *msg, void *user_data)
 {
 	int error = l_genl_msg_get_error(msg);
@@ -1311,11 +1677,16 @@ void ap_update_beacon(struct ap_state *ap)
 						NULL, 0);
 	L_AUTO_FREE_VAR(uint8_t *, tail) = malloc(tail_len);
 	size_t head_len;
+	_auto_(l_free) uint8_t *probe_resp = NULL;
+	size_t probe_resp_len = 0;
 	uint64_t wdev_id = netdev_get_wdev_id(ap->netdev);
+	struct wiphy *wiphy = netdev_get_wiphy(ap->netdev);
 	static const uint8_t bcast_addr[6] = {
 		0xff, 0xff, 0xff, 0xff, 0xff, 0xff
 	};
 
+	ap_invalidate_templates(ap);
+
 	if (L_WARN_ON(!ap->started))
 		return;
 
@@ -1326,8 +1697,16 @@ void ap_update_beacon(struct ap_state *ap)
 	if (L_WARN_ON(!head_len || !tail_len))
 		return;
 
+	/* Keep the offloaded Probe Response in sync with the beacon */
+	if (wiphy_supports_probe_resp_offload(wiphy)) {
+		probe_resp = ap_build_offload_probe_resp(ap, &probe_resp_len);
+		if (L_WARN_ON(!probe_resp))
+			return;
+	}
+
 	cmd = l_genl_msg_new_sized(NL80211_CMD_SET_BEACON,
-					32 + head_len + tail_len);
+					32 + head_len + tail_len +
+					probe_resp_len);
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_WDEV, 8, &wdev_id);
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_BEACON_HEAD, head_len, head);
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_BEACON_TAIL, tail_len, tail);
@@ -1335,6 +1714,10 @@ void ap_update_beacon(struct ap_state *ap)
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_IE_PROBE_RESP, 0, "");
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_IE_ASSOC_RESP, 0, "");
 
+	if (probe_resp)
+		l_genl_msg_append_attr(cmd, NL80211_ATTR_PROBE_RESP,
+					probe_resp_len, probe_resp);
+
 	if (l_genl_family_send(ap->nl80211, cmd, ap_set_beacon_cb, NULL, NULL))
 		return;
 
@@ -1413,14 +1796,25 @@ error:
 
 static bool ap_sta_get_dhcp4_lease(struct sta_state *sta)
 {
+	const struct lease_db_entry *entry = NULL;
+	uint32_t requested_ip = 0;
+
 	if (sta->ip_alloc_lease)
 		return true;
 
 	if (!sta->ap->netconfig_dhcp)
 		return false;
 
+	/* Try to give a returning client the address it had last time */
+	if (sta->ap->leases)
+		entry = lease_db_lookup(sta->ap->leases, sta->addr);
+
+	if (entry)
+		requested_ip = htonl(entry->addr);
+
 	sta->ip_alloc_lease = l_dhcp_server_discover(sta->ap->netconfig_dhcp,
-							0, NULL, sta->addr);
+							requested_ip, NULL,
+							sta->addr);
 	if (!sta->ip_alloc_lease) {
 		l_error("l_dhcp_server_discover() failed, see IWD_DHCP_DEBUG "
 			"output");
@@ -1485,6 +1879,7 @@ static void ap_handshake_event(struct handshake_state *hs,
 	}
 	case HANDSHAKE_EVENT_REKEY_COMPLETE:
 		ap_set_sta_rekey_timer(ap, sta);
+		ap_gtk_sta_done(ap, sta);
 		break;
 	default:
 		break;
@@ -1683,20 +2078,6 @@ static struct l_genl_msg *ap_build_cmd_new_station(struct sta_state *sta)
 	return msg;
 }
 
-static void ap_gtk_op_cb(struct l_genl_msg *msg, void *user_data)
-{
-	if (l_genl_msg_get_error(msg) < 0) {
-		uint8_t cmd = l_genl_msg_get_command(msg);
-		const char *cmd_name =
-			cmd == NL80211_CMD_NEW_KEY ? "NEW_KEY" :
-			cmd == NL80211_CMD_SET_KEY ? "SET_KEY" :
-			"DEL_KEY";
-
-		l_error("%s failed for the GTK: %i",
-			cmd_name, l_genl_msg_get_error(msg));
-	}
-}
-
 static void ap_associate_sta_cb(struct l_genl_msg *msg, void *user_data)
 {
 	struct sta_state *sta = user_data;
@@ -1778,6 +2159,7 @@ static void ap_associate_sta_cb(struct l_genl_msg *msg, void *user_data)
 		 * just use NL80211_CMD_GET_KEY from now.
 		 */
 		ap->gtk_set = true;
+		ap_start_gtk_rekey_timer(ap);
 	}
 
 	if (ap->group_cipher == IE_RSN_CIPHER_SUITE_NO_GROUP_TRAFFIC)
@@ -1812,8 +2194,10 @@ static void ap_associate_sta(struct ap_state *ap, struct sta_state *sta)
 
 	if (sta->associated)
 		msg = nl80211_build_set_station_associated(ifindex, sta->addr);
-	else
+	else {
 		msg = ap_build_cmd_new_station(sta);
+		ap_invalidate_templates(ap);
+	}
 
 	sta->associated = true;
 	sta->rsna = false;
@@ -2093,7 +2477,9 @@ static void ap_assoc_reassoc(struct sta_state *sta, bool reassoc,
 	_auto_(l_uintset_free) struct l_uintset *rates = NULL;
 	struct ie_rsn_info rsn_info;
 	int err;
+	struct ie_index index;
 	struct ie_tlv_iter iter;
+	unsigned int i;
 	_auto_(l_free) uint8_t *wsc_data = NULL;
 	ssize_t wsc_data_len;
 	bool fils_ip_req = false;
@@ -2107,11 +2493,17 @@ static void ap_assoc_reassoc(struct sta_state *sta, bool reassoc,
 		goto unsupported;
 	}
 
-	wsc_data = ie_tlv_extract_wsc_payload(ies, ies_len, &wsc_data_len);
+	ie_index_init(&index, ies, ies_len);
 
-	ie_tlv_iter_init(&iter, ies, ies_len);
+	if (ie_index_find_vendor(&index, microsoft_oui, 0x04))
+		wsc_data = ie_tlv_extract_wsc_payload(ies, ies_len,
+							&wsc_data_len);
+
+	err = 0;
+
+	for (i = 0; i < index.n_entries && !err; i++) {
+		ie_index_entry_to_iter(&index.entries[i], &iter);
 
-	while (ie_tlv_iter_next(&iter))
 		switch (ie_tlv_iter_get_tag(&iter)) {
 		case IE_TYPE_SSID:
 			ssid = (const char *) ie_tlv_iter_get_data(&iter);
@@ -2120,10 +2512,8 @@ static void ap_assoc_reassoc(struct sta_state *sta, bool reassoc,
 
 		case IE_TYPE_SUPPORTED_RATES:
 		case IE_TYPE_EXTENDED_SUPPORTED_RATES:
-			if (ap_parse_supported_rates(&iter, &rates) < 0) {
+			if (ap_parse_supported_rates(&iter, &rates) < 0)
 				err = MMPDU_REASON_CODE_INVALID_IE;
-				goto bad_frame;
-			}
 
 			break;
 
@@ -2139,7 +2529,7 @@ static void ap_assoc_reassoc(struct sta_state *sta, bool reassoc,
 
 			if (ie_parse_rsne(&iter, &rsn_info) < 0) {
 				err = MMPDU_REASON_CODE_INVALID_IE;
-				goto bad_frame;
+				break;
 			}
 
 			rsn = (const uint8_t *) ie_tlv_iter_get_data(&iter) - 2;
@@ -2158,7 +2548,7 @@ static void ap_assoc_reassoc(struct sta_state *sta, bool reassoc,
 		case IE_TYPE_HT_CAPABILITIES:
 			if (ie_tlv_iter_get_length(&iter) != 26) {
 				err = MMPDU_REASON_CODE_INVALID_IE;
-				goto bad_frame;
+				break;
 			}
 
 			if (test_bit(ie_tlv_iter_get_data(&iter), 4))
@@ -2167,6 +2557,12 @@ static void ap_assoc_reassoc(struct sta_state *sta, bool reassoc,
 			sta->ht_support = true;
 			break;
 		}
+	}
+
+	ie_index_free(&index);
+
+	if (err)
+		goto bad_frame;
 
 	if (!rates || !ssid || (!wsc_data && !rsn) ||
 			ssid_len != strlen(ap->ssid) ||
@@ -2270,14 +2666,18 @@ static void ap_assoc_reassoc(struct sta_state *sta, bool reassoc,
 	else if (sta->associated)
 		ap_stop_handshake(sta);
 
-	if (!sta->associated) {
+	if (!sta->associated && !sta->aid) {
 		/*
 		 * Everything fine so far, assign an AID, send response.
 		 * According to 802.11-2016 11.3.5.3 l) we will only go to
 		 * State 3 (set sta->associated) once we receive the station's
 		 * ACK or gave up on resends.
 		 */
-		sta->aid = ++ap->last_aid;
+		sta->aid = ap_alloc_aid(ap);
+		if (!sta->aid) {
+			err = MMPDU_STATUS_CODE_DENIED_NO_MORE_STAS;
+			goto unsupported;
+		}
 	}
 
 	sta->capability = *capability;
@@ -2350,7 +2750,7 @@ static void ap_assoc_req_cb(const struct mmpdu_header *hdr, const void *body,
 			memcmp(hdr->address_3, bssid, 6))
 		return;
 
-	sta = l_queue_find(ap->sta_states, ap_sta_match_addr, from);
+	sta = ap_sta_find(ap, from);
 	if (!sta) {
 		if (!ap_assoc_resp(ap, NULL, from,
 				MMPDU_REASON_CODE_STA_REQ_ASSOC_WITHOUT_AUTH,
@@ -2384,7 +2784,7 @@ static void ap_reassoc_req_cb(const struct mmpdu_header *hdr, const void *body,
 			memcmp(hdr->address_3, bssid, 6))
 		return;
 
-	sta = l_queue_find(ap->sta_states, ap_sta_match_addr, from);
+	sta = ap_sta_find(ap, from);
 	if (!sta) {
 		err = MMPDU_REASON_CODE_STA_REQ_ASSOC_WITHOUT_AUTH;
 		goto bad_frame;
@@ -2418,6 +2818,30 @@ static void ap_probe_resp_cb(int err, void *user_data)
 		l_info("AP Probe Response delivered OK");
 }
 
+/*
+ * Stations usually send a burst of broadcast Probe Requests on every channel
+ * they visit, e.g. one wildcard and one per known SSID, and each of those
+ * would be answered with the same Probe Response.  Remember the last few
+ * stations we answered, in a small table indexed by address hash, and skip
+ * responses to a repeated broadcast probe received within a short window.
+ */
+static bool ap_probe_req_is_duplicate(struct ap_state *ap,
+					const uint8_t *addr)
+{
+	struct ap_probe_record *record = &ap->probe_records[
+				util_address_hash(addr) % AP_PROBE_RECORDS];
+	uint64_t now = l_time_now();
+
+	if (!memcmp(record->addr, addr, 6) &&
+			l_time_before(now, record->timestamp +
+						AP_PROBE_COALESCE_TIME))
+		return true;
+
+	memcpy(record->addr, addr, 6);
+	record->timestamp = now;
+	return false;
+}
+
 /*
  * Parse Probe Request according to 802.11-2016 9.3.3.10 and act according
  * to 802.11-2016 11.1.4.3
@@ -2434,6 +2858,8 @@ static void ap_probe_req_cb(const struct mmpdu_header *hdr, const void *body,
 	struct ie_tlv_iter iter;
 	const uint8_t *bssid = netdev_get_address(ap->netdev);
 	bool match = false;
+	uint8_t *wsc_data;
+	ssize_t wsc_data_len;
 	uint32_t resp_len;
 	uint8_t *resp;
 
@@ -2507,17 +2933,53 @@ static void ap_probe_req_cb(const struct mmpdu_header *hdr, const void *body,
 	if (!match)
 		return;
 
-	resp_len = 512 + ap_get_extra_ies_len(ap,
-					MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
-					hdr, body + body_len - (void *) hdr);
-	resp = l_new(uint8_t, resp_len);
-	len = ap_build_beacon_pr_head(ap,
+	/*
+	 * Process the client Probe Request WSC IE first as it may cause us
+	 * to exit "active PBC mode" and that will be immediately reflected
+	 * in our Probe Response WSC IE.
+	 */
+	wsc_data = ie_tlv_extract_wsc_payload(req->ies, body_len - sizeof(*req),
+						&wsc_data_len);
+	if (wsc_data) {
+		ap_process_wsc_probe_req(ap, hdr->address_2, wsc_data,
+						wsc_data_len);
+		l_free(wsc_data);
+	}
+
+	/*
+	 * The ap->ops extra IEs may depend on the contents of each request
+	 * so only coalesce when our response is fully determined by the
+	 * template.
+	 */
+	if (!ap->ops->write_extra_ies &&
+			util_is_broadcast_address(hdr->address_1) &&
+			ap_probe_req_is_duplicate(ap, hdr->address_2)) {
+		l_debug("Coalescing repeated Probe Request from "MAC,
+			MAC_STR(hdr->address_2));
+		return;
+	}
+
+	if (!ap->pr_template && !ap_build_probe_resp_template(ap))
+		return;
+
+	resp_len = ap->pr_template_len;
+
+	if (ap->ops->get_extra_ies_len)
+		resp_len += ap->ops->get_extra_ies_len(
 					MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
-					hdr->address_2, resp, resp_len);
-	len += ap_build_beacon_pr_tail(ap,
+					hdr, body + body_len - (void *) hdr,
+					ap->user_data);
+
+	resp = l_malloc(resp_len);
+	memcpy(resp, ap->pr_template, ap->pr_template_len);
+	memcpy(((struct mmpdu_header *) resp)->address_1, hdr->address_2, 6);
+	len = ap->pr_template_len;
+
+	if (ap->ops->write_extra_ies)
+		len += ap->ops->write_extra_ies(
 					MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
 					hdr, body + body_len - (void *) hdr,
-					resp + len, resp_len - len);
+					resp + len, ap->user_data);
 
 	ap_send_mgmt_frame(ap, (struct mmpdu_header *) resp, len,
 				ap_probe_resp_cb, NULL);
@@ -2541,7 +3003,7 @@ static void ap_disassoc_cb(const struct mmpdu_header *hdr, const void *body,
 			memcmp(hdr->address_3, bssid, 6))
 		return;
 
-	sta = l_queue_find(ap->sta_states, ap_sta_match_addr, hdr->address_2);
+	sta = ap_sta_find(ap, hdr->address_2);
 
 	if (sta && sta->assoc_resp_cmd_id) {
 		l_genl_family_cancel(ap->nl80211, sta->assoc_resp_cmd_id);
@@ -2638,7 +3100,7 @@ static void ap_auth_cb(const struct mmpdu_header *hdr, const void *body,
 		return;
 	}
 
-	sta = l_queue_find(ap->sta_states, ap_sta_match_addr, from);
+	sta = ap_sta_find(ap, from);
 
 	/*
 	 * Figure 11-13 in 802.11-2016 11.3.2 shows a transition from
@@ -2662,10 +3124,7 @@ static void ap_auth_cb(const struct mmpdu_header *hdr, const void *body,
 	memcpy(sta->addr, from, 6);
 	sta->ap = ap;
 
-	if (!ap->sta_states)
-		ap->sta_states = l_queue_new();
-
-	l_queue_push_tail(ap->sta_states, sta);
+	ap_sta_add(ap, sta);
 
 	/*
 	 * Nothing to do here netlink-wise as we can't receive any data
@@ -2722,13 +3181,22 @@ static void ap_dhcp_event_cb(struct l_dhcp_server *server,
 				const struct l_dhcp_lease *lease)
 {
 	struct ap_state *ap = user_data;
+	const uint8_t *mac = l_dhcp_lease_get_mac(lease);
 
 	switch (event) {
 	case L_DHCP_SERVER_EVENT_NEW_LEASE:
+		if (ap->leases)
+			lease_db_set(ap->leases, mac,
+				ntohl(l_dhcp_lease_get_address_u32(lease)),
+				time(NULL) + l_dhcp_lease_get_lifetime(lease));
+
 		ap_event(ap, AP_EVENT_DHCP_NEW_LEASE, lease);
 		break;
 
 	case L_DHCP_SERVER_EVENT_LEASE_EXPIRED:
+		if (ap->leases)
+			lease_db_remove(ap->leases, mac);
+
 		ap_event(ap, AP_EVENT_DHCP_LEASE_EXPIRED, lease);
 		break;
 
@@ -2737,6 +3205,34 @@ static void ap_dhcp_event_cb(struct l_dhcp_server *server,
 	}
 }
 
+static void ap_restore_lease(const struct lease_db_entry *entry,
+				void *user_data)
+{
+	struct ap_state *ap = user_data;
+	uint64_t now = time(NULL);
+	struct l_dhcp_lease *lease;
+
+	if (entry->expiry <= now)
+		return;
+
+	/*
+	 * The server hands out leases for its configured lease time, so
+	 * lower it temporarily so that a restored lease ends when the
+	 * original one would have.
+	 */
+	l_dhcp_server_set_lease_time(ap->netconfig_dhcp,
+				L_MIN(entry->expiry - now,
+					(uint64_t) ap->lease_time));
+
+	lease = l_dhcp_server_discover(ap->netconfig_dhcp, htonl(entry->addr),
+					NULL, entry->mac);
+	if (!lease || l_dhcp_lease_get_address_u32(lease) !=
+			htonl(entry->addr))
+		return;
+
+	l_dhcp_server_request(ap->netconfig_dhcp, lease);
+}
+
 static void ap_start_cb(struct l_genl_msg *msg, void *user_data)
 {
 	struct ap_state *ap = user_data;
@@ -2756,6 +3252,19 @@ static void ap_start_cb(struct l_genl_msg *msg, void *user_data)
 			return;
 		}
 
+		/*
+		 * Hand the leases remembered from previous runs back to the
+		 * server before any client can ask for an address so that
+		 * returning clients keep their addresses.  This is done
+		 * before setting the event handler so the restored leases
+		 * aren't written back to the database.
+		 */
+		if (ap->leases) {
+			lease_db_foreach(ap->leases, ap_restore_lease, ap);
+			l_dhcp_server_set_lease_time(ap->netconfig_dhcp,
+							ap->lease_time);
+		}
+
 		if (!l_dhcp_server_set_event_handler(ap->netconfig_dhcp,
 							ap_dhcp_event_cb,
 							ap, NULL)) {
@@ -2780,7 +3289,6 @@ static struct l_genl_msg *ap_build_cmd_start_ap(struct ap_state *ap)
 	L_AUTO_FREE_VAR(uint8_t *, tail) = l_malloc(tail_len);
 	size_t head_len;
 
-	uint32_t dtim_period = 3;
 	uint32_t ifindex = netdev_get_ifindex(ap->netdev);
 	struct wiphy *wiphy = netdev_get_wiphy(ap->netdev);
 	uint32_t hidden_ssid = NL80211_HIDDEN_SSID_NOT_IN_USE;
@@ -2797,8 +3305,6 @@ static struct l_genl_msg *ap_build_cmd_start_ap(struct ap_state *ap)
 		0xff, 0xff, 0xff, 0xff, 0xff, 0xff
 	};
 
-	static const uint8_t zero_addr[6] = { 0 };
-
 	for (i = 0, nl_ciphers_cnt = 0; i < 8; i++)
 		if (ap->ciphers & (1 << i))
 			nl_ciphers[nl_ciphers_cnt++] =
@@ -2825,7 +3331,8 @@ static struct l_genl_msg *ap_build_cmd_start_ap(struct ap_state *ap)
 	/* START_AP attrs */
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_BEACON_INTERVAL, 4,
 				&ap->beacon_interval);
-	l_genl_msg_append_attr(cmd, NL80211_ATTR_DTIM_PERIOD, 4, &dtim_period);
+	l_genl_msg_append_attr(cmd, NL80211_ATTR_DTIM_PERIOD, 4,
+				&ap->dtim_period);
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_IFINDEX, 4, &ifindex);
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_SSID, strlen(ap->ssid),
 				ap->ssid);
@@ -2847,19 +3354,17 @@ static struct l_genl_msg *ap_build_cmd_start_ap(struct ap_state *ap)
 					&ap->chandef.center1_frequency);
 
 	if (wiphy_supports_probe_resp_offload(wiphy)) {
-		uint8_t probe_resp[head_len + tail_len];
-		uint8_t *ptr = probe_resp;
+		_auto_(l_free) uint8_t *probe_resp = NULL;
+		size_t probe_resp_len;
 
-		ptr += ap_build_beacon_pr_head(ap,
-					MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
-					zero_addr, ptr, sizeof(probe_resp));
-		ptr += ap_build_beacon_pr_tail(ap,
-					MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
-					NULL, 0, ptr, sizeof(probe_resp) -
-					(ptr - probe_resp));
+		probe_resp = ap_build_offload_probe_resp(ap, &probe_resp_len);
+		if (!probe_resp) {
+			l_genl_msg_unref(cmd);
+			return NULL;
+		}
 
 		l_genl_msg_append_attr(cmd, NL80211_ATTR_PROBE_RESP,
-					ptr - probe_resp, probe_resp);
+					probe_resp_len, probe_resp);
 	}
 
 	if (wiphy_has_ext_feature(wiphy,
@@ -2914,30 +3419,36 @@ static bool ap_parse_new_station_ies(const void *data, uint16_t len,
 					uint8_t **rsn_out,
 					struct l_uintset **rates_out)
 {
+	struct ie_index index;
+	const struct ie_index_entry *entry;
 	struct ie_tlv_iter iter;
 	uint8_t *rsn = NULL;
 	struct l_uintset *rates = NULL;
 
-	ie_tlv_iter_init(&iter, data, len);
+	ie_index_init(&index, data, len);
 
-	while (ie_tlv_iter_next(&iter)) {
-		switch (ie_tlv_iter_get_tag(&iter)) {
-		case IE_TYPE_RSN:
-			if (rsn || ie_parse_rsne(&iter, NULL) < 0)
-				goto parse_error;
+	entry = ie_index_find(&index, IE_TYPE_RSN);
+	if (entry) {
+		ie_index_entry_to_iter(entry, &iter);
 
-			rsn = l_memdup(ie_tlv_iter_get_data(&iter) - 2,
-					ie_tlv_iter_get_length(&iter) + 2);
-			break;
-		case IE_TYPE_EXTENDED_SUPPORTED_RATES:
-			if (rates || ap_parse_supported_rates(&iter, &rates) <
-					0)
-				goto parse_error;
+		if (ie_index_next(&index, entry) ||
+				ie_parse_rsne(&iter, NULL) < 0)
+			goto parse_error;
 
-			break;
-		}
+		rsn = l_memdup(entry->data - 2, entry->len + 2);
 	}
 
+	entry = ie_index_find(&index, IE_TYPE_EXTENDED_SUPPORTED_RATES);
+	if (entry) {
+		ie_index_entry_to_iter(entry, &iter);
+
+		if (ie_index_next(&index, entry) ||
+				ap_parse_supported_rates(&iter, &rates) < 0)
+			goto parse_error;
+	}
+
+	ie_index_free(&index);
+
 	*rsn_out = rsn;
 
 	if (rates_out)
@@ -2948,6 +3459,8 @@ static bool ap_parse_new_station_ies(const void *data, uint16_t len,
 	return true;
 
 parse_error:
+	ie_index_free(&index);
+
 	if (rsn)
 		l_free(rsn);
 
@@ -2960,12 +3473,14 @@ parse_error:
 static void ap_handle_new_station(struct ap_state *ap, struct l_genl_msg *msg)
 {
 	struct sta_state *sta;
+	struct l_genl_msg *del_msg;
 	struct l_genl_attr attr;
 	uint16_t type;
 	uint16_t len;
 	const void *data;
 	const uint8_t *mac = NULL;
 	uint8_t *assoc_rsne = NULL;
+	uint16_t aid;
 
 	if (!l_genl_attr_init(&attr, msg))
 		return;
@@ -2996,22 +3511,36 @@ static void ap_handle_new_station(struct ap_state *ap, struct l_genl_msg *msg)
 	 * Softmac's should already have a station created. The above check
 	 * may also fail for softmac cards.
 	 */
-	sta = l_queue_find(ap->sta_states, ap_sta_match_addr, mac);
+	sta = ap_sta_find(ap, mac);
 	if (sta)
 		goto cleanup;
 
+	aid = ap_alloc_aid(ap);
+	if (!aid) {
+		l_error("No AIDs left, rejecting station %s",
+				util_address_to_string(mac));
+		del_msg = nl80211_build_del_station(
+					netdev_get_ifindex(ap->netdev),
+					mac, MMPDU_REASON_CODE_DISASSOC_AP_BUSY,
+					MPDU_MANAGEMENT_SUBTYPE_DISASSOCIATION);
+		if (!l_genl_family_send(ap->nl80211, del_msg, NULL, NULL,
+					NULL)) {
+			l_genl_msg_unref(del_msg);
+			l_error("Issuing DEL_STATION failed");
+		}
+
+		goto cleanup;
+	}
+
 	sta = l_new(struct sta_state, 1);
 	memcpy(sta->addr, mac, 6);
 	sta->ap = ap;
 	sta->assoc_rsne = assoc_rsne;
-	sta->aid = ++ap->last_aid;
+	sta->aid = aid;
 
 	sta->associated = true;
 
-	if (!ap->sta_states)
-		ap->sta_states = l_queue_new();
-
-	l_queue_push_tail(ap->sta_states, sta);
+	ap_sta_add(ap, sta);
 
 	if (ap->supports_ht)
 		ap_update_beacon(ap);
@@ -3204,11 +3733,32 @@ static void ap_query_macs(struct ap_state *ap, const char *addr_str,
 
 #define AP_DEFAULT_IPV4_PREFIX_LEN 28
 
+/*
+ * The SSID comes from the Start() caller so, as for the network profiles,
+ * encode it in hex with a '=' prefix unless it is safe to use as a file name.
+ */
+static char *ap_get_leases_path(const char *ssid)
+{
+	const char *c;
+	_auto_(l_free) char *hex = NULL;
+
+	for (c = ssid; *c; c++)
+		if (!isalnum(*c) && !strchr("-_ ", *c))
+			break;
+
+	if (!*c)
+		return storage_get_path("ap/%s.leases", ssid);
+
+	hex = l_util_hexstring((const unsigned char *) ssid, strlen(ssid));
+	return storage_get_path("ap/=%s.leases", hex);
+}
+
 static int ap_setup_netconfig4(struct ap_state *ap, const char **addr_str_list,
 				uint8_t prefix_len, const char *gateway_str,
 				const char **ip_range,
 				const char **dns_str_list,
-				unsigned int lease_time)
+				unsigned int lease_time,
+				bool persistent_leases)
 {
 	uint32_t ifindex = netdev_get_ifindex(ap->netdev);
 	struct l_rtnl_address *existing_addr = ip_pool_get_addr4(ifindex);
@@ -3218,6 +3768,8 @@ static int ap_setup_netconfig4(struct ap_state *ap, const char **addr_str_list,
 	struct l_dhcp_server *dhcp = NULL;
 	bool r;
 	char addr_str_buf[INET_ADDRSTRLEN];
+	uint32_t pool_start;
+	uint32_t pool_end;
 
 	dhcp = l_dhcp_server_new(ifindex);
 	if (!dhcp) {
@@ -3301,6 +3853,17 @@ static int ap_setup_netconfig4(struct ap_state *ap, const char **addr_str_list,
 			l_error("l_dhcp_server_set_ip_range failed");
 			goto cleanup;
 		}
+
+		inet_pton(AF_INET, ip_range[0], &ia);
+		pool_start = ntohl(ia.s_addr);
+		inet_pton(AF_INET, ip_range[1], &ia);
+		pool_end = ntohl(ia.s_addr);
+	} else {
+		uint32_t netmask = util_netmask_from_prefix(prefix_len);
+
+		inet_pton(AF_INET, addr_str_buf, &ia);
+		pool_start = (ntohl(ia.s_addr) & netmask) + 1;
+		pool_end = (ntohl(ia.s_addr) | ~netmask) - 1;
 	}
 
 	if (dns_str_list) {
@@ -3316,6 +3879,23 @@ static int ap_setup_netconfig4(struct ap_state *ap, const char **addr_str_list,
 		goto cleanup;
 	}
 
+	ap->lease_time = lease_time ?: AP_DEFAULT_LEASE_TIME;
+
+	if (persistent_leases) {
+		_auto_(l_free) char *path = ap_get_leases_path(ap->ssid);
+
+		ap->leases = lease_db_new(pool_start, pool_end);
+
+		if (ap->leases) {
+			int err = lease_db_open(ap->leases, path, time(NULL));
+
+			/* Keep going with in-memory leases only */
+			if (err < 0)
+				l_warn("Can't open the AP lease database %s: "
+					"%s (%i)", path, strerror(-err), -err);
+		}
+	}
+
 	ap->netconfig_set_addr4 = true;
 	ap->netconfig_addr4 = l_steal_ptr(new_addr);
 	ap->netconfig_dhcp = l_steal_ptr(dhcp);
@@ -3349,6 +3929,7 @@ static int ap_load_ipv4(struct ap_state *ap, const struct l_settings *config)
 	char **ip_range = NULL;
 	char **dns_str_list = NULL;
 	unsigned int lease_time = 0;
+	bool persistent_leases = true;
 	struct in_addr ia;
 
 	if (!l_settings_has_group(config, "IPv4") || !netconfig_enabled())
@@ -3458,10 +4039,17 @@ static int ap_load_ipv4(struct ap_state *ap, const struct l_settings *config)
 		}
 	}
 
+	if (l_settings_has_key(config, "IPv4", "PersistentLeases") &&
+			!l_settings_get_bool(config, "IPv4", "PersistentLeases",
+						&persistent_leases)) {
+		l_error("Error parsing [IPv4].PersistentLeases as a boolean");
+		goto done;
+	}
+
 	ret = ap_setup_netconfig4(ap, (const char **) addr_str_list, prefix_len,
 					gateway_str, (const char **) ip_range,
 					(const char **) dns_str_list,
-					lease_time);
+					lease_time, persistent_leases);
 
 done:
 	l_strv_free(addr_str_list);
@@ -3560,6 +4148,25 @@ static char **ap_ciphers_to_strv(uint16_t ciphers)
 	return list;
 }
 
+/*
+ * Find another BSS already set up on the same radio.  A single radio can
+ * only beacon on one channel so any additional BSS has to follow it.
+ */
+static struct ap_state *ap_find_wiphy_peer(struct ap_state *ap)
+{
+	const struct l_queue_entry *e;
+	struct wiphy *wiphy = netdev_get_wiphy(ap->netdev);
+
+	for (e = l_queue_get_entries(ap_list); e; e = e->next) {
+		struct ap_state *peer = e->data;
+
+		if (peer != ap && netdev_get_wiphy(peer->netdev) == wiphy)
+			return peer;
+	}
+
+	return NULL;
+}
+
 static bool ap_validate_band_channel(struct ap_state *ap)
 {
 	struct wiphy *wiphy = netdev_get_wiphy(ap->netdev);
@@ -3617,6 +4224,7 @@ static int ap_load_config(struct ap_state *ap, const struct l_settings *config,
 				bool *out_cck_rates)
 {
 	struct wiphy *wiphy = netdev_get_wiphy(ap->netdev);
+	struct ap_state *peer = ap_find_wiphy_peer(ap);
 	size_t len;
 	L_AUTO_FREE_VAR(char *, strval) = NULL;
 	_auto_(l_strv_free) char **ciphers_str = NULL;
@@ -3672,6 +4280,17 @@ static int ap_load_config(struct ap_state *ap, const struct l_settings *config,
 			ap->band = BAND_FREQ_5_GHZ;
 		else
 			ap->band = BAND_FREQ_2_4_GHZ;
+
+		if (peer && (peer->channel != ap->channel ||
+						peer->band != ap->band)) {
+			l_error("AP channel %u conflicts with channel %u used "
+				"by another AP on this radio", ap->channel,
+				peer->channel);
+			return -EBUSY;
+		}
+	} else if (peer) {
+		ap->channel = peer->channel;
+		ap->band = peer->band;
 	} else {
 		/* TODO: Start a Get Survey to decide the channel */
 		ap->channel = 6;
@@ -3697,6 +4316,16 @@ static int ap_load_config(struct ap_state *ap, const struct l_settings *config,
 		return -EINVAL;
 	}
 
+	if (peer && (peer->chandef.frequency != ap->chandef.frequency ||
+			peer->chandef.channel_width !=
+			ap->chandef.channel_width ||
+			peer->chandef.center1_frequency !=
+			ap->chandef.center1_frequency)) {
+		l_error("AP channel width differs from another AP on this "
+			"radio, check the DisableHT settings");
+		return -EBUSY;
+	}
+
 	strval = l_settings_get_string(config, "WSC", "DeviceName");
 	if (strval) {
 		len = strlen(strval);
@@ -3771,9 +4400,70 @@ static int ap_load_config(struct ap_state *ap, const struct l_settings *config,
 		}
 
 		ap->rekey_time = uintval * L_USEC_PER_SEC;
-	} else
+	} else if (peer)
+		ap->rekey_time = peer->rekey_time;
+	else
 		ap->rekey_time = 0;
 
+	if (l_settings_has_key(config, "General", "GroupRekeyTimeout")) {
+		unsigned int uintval;
+
+		if (!l_settings_get_uint(config, "General",
+						"GroupRekeyTimeout",
+						&uintval)) {
+			l_error("AP [General].GroupRekeyTimeout is not valid");
+			return -EINVAL;
+		}
+
+		ap->gtk_rekey_time = (uint64_t) uintval * L_USEC_PER_SEC;
+	} else if (peer)
+		ap->gtk_rekey_time = peer->gtk_rekey_time;
+	else
+		ap->gtk_rekey_time = 0;
+
+	/*
+	 * BSSes on one radio share its beacon schedule, the interval and the
+	 * DTIM period are taken from another AP already running on it.
+	 */
+	if (l_settings_has_key(config, "General", "BeaconInterval")) {
+		unsigned int uintval;
+
+		if (!l_settings_get_uint(config, "General",
+						"BeaconInterval", &uintval) ||
+				uintval < 10 || uintval > 10000) {
+			l_error("AP [General].BeaconInterval is not valid");
+			return -EINVAL;
+		}
+
+		ap->beacon_interval = uintval;
+	} else if (peer)
+		ap->beacon_interval = peer->beacon_interval;
+	else
+		ap->beacon_interval = 100;
+
+	if (l_settings_has_key(config, "General", "DTIMPeriod")) {
+		unsigned int uintval;
+
+		if (!l_settings_get_uint(config, "General",
+						"DTIMPeriod", &uintval) ||
+				uintval < 1 || uintval > 255) {
+			l_error("AP [General].DTIMPeriod is not valid");
+			return -EINVAL;
+		}
+
+		ap->dtim_period = uintval;
+	} else if (peer)
+		ap->dtim_period = peer->dtim_period;
+	else
+		ap->dtim_period = 3;
+
+	if (peer && (peer->beacon_interval != ap->beacon_interval ||
+			peer->dtim_period != ap->dtim_period)) {
+		l_error("AP beacon interval or DTIM period differs from "
+			"another AP on this radio");
+		return -EBUSY;
+	}
+
 	/*
 	 * Since 5GHz won't ever support only CCK rates we can ignore this
 	 * setting on that band.
@@ -3892,9 +4582,10 @@ struct ap_state *ap_start(struct netdev *netdev, struct l_settings *config,
 	if (err)
 		goto error;
 
+	l_queue_push_tail(ap_list, ap);
+
 	err = -EINVAL;
 
-	ap->beacon_interval = 100;
 	ap->networks = l_queue_new();
 
 	wsc_uuid_from_addr(netdev_get_address(netdev), ap->wsc_uuid_r);
@@ -4098,10 +4789,12 @@ bool ap_station_disconnect(struct ap_state *ap, const uint8_t *mac,
 	if (!ap->started)
 		return false;
 
-	sta = l_queue_remove_if(ap->sta_states, ap_sta_match_addr, mac);
+	sta = ap_sta_find(ap, mac);
 	if (!sta)
 		return false;
 
+	ap_sta_unlink(ap, sta);
+
 	if (ap->supports_ht)
 		ap_update_beacon(ap);
 
@@ -4803,6 +5496,7 @@ static int ap_init(void)
 	const struct l_settings *settings = iwd_get_config();
 
 	netdev_watch = netdev_watch_add(ap_netdev_watch, NULL, NULL);
+	ap_list = l_queue_new();
 
 #ifdef HAVE_DBUS
 	l_dbus_register_interface(dbus_get_bus(), IWD_AP_INTERFACE,
@@ -4846,6 +5540,8 @@ static void ap_exit(void)
 #endif
 
 	l_strv_free(global_addr4_strs);
+	l_queue_destroy(ap_list, NULL);
+	ap_list = NULL;
 }
 
 IWD_MODULE(ap, ap_init, ap_exit)
@@ -145,6 +145,65 @@ static const int32_t ht_vht_he_base_rssi[] = {
 	-82, -79, -77, -74, -70, -66, -65, -64, -59, -57, -54, -51
 };
 
+/*
+ * Highest MCS index usable at a given RSSI for each channel width, i.e. the
+ * highest index for which rssi >= ht_vht_he_base_rssi[index] + width * 3.
+ * Indexed by RSSI - MCS_RSSI_MIN, anything above MCS_RSSI_MAX can use every
+ * index and -1 means that not even MCS 0 is usable.  This lets the rate
+ * estimation pick the MCS with a single lookup instead of trying each index
+ * in turn.  The table was generated with the following python snippet:
+ *
+ * for w in range(0, 4):
+ *	print([max([-1] + [i for i in range(0, 12)
+ *			if rssi >= base_rssi[i] + w * 3])
+ *		for rssi in range(-82, -41)])
+ */
+#define MCS_RSSI_MIN	-82
+#define MCS_RSSI_MAX	-42
+
+static const int8_t max_mcs_by_rssi[4][MCS_RSSI_MAX - MCS_RSSI_MIN + 1] = {
+	[OFDM_CHANNEL_WIDTH_20MHZ] = {
+		 0,  0,  0,  1,  1,  2,  2,  2,  3,  3,  3,  3,
+		 4,  4,  4,  4,  5,  6,  7,  7,  7,  7,  7,  8,
+		 8,  9,  9,  9, 10, 10, 10, 11, 11, 11, 11, 11,
+		11, 11, 11, 11, 11,
+	},
+	[OFDM_CHANNEL_WIDTH_40MHZ] = {
+		-1, -1, -1,  0,  0,  0,  1,  1,  2,  2,  2,  3,
+		 3,  3,  3,  4,  4,  4,  4,  5,  6,  7,  7,  7,
+		 7,  7,  8,  8,  9,  9,  9, 10, 10, 10, 11, 11,
+		11, 11, 11, 11, 11,
+	},
+	[OFDM_CHANNEL_WIDTH_80MHZ] = {
+		-1, -1, -1, -1, -1, -1,  0,  0,  0,  1,  1,  2,
+		 2,  2,  3,  3,  3,  3,  4,  4,  4,  4,  5,  6,
+		 7,  7,  7,  7,  7,  8,  8,  9,  9,  9, 10, 10,
+		10, 11, 11, 11, 11,
+	},
+	[OFDM_CHANNEL_WIDTH_160MHZ] = {
+		-1, -1, -1, -1, -1, -1, -1, -1, -1,  0,  0,  0,
+		 1,  1,  2,  2,  2,  3,  3,  3,  3,  4,  4,  4,
+		 4,  5,  6,  7,  7,  7,  7,  7,  8,  8,  9,  9,
+		 9, 10, 10, 10, 11,
+	},
+};
+
+static int max_mcs_for_rssi(enum ofdm_channel_width width, int32_t rssi,
+				int max_index)
+{
+	int mcs;
+
+	if (rssi < MCS_RSSI_MIN)
+		return -1;
+
+	if (rssi > MCS_RSSI_MAX)
+		rssi = MCS_RSSI_MAX;
+
+	mcs = max_mcs_by_rssi[width][rssi - MCS_RSSI_MIN];
+
+	return mcs > max_index ? max_index : mcs;
+}
+
 /*
  * Data Rate for HT/VHT is obtained according to this formula:
  * Nsd * Nbpscs * R * Nss / (Tdft + Tgi)
@@ -218,13 +277,28 @@ bool band_ofdm_rate(uint8_t index, enum ofdm_channel_width width,
 	return true;
 }
 
+static uint64_t ht_vht_rate(uint8_t index, enum ofdm_channel_width width,
+				uint8_t nss, bool sgi)
+{
+	uint64_t rate = ht_vht_rates[width][index];
+
+	if (sgi)
+		rate = rate / 9 * 10;
+
+	return rate * nss;
+}
+
 static bool find_best_mcs_ht(const struct band *band,
 				const uint8_t *tx_mcs_set,
 				uint8_t max_mcs, enum ofdm_channel_width width,
 				int32_t rssi, bool sgi,
 				uint64_t *out_data_rate)
 {
-	int i;
+	int max_index = max_mcs_for_rssi(width, rssi, 7);
+	int nss;
+
+	if (max_index < 0)
+		return false;
 
 	/*
 	 * TODO: Support MCS values 32 - 76
@@ -232,17 +306,27 @@ static bool find_best_mcs_ht(const struct band *band,
 	 * The MCS values > 31 use an unequal modulation, and the number of
 	 * supported MCS indexes per NSS differs.  We do not consider them
 	 * here for now to keep things simple(r).
+	 *
+	 * Each byte of the MCS sets holds the 8 MCS indexes for one NSS.
+	 * Take the highest NSS with a common index usable at this RSSI, then
+	 * the highest such index, same as trying every MCS from max_mcs down.
 	 */
-	for (i = max_mcs; i >= 0; i--) {
-		if (!test_bit(band->ht_mcs_set, i))
-			continue;
+	for (nss = max_mcs / 8; nss >= 0; nss--) {
+		unsigned int mask = band->ht_mcs_set[nss] & tx_mcs_set[nss];
+		int i;
+
+		if (nss == max_mcs / 8)
+			mask &= (2U << (max_mcs % 8)) - 1;
 
-		if (!test_bit(tx_mcs_set, i))
+		mask &= (2U << max_index) - 1;
+		if (!mask)
 			continue;
 
-		if (band_ofdm_rate(i % 8, width, rssi,
-					(i / 8) + 1, sgi, out_data_rate))
-			return true;
+		for (i = max_index; !(mask & (1U << i)); i--)
+			;
+
+		*out_data_rate = ht_vht_rate(i, width, nss + 1, sgi);
+		return true;
 	}
 
 	return false;
@@ -326,22 +410,19 @@ static bool find_best_mcs_vht(uint8_t max_index, enum ofdm_channel_width width,
 				int32_t rssi, uint8_t nss, bool sgi,
 				uint64_t *out_data_rate)
 {
-	int i;
-
 	/*
-	 * Iterate over all available MCS indexes to find the best one
-	 * we can use.  Note that band_ofdm_rate() will return false if a
-	 * given combination cannot be used due to rssi being too low.
+	 * Find the best MCS index we can use at this rssi.
 	 *
 	 * Also, Certain MCS/Width/NSS combinations are not valid,
 	 * refer to IEEE 802.11-2016 Section 21.5 for more details
 	 */
+	int i = max_mcs_for_rssi(width, rssi, max_index);
 
-	for (i = max_index; i >= 0; i--)
-		if (band_ofdm_rate(i, width, rssi, nss, sgi, out_data_rate))
-			return true;
+	if (i < 0)
+		return false;
 
-	return false;
+	*out_data_rate = ht_vht_rate(i, width, nss, sgi);
+	return true;
 }
 
 static bool find_best_mcs_nss(const uint8_t *rx_map, const uint8_t *tx_map,
@@ -529,7 +610,7 @@ try_vht80:
  * Note: The table below assumes a 0.8us GI. There isn't any way to know what
  *       GI will be used for an actual connection, so assume the best.
  */
-static uint64_t he_rates[4][12] = {
+static const uint64_t he_rates[4][12] = {
 	[OFDM_CHANNEL_WIDTH_20MHZ] = {
 		8600000ULL, 17200000ULL, 25800000ULL, 34400000ULL,
 		51600000ULL, 68800000ULL, 77400000ULL, 86000000ULL,
@@ -552,25 +633,6 @@ static uint64_t he_rates[4][12] = {
 	},
 };
 
-static bool band_he_rate(uint8_t index, enum ofdm_channel_width width,
-			int32_t rssi, uint8_t nss, uint64_t *data_rate)
-{
-	uint64_t rate;
-	int32_t width_adjust;
-
-	width_adjust = width * 3;
-
-	if (rssi < ht_vht_he_base_rssi[index] + width_adjust)
-		return false;
-
-	rate = he_rates[width][index];
-
-	rate *= nss;
-
-	*data_rate = rate;
-	return true;
-}
-
 static bool find_rate_he(const uint8_t *rx_map, const uint8_t *tx_map,
 				enum ofdm_channel_width width, int32_t rssi,
 				uint64_t *out_data_rate)
@@ -583,11 +645,12 @@ static bool find_rate_he(const uint8_t *rx_map, const uint8_t *tx_map,
 				&max_mcs, &nss))
 		return false;
 
-	for (i = max_mcs; i >= 0; i--)
-		if (band_he_rate(i, width, rssi, nss, out_data_rate))
-			return true;
+	i = max_mcs_for_rssi(width, rssi, max_mcs);
+	if (i < 0)
+		return false;
 
-	return false;
+	*out_data_rate = he_rates[width][i] * nss;
+	return true;
 }
 
 /*
@@ -902,64 +965,154 @@ static const struct operating_class_info e4_operating_classes[] = {
 	}
 };
 
-static const struct operating_class_info *e4_find_opclass(uint32_t opclass)
+/*
+ * Lookup indexes over e4_operating_classes so that none of the conversions
+ * below need to search the table.  For each class there is a bitmap of the
+ * channels in its channel set, of its center frequency channels and of the
+ * 20 Mhz channels covered by those center frequencies.  Any frequency that
+ * maps to a channel or a center frequency channel of some class is set in a
+ * single bitmap covering all bands.
+ *
+ * The indexes are derived from the table once, on first use.
+ */
+#define E4_FREQ_MIN	2400
+#define E4_FREQ_MAX	7200
+
+struct e4_class_index {
+	uint8_t channels[32];
+	uint8_t centers[32];
+	uint8_t center_channels[32];
+};
+
+static struct {
+	/* Position in e4_operating_classes + 1, indexed by operating class */
+	uint8_t opclass[256];
+	struct e4_class_index classes[L_ARRAY_SIZE(e4_operating_classes)];
+	uint8_t freqs[(E4_FREQ_MAX - E4_FREQ_MIN) / 8 + 1];
+	bool built;
+} e4_index;
+
+static void e4_index_add_freq(const struct operating_class_info *info,
+				uint8_t channel)
+{
+	uint32_t freq = channel * 5 + info->starting_frequency;
+	unsigned int i;
+
+	/*
+	 * Channels are derived from frequencies by dividing the offset from
+	 * the starting frequency by 5, so the 4 Mhz above the channel's own
+	 * frequency map to it as well
+	 */
+	for (i = 0; i < 5; i++)
+		set_bit(e4_index.freqs, freq + i - E4_FREQ_MIN);
+}
+
+static void e4_index_build(void)
 {
 	unsigned int i;
+	unsigned int j;
 
 	for (i = 0; i < L_ARRAY_SIZE(e4_operating_classes); i++) {
-		if (e4_operating_classes[i].operating_class != opclass)
-			continue;
+		const struct operating_class_info *info =
+						&e4_operating_classes[i];
+		struct e4_class_index *index = &e4_index.classes[i];
+		unsigned int offset;
 
-		return &e4_operating_classes[i];
+		e4_index.opclass[info->operating_class] = i + 1;
+
+		for (j = 0; info->channel_set[j] &&
+				j < L_ARRAY_SIZE(info->channel_set); j++) {
+			set_bit(index->channels, info->channel_set[j]);
+			e4_index_add_freq(info, info->channel_set[j]);
+		}
+
+		/*
+		 * Only classes in Table E4 with center frequencies are 128-130,
+		 * which use 20 Mhz wide channels.  Since E4 gives a center
+		 * frequency, calculate the channel offset based on channel
+		 * spacing.
+		 *
+		 * Typically +/- 6 for 80 Mhz channels and +/- 14 for 160 Mhz
+		 * channels.  The channels covered by a center frequency are
+		 * spaced 20 Mhz apart.
+		 */
+		offset = (info->channel_spacing - 20) / 5 / 2;
+
+		for (j = 0; info->center_frequencies[j] &&
+				j < L_ARRAY_SIZE(info->center_frequencies);
+				j++) {
+			unsigned int center = info->center_frequencies[j];
+			unsigned int channel;
+
+			set_bit(index->centers, center);
+			e4_index_add_freq(info, center);
+
+			for (channel = center - offset;
+					channel <= center + offset;
+					channel += 4)
+				set_bit(index->center_channels, channel);
+		}
 	}
 
-	return NULL;
+	e4_index.built = true;
 }
 
-static int e4_channel_to_frequency(const struct operating_class_info *info,
-					uint32_t channel)
+static const struct e4_class_index *e4_get_index(
+				const struct operating_class_info *info)
 {
-	unsigned int i;
-	unsigned int offset;
+	if (!e4_index.built)
+		e4_index_build();
 
-	for (i = 0; info->channel_set[i] &&
-				i < L_ARRAY_SIZE(info->channel_set); i++) {
-		if (info->channel_set[i] != channel)
-			continue;
+	return &e4_index.classes[info - e4_operating_classes];
+}
 
-		return channel * 5 + info->starting_frequency;
-	}
+static const struct operating_class_info *e4_find_opclass(uint32_t opclass)
+{
+	if (opclass >= L_ARRAY_SIZE(e4_index.opclass))
+		return NULL;
 
-	/*
-	 * Only classes in Table E4 with center frequencies are 128-130,
-	 * which use 20 Mhz wide channels.  Since E4 gives a center frequency,
-	 * calculate the channel offset based on channel spacing.
-	 *
-	 * Typically +/- 6 for 80 Mhz channels and +/- 14 for 160 Mhz channels
-	 */
-	offset = (info->channel_spacing - 20) / 5 / 2;
+	if (!e4_index.built)
+		e4_index_build();
 
-	/*
-	 * Check that the channel is in the frequency range given by one of
-	 * the center frequencies listed for the operating class.  The channel
-	 * must be a valid channel for a lower operating class and spaced
-	 * 20 mhz apart
-	 */
-	for (i = 0; info->center_frequencies[i] &&
-			i < L_ARRAY_SIZE(info->center_frequencies); i++) {
+	if (!e4_index.opclass[opclass])
+		return NULL;
 
-		unsigned int upper = info->center_frequencies[i] + offset;
-		unsigned int j = info->center_frequencies[i] - offset;
+	return &e4_operating_classes[e4_index.opclass[opclass] - 1];
+}
 
-		while (j <= upper && channel >= j) {
-			if (channel == j)
-				return channel * 5 + info->starting_frequency;
+/*
+ * Whether the frequency is a channel or a center frequency channel of any
+ * operating class
+ */
+static bool e4_has_any_frequency(uint32_t frequency)
+{
+	if (frequency < E4_FREQ_MIN || frequency > E4_FREQ_MAX)
+		return false;
 
-			j += 4;
-		}
-	}
+	if (!e4_index.built)
+		e4_index_build();
 
-	return -EINVAL;
+	return test_bit(e4_index.freqs, frequency - E4_FREQ_MIN);
+}
+
+static int e4_channel_to_frequency(const struct operating_class_info *info,
+					uint32_t channel)
+{
+	const struct e4_class_index *index = e4_get_index(info);
+
+	/*
+	 * The channel must either be in the channel set, or be in the
+	 * frequency range given by one of the center frequencies listed for
+	 * the operating class
+	 */
+	if (channel > 255)
+		return -EINVAL;
+
+	if (!test_bit(index->channels, channel) &&
+			!test_bit(index->center_channels, channel))
+		return -EINVAL;
+
+	return channel * 5 + info->starting_frequency;
 }
 
 static int e4_frequency_to_channel(const struct operating_class_info *info,
@@ -971,35 +1124,23 @@ static int e4_frequency_to_channel(const struct operating_class_info *info,
 static int e4_has_frequency(const struct operating_class_info *info,
 				uint32_t frequency)
 {
-	unsigned int i;
 	unsigned int channel = e4_frequency_to_channel(info, frequency);
 
-	for (i = 0; info->channel_set[i] &&
-				i < L_ARRAY_SIZE(info->channel_set); i++) {
-		if (info->channel_set[i] != channel)
-			continue;
-
-		return 0;
-	}
+	if (channel > 255 || !test_bit(e4_get_index(info)->channels, channel))
+		return -ENOENT;
 
-	return -ENOENT;
+	return 0;
 }
 
 static int e4_has_ccfi(const struct operating_class_info *info,
 				uint32_t center_frequency)
 {
-	unsigned int i;
 	unsigned int ccfi = e4_frequency_to_channel(info, center_frequency);
 
-	for (i = 0; info->center_frequencies[i] &&
-			i < L_ARRAY_SIZE(info->center_frequencies); i++) {
-		if (info->center_frequencies[i] != ccfi)
-			continue;
-
-		return 0;
-	}
+	if (ccfi > 255 || !test_bit(e4_get_index(info)->centers, ccfi))
+		return -ENOENT;
 
-	return -ENOENT;
+	return 0;
 }
 
 static int e4_class_matches(const struct operating_class_info *info,
@@ -1286,7 +1427,6 @@ _Pragma("GCC diagnostic pop")
 
 uint8_t band_freq_to_channel(uint32_t freq, enum band_freq *out_band)
 {
-	unsigned int i;
 	enum band_freq band = 0;
 	uint32_t channel = 0;
 
@@ -1348,25 +1488,17 @@ uint8_t band_freq_to_channel(uint32_t freq, enum band_freq *out_band)
 		return 0;
 
 check_e4:
-	for (i = 0; i < L_ARRAY_SIZE(e4_operating_classes); i++) {
-		const struct operating_class_info *info =
-						&e4_operating_classes[i];
-
-		if (e4_has_frequency(info, freq) == 0 ||
-					e4_has_ccfi(info, freq) == 0) {
-			if (out_band)
-				*out_band = band;
+	if (!e4_has_any_frequency(freq))
+		return 0;
 
-			return channel;
-		}
-	}
+	if (out_band)
+		*out_band = band;
 
-	return 0;
+	return channel;
 }
 
 uint32_t band_channel_to_freq(uint8_t channel, enum band_freq band)
 {
-	unsigned int i;
 	uint32_t freq = 0;
 
 	if (band == BAND_FREQ_2_4_GHZ) {
@@ -1406,16 +1538,10 @@ uint32_t band_channel_to_freq(uint8_t channel, enum band_freq band)
 	}
 
 check_e4:
-	for (i = 0; i < L_ARRAY_SIZE(e4_operating_classes); i++) {
-		const struct operating_class_info *info =
-						&e4_operating_classes[i];
-
-		if (e4_has_frequency(info, freq) == 0 ||
-					e4_has_ccfi(info, freq) == 0)
-			return freq;
-	}
+	if (!e4_has_any_frequency(freq))
+		return 0;
 
-	return 0;
+	return freq;
 }
 
 static const char *const oper_class_us_codes[] = {
@@ -29,8 +29,18 @@
 #include <stdbool.h>
 #include <string.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <linux/if_ether.h>
 
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <wmmintrin.h>
+#elif defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#include <arm_neon.h>
+#endif
+
 #include <ell/ell.h>
 
 #include "ell/useful.h"
@@ -72,6 +82,124 @@ size_t crypto_dh5_prime_size = sizeof(crypto_dh5_prime);
 const unsigned char crypto_dh5_generator[] = { 0x2 };
 size_t crypto_dh5_generator_size = sizeof(crypto_dh5_generator);
 
+static struct crypto_stat_info crypto_stats[__CRYPTO_STAT_MAX];
+
+void crypto_stat_record(enum crypto_stat stat, uint64_t start_time)
+{
+	struct crypto_stat_info *info;
+	uint64_t usec = l_time_diff(start_time, l_time_now());
+	unsigned int bucket;
+
+	if (L_WARN_ON(stat >= __CRYPTO_STAT_MAX))
+		return;
+
+	info = &crypto_stats[stat];
+	bucket = usec ? 64 - __builtin_clzll(usec) : 0;
+
+	info->count++;
+	info->total_usec += usec;
+	info->max_usec = L_MAX(info->max_usec, usec);
+	info->histogram[L_MIN(bucket, CRYPTO_STAT_BUCKETS - 1U)]++;
+}
+
+void crypto_stat_timer_stop(struct crypto_stat_timer *timer)
+{
+	crypto_stat_record(timer->stat, timer->start_time);
+}
+
+const struct crypto_stat_info *crypto_stat_get(enum crypto_stat stat)
+{
+	if (stat >= __CRYPTO_STAT_MAX)
+		return NULL;
+
+	return &crypto_stats[stat];
+}
+
+const char *crypto_stat_to_str(enum crypto_stat stat)
+{
+	switch (stat) {
+	case CRYPTO_STAT_PSK_FROM_PASSPHRASE:
+		return "psk-from-passphrase";
+	case CRYPTO_STAT_DERIVE_PTK:
+		return "derive-ptk";
+	case CRYPTO_STAT_DERIVE_FT_KEYS:
+		return "derive-ft-keys";
+	case CRYPTO_STAT_PRF:
+		return "prf";
+	case CRYPTO_STAT_KDF:
+		return "kdf";
+	case CRYPTO_STAT_HKDF_EXTRACT:
+		return "hkdf-extract";
+	case CRYPTO_STAT_HKDF_EXPAND:
+		return "hkdf-expand";
+	case CRYPTO_STAT_AES_KEY_WRAP:
+		return "aes-key-wrap";
+	case CRYPTO_STAT_AES_CMAC:
+		return "aes-cmac";
+	case CRYPTO_STAT_AES_SIV:
+		return "aes-siv";
+	case CRYPTO_STAT_SAE_PT:
+		return "sae-pt";
+	case CRYPTO_STAT_SAE_PWE:
+		return "sae-pwe";
+	case CRYPTO_STAT_SAE_COMMIT:
+		return "sae-commit";
+	case CRYPTO_STAT_SAE_KEYS:
+		return "sae-keys";
+	case CRYPTO_STAT_SAE_CONFIRM:
+		return "sae-confirm";
+	case CRYPTO_STAT_DPP_DERIVE:
+		return "dpp-derive";
+	case CRYPTO_STAT_TLS_HANDSHAKE:
+		return "tls-handshake";
+	case __CRYPTO_STAT_MAX:
+		break;
+	}
+
+	return NULL;
+}
+
+/*
+ * One line per primitive that has been used, with the non-empty histogram
+ * buckets printed as <upper bound in us>:<count>
+ */
+void crypto_stats_log(void)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < __CRYPTO_STAT_MAX; i++) {
+		const struct crypto_stat_info *info = &crypto_stats[i];
+		struct l_string *buckets;
+		char *str;
+
+		if (!info->count)
+			continue;
+
+		buckets = l_string_new(64);
+
+		for (j = 0; j < CRYPTO_STAT_BUCKETS; j++) {
+			if (!info->histogram[j])
+				continue;
+
+			if (j == CRYPTO_STAT_BUCKETS - 1)
+				l_string_append_printf(buckets, " inf:%u",
+							info->histogram[j]);
+			else
+				l_string_append_printf(buckets, " %llu:%u",
+							1ULL << j,
+							info->histogram[j]);
+		}
+
+		str = l_string_unwrap(buckets);
+
+		l_info("crypto %s: %" PRIu64 " calls, %" PRIu64 " us total, "
+			"%" PRIu64 " us avg, %" PRIu64 " us max, histogram%s",
+			crypto_stat_to_str(i), info->count, info->total_usec,
+			info->total_usec / info->count, info->max_usec, str);
+		l_free(str);
+	}
+}
+
 static bool hmac_common(enum l_checksum_type type,
 			const void *key, size_t key_len,
 			const void *data, size_t data_len,
@@ -118,18 +246,856 @@ bool hmac_sha384(const void *key, size_t key_len,
 				output, size);
 }
 
+/*
+ * RFC 5297 Section 2.3 - Doubling
+ */
+static void dbl(uint8_t *val)
+{
+	int i;
+	uint8_t c = val[0] >> 7;
+
+	/* shift all but last byte (since i + 1 would overflow) */
+	for (i = 0; i < 15; i++)
+		val[i] = (val[i] << 1) | (val[i + 1] >> 7);
+
+	val[15] <<= 1;
+
+	/*
+	 * "The condition under which the xor operation is performed is when the
+	 * bit being shifted off is one."  Masked rather than branched on since
+	 * this also derives the secret CMAC subkeys.
+	 */
+	val[15] ^= 0x87 & -c;
+}
+
+static void xor(uint8_t *a, const uint8_t *b, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		a[i] ^= b[i];
+}
+
+/*
+ * User-space AES
+ *
+ * The generic implementation evaluates the S-box as a boolean circuit over
+ * bit planes instead of using lookup tables, so that neither branches nor
+ * memory accesses depend on the key or the data.
+ * AES-NI and the ARMv8 Cryptography Extensions are used when available.
+ */
+struct aes_ctx {
+	uint8_t ek[15][16];
+	uint8_t dk[15][16];
+	unsigned int rounds;
+};
+
+struct aes_impl {
+	enum crypto_aes_impl id;
+	bool (*supported)(void);
+	void (*encrypt)(const struct aes_ctx *ctx, const uint8_t *in,
+				uint8_t *out);
+	void (*decrypt)(const struct aes_ctx *ctx, const uint8_t *in,
+				uint8_t *out);
+};
+
+/*
+ * Boyar and Peralta, "A depth-16 circuit for the AES S-box", operating on
+ * bit planes: bit i of q[b] is bit b of byte i.
+ */
+static void aes_bitslice_sbox(uint32_t *q)
+{
+	uint32_t x0, x1, x2, x3, x4, x5, x6, x7;
+	uint32_t y1, y2, y3, y4, y5, y6, y7, y8, y9;
+	uint32_t y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+	uint32_t y20, y21;
+	uint32_t z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+	uint32_t z10, z11, z12, z13, z14, z15, z16, z17;
+	uint32_t t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+	uint32_t t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+	uint32_t t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+	uint32_t t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+	uint32_t t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+	uint32_t t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+	uint32_t t60, t61, t62, t63, t64, t65, t66, t67;
+	uint32_t s0, s1, s2, s3, s4, s5, s6, s7;
+
+	x0 = q[7];
+	x1 = q[6];
+	x2 = q[5];
+	x3 = q[4];
+	x4 = q[3];
+	x5 = q[2];
+	x6 = q[1];
+	x7 = q[0];
+
+	/* Top linear transformation */
+	y14 = x3 ^ x5;
+	y13 = x0 ^ x6;
+	y9 = x0 ^ x3;
+	y8 = x0 ^ x5;
+	t0 = x1 ^ x2;
+	y1 = t0 ^ x7;
+	y4 = y1 ^ x3;
+	y12 = y13 ^ y14;
+	y2 = y1 ^ x0;
+	y5 = y1 ^ x6;
+	y3 = y5 ^ y8;
+	t1 = x4 ^ y12;
+	y15 = t1 ^ x5;
+	y20 = t1 ^ x1;
+	y6 = y15 ^ x7;
+	y10 = y15 ^ t0;
+	y11 = y20 ^ y9;
+	y7 = x7 ^ y11;
+	y17 = y10 ^ y11;
+	y19 = y10 ^ y8;
+	y16 = t0 ^ y11;
+	y21 = y13 ^ y16;
+	y18 = x0 ^ y16;
+
+	/* Non-linear section */
+	t2 = y12 & y15;
+	t3 = y3 & y6;
+	t4 = t3 ^ t2;
+	t5 = y4 & x7;
+	t6 = t5 ^ t2;
+	t7 = y13 & y16;
+	t8 = y5 & y1;
+	t9 = t8 ^ t7;
+	t10 = y2 & y7;
+	t11 = t10 ^ t7;
+	t12 = y9 & y11;
+	t13 = y14 & y17;
+	t14 = t13 ^ t12;
+	t15 = y8 & y10;
+	t16 = t15 ^ t12;
+	t17 = t4 ^ t14;
+	t18 = t6 ^ t16;
+	t19 = t9 ^ t14;
+	t20 = t11 ^ t16;
+	t21 = t17 ^ y20;
+	t22 = t18 ^ y19;
+	t23 = t19 ^ y21;
+	t24 = t20 ^ y18;
+
+	t25 = t21 ^ t22;
+	t26 = t21 & t23;
+	t27 = t24 ^ t26;
+	t28 = t25 & t27;
+	t29 = t28 ^ t22;
+	t30 = t23 ^ t24;
+	t31 = t22 ^ t26;
+	t32 = t31 & t30;
+	t33 = t32 ^ t24;
+	t34 = t23 ^ t33;
+	t35 = t27 ^ t33;
+	t36 = t24 & t35;
+	t37 = t36 ^ t34;
+	t38 = t27 ^ t36;
+	t39 = t29 & t38;
+	t40 = t25 ^ t39;
+
+	t41 = t40 ^ t37;
+	t42 = t29 ^ t33;
+	t43 = t29 ^ t40;
+	t44 = t33 ^ t37;
+	t45 = t42 ^ t41;
+	z0 = t44 & y15;
+	z1 = t37 & y6;
+	z2 = t33 & x7;
+	z3 = t43 & y16;
+	z4 = t40 & y1;
+	z5 = t29 & y7;
+	z6 = t42 & y11;
+	z7 = t45 & y17;
+	z8 = t41 & y10;
+	z9 = t44 & y12;
+	z10 = t37 & y3;
+	z11 = t33 & y4;
+	z12 = t43 & y13;
+	z13 = t40 & y5;
+	z14 = t29 & y2;
+	z15 = t42 & y9;
+	z16 = t45 & y14;
+	z17 = t41 & y8;
+
+	/* Bottom linear transformation */
+	t46 = z15 ^ z16;
+	t47 = z10 ^ z11;
+	t48 = z5 ^ z13;
+	t49 = z9 ^ z10;
+	t50 = z2 ^ z12;
+	t51 = z2 ^ z5;
+	t52 = z7 ^ z8;
+	t53 = z0 ^ z3;
+	t54 = z6 ^ z7;
+	t55 = z16 ^ z17;
+	t56 = z12 ^ t48;
+	t57 = t50 ^ t53;
+	t58 = z4 ^ t46;
+	t59 = z3 ^ t54;
+	t60 = t46 ^ t57;
+	t61 = z14 ^ t57;
+	t62 = t52 ^ t58;
+	t63 = t49 ^ t58;
+	t64 = z4 ^ t59;
+	t65 = t61 ^ t62;
+	t66 = z1 ^ t63;
+	s0 = t59 ^ t63;
+	s6 = t56 ^ ~t62;
+	s7 = t48 ^ ~t60;
+	t67 = t64 ^ t65;
+	s3 = t53 ^ t66;
+	s4 = t51 ^ t66;
+	s5 = t47 ^ t65;
+	s1 = t64 ^ ~s3;
+	s2 = t55 ^ ~t67;
+
+	q[7] = s0;
+	q[6] = s1;
+	q[5] = s2;
+	q[4] = s3;
+	q[3] = s4;
+	q[2] = s5;
+	q[1] = s6;
+	q[0] = s7;
+}
+
+/* FIPS 197 Section 5.3.2, the inverse of the S-box affine transform */
+static void aes_bitslice_inv_affine(uint32_t *q)
+{
+	uint32_t t[8];
+	unsigned int b;
+
+	for (b = 0; b < 8; b++)
+		t[b] = q[(b + 7) % 8] ^ q[(b + 5) % 8] ^ q[(b + 2) % 8] ^
+						(0x05 & (1 << b) ? ~0U : 0);
+
+	memcpy(q, t, sizeof(t));
+}
+
+/* Hacker's Delight 7-3, transposes the 8x8 bit matrix formed by 8 bytes */
+static uint64_t aes_transpose8(uint64_t x)
+{
+	uint64_t t;
+
+	t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaULL;
+	x ^= t ^ (t << 7);
+	t = (x ^ (x >> 14)) & 0x0000cccc0000ccccULL;
+	x ^= t ^ (t << 14);
+	t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ULL;
+	x ^= t ^ (t << 28);
+
+	return x;
+}
+
+static void aes_bitslice_pack(const uint8_t *s, uint32_t *q)
+{
+	uint64_t lo = aes_transpose8(l_get_le64(s));
+	uint64_t hi = aes_transpose8(l_get_le64(s + 8));
+	unsigned int b;
+
+	for (b = 0; b < 8; b++)
+		q[b] = ((lo >> (8 * b)) & 0xff) | ((hi >> (8 * b)) & 0xff) << 8;
+}
+
+static void aes_bitslice_unpack(const uint32_t *q, uint8_t *s)
+{
+	uint64_t lo = 0;
+	uint64_t hi = 0;
+	unsigned int b;
+
+	for (b = 0; b < 8; b++) {
+		lo |= (uint64_t) (q[b] & 0xff) << (8 * b);
+		hi |= (uint64_t) ((q[b] >> 8) & 0xff) << (8 * b);
+	}
+
+	l_put_le64(aes_transpose8(lo), s);
+	l_put_le64(aes_transpose8(hi), s + 8);
+}
+
+static void aes_sub_bytes(uint8_t *s)
+{
+	uint32_t q[8];
+
+	aes_bitslice_pack(s, q);
+	aes_bitslice_sbox(q);
+	aes_bitslice_unpack(q, s);
+	explicit_bzero(q, sizeof(q));
+}
+
+/* S-box^-1 = A^-1 o S-box o A^-1, where A is the S-box affine transform */
+static void aes_inv_sub_bytes(uint8_t *s)
+{
+	uint32_t q[8];
+
+	aes_bitslice_pack(s, q);
+	aes_bitslice_inv_affine(q);
+	aes_bitslice_sbox(q);
+	aes_bitslice_inv_affine(q);
+	aes_bitslice_unpack(q, s);
+	explicit_bzero(q, sizeof(q));
+}
+
+/* Row r of the column-major state is rotated left by r * dir columns */
+static void aes_shift_rows(uint8_t *s, unsigned int dir)
+{
+	uint8_t t[16];
+	unsigned int r, c;
+
+	for (r = 0; r < 4; r++)
+		for (c = 0; c < 4; c++)
+			t[r + 4 * c] = s[r + 4 * ((c + r * dir) % 4)];
+
+	memcpy(s, t, 16);
+}
+
+static inline uint8_t xtime(uint8_t x)
+{
+	return (x << 1) ^ (((x >> 7) & 1) * 0x1b);
+}
+
+static void aes_mix_columns(uint8_t *s)
+{
+	unsigned int c;
+
+	for (c = 0; c < 16; c += 4) {
+		uint8_t a0 = s[c], a1 = s[c + 1], a2 = s[c + 2], a3 = s[c + 3];
+		uint8_t t = a0 ^ a1 ^ a2 ^ a3;
+
+		s[c] ^= t ^ xtime(a0 ^ a1);
+		s[c + 1] ^= t ^ xtime(a1 ^ a2);
+		s[c + 2] ^= t ^ xtime(a2 ^ a3);
+		s[c + 3] ^= t ^ xtime(a3 ^ a0);
+	}
+}
+
+static void aes_inv_mix_columns(uint8_t *s)
+{
+	unsigned int c;
+
+	for (c = 0; c < 16; c += 4) {
+		uint8_t u = xtime(xtime(s[c] ^ s[c + 2]));
+		uint8_t v = xtime(xtime(s[c + 1] ^ s[c + 3]));
+
+		s[c] ^= u;
+		s[c + 1] ^= v;
+		s[c + 2] ^= u;
+		s[c + 3] ^= v;
+	}
+
+	aes_mix_columns(s);
+}
+
+static void aes_add_round_key(uint8_t *s, const uint8_t *rk)
+{
+	unsigned int i;
+
+	for (i = 0; i < 16; i++)
+		s[i] ^= rk[i];
+}
+
+/* FIPS 197 Section 5.2 and 5.3.5 (Equivalent Inverse Cipher keys) */
+static bool aes_ctx_init(struct aes_ctx *ctx, const void *key, size_t key_len)
+{
+	uint8_t *w = ctx->ek[0];
+	unsigned int nk = key_len / 4;
+	unsigned int i;
+	uint8_t rcon = 1;
+
+	if (key_len != 16 && key_len != 24 && key_len != 32)
+		return false;
+
+	ctx->rounds = nk + 6;
+	memcpy(w, key, key_len);
+
+	for (i = nk; i < 4 * (ctx->rounds + 1); i++) {
+		uint8_t t[16] = { 0 };
+
+		memcpy(t, w + 4 * (i - 1), 4);
+
+		if (i % nk == 0) {
+			uint8_t t0 = t[0];
+
+			memmove(t, t + 1, 3);
+			t[3] = t0;
+		}
+
+		if (i % nk == 0 || (nk > 6 && i % nk == 4))
+			aes_sub_bytes(t);
+
+		if (i % nk == 0) {
+			t[0] ^= rcon;
+			rcon = xtime(rcon);
+		}
+
+		w[4 * i] = w[4 * (i - nk)] ^ t[0];
+		w[4 * i + 1] = w[4 * (i - nk) + 1] ^ t[1];
+		w[4 * i + 2] = w[4 * (i - nk) + 2] ^ t[2];
+		w[4 * i + 3] = w[4 * (i - nk) + 3] ^ t[3];
+
+		explicit_bzero(t, sizeof(t));
+	}
+
+	memcpy(ctx->dk[0], ctx->ek[ctx->rounds], 16);
+	memcpy(ctx->dk[ctx->rounds], ctx->ek[0], 16);
+
+	for (i = 1; i < ctx->rounds; i++) {
+		memcpy(ctx->dk[i], ctx->ek[ctx->rounds - i], 16);
+		aes_inv_mix_columns(ctx->dk[i]);
+	}
+
+	return true;
+}
+
+static void aes_generic_encrypt(const struct aes_ctx *ctx, const uint8_t *in,
+				uint8_t *out)
+{
+	uint8_t s[16];
+	unsigned int i;
+
+	memcpy(s, in, 16);
+	aes_add_round_key(s, ctx->ek[0]);
+
+	for (i = 1; i <= ctx->rounds; i++) {
+		aes_sub_bytes(s);
+		aes_shift_rows(s, 1);
+
+		if (i != ctx->rounds)
+			aes_mix_columns(s);
+
+		aes_add_round_key(s, ctx->ek[i]);
+	}
+
+	memcpy(out, s, 16);
+	explicit_bzero(s, 16);
+}
+
+static void aes_generic_decrypt(const struct aes_ctx *ctx, const uint8_t *in,
+				uint8_t *out)
+{
+	uint8_t s[16];
+	unsigned int i;
+
+	memcpy(s, in, 16);
+	aes_add_round_key(s, ctx->dk[0]);
+
+	for (i = 1; i <= ctx->rounds; i++) {
+		aes_inv_sub_bytes(s);
+		aes_shift_rows(s, 3);
+
+		if (i != ctx->rounds)
+			aes_inv_mix_columns(s);
+
+		aes_add_round_key(s, ctx->dk[i]);
+	}
+
+	memcpy(out, s, 16);
+	explicit_bzero(s, 16);
+}
+
+static bool aes_generic_supported(void)
+{
+	return true;
+}
+
+#if defined(__x86_64__)
+static bool aes_ni_supported(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+
+	return ecx & bit_AES;
+}
+
+__attribute__((target("aes,sse2")))
+static void aes_ni_encrypt(const struct aes_ctx *ctx, const uint8_t *in,
+				uint8_t *out)
+{
+	__m128i s = _mm_loadu_si128((const __m128i *) in);
+	unsigned int i;
+
+	s = _mm_xor_si128(s, _mm_loadu_si128((const __m128i *) ctx->ek[0]));
+
+	for (i = 1; i < ctx->rounds; i++)
+		s = _mm_aesenc_si128(s,
+				_mm_loadu_si128((const __m128i *) ctx->ek[i]));
+
+	s = _mm_aesenclast_si128(s,
+			_mm_loadu_si128((const __m128i *) ctx->ek[i]));
+	_mm_storeu_si128((__m128i *) out, s);
+}
+
+__attribute__((target("aes,sse2")))
+static void aes_ni_decrypt(const struct aes_ctx *ctx, const uint8_t *in,
+				uint8_t *out)
+{
+	__m128i s = _mm_loadu_si128((const __m128i *) in);
+	unsigned int i;
+
+	s = _mm_xor_si128(s, _mm_loadu_si128((const __m128i *) ctx->dk[0]));
+
+	for (i = 1; i < ctx->rounds; i++)
+		s = _mm_aesdec_si128(s,
+				_mm_loadu_si128((const __m128i *) ctx->dk[i]));
+
+	s = _mm_aesdeclast_si128(s,
+			_mm_loadu_si128((const __m128i *) ctx->dk[i]));
+	_mm_storeu_si128((__m128i *) out, s);
+}
+#endif
+
+#if defined(__aarch64__)
+static bool aes_armv8_ce_supported(void)
+{
+	return getauxval(AT_HWCAP) & HWCAP_AES;
+}
+
+__attribute__((target("+crypto")))
+static void aes_armv8_ce_encrypt(const struct aes_ctx *ctx,
+					const uint8_t *in, uint8_t *out)
+{
+	uint8x16_t s = vld1q_u8(in);
+	unsigned int i;
+
+	for (i = 0; i < ctx->rounds - 1; i++)
+		s = vaesmcq_u8(vaeseq_u8(s, vld1q_u8(ctx->ek[i])));
+
+	s = vaeseq_u8(s, vld1q_u8(ctx->ek[i]));
+	vst1q_u8(out, veorq_u8(s, vld1q_u8(ctx->ek[i + 1])));
+}
+
+__attribute__((target("+crypto")))
+static void aes_armv8_ce_decrypt(const struct aes_ctx *ctx,
+					const uint8_t *in, uint8_t *out)
+{
+	uint8x16_t s = vld1q_u8(in);
+	unsigned int i;
+
+	for (i = 0; i < ctx->rounds - 1; i++)
+		s = vaesimcq_u8(vaesdq_u8(s, vld1q_u8(ctx->dk[i])));
+
+	s = vaesdq_u8(s, vld1q_u8(ctx->dk[i]));
+	vst1q_u8(out, veorq_u8(s, vld1q_u8(ctx->dk[i + 1])));
+}
+#endif
+
+/* In order of preference */
+static const struct aes_impl aes_impls[] = {
+#if defined(__x86_64__)
+	{
+		.id = CRYPTO_AES_IMPL_AESNI,
+		.supported = aes_ni_supported,
+		.encrypt = aes_ni_encrypt,
+		.decrypt = aes_ni_decrypt,
+	},
+#endif
+#if defined(__aarch64__)
+	{
+		.id = CRYPTO_AES_IMPL_ARMV8_CE,
+		.supported = aes_armv8_ce_supported,
+		.encrypt = aes_armv8_ce_encrypt,
+		.decrypt = aes_armv8_ce_decrypt,
+	},
+#endif
+	{
+		.id = CRYPTO_AES_IMPL_GENERIC,
+		.supported = aes_generic_supported,
+		.encrypt = aes_generic_encrypt,
+		.decrypt = aes_generic_decrypt,
+	},
+};
+
+/* NULL selects the kernel's AF_ALG implementation through ell */
+static const struct aes_impl *aes_impl;
+static bool aes_impl_selected;
+
+static const struct aes_impl *aes_get_impl(void)
+{
+	unsigned int i;
+
+	if (aes_impl_selected)
+		return aes_impl;
+
+	for (i = 0; i < L_ARRAY_SIZE(aes_impls); i++) {
+		if (!aes_impls[i].supported())
+			continue;
+
+		aes_impl = &aes_impls[i];
+		break;
+	}
+
+	aes_impl_selected = true;
+
+	return aes_impl;
+}
+
+enum crypto_aes_impl crypto_aes_get_impl(void)
+{
+	const struct aes_impl *impl = aes_get_impl();
+
+	return impl ? impl->id : CRYPTO_AES_IMPL_KERNEL;
+}
+
+bool crypto_aes_set_impl(enum crypto_aes_impl id)
+{
+	unsigned int i;
+
+	if (id == CRYPTO_AES_IMPL_KERNEL) {
+		aes_impl = NULL;
+		aes_impl_selected = true;
+		return true;
+	}
+
+	for (i = 0; i < L_ARRAY_SIZE(aes_impls); i++) {
+		if (aes_impls[i].id != id)
+			continue;
+
+		if (!aes_impls[i].supported())
+			return false;
+
+		aes_impl = &aes_impls[i];
+		aes_impl_selected = true;
+		return true;
+	}
+
+	return false;
+}
+
+const char *crypto_aes_impl_to_str(enum crypto_aes_impl id)
+{
+	switch (id) {
+	case CRYPTO_AES_IMPL_KERNEL:
+		return "kernel";
+	case CRYPTO_AES_IMPL_GENERIC:
+		return "generic";
+	case CRYPTO_AES_IMPL_AESNI:
+		return "aes-ni";
+	case CRYPTO_AES_IMPL_ARMV8_CE:
+		return "armv8-ce";
+	}
+
+	return NULL;
+}
+
+/*
+ * A single AES key for ECB block operations, either expanded in user space
+ * or held by an AF_ALG socket when the kernel implementation is selected.
+ */
+struct aes_cipher {
+	const struct aes_impl *impl;
+	struct l_cipher *kernel;
+	struct aes_ctx ctx;
+};
+
+static bool aes_cipher_init(struct aes_cipher *aes, const void *key,
+				size_t key_len)
+{
+	aes->impl = aes_get_impl();
+	aes->kernel = NULL;
+
+	if (aes->impl)
+		return aes_ctx_init(&aes->ctx, key, key_len);
+
+	aes->kernel = l_cipher_new(L_CIPHER_AES, key, key_len);
+
+	return aes->kernel != NULL;
+}
+
+static bool aes_cipher_encrypt(struct aes_cipher *aes, const void *in,
+				void *out)
+{
+	if (!aes->impl)
+		return l_cipher_encrypt(aes->kernel, in, out, 16);
+
+	aes->impl->encrypt(&aes->ctx, in, out);
+	return true;
+}
+
+static bool aes_cipher_decrypt(struct aes_cipher *aes, const void *in,
+				void *out)
+{
+	if (!aes->impl)
+		return l_cipher_decrypt(aes->kernel, in, out, 16);
+
+	aes->impl->decrypt(&aes->ctx, in, out);
+	return true;
+}
+
+static void aes_cipher_clear(struct aes_cipher *aes)
+{
+	if (aes->impl)
+		explicit_bzero(&aes->ctx, sizeof(aes->ctx));
+	else
+		l_cipher_free(aes->kernel);
+}
+
+/*
+ * RFC 4493 AES-CMAC.  Like the AF_ALG backed l_checksum it replaces,
+ * retrieving the digest starts a new message.
+ */
+struct aes_cmac {
+	struct aes_cipher aes;
+	struct l_checksum *kernel;
+	uint8_t k1[16];
+	uint8_t k2[16];
+	uint8_t x[16];
+	uint8_t last[16];
+	size_t last_len;
+};
+
+static bool aes_cmac_init(struct aes_cmac *cmac, const void *key,
+				size_t key_len)
+{
+	memset(cmac, 0, sizeof(*cmac));
+
+	if (!aes_get_impl()) {
+		cmac->kernel = l_checksum_new_cmac_aes(key, key_len);
+		return cmac->kernel != NULL;
+	}
+
+	if (!aes_cipher_init(&cmac->aes, key, key_len))
+		return false;
+
+	/* RFC 4493 Section 2.3, Subkey Generation */
+	aes_cipher_encrypt(&cmac->aes, cmac->k1, cmac->k1);
+	dbl(cmac->k1);
+	memcpy(cmac->k2, cmac->k1, 16);
+	dbl(cmac->k2);
+
+	return true;
+}
+
+static bool aes_cmac_update(struct aes_cmac *cmac, const void *data,
+				size_t len)
+{
+	const uint8_t *p = data;
+
+	if (cmac->kernel)
+		return l_checksum_update(cmac->kernel, data, len);
+
+	/* The last block is held back until the digest is requested */
+	while (len) {
+		size_t n;
+
+		if (cmac->last_len == 16) {
+			xor(cmac->x, cmac->last, 16);
+			aes_cipher_encrypt(&cmac->aes, cmac->x, cmac->x);
+			cmac->last_len = 0;
+		}
+
+		n = L_MIN(len, 16 - cmac->last_len);
+		memcpy(cmac->last + cmac->last_len, p, n);
+		cmac->last_len += n;
+		p += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+static void aes_cmac_get_digest(struct aes_cmac *cmac, void *out,
+				size_t len)
+{
+	if (cmac->kernel) {
+		l_checksum_get_digest(cmac->kernel, out, len);
+		return;
+	}
+
+	if (cmac->last_len == 16)
+		xor(cmac->x, cmac->k1, 16);
+	else {
+		memset(cmac->last + cmac->last_len, 0, 16 - cmac->last_len);
+		cmac->last[cmac->last_len] = 0x80;
+		xor(cmac->x, cmac->k2, 16);
+	}
+
+	xor(cmac->x, cmac->last, 16);
+	aes_cipher_encrypt(&cmac->aes, cmac->x, cmac->x);
+	memcpy(out, cmac->x, L_MIN(len, 16U));
+
+	explicit_bzero(cmac->x, 16);
+	explicit_bzero(cmac->last, 16);
+	cmac->last_len = 0;
+}
+
+static void aes_cmac_clear(struct aes_cmac *cmac)
+{
+	if (cmac->kernel) {
+		l_checksum_free(cmac->kernel);
+		return;
+	}
+
+	aes_cipher_clear(&cmac->aes);
+	explicit_bzero(cmac, sizeof(*cmac));
+}
+
+/* AES-CTR with a 128-bit big endian counter, as the kernel's ctr(aes) */
+static bool aes_ctr(const void *key, size_t key_len, const uint8_t *iv,
+			const uint8_t *in, uint8_t *out, size_t len)
+{
+	struct aes_cipher aes;
+	uint8_t ctr[16];
+	uint8_t ks[16];
+
+	if (!aes_get_impl()) {
+		struct l_cipher *cipher = l_cipher_new(L_CIPHER_AES_CTR,
+							key, key_len);
+		bool r;
+
+		if (!cipher)
+			return false;
+
+		r = l_cipher_set_iv(cipher, iv, 16) &&
+			l_cipher_encrypt(cipher, in, out, len);
+		l_cipher_free(cipher);
+
+		return r;
+	}
+
+	if (!aes_cipher_init(&aes, key, key_len))
+		return false;
+
+	memcpy(ctr, iv, 16);
+
+	while (len) {
+		size_t n = L_MIN(len, 16U);
+		int i;
+
+		aes_cipher_encrypt(&aes, ctr, ks);
+		xor(ks, in, n);
+		memcpy(out, ks, n);
+
+		for (i = 15; i >= 0; i--)
+			if (++ctr[i])
+				break;
+
+		in += n;
+		out += n;
+		len -= n;
+	}
+
+	explicit_bzero(ks, sizeof(ks));
+	aes_cipher_clear(&aes);
+
+	return true;
+}
+
 bool cmac_aes(const void *key, size_t key_len,
 		const void *data, size_t data_len, void *output, size_t size)
 {
-	struct l_checksum *cmac_aes;
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_AES_CMAC);
+	struct aes_cmac cmac;
 
-	cmac_aes = l_checksum_new_cmac_aes(key, key_len);
-	if (!cmac_aes)
+	if (!aes_cmac_init(&cmac, key, key_len))
 		return false;
 
-	l_checksum_update(cmac_aes, data, data_len);
-	l_checksum_get_digest(cmac_aes, output, size);
-	l_checksum_free(cmac_aes);
+	aes_cmac_update(&cmac, data, data_len);
+	aes_cmac_get_digest(&cmac, output, size);
+	aes_cmac_clear(&cmac);
 
 	return true;
 }
@@ -148,15 +1114,15 @@ bool cmac_aes(const void *key, size_t key_len,
 bool aes_unwrap(const uint8_t *kek, size_t kek_len, const uint8_t *in, size_t len,
 			uint8_t *out)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_AES_KEY_WRAP);
 	uint64_t b[2];
 	uint64_t *r;
 	size_t n = (len - 8) >> 3;
 	int i, j;
-	struct l_cipher *cipher;
+	struct aes_cipher aes;
 	uint64_t t = n * 6;
 
-	cipher = l_cipher_new(L_CIPHER_AES, kek, kek_len);
-	if (!cipher)
+	if (!aes_cipher_init(&aes, kek, kek_len))
 		return false;
 
 	/* Set up */
@@ -171,7 +1137,7 @@ bool aes_unwrap(const uint8_t *kek, size_t kek_len, const uint8_t *in, size_t le
 			b[0] ^= L_CPU_TO_BE64(t);
 			b[1] = L_GET_UNALIGNED(r);
 
-			if (!l_cipher_decrypt(cipher, b, b, 16)) {
+			if (!aes_cipher_decrypt(&aes, b, b)) {
 				b[0] = 0;
 				goto done;
 			}
@@ -182,7 +1148,7 @@ bool aes_unwrap(const uint8_t *kek, size_t kek_len, const uint8_t *in, size_t le
 	}
 
 done:
-	l_cipher_free(cipher);
+	aes_cipher_clear(&aes);
 	explicit_bzero(&b[1], 8);
 
 	/* Check IV */
@@ -205,15 +1171,15 @@ done:
  */
 bool aes_wrap(const uint8_t *kek, const uint8_t *in, size_t len, uint8_t *out)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_AES_KEY_WRAP);
 	uint64_t b[2] = { 0xa6a6a6a6a6a6a6a6, 0 };
 	uint64_t *r = (uint64_t *) out + 1;
 	size_t n = len >> 3;
 	unsigned int i, j;
 	uint32_t t = 1;
-	struct l_cipher *cipher;
+	struct aes_cipher aes;
 
-	cipher = l_cipher_new(L_CIPHER_AES, kek, 16);
-	if (!cipher)
+	if (!aes_cipher_init(&aes, kek, 16))
 		return false;
 
 	memmove(r, in, len);
@@ -221,7 +1187,7 @@ bool aes_wrap(const uint8_t *kek, const uint8_t *in, size_t len, uint8_t *out)
 	for (j = 0; j < 6; j++) {
 		for (i = 0; i < n; i++, t++) {
 			b[1] = L_GET_UNALIGNED(r + i);
-			l_cipher_encrypt(cipher, b, b, 16);
+			aes_cipher_encrypt(&aes, b, b);
 			L_PUT_UNALIGNED(b[1], r + i);
 			b[0] ^= L_CPU_TO_BE64(t);
 		}
@@ -229,45 +1195,16 @@ bool aes_wrap(const uint8_t *kek, const uint8_t *in, size_t len, uint8_t *out)
 
 	L_PUT_UNALIGNED(b[0], r - 1);
 
-	l_cipher_free(cipher);
+	aes_cipher_clear(&aes);
+	explicit_bzero(&b[1], 8);
 
 	return true;
 }
 
-/*
- * RFC 5297 Section 2.3 - Doubling
- */
-static void dbl(uint8_t *val)
-{
-	int i;
-	int c = val[0] & (1 << 7);
-
-	/* shift all but last byte (since i + 1 would overflow) */
-	for (i = 0; i < 15; i++)
-		val[i] = (val[i] << 1) | (val[i + 1] >> 7);
-
-	val[15] <<= 1;
-
-	/*
-	 * "The condition under which the xor operation is performed is when the
-	 * bit being shifted off is one."
-	 */
-	if (c)
-		val[15] ^= 0x87;
-}
-
-static void xor(uint8_t *a, uint8_t *b, size_t len)
-{
-	size_t i;
-
-	for (i = 0; i < len; i++)
-		a[i] ^= b[i];
-}
-
 /*
  * RFC 5297 Section 2.4 - S2V
  */
-static bool s2v(struct l_checksum *cmac, struct iovec *iov, size_t iov_len,
+static bool s2v(struct aes_cmac *cmac, struct iovec *iov, size_t iov_len,
 		uint8_t *v)
 {
 	uint8_t zero[16] = { 0 };
@@ -276,10 +1213,10 @@ static bool s2v(struct l_checksum *cmac, struct iovec *iov, size_t iov_len,
 	size_t i;
 
 	/* AES-CMAC(K, <zero>) */
-	if (!l_checksum_update(cmac, zero, sizeof(zero)))
+	if (!aes_cmac_update(cmac, zero, sizeof(zero)))
 		return false;
 
-	l_checksum_get_digest(cmac, d, sizeof(d));
+	aes_cmac_get_digest(cmac, d, sizeof(d));
 
 	/* Last element is treated special */
 	for (i = 0; i < iov_len - 1; i++) {
@@ -287,16 +1224,16 @@ static bool s2v(struct l_checksum *cmac, struct iovec *iov, size_t iov_len,
 		dbl(d);
 
 		/* AES-CMAC(K, Si) */
-		if (!l_checksum_update(cmac, iov[i].iov_base, iov[i].iov_len))
+		if (!aes_cmac_update(cmac, iov[i].iov_base, iov[i].iov_len))
 			return false;
 
-		l_checksum_get_digest(cmac, tmp, sizeof(tmp));
+		aes_cmac_get_digest(cmac, tmp, sizeof(tmp));
 		/* D = D xor AES-CMAC(K, Si) */
 		xor(d, tmp, sizeof(tmp));
 	}
 
 	if (iov[i].iov_len >= 16) {
-		if (!l_checksum_update(cmac, iov[i].iov_base,
+		if (!aes_cmac_update(cmac, iov[i].iov_base,
 					iov[i].iov_len - 16))
 			return false;
 		/* xorend(d) */
@@ -312,10 +1249,10 @@ static bool s2v(struct l_checksum *cmac, struct iovec *iov, size_t iov_len,
 		d[iov[i].iov_len] ^= 0x80;
 	}
 
-	if (!l_checksum_update(cmac, d, 16))
+	if (!aes_cmac_update(cmac, d, 16))
 		return false;
 
-	l_checksum_get_digest(cmac, v, 16);
+	aes_cmac_get_digest(cmac, v, 16);
 
 	return true;
 }
@@ -327,8 +1264,8 @@ bool aes_siv_encrypt(const void *key, size_t key_len, const void *in,
 			size_t in_len, struct iovec *ad, size_t num_ad,
 			void *out)
 {
-	struct l_checksum *cmac;
-	struct l_cipher *ctr;
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_AES_SIV);
+	struct aes_cmac cmac;
 	struct iovec iov[num_ad + 1];
 	uint8_t v[16];
 
@@ -343,47 +1280,31 @@ bool aes_siv_encrypt(const void *key, size_t key_len, const void *in,
 	 * key is split into two equal halves... K1 is used for S2V and K2 is
 	 * used for CTR
 	 */
-	cmac = l_checksum_new_cmac_aes(key, key_len / 2);
-	if (!cmac)
+	if (!aes_cmac_init(&cmac, key, key_len / 2))
 		return false;
 
-	if (!s2v(cmac, iov, num_ad, v)) {
-		l_checksum_free(cmac);
+	if (!s2v(&cmac, iov, num_ad, v)) {
+		aes_cmac_clear(&cmac);
 		return false;
 	}
 
-	l_checksum_free(cmac);
+	aes_cmac_clear(&cmac);
 
 	memcpy(out, v, 16);
 
 	v[8] &= 0x7f;
 	v[12] &= 0x7f;
 
-	ctr = l_cipher_new(L_CIPHER_AES_CTR, key + (key_len / 2), key_len / 2);
-	if (!ctr)
-		return false;
-
-	if (!l_cipher_set_iv(ctr, v, 16))
-		goto free_ctr;
-
-	if (!l_cipher_encrypt(ctr, in, out + 16, in_len))
-		goto free_ctr;
-
-	l_cipher_free(ctr);
-
-	return true;
-
-free_ctr:
-	l_cipher_free(ctr);
-	return false;
+	return aes_ctr(key + (key_len / 2), key_len / 2, v, in, out + 16,
+			in_len);
 }
 
 bool aes_siv_decrypt(const void *key, size_t key_len, const void *in,
 			size_t in_len, struct iovec *ad, size_t num_ad,
 			void *out)
 {
-	struct l_checksum *cmac;
-	struct l_cipher *ctr;
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_AES_SIV);
+	struct aes_cmac cmac;
 	struct iovec iov[num_ad + 1];
 	uint8_t iv[16];
 	uint8_t v[16];
@@ -406,38 +1327,25 @@ bool aes_siv_decrypt(const void *key, size_t key_len, const void *in,
 	iv[8] &= 0x7f;
 	iv[12] &= 0x7f;
 
-	ctr = l_cipher_new(L_CIPHER_AES_CTR, key + (key_len / 2), key_len / 2);
-	if (!ctr)
+	if (!aes_ctr(key + (key_len / 2), key_len / 2, iv, in + 16, out,
+			in_len - 16))
 		return false;
 
-	if (!l_cipher_set_iv(ctr, iv, 16))
-		goto free_ctr;
-
-	if (!l_cipher_decrypt(ctr, in + 16, out, in_len - 16))
-		goto free_ctr;
-
-	l_cipher_free(ctr);
-
 check_cmac:
-	cmac = l_checksum_new_cmac_aes(key, key_len / 2);
-	if (!cmac)
+	if (!aes_cmac_init(&cmac, key, key_len / 2))
 		return false;
 
-	if (!s2v(cmac, iov, num_ad, v)) {
-		l_checksum_free(cmac);
+	if (!s2v(&cmac, iov, num_ad, v)) {
+		aes_cmac_clear(&cmac);
 		return false;
 	}
 
-	l_checksum_free(cmac);
+	aes_cmac_clear(&cmac);
 
 	if (memcmp(v, in, 16))
 		return false;
 
 	return true;
-
-free_ctr:
-	l_cipher_free(ctr);
-	return false;
 }
 
 static void arc4_set_key(struct arc4_ctx *ctx, unsigned int length,
@@ -556,6 +1464,7 @@ int crypto_psk_from_passphrase(const char *passphrase,
 				const unsigned char *ssid, size_t ssid_len,
 				unsigned char *out_psk)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_PSK_FROM_PASSPHRASE);
 	bool result;
 	unsigned char psk[32];
 
@@ -588,6 +1497,7 @@ bool prf_sha1(const void *key, size_t key_len,
 		const void *prefix, size_t prefix_len,
 		const void *data, size_t data_len, void *output, size_t size)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_PRF);
 	struct l_checksum *hmac;
 	unsigned int i, offset = 0;
 	unsigned char empty = '\0';
@@ -628,6 +1538,7 @@ bool prf_plus(enum l_checksum_type type, const void *key, size_t key_len,
 		void *out, size_t out_len,
 		size_t n_extra, ...)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_PRF);
 	struct iovec iov[n_extra + 2];
 	uint8_t *t = out;
 	size_t t_len = 0;
@@ -758,6 +1669,7 @@ bool crypto_kdf(enum l_checksum_type type, const void *key, size_t key_len,
 		const void *prefix, size_t prefix_len,
 		const void *data, size_t data_len, void *output, size_t size)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_KDF);
 	struct l_checksum *hmac;
 	unsigned int i, offset = 0;
 	unsigned int counter;
@@ -828,6 +1740,7 @@ bool hkdf_extract(enum l_checksum_type type, const void *key,
 				size_t key_len, uint8_t num_args,
 				void *out, ...)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_HKDF_EXTRACT);
 	struct l_checksum *hmac;
 	struct iovec iov[num_args];
 	const uint8_t zero_key[64] = { 0 };
@@ -868,6 +1781,8 @@ bool hkdf_extract(enum l_checksum_type type, const void *key,
 bool hkdf_expand(enum l_checksum_type type, const void *key, size_t key_len,
 			const char *info, void *out, size_t out_len)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_HKDF_EXPAND);
+
 	return prf_plus(type, key, key_len, out, out_len, 1,
 			info, strlen(info));
 }
@@ -935,6 +1850,8 @@ bool crypto_derive_pairwise_ptk(const uint8_t *pmk, size_t pmk_len,
 				uint8_t *out_ptk, size_t ptk_len,
 				enum l_checksum_type type)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_DERIVE_PTK);
+
 	return crypto_derive_ptk(pmk, pmk_len, "Pairwise key expansion",
 					addr1, addr2, nonce1, nonce2,
 					out_ptk, ptk_len,
@@ -949,6 +1866,7 @@ bool crypto_derive_pmk_r0(const uint8_t *xxkey, size_t xxkey_len,
 				const uint8_t *s0khid, bool sha384,
 				uint8_t *out_pmk_r0, uint8_t *out_pmk_r0_name)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_DERIVE_FT_KEYS);
 	uint8_t context[512];
 	size_t pos = 0;
 	uint8_t output[64];
@@ -1013,6 +1931,7 @@ bool crypto_derive_pmk_r1(const uint8_t *pmk_r0,
 				uint8_t *out_pmk_r1,
 				uint8_t *out_pmk_r1_name)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_DERIVE_FT_KEYS);
 	uint8_t context[2 * ETH_ALEN];
 	struct l_checksum *sha;
 	bool r = false;
@@ -1062,6 +1981,7 @@ bool crypto_derive_ft_ptk(const uint8_t *pmk_r1, const uint8_t *pmk_r1_name,
 				bool sha384, uint8_t *out_ptk, size_t ptk_len,
 				uint8_t *out_ptk_name)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_DERIVE_PTK);
 	uint8_t context[ETH_ALEN * 2 + 64];
 	struct l_checksum *sha;
 	bool r = false;
@@ -1148,6 +2068,7 @@ struct l_ecc_point *crypto_derive_sae_pt_ecc(unsigned int group,
 						const char *password,
 						const char *identifier)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_SAE_PT);
 	const struct l_ecc_curve *curve = l_ecc_curve_from_ike_group(group);
 	enum l_checksum_type hash;
 	size_t hash_len;
@@ -1203,6 +2124,7 @@ struct l_ecc_point *crypto_derive_sae_pwe_from_pt_ecc(const uint8_t *mac1,
 						const uint8_t *mac2,
 						const struct l_ecc_point *pt)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_SAE_PWE);
 	const struct l_ecc_curve *curve = l_ecc_point_get_curve(pt);
 	enum l_checksum_type hash;
 	size_t hash_len;
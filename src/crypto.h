@@ -21,6 +21,7 @@
  */
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
 
 struct l_ecc_point;
@@ -61,6 +62,66 @@ enum crypto_akm {
 	CRYPTO_AKM_OSEN = 0x506f9a01,
 };
 
+/* Block cipher backends used by the AES based functions below */
+enum crypto_aes_impl {
+	CRYPTO_AES_IMPL_KERNEL,
+	CRYPTO_AES_IMPL_GENERIC,
+	CRYPTO_AES_IMPL_AESNI,
+	CRYPTO_AES_IMPL_ARMV8_CE,
+};
+
+/* Primitives with call counts and latency histograms, see crypto_stat_get */
+enum crypto_stat {
+	CRYPTO_STAT_PSK_FROM_PASSPHRASE,
+	CRYPTO_STAT_DERIVE_PTK,
+	CRYPTO_STAT_DERIVE_FT_KEYS,
+	CRYPTO_STAT_PRF,
+	CRYPTO_STAT_KDF,
+	CRYPTO_STAT_HKDF_EXTRACT,
+	CRYPTO_STAT_HKDF_EXPAND,
+	CRYPTO_STAT_AES_KEY_WRAP,
+	CRYPTO_STAT_AES_CMAC,
+	CRYPTO_STAT_AES_SIV,
+	CRYPTO_STAT_SAE_PT,
+	CRYPTO_STAT_SAE_PWE,
+	CRYPTO_STAT_SAE_COMMIT,
+	CRYPTO_STAT_SAE_KEYS,
+	CRYPTO_STAT_SAE_CONFIRM,
+	CRYPTO_STAT_DPP_DERIVE,
+	CRYPTO_STAT_TLS_HANDSHAKE,
+	__CRYPTO_STAT_MAX,
+};
+
+/*
+ * Bucket 0 counts calls that took less than 1us, bucket n those that took
+ * [2^(n-1), 2^n) us and the last bucket everything slower.
+ */
+#define CRYPTO_STAT_BUCKETS	24
+
+struct crypto_stat_info {
+	uint64_t count;
+	uint64_t total_usec;
+	uint64_t max_usec;
+	uint32_t histogram[CRYPTO_STAT_BUCKETS];
+};
+
+struct crypto_stat_timer {
+	enum crypto_stat stat;
+	uint64_t start_time;
+};
+
+void crypto_stat_record(enum crypto_stat stat, uint64_t start_time);
+void crypto_stat_timer_stop(struct crypto_stat_timer *timer);
+const struct crypto_stat_info *crypto_stat_get(enum crypto_stat stat);
+const char *crypto_stat_to_str(enum crypto_stat stat);
+void crypto_stats_log(void);
+
+/* Records the time until the end of the enclosing scope under @s */
+#define CRYPTO_STAT_TIMER(s)						\
+	struct crypto_stat_timer __crypto_stat_timer			\
+		__attribute__((cleanup(crypto_stat_timer_stop))) =	\
+			{ .stat = (s), .start_time = l_time_now() }
+
 /* Min & Max reported by crypto_cipher_key_len when ignoring WEP */
 #define CRYPTO_MIN_GTK_LEN 16
 #define CRYPTO_MAX_GTK_LEN 32
@@ -83,6 +144,10 @@ bool hmac_sha384(const void *key, size_t key_len,
 bool cmac_aes(const void *key, size_t key_len,
 		const void *data, size_t data_len, void *output, size_t size);
 
+enum crypto_aes_impl crypto_aes_get_impl(void);
+bool crypto_aes_set_impl(enum crypto_aes_impl impl);
+const char *crypto_aes_impl_to_str(enum crypto_aes_impl impl);
+
 bool aes_unwrap(const uint8_t *kek, size_t kek_len, const uint8_t *in, size_t len,
 			uint8_t *out);
 bool aes_wrap(const uint8_t *kek, const uint8_t *in, size_t len, uint8_t *out);
@@ -645,6 +645,7 @@ bool dpp_derive_r_auth(const void *i_nonce, const void *r_nonce,
 				struct l_ecc_point *r_boot,
 				void *r_auth)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_DPP_DERIVE);
 	uint64_t pix[L_ECC_MAX_DIGITS];
 	uint64_t prx[L_ECC_MAX_DIGITS];
 	uint64_t brx[L_ECC_MAX_DIGITS];
@@ -677,6 +678,7 @@ bool dpp_derive_i_auth(const void *r_nonce, const void *i_nonce,
 				struct l_ecc_point *r_boot,
 				struct l_ecc_point *i_boot, void *i_auth)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_DPP_DERIVE);
 	uint64_t prx[L_ECC_MAX_DIGITS];
 	uint64_t pix[L_ECC_MAX_DIGITS];
 	uint64_t brx[L_ECC_MAX_DIGITS];
@@ -711,6 +713,7 @@ struct l_ecc_scalar *dpp_derive_k1(const struct l_ecc_point *i_proto_public,
 				const struct l_ecc_scalar *boot_private,
 				void *k1)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_DPP_DERIVE);
 	struct l_ecc_scalar *m;
 	uint64_t mx_bytes[L_ECC_MAX_DIGITS];
 	ssize_t key_len;
@@ -744,6 +747,7 @@ struct l_ecc_scalar *dpp_derive_k2(const struct l_ecc_point *i_proto_public,
 				const struct l_ecc_scalar *proto_private,
 				void *k2)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_DPP_DERIVE);
 	struct l_ecc_scalar *n;
 	uint64_t nx_bytes[L_ECC_MAX_DIGITS];
 	ssize_t key_len;
@@ -773,6 +777,7 @@ bool dpp_derive_ke(const uint8_t *i_nonce, const uint8_t *r_nonce,
 				struct l_ecc_scalar *m, struct l_ecc_scalar *n,
 				struct l_ecc_point *l, void *ke)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_DPP_DERIVE);
 	uint8_t nonces[32 + 32];
 	size_t nonce_len;
 	uint64_t mx_bytes[L_ECC_MAX_DIGITS];
@@ -1234,6 +1239,7 @@ struct l_ecc_point *dpp_derive_li(const struct l_ecc_point *boot_public,
 				const struct l_ecc_point *proto_public,
 				const struct l_ecc_scalar *boot_private)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_DPP_DERIVE);
 	const struct l_ecc_curve *curve = l_ecc_point_get_curve(boot_public);
 	struct l_ecc_point *ret = l_ecc_point_new(curve);
 
@@ -1252,6 +1258,7 @@ struct l_ecc_point *dpp_derive_lr(const struct l_ecc_scalar *boot_private,
 				const struct l_ecc_scalar *proto_private,
 				const struct l_ecc_point *peer_public)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_DPP_DERIVE);
 	const struct l_ecc_curve *curve = l_ecc_point_get_curve(peer_public);
 	_auto_(l_ecc_scalar_free) struct l_ecc_scalar *order =
 					l_ecc_curve_get_order(curve);
@@ -1330,6 +1337,8 @@ struct l_ecc_point *dpp_derive_qi(const struct l_ecc_curve *curve,
 					const char *identifier,
 					const uint8_t *mac_initiator)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_DPP_DERIVE);
+
 	return dpp_derive_q(curve, dpp_pkex_initiator_p256, key, identifier,
 				mac_initiator);
 }
@@ -1344,6 +1353,8 @@ struct l_ecc_point *dpp_derive_qr(const struct l_ecc_curve *curve,
 					const char *identifier,
 					const uint8_t *mac_responder)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_DPP_DERIVE);
+
 	return dpp_derive_q(curve, dpp_pkex_responder_p256, key, identifier,
 				mac_responder);
 }
@@ -1361,6 +1372,7 @@ bool dpp_derive_z(const uint8_t *mac_i, const uint8_t *mac_r,
 				const char *identifier,
 				void *z_out, size_t *z_len)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_DPP_DERIVE);
 	const struct l_ecc_curve *curve = l_ecc_point_get_curve(n);
 	size_t bytes = l_ecc_curve_get_scalar_bytes(curve);
 	enum l_checksum_type sha = dpp_sha_from_key_len(bytes);
@@ -1401,6 +1413,7 @@ bool dpp_derive_u(const struct l_ecc_point *j,
 			const struct l_ecc_point *x,
 			void *u_out, size_t *u_len)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_DPP_DERIVE);
 	const struct l_ecc_curve *curve = l_ecc_point_get_curve(y);
 	uint8_t j_x[L_ECC_SCALAR_MAX_BYTES];
 	uint8_t a_x[L_ECC_SCALAR_MAX_BYTES];
@@ -1444,6 +1457,7 @@ bool dpp_derive_v(const struct l_ecc_point *l, const uint8_t *mac,
 			const struct l_ecc_point *y,
 			void *v_out, size_t *v_len)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_DPP_DERIVE);
 	const struct l_ecc_curve *curve = l_ecc_point_get_curve(l);
 	uint8_t l_x[L_ECC_SCALAR_MAX_BYTES];
 	uint8_t b_x[L_ECC_SCALAR_MAX_BYTES];
@@ -51,6 +51,7 @@
 #define EAP_AKA_ST_SYNC_FAILURE	0x04
 #define EAP_AKA_ST_IDENTITY	0x05
 #define EAP_AKA_ST_NOTIFICATION	0x0c
+#define EAP_AKA_ST_REAUTHENTICATION	0x0d
 #define EAP_AKA_ST_CLIENT_ERROR	0x0e
 
 /*
@@ -86,12 +87,17 @@ struct eap_aka_handle {
 	/* Derived EMSK from PRNG */
 	uint8_t emsk[EAP_SIM_EMSK_LEN];
 
-	/* Flag set if AT_ANY_ID_REQ was present */
-	bool any_id_req : 1;
-
 	/* Flag to indicate protected status indications */
 	bool protected : 1;
 
+	/* Flag set if this is a fast re-authentication */
+	bool reauth : 1;
+
+	/* Fast re-authentication counter, NONCE_S and AT_MAC from server */
+	uint16_t counter;
+	uint8_t nonce_s[EAP_SIM_NONCE_S_LEN];
+	uint8_t reauth_mac[EAP_SIM_MAC_LEN];
+
 	/* Authentication value from AuC */
 	uint8_t autn[EAP_AKA_AUTN_LEN];
 
@@ -105,6 +111,12 @@ struct eap_aka_handle {
 	uint8_t *chal_pkt;
 	uint32_t pkt_len;
 
+	/* Last answered Challenge and our response, for retransmissions */
+	uint8_t *last_chal;
+	size_t last_chal_len;
+	uint8_t *last_resp;
+	size_t last_resp_len;
+
 	struct iwd_sim_auth *auth;
 	unsigned int auth_watch;
 };
@@ -119,6 +131,14 @@ static void eap_aka_clear_secrets(struct eap_aka_handle *aka)
 	explicit_bzero(aka->emsk, sizeof(aka->emsk));
 }
 
+static void eap_aka_forget_challenge(struct eap_aka_handle *aka)
+{
+	l_free(l_steal_ptr(aka->last_chal));
+	aka->last_chal_len = 0;
+	l_free(l_steal_ptr(aka->last_resp));
+	aka->last_resp_len = 0;
+}
+
 static void eap_aka_free(struct eap_state *eap)
 {
 	struct eap_aka_handle *aka = eap_get_data(eap);
@@ -127,6 +147,8 @@ static void eap_aka_free(struct eap_state *eap)
 		sim_auth_unregistered_watch_remove(aka->auth, aka->auth_watch);
 
 	eap_aka_clear_secrets(aka);
+	eap_aka_forget_challenge(aka);
+	l_free(aka->chal_pkt);
 
 	l_free(aka->identity);
 	l_free(aka->kdf_in);
@@ -135,6 +157,61 @@ static void eap_aka_free(struct eap_state *eap)
 	eap_set_data(eap, NULL);
 }
 
+static enum sim_auth_method eap_aka_method(struct eap_aka_handle *aka)
+{
+	if (aka->type == EAP_TYPE_AKA_PRIME)
+		return SIM_AUTH_METHOD_AKA_PRIME;
+
+	return SIM_AUTH_METHOD_AKA;
+}
+
+/*
+ * Keep the keys of the last full authentication for fast re-authentication
+ * with reauth_id, or forget them if the server didn't hand out an identity.
+ * AKA' re-authentication is based on K_re, EAP-AKA's on MK.
+ */
+static void eap_aka_store_reauth(struct eap_aka_handle *aka,
+					const char *reauth_id, uint16_t counter)
+{
+	bool prime = aka->type == EAP_TYPE_AKA_PRIME;
+	struct sim_auth_reauth reauth = {
+		.id = (char *) reauth_id,
+		.counter = counter,
+		.key_len = prime ? EAP_AKA_K_RE_LEN : EAP_SIM_MK_LEN,
+		.k_aut_len = prime ? EAP_AKA_PRIME_K_AUT_LEN :
+							EAP_SIM_K_AUT_LEN,
+	};
+
+	if (!reauth_id) {
+		sim_auth_set_reauth(aka->auth, eap_aka_method(aka), NULL);
+		return;
+	}
+
+	memcpy(reauth.key, prime ? aka->k_re : aka->mk, reauth.key_len);
+	memcpy(reauth.k_encr, aka->k_encr, EAP_SIM_K_ENCR_LEN);
+	memcpy(reauth.k_aut, aka->k_aut, reauth.k_aut_len);
+
+	sim_auth_set_reauth(aka->auth, eap_aka_method(aka), &reauth);
+	explicit_bzero(&reauth, sizeof(reauth));
+}
+
+/* Remember the identities for the next authentication with this SIM */
+static void eap_aka_store_next_ids(struct eap_aka_handle *aka)
+{
+	_auto_(l_free) char *pseudonym = NULL;
+	_auto_(l_free) char *reauth_id = NULL;
+
+	if (!eap_sim_get_next_ids(aka->chal_pkt, aka->pkt_len, aka->k_encr,
+					&pseudonym, &reauth_id))
+		l_warn("Could not decrypt AT_ENCR_DATA");
+
+	if (pseudonym)
+		sim_auth_set_pseudonym(aka->auth, eap_aka_method(aka),
+					pseudonym);
+
+	eap_aka_store_reauth(aka, reauth_id, 0);
+}
+
 static bool derive_aka_mk(const char *identity, const uint8_t *ik,
 		const uint8_t *ck, uint8_t *mk)
 {
@@ -172,14 +249,25 @@ static void eap_aka_finish(struct eap_state *eap)
 {
 	struct eap_aka_handle *aka = eap_get_data(eap);
 	uint8_t session_id[1 + EAP_SIM_RAND_LEN + EAP_AKA_AUTN_LEN];
-
-	session_id[0] = EAP_TYPE_AKA;
-	memcpy(session_id + 1, aka->rand, EAP_SIM_RAND_LEN);
-	memcpy(session_id + 1 + EAP_SIM_RAND_LEN, aka->autn, EAP_AKA_AUTN_LEN);
+	size_t session_len = sizeof(session_id);
+
+	if (aka->reauth) {
+		/* RFC 5247 Appendix A, Type-Code || NONCE_S || MAC */
+		session_id[0] = aka->type;
+		memcpy(session_id + 1, aka->nonce_s, EAP_SIM_NONCE_S_LEN);
+		memcpy(session_id + 1 + EAP_SIM_NONCE_S_LEN, aka->reauth_mac,
+					EAP_SIM_MAC_LEN);
+		session_len = 1 + EAP_SIM_NONCE_S_LEN + EAP_SIM_MAC_LEN;
+	} else {
+		session_id[0] = EAP_TYPE_AKA;
+		memcpy(session_id + 1, aka->rand, EAP_SIM_RAND_LEN);
+		memcpy(session_id + 1 + EAP_SIM_RAND_LEN, aka->autn,
+					EAP_AKA_AUTN_LEN);
+	}
 
 	eap_method_success(eap);
 	eap_set_key_material(eap, aka->msk, 32, aka->emsk, 32, NULL, 0,
-					session_id, sizeof(session_id));
+					session_id, session_len);
 }
 
 static void check_milenage_cb(const uint8_t *res, const uint8_t *ck,
@@ -262,6 +350,8 @@ static void check_milenage_cb(const uint8_t *res, const uint8_t *ck,
 		goto chal_error;
 	}
 
+	eap_aka_store_next_ids(aka);
+
 	aka->state = EAP_AKA_STATE_CHALLENGE;
 
 	pos += eap_sim_build_header(eap, aka->type, EAP_AKA_ST_CHALLENGE,
@@ -282,8 +372,16 @@ static void check_milenage_cb(const uint8_t *res, const uint8_t *ck,
 		goto chal_fatal;
 	}
 
-	l_free(aka->chal_pkt);
-	aka->chal_pkt = NULL;
+	/*
+	 * Running the same AUTN through the SIM again would fail its
+	 * sequence number check, so a retransmitted Challenge is answered
+	 * with this response until the session ends.
+	 */
+	eap_aka_forget_challenge(aka);
+	aka->last_chal = l_steal_ptr(aka->chal_pkt);
+	aka->last_chal_len = aka->pkt_len;
+	aka->last_resp = l_memdup(response, resp_len);
+	aka->last_resp_len = resp_len;
 
 	eap_method_respond(eap, response, resp_len);
 
@@ -511,9 +609,31 @@ static void handle_notification(struct eap_state *eap, const uint8_t *pkt,
 
 	if (value == EAP_SIM_SUCCESS && aka->protected &&
 			aka->state == EAP_AKA_STATE_CHALLENGE) {
-		/* header + MAC + MAC header */
-		uint8_t response[EAP_SIM_ROUND(8 + EAP_SIM_MAC_LEN + 4)];
+		uint8_t response[EAP_SIM_COUNTER_RESPONSE_LEN_MAX +
+						EAP_SIM_NONCE_S_LEN];
 		uint8_t *pos = response;
+		size_t resp_len;
+
+		/*
+		 * RFC 4187 Section 9.10, on fast re-authentication the
+		 * server must echo the counter of this exchange
+		 */
+		if (aka->reauth) {
+			uint16_t counter;
+
+			if (!eap_sim_verify_mac(eap, aka->type, pkt, len,
+							aka->k_aut, NULL, 0)) {
+				l_error("Notification MAC was invalid");
+				goto notif_error;
+			}
+
+			if (!eap_sim_get_encr_counter(pkt, len, aka->k_encr,
+							&counter) ||
+					counter != aka->counter) {
+				l_error("Notification counter doesn't match");
+				goto notif_error;
+			}
+		}
 
 		/*
 		 * Server sent successful result indication
@@ -521,22 +641,37 @@ static void handle_notification(struct eap_state *eap, const uint8_t *pkt,
 		eap_aka_finish(eap);
 
 		/*
-		 * Build response packet
+		 * Build response packet, RFC 4187 Section 9.11 requires the
+		 * counter on fast re-authentication
 		 */
-		pos += eap_sim_build_header(eap, aka->type,
-				EAP_AKA_ST_NOTIFICATION, pos, 20);
-		pos += eap_sim_add_attribute(pos, EAP_SIM_AT_MAC,
-				EAP_SIM_PAD_NONE, NULL, EAP_SIM_MAC_LEN);
+		if (aka->reauth) {
+			resp_len = eap_sim_build_counter_response(eap,
+					aka->type, EAP_AKA_ST_NOTIFICATION,
+					aka->counter, false, false,
+					aka->k_encr, aka->k_aut, NULL,
+					response);
+		} else {
+			/* header + MAC + MAC header */
+			pos += eap_sim_build_header(eap, aka->type,
+					EAP_AKA_ST_NOTIFICATION, pos, 20);
+			pos += eap_sim_add_attribute(pos, EAP_SIM_AT_MAC,
+					EAP_SIM_PAD_NONE, NULL,
+					EAP_SIM_MAC_LEN);
+			resp_len = pos - response;
+
+			if (!eap_sim_derive_mac(aka->type, response, resp_len,
+					aka->k_aut, response + 12))
+				resp_len = 0;
+		}
 
-		if (!eap_sim_derive_mac(aka->type, response, pos - response,
-				aka->k_aut, response + 12)) {
+		if (!resp_len) {
 			l_error("could not derive MAC");
 			eap_method_error(eap);
 			aka->state = EAP_AKA_STATE_ERROR;
 			return;
 		}
 
-		eap_method_respond(eap, response, pos - response);
+		eap_method_respond(eap, response, resp_len);
 
 		aka->state = EAP_AKA_STATE_SUCCESS;
 
@@ -560,20 +695,12 @@ notif_error:
 	eap_sim_client_error(eap, aka->type, EAP_SIM_ERROR_PROCESS);
 }
 
-static void handle_identity(struct eap_state *eap, const uint8_t *pkt,
-		size_t len)
+static void eap_aka_send_identity(struct eap_state *eap)
 {
 	struct eap_aka_handle *aka = eap_get_data(eap);
 	uint8_t response[EAP_SIM_ROUND(8 + strlen(aka->identity) + 4)];
 	uint8_t *pos = response;
 
-	if (aka->state != EAP_AKA_STATE_UNCONNECTED) {
-		l_error("invalid packet for EAP-AKA state");
-		eap_sim_client_error(eap, aka->type, EAP_SIM_ERROR_PROCESS);
-		return;
-	}
-
-	aka->state = EAP_AKA_STATE_IDENTITY;
 	/*
 	 * Build response packet
 	 */
@@ -586,6 +713,186 @@ static void handle_identity(struct eap_state *eap, const uint8_t *pkt,
 	eap_method_respond(eap, response, pos - response);
 }
 
+static void handle_identity(struct eap_state *eap, const uint8_t *pkt,
+		size_t len)
+{
+	struct eap_aka_handle *aka = eap_get_data(eap);
+	struct eap_sim_tlv_iter iter;
+	enum sim_auth_identity_type id_type = SIM_AUTH_IDENTITY_ANY;
+	bool id_req = false;
+
+	if (len < 3) {
+		l_error("packet is too small");
+		goto identity_error;
+	}
+
+	/* RFC 4187 Section 4.1, the server may ask for another identity */
+	if (aka->state != EAP_AKA_STATE_UNCONNECTED &&
+			aka->state != EAP_AKA_STATE_IDENTITY) {
+		l_error("invalid packet for EAP-AKA state");
+		goto identity_error;
+	}
+
+	eap_sim_tlv_iter_init(&iter, pkt + 3, len - 3);
+
+	while (eap_sim_tlv_iter_next(&iter)) {
+		switch (eap_sim_tlv_iter_get_type(&iter)) {
+		case EAP_SIM_AT_ANY_ID_REQ:
+			id_type = SIM_AUTH_IDENTITY_ANY;
+			id_req = true;
+			break;
+
+		case EAP_SIM_AT_FULLAUTH_ID_REQ:
+			id_type = SIM_AUTH_IDENTITY_FULLAUTH;
+			id_req = true;
+			break;
+
+		case EAP_SIM_AT_PERMANENT_ID_REQ:
+			id_type = SIM_AUTH_IDENTITY_PERMANENT;
+			id_req = true;
+			break;
+		}
+	}
+
+	if (id_req) {
+		l_free(aka->identity);
+		aka->identity = sim_auth_get_identity(aka->auth,
+							eap_aka_method(aka),
+							id_type);
+	}
+
+	aka->state = EAP_AKA_STATE_IDENTITY;
+
+	eap_aka_send_identity(eap);
+	return;
+
+identity_error:
+	eap_sim_client_error(eap, aka->type, EAP_SIM_ERROR_PROCESS);
+}
+
+/*
+ * Handles EAP-AKA Re-authentication subtype
+ */
+static void handle_reauthentication(struct eap_state *eap,
+					const uint8_t *pkt, size_t len)
+{
+	struct eap_aka_handle *aka = eap_get_data(eap);
+	const struct sim_auth_reauth *reauth;
+	struct eap_sim_reauth_request req;
+	uint8_t response[EAP_SIM_COUNTER_RESPONSE_LEN_MAX +
+						EAP_SIM_NONCE_S_LEN];
+	size_t resp_len;
+	bool too_small;
+	bool r;
+
+	if (aka->state != EAP_AKA_STATE_UNCONNECTED &&
+			aka->state != EAP_AKA_STATE_IDENTITY) {
+		l_error("invalid packet for EAP-AKA state");
+		goto reauth_error;
+	}
+
+	reauth = sim_auth_get_reauth(aka->auth, eap_aka_method(aka));
+	if (!reauth || strcmp(reauth->id, aka->identity)) {
+		l_error("no fast re-authentication state for %s",
+				aka->identity);
+		goto reauth_error;
+	}
+
+	if (aka->type == EAP_TYPE_AKA_PRIME)
+		memcpy(aka->k_re, reauth->key, EAP_AKA_K_RE_LEN);
+	else
+		memcpy(aka->mk, reauth->key, EAP_SIM_MK_LEN);
+
+	memcpy(aka->k_encr, reauth->k_encr, EAP_SIM_K_ENCR_LEN);
+	memcpy(aka->k_aut, reauth->k_aut, reauth->k_aut_len);
+
+	if (!eap_sim_verify_mac(eap, aka->type, pkt, len, aka->k_aut,
+			NULL, 0)) {
+		l_error("MAC was not valid");
+		goto reauth_error;
+	}
+
+	if (!eap_sim_parse_reauth_request(pkt, len, aka->k_encr, &req)) {
+		l_error("malformed Re-authentication request");
+		goto reauth_error;
+	}
+
+	/* RFC 4187 Section 5.5, the counter must be fresh */
+	too_small = req.counter <= reauth->counter;
+	aka->protected = req.result_ind && !too_small;
+
+	resp_len = eap_sim_build_counter_response(eap, aka->type,
+					EAP_AKA_ST_REAUTHENTICATION,
+					req.counter, too_small, aka->protected,
+					aka->k_encr, aka->k_aut, req.nonce_s,
+					response);
+
+	if (too_small) {
+		/*
+		 * The server falls back to a full authentication which
+		 * replaces the stored state.  Don't drop it here, a replayed
+		 * request would otherwise be enough to erase it.
+		 */
+		l_warn("re-authentication counter %u is not fresh",
+				req.counter);
+		eap_sim_reauth_request_clear(&req);
+
+		if (!resp_len)
+			goto reauth_fatal;
+
+		eap_method_respond(eap, response, resp_len);
+		return;
+	}
+
+	if (aka->type == EAP_TYPE_AKA_PRIME)
+		r = eap_aka_prime_derive_reauth_keys(aka->k_re, aka->identity,
+						req.counter, req.nonce_s,
+						aka->msk, aka->emsk);
+	else
+		r = eap_sim_derive_reauth_keys(aka->mk, aka->identity,
+						req.counter, req.nonce_s,
+						aka->msk, aka->emsk);
+
+	if (!resp_len || !r) {
+		l_error("could not derive re-authentication keys");
+		eap_sim_reauth_request_clear(&req);
+		goto reauth_fatal;
+	}
+
+	aka->reauth = true;
+	aka->counter = req.counter;
+	memcpy(aka->nonce_s, req.nonce_s, EAP_SIM_NONCE_S_LEN);
+	memcpy(aka->reauth_mac, req.mac, EAP_SIM_MAC_LEN);
+
+	if (req.next_pseudonym)
+		sim_auth_set_pseudonym(aka->auth, eap_aka_method(aka),
+					req.next_pseudonym);
+
+	/* The keys of the full authentication are kept, reauth is replaced */
+	eap_aka_store_reauth(aka, req.next_reauth_id, req.counter);
+	eap_sim_reauth_request_clear(&req);
+
+	aka->state = EAP_AKA_STATE_CHALLENGE;
+
+	eap_method_respond(eap, response, resp_len);
+
+	if (!aka->protected) {
+		eap_aka_finish(eap);
+
+		aka->state = EAP_AKA_STATE_SUCCESS;
+	}
+
+	return;
+
+reauth_fatal:
+	eap_method_error(eap);
+	aka->state = EAP_AKA_STATE_ERROR;
+	return;
+
+reauth_error:
+	eap_sim_client_error(eap, aka->type, EAP_SIM_ERROR_PROCESS);
+}
+
 static void eap_aka_handle_request(struct eap_state *eap,
 					const uint8_t *pkt, size_t len)
 {
@@ -609,6 +916,10 @@ static void eap_aka_handle_request(struct eap_state *eap,
 		handle_notification(eap, pkt, len);
 		break;
 
+	case EAP_AKA_ST_REAUTHENTICATION:
+		handle_reauthentication(eap, pkt, len);
+		break;
+
 	default:
 		l_error("unknown EAP-SIM subtype: %u", pkt[0]);
 		goto req_error;
@@ -620,6 +931,25 @@ req_error:
 	eap_sim_client_error(eap, aka->type, EAP_SIM_ERROR_PROCESS);
 }
 
+static void eap_aka_handle_retransmit(struct eap_state *eap,
+					const uint8_t *pkt, size_t len)
+{
+	struct eap_aka_handle *aka = eap_get_data(eap);
+
+	/* The SIM is still working on it, the response will follow */
+	if (aka->chal_pkt)
+		return;
+
+	if (aka->last_resp && len == aka->last_chal_len &&
+			!memcmp(pkt, aka->last_chal, len)) {
+		l_debug("Challenge retransmitted, repeating the response");
+		eap_method_respond(eap, aka->last_resp, aka->last_resp_len);
+		return;
+	}
+
+	eap_aka_handle_request(eap, pkt, len);
+}
+
 static const char *eap_aka_get_identity(struct eap_state *eap)
 {
 	struct eap_aka_handle *aka = eap_get_data(eap);
@@ -673,14 +1003,6 @@ static bool eap_aka_common_load_settings(struct eap_state *eap,
 						const char *prefix)
 {
 	struct eap_aka_handle *aka = eap_get_data(eap);
-	/*
-	 * RFC 4187 Section 4.1.1.6
-	 * For AKA, the permanent username prefix is '0'
-	 *
-	 * RFC 5448 Section 3
-	 * For AKA', the permanent username prefix is '6'
-	 */
-	char id_prefix = (aka->type == EAP_TYPE_AKA) ? '0' : '6';
 
 	/*
 	 * No specific settings for EAP-SIM, the auth provider will have all
@@ -693,8 +1015,12 @@ static bool eap_aka_common_load_settings(struct eap_state *eap,
 
 	aka->auth_watch = sim_auth_unregistered_watch_add(aka->auth,
 			auth_destroyed, eap);
-	aka->identity = l_strdup_printf("%c%s", id_prefix,
-			iwd_sim_auth_get_nai(aka->auth));
+	/*
+	 * Offer the fast re-authentication identity or pseudonym if the
+	 * server handed one out, the permanent identity otherwise
+	 */
+	aka->identity = sim_auth_get_identity(aka->auth, eap_aka_method(aka),
+						SIM_AUTH_IDENTITY_ANY);
 
 	return true;
 }
@@ -733,10 +1059,16 @@ static bool eap_aka_reset_state(struct eap_state *eap)
 	aka->kdf_in = NULL;
 	l_free(aka->chal_pkt);
 	aka->chal_pkt = NULL;
+	eap_aka_forget_challenge(aka);
 
 	eap_aka_clear_secrets(aka);
 	memset(aka->autn, 0, sizeof(aka->autn));
 
+	aka->reauth = false;
+	aka->counter = 0;
+	memset(aka->nonce_s, 0, sizeof(aka->nonce_s));
+	memset(aka->reauth_mac, 0, sizeof(aka->reauth_mac));
+
 	return true;
 }
 
@@ -746,6 +1078,7 @@ static struct eap_method eap_aka = {
 	.name = "AKA",
 	.free = eap_aka_free,
 	.handle_request = eap_aka_handle_request,
+	.handle_retransmit = eap_aka_handle_retransmit,
 	.check_settings = eap_aka_check_settings,
 	.load_settings = eap_aka_load_settings,
 	.get_identity = eap_aka_get_identity,
@@ -758,6 +1091,7 @@ static struct eap_method eap_aka_prime = {
 	.name = "AKA'",
 	.free = eap_aka_free,
 	.handle_request = eap_aka_handle_request,
+	.handle_retransmit = eap_aka_handle_retransmit,
 	.check_settings = eap_aka_check_settings,
 	.load_settings = eap_aka_prime_load_settings,
 	.get_identity = eap_aka_get_identity,
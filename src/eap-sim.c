@@ -41,15 +41,12 @@
 /*
  * EAP-SIM authentication protocol.
  *
- * Open Items:
- *    - Fast Re-authentication. In order to implement this, the higher level
- *      EAP code would need to know/retrieve a fast re-authentication identity
- *      that it would send in the EAP-Start packet. This ID is provided by
- *      the server during the challenge in full authentication. EAP-SIM does
- *      save this ID, but there is no mechanism to provide it to the upper
- *      level EAP system. Once this is done the server will recognize the
- *      ID and send a SIM/Re-authentication request.
+ * Fast re-authentication state (MK, K_encr, K_aut and the counter) is kept
+ * by simauth along with the identity the server handed out for it.  That
+ * identity is offered as the EAP identity, so that a server recognizing it
+ * can skip the GSM round-trip and send a SIM/Re-authentication request.
  *
+ * Open Items:
  *    - Version validation. Perhaps a real SIM card will provide a version
  *      of EAP-SIM that it supports? Currently we accept any version the
  *      server provides.
@@ -64,6 +61,7 @@
 #define EAP_SIM_ST_START		0x0a
 #define EAP_SIM_ST_CHALLENGE		0x0b
 #define EAP_SIM_ST_NOTIFICATION		0x0c
+#define EAP_SIM_ST_REAUTHENTICATION	0x0d
 #define EAP_SIM_ST_CLIENT_ERROR		0x0e
 
 /* EAP-SIM value lengths */
@@ -114,12 +112,17 @@ struct eap_sim_handle {
 	/* Save RANDS from AT_RAND attribute for session ID derivation */
 	uint8_t rands[EAP_SIM_RAND_LEN * 3];
 
-	/* Flag set if AT_ANY_ID_REQ was present */
-	bool any_id_req : 1;
-
 	/* Flag to indicate protected status indications */
 	bool protected : 1;
 
+	/* Flag set if this is a fast re-authentication */
+	bool reauth : 1;
+
+	/* Fast re-authentication counter, NONCE_S and AT_MAC from server */
+	uint16_t counter;
+	uint8_t nonce_s[EAP_SIM_NONCE_S_LEN];
+	uint8_t reauth_mac[EAP_SIM_MAC_LEN];
+
 	uint8_t *chal_pkt;
 	uint32_t pkt_len;
 
@@ -152,6 +155,50 @@ static void eap_sim_free(struct eap_state *eap)
 	eap_set_data(eap, NULL);
 }
 
+/*
+ * Keep the keys of the last full authentication for fast re-authentication
+ * with reauth_id, or forget them if the server didn't hand out an identity
+ */
+static void eap_sim_store_reauth(struct eap_sim_handle *sim,
+					const char *reauth_id, uint16_t counter)
+{
+	struct sim_auth_reauth reauth = {
+		.id = (char *) reauth_id,
+		.counter = counter,
+		.key_len = EAP_SIM_MK_LEN,
+		.k_aut_len = EAP_SIM_K_AUT_LEN,
+	};
+
+	if (!reauth_id) {
+		sim_auth_set_reauth(sim->auth, SIM_AUTH_METHOD_SIM, NULL);
+		return;
+	}
+
+	memcpy(reauth.key, sim->mk, EAP_SIM_MK_LEN);
+	memcpy(reauth.k_encr, sim->k_encr, EAP_SIM_K_ENCR_LEN);
+	memcpy(reauth.k_aut, sim->k_aut, EAP_SIM_K_AUT_LEN);
+
+	sim_auth_set_reauth(sim->auth, SIM_AUTH_METHOD_SIM, &reauth);
+	explicit_bzero(&reauth, sizeof(reauth));
+}
+
+/* Remember the identities for the next authentication with this SIM */
+static void eap_sim_store_next_ids(struct eap_sim_handle *sim)
+{
+	_auto_(l_free) char *pseudonym = NULL;
+	_auto_(l_free) char *reauth_id = NULL;
+
+	if (!eap_sim_get_next_ids(sim->chal_pkt, sim->pkt_len, sim->k_encr,
+					&pseudonym, &reauth_id))
+		l_warn("Could not decrypt AT_ENCR_DATA");
+
+	if (pseudonym)
+		sim_auth_set_pseudonym(sim->auth, SIM_AUTH_METHOD_SIM,
+					pseudonym);
+
+	eap_sim_store_reauth(sim, reauth_id, 0);
+}
+
 /*
  * Derive the master key (MK):
  *  SHA1(identity | kc | nonce | version list | selected version)
@@ -202,6 +249,10 @@ static void handle_start(struct eap_state *eap, const uint8_t *pkt,
 {
 	struct eap_sim_handle *sim = eap_get_data(eap);
 	struct eap_sim_tlv_iter iter;
+	const struct sim_auth_reauth *reauth;
+	enum sim_auth_identity_type id_type = SIM_AUTH_IDENTITY_ANY;
+	bool id_req = false;
+	bool reauth_id;
 	uint16_t resp_len;
 	uint8_t *response;
 	uint8_t *pos;
@@ -211,7 +262,9 @@ static void handle_start(struct eap_state *eap, const uint8_t *pkt,
 		goto start_error;
 	}
 
-	if (sim->state != EAP_SIM_STATE_UNCONNECTED) {
+	/* RFC 4186 Section 4.2, the server may ask for another identity */
+	if (sim->state != EAP_SIM_STATE_UNCONNECTED &&
+			sim->state != EAP_SIM_STATE_START) {
 		l_error("invalid packet for EAP-SIM state");
 		goto start_error;
 	}
@@ -238,6 +291,7 @@ static void handle_start(struct eap_state *eap, const uint8_t *pkt,
 				goto start_error;
 			}
 
+			l_free(sim->vlist);
 			sim->vlist = l_memdup(contents + 2, sim->vlist_len);
 
 			sim->selected_version = sim->vlist[0];
@@ -245,15 +299,18 @@ static void handle_start(struct eap_state *eap, const uint8_t *pkt,
 			break;
 
 		case EAP_SIM_AT_ANY_ID_REQ:
-			sim->any_id_req = true;
+			id_type = SIM_AUTH_IDENTITY_ANY;
+			id_req = true;
+			break;
 
+		case EAP_SIM_AT_FULLAUTH_ID_REQ:
+			id_type = SIM_AUTH_IDENTITY_FULLAUTH;
+			id_req = true;
 			break;
 
 		case EAP_SIM_AT_PERMANENT_ID_REQ:
-		case EAP_SIM_AT_FULLAUTH_ID_REQ:
-			/*
-			 * TODO: Server requesting permanent ID/pseudonym
-			 */
+			id_type = SIM_AUTH_IDENTITY_PERMANENT;
+			id_req = true;
 			break;
 
 		default:
@@ -265,9 +322,29 @@ static void handle_start(struct eap_state *eap, const uint8_t *pkt,
 
 	sim->state = EAP_SIM_STATE_START;
 
-	/* header + AT_NONCE + AT_SELECTED_VERSION */
-	resp_len = (8) + (20) + (4);
-	if (sim->any_id_req) {
+	if (id_req) {
+		l_free(sim->identity);
+		sim->identity = sim_auth_get_identity(sim->auth,
+							SIM_AUTH_METHOD_SIM,
+							id_type);
+	}
+
+	reauth = sim_auth_get_reauth(sim->auth, SIM_AUTH_METHOD_SIM);
+	reauth_id = id_req && reauth && !strcmp(reauth->id, sim->identity);
+
+	/* header */
+	resp_len = 8;
+
+	/*
+	 * RFC 4186 Section 9.2, AT_NONCE_MT and AT_SELECTED_VERSION are left
+	 * out when answering with a fast re-authentication identity
+	 */
+	if (!reauth_id) {
+		/* + AT_NONCE + AT_SELECTED_VERSION */
+		resp_len += (20) + (4);
+	}
+
+	if (id_req) {
 		/* + AT_IDENTITY */
 		resp_len += EAP_SIM_ROUND(strlen(sim->identity) + 4);
 	}
@@ -279,13 +356,17 @@ static void handle_start(struct eap_state *eap, const uint8_t *pkt,
 
 	pos += eap_sim_build_header(eap, EAP_TYPE_SIM, EAP_SIM_ST_START, pos,
 			resp_len);
-	pos += eap_sim_add_attribute(pos, EAP_SIM_AT_NONCE, EAP_SIM_PAD_ZERO,
-			sim->nonce, EAP_SIM_NONCE_LEN);
-	pos += eap_sim_add_attribute(pos, EAP_SIM_AT_SELECTED_VERSION,
-			EAP_SIM_PAD_NONE, (uint8_t *)&sim->selected_version,
-			2);
 
-	if (sim->any_id_req)
+	if (!reauth_id) {
+		pos += eap_sim_add_attribute(pos, EAP_SIM_AT_NONCE,
+				EAP_SIM_PAD_ZERO, sim->nonce,
+				EAP_SIM_NONCE_LEN);
+		pos += eap_sim_add_attribute(pos, EAP_SIM_AT_SELECTED_VERSION,
+				EAP_SIM_PAD_NONE,
+				(uint8_t *)&sim->selected_version, 2);
+	}
+
+	if (id_req)
 		pos += eap_sim_add_attribute(pos, EAP_SIM_AT_IDENTITY,
 				EAP_SIM_PAD_LENGTH, (uint8_t *)sim->identity,
 				strlen(sim->identity));
@@ -302,16 +383,25 @@ static void eap_sim_finish(struct eap_state *eap)
 {
 	struct eap_sim_handle *sim = eap_get_data(eap);
 	uint8_t session_id[1 + sizeof(sim->rands) + EAP_SIM_NONCE_LEN];
+	size_t session_len = sizeof(session_id);
 
 	session_id[0] = EAP_TYPE_SIM;
 
-	memcpy(session_id + 1, sim->rands, sizeof(sim->rands));
-	memcpy(session_id + 1 + sizeof(sim->rands), sim->nonce,
-				EAP_SIM_NONCE_LEN);
+	if (sim->reauth) {
+		/* RFC 5247 Appendix A, Type-Code || NONCE_S || MAC */
+		memcpy(session_id + 1, sim->nonce_s, EAP_SIM_NONCE_S_LEN);
+		memcpy(session_id + 1 + EAP_SIM_NONCE_S_LEN, sim->reauth_mac,
+					EAP_SIM_MAC_LEN);
+		session_len = 1 + EAP_SIM_NONCE_S_LEN + EAP_SIM_MAC_LEN;
+	} else {
+		memcpy(session_id + 1, sim->rands, sizeof(sim->rands));
+		memcpy(session_id + 1 + sizeof(sim->rands), sim->nonce,
+					EAP_SIM_NONCE_LEN);
+	}
 
 	eap_method_success(eap);
 	eap_set_key_material(eap, sim->msk, 32, sim->emsk, 32, NULL, 0,
-					session_id, sizeof(session_id));
+					session_id, session_len);
 }
 
 static void gsm_callback(const uint8_t *sres, const uint8_t *kc,
@@ -358,12 +448,7 @@ static void gsm_callback(const uint8_t *sres, const uint8_t *kc,
 
 	sim->state = EAP_SIM_STATE_CHALLENGE;
 
-	/*
-	 * TODO: When/If fast re-authentication is supported, the AT_ENCR_DATA
-	 *       attribute would be decrypted here. Currently there is no need
-	 *       or reason to do this without support for fast
-	 *       re-authentication.
-	 */
+	eap_sim_store_next_ids(sim);
 
 	/* build response packet */
 	pos += eap_sim_build_header(eap, EAP_TYPE_SIM, EAP_SIM_ST_CHALLENGE,
@@ -540,9 +625,31 @@ static void handle_notification(struct eap_state *eap, const uint8_t *pkt,
 
 	if (value == EAP_SIM_SUCCESS && sim->protected &&
 			sim->state == EAP_SIM_STATE_CHALLENGE) {
-		/* header + MAC + MAC header */
-		uint8_t response[8 + EAP_SIM_MAC_LEN + 4];
+		uint8_t response[EAP_SIM_COUNTER_RESPONSE_LEN_MAX +
+						EAP_SIM_NONCE_S_LEN];
 		uint8_t *pos = response;
+		size_t resp_len;
+
+		/*
+		 * RFC 4186 Section 9.8, on fast re-authentication the
+		 * server must echo the counter of this exchange
+		 */
+		if (sim->reauth) {
+			uint16_t counter;
+
+			if (!eap_sim_verify_mac(eap, EAP_TYPE_SIM, pkt, len,
+							sim->k_aut, NULL, 0)) {
+				l_error("Notification MAC was invalid");
+				goto notif_error;
+			}
+
+			if (!eap_sim_get_encr_counter(pkt, len, sim->k_encr,
+							&counter) ||
+					counter != sim->counter) {
+				l_error("Notification counter doesn't match");
+				goto notif_error;
+			}
+		}
 
 		/*
 		 * Server sent successful result indication
@@ -550,22 +657,37 @@ static void handle_notification(struct eap_state *eap, const uint8_t *pkt,
 		eap_sim_finish(eap);
 
 		/*
-		 * Build response packet
+		 * Build response packet, RFC 4186 Section 9.9 requires the
+		 * counter on fast re-authentication
 		 */
-		pos += eap_sim_build_header(eap, EAP_TYPE_SIM,
-				EAP_SIM_ST_NOTIFICATION, pos, 20);
-		pos += eap_sim_add_attribute(pos, EAP_SIM_AT_MAC,
-				EAP_SIM_PAD_NONE, NULL, EAP_SIM_MAC_LEN);
+		if (sim->reauth) {
+			resp_len = eap_sim_build_counter_response(eap,
+					EAP_TYPE_SIM, EAP_SIM_ST_NOTIFICATION,
+					sim->counter, false, false,
+					sim->k_encr, sim->k_aut, NULL,
+					response);
+		} else {
+			/* header + MAC + MAC header */
+			pos += eap_sim_build_header(eap, EAP_TYPE_SIM,
+					EAP_SIM_ST_NOTIFICATION, pos, 20);
+			pos += eap_sim_add_attribute(pos, EAP_SIM_AT_MAC,
+					EAP_SIM_PAD_NONE, NULL,
+					EAP_SIM_MAC_LEN);
+			resp_len = pos - response;
+
+			if (!eap_sim_derive_mac(EAP_TYPE_SIM, response,
+					resp_len, sim->k_aut, response + 12))
+				resp_len = 0;
+		}
 
-		if (!eap_sim_derive_mac(EAP_TYPE_SIM, response, pos - response,
-				sim->k_aut, response + 12)) {
+		if (!resp_len) {
 			l_error("could not derive MAC");
 			eap_method_error(eap);
 			sim->state = EAP_SIM_STATE_ERROR;
 			return;
 		}
 
-		eap_method_respond(eap, response, pos - response);
+		eap_method_respond(eap, response, resp_len);
 
 		sim->state = EAP_SIM_STATE_SUCCESS;
 		return;
@@ -588,6 +710,120 @@ notif_error:
 	eap_sim_client_error(eap, EAP_TYPE_SIM, EAP_SIM_ERROR_PROCESS);
 }
 
+/*
+ * Handles EAP-SIM Re-authentication subtype
+ */
+static void handle_reauthentication(struct eap_state *eap,
+					const uint8_t *pkt, size_t len)
+{
+	struct eap_sim_handle *sim = eap_get_data(eap);
+	const struct sim_auth_reauth *reauth;
+	struct eap_sim_reauth_request req;
+	uint8_t response[EAP_SIM_COUNTER_RESPONSE_LEN_MAX +
+						EAP_SIM_NONCE_S_LEN];
+	size_t resp_len;
+	bool too_small;
+
+	if (sim->state != EAP_SIM_STATE_UNCONNECTED &&
+			sim->state != EAP_SIM_STATE_START) {
+		l_error("invalid packet for EAP-SIM state");
+		goto reauth_error;
+	}
+
+	reauth = sim_auth_get_reauth(sim->auth, SIM_AUTH_METHOD_SIM);
+	if (!reauth || strcmp(reauth->id, sim->identity)) {
+		l_error("no fast re-authentication state for %s",
+				sim->identity);
+		goto reauth_error;
+	}
+
+	memcpy(sim->mk, reauth->key, EAP_SIM_MK_LEN);
+	memcpy(sim->k_encr, reauth->k_encr, EAP_SIM_K_ENCR_LEN);
+	memcpy(sim->k_aut, reauth->k_aut, EAP_SIM_K_AUT_LEN);
+
+	if (!eap_sim_verify_mac(eap, EAP_TYPE_SIM, pkt, len, sim->k_aut,
+			NULL, 0)) {
+		l_error("server MAC was invalid");
+		goto reauth_error;
+	}
+
+	if (!eap_sim_parse_reauth_request(pkt, len, sim->k_encr, &req)) {
+		l_error("malformed Re-authentication request");
+		goto reauth_error;
+	}
+
+	/* RFC 4186 Section 5.5, the counter must be fresh */
+	too_small = req.counter <= reauth->counter;
+	sim->protected = req.result_ind && !too_small;
+
+	resp_len = eap_sim_build_counter_response(eap, EAP_TYPE_SIM,
+					EAP_SIM_ST_REAUTHENTICATION,
+					req.counter, too_small, sim->protected,
+					sim->k_encr, sim->k_aut, req.nonce_s,
+					response);
+
+	if (too_small) {
+		/*
+		 * The server falls back to a full authentication which
+		 * replaces the stored state.  Don't drop it here, a replayed
+		 * request would otherwise be enough to erase it.
+		 */
+		l_warn("re-authentication counter %u is not fresh",
+				req.counter);
+		eap_sim_reauth_request_clear(&req);
+
+		if (!resp_len)
+			goto reauth_fatal;
+
+		eap_method_respond(eap, response, resp_len);
+		return;
+	}
+
+	if (!resp_len || !eap_sim_derive_reauth_keys(sim->mk, sim->identity,
+						req.counter, req.nonce_s,
+						sim->msk, sim->emsk)) {
+		l_error("could not derive re-authentication keys");
+		eap_sim_reauth_request_clear(&req);
+		goto reauth_fatal;
+	}
+
+	sim->reauth = true;
+	sim->counter = req.counter;
+	memcpy(sim->nonce_s, req.nonce_s, EAP_SIM_NONCE_S_LEN);
+	memcpy(sim->reauth_mac, req.mac, EAP_SIM_MAC_LEN);
+
+	if (req.next_pseudonym)
+		sim_auth_set_pseudonym(sim->auth, SIM_AUTH_METHOD_SIM,
+					req.next_pseudonym);
+
+	/* The keys of the full authentication are kept, reauth is replaced */
+	eap_sim_store_reauth(sim, req.next_reauth_id, req.counter);
+	eap_sim_reauth_request_clear(&req);
+
+	sim->state = EAP_SIM_STATE_CHALLENGE;
+
+	eap_method_respond(eap, response, resp_len);
+
+	if (!sim->protected) {
+		/*
+		 * Result indication not required, we must accept success.
+		 */
+		eap_sim_finish(eap);
+
+		sim->state = EAP_SIM_STATE_SUCCESS;
+	}
+
+	return;
+
+reauth_fatal:
+	eap_method_error(eap);
+	sim->state = EAP_SIM_STATE_ERROR;
+	return;
+
+reauth_error:
+	eap_sim_client_error(eap, EAP_TYPE_SIM, EAP_SIM_ERROR_PROCESS);
+}
+
 static void eap_sim_handle_request(struct eap_state *eap,
 					const uint8_t *pkt, size_t len)
 {
@@ -606,6 +842,9 @@ static void eap_sim_handle_request(struct eap_state *eap,
 	case EAP_SIM_ST_NOTIFICATION:
 		handle_notification(eap, pkt, len);
 		break;
+	case EAP_SIM_ST_REAUTHENTICATION:
+		handle_reauthentication(eap, pkt, len);
+		break;
 	default:
 		l_error("unknown EAP-SIM subtype: %u", pkt[0]);
 		goto req_error;
@@ -679,6 +918,11 @@ static bool eap_sim_reset_state(struct eap_state *eap)
 	memset(sim->nonce, 0, sizeof(sim->nonce));
 	eap_sim_clear_secrets(sim);
 
+	sim->reauth = false;
+	sim->counter = 0;
+	memset(sim->nonce_s, 0, sizeof(sim->nonce_s));
+	memset(sim->reauth_mac, 0, sizeof(sim->reauth_mac));
+
 	return true;
 }
 
@@ -702,11 +946,11 @@ static bool eap_sim_load_settings(struct eap_state *eap,
 	sim->auth_watch = sim_auth_unregistered_watch_add(sim->auth,
 			auth_destroyed, eap);
 	/*
-	 * RFC 4186 Section 4.2.1.6
-	 * EAP-SIM identity prefix is '1'
+	 * Offer the fast re-authentication identity or pseudonym if the
+	 * server handed one out, the permanent identity otherwise
 	 */
-	sim->identity = l_strdup_printf("%c%s", '1',
-			iwd_sim_auth_get_nai(sim->auth));
+	sim->identity = sim_auth_get_identity(sim->auth, SIM_AUTH_METHOD_SIM,
+						SIM_AUTH_IDENTITY_ANY);
 
 	return true;
 }
@@ -26,6 +26,8 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
 #include <ell/ell.h>
 
 #include "ell/useful.h"
@@ -34,55 +36,8 @@
 #include "src/eap.h"
 #include "src/eap-private.h"
 #include "src/eap-tls-common.h"
-
-struct databuf {
-	uint8_t *data;
-	size_t len;
-	size_t capacity;
-};
-
-static struct databuf *databuf_new(size_t capacity)
-{
-	struct databuf *databuf;
-
-	if (!capacity)
-		return NULL;
-
-	databuf = l_new(struct databuf, 1);
-	databuf->data = l_malloc(capacity);
-	databuf->capacity = capacity;
-
-	return databuf;
-}
-
-static void databuf_append(struct databuf *databuf, const uint8_t *data,
-								size_t data_len)
-{
-	size_t new_len;
-
-	if (!databuf)
-		return;
-
-	new_len = databuf->len + data_len;
-
-	if (new_len > databuf->capacity) {
-		databuf->capacity = new_len * 2;
-		databuf->data = l_realloc(databuf->data, databuf->capacity);
-	}
-
-	memcpy(databuf->data + databuf->len, data, data_len);
-
-	databuf->len = new_len;
-}
-
-static void databuf_free(struct databuf *databuf)
-{
-	if (!databuf)
-		return;
-
-	l_free(databuf->data);
-	l_free(databuf);
-}
+#include "src/util.h"
+#include "src/crypto.h"
 
 #define EAP_TLS_PDU_MAX_LEN 65536
 
@@ -113,9 +68,12 @@ struct eap_tls_state {
 	size_t tx_frag_offset;
 	size_t tx_frag_last_len;
 
+	uint64_t handshake_start;
+
 	bool expecting_frag_ack:1;
 	bool tunnel_ready:1;
 	bool tls_session_resumed:1;
+	bool tls_session_cached:1;
 	bool tls_cache_disabled:1;
 
 	struct l_queue *ca_cert;
@@ -127,9 +85,68 @@ struct eap_tls_state {
 	void *variant_data;
 };
 
+/*
+ * The session cache is an l_settings object because that is what l_tls
+ * stores the session state in, one group per peer.  On top of it we keep
+ * an index of the cached peers in least recently used order to bound the
+ * cache size and to expire peers that haven't been seen for the session
+ * lifetime.  The last use is stored in the peer's group as wall clock
+ * time.  New, dropped and forgotten sessions are written back to storage
+ * right away, last use updates are written in batches since every write
+ * rewrites the whole file.
+ */
+#define EAP_TLS_SESSION_LIFETIME	(24 * 3600 * L_USEC_PER_SEC)
+#define EAP_TLS_SESSION_CACHE_MAX	64
+#define EAP_TLS_SESSION_SYNC_DELAY	10	/* Seconds */
+
+struct eap_tls_session_entry {
+	char *peer_id;
+	uint64_t expire_time;	/* Monotonic, last use + lifetime */
+};
+
 static struct l_settings *eap_tls_session_cache;
 static eap_tls_session_cache_load_func_t eap_tls_session_cache_load;
 static eap_tls_session_cache_sync_func_t eap_tls_session_cache_sync;
+static struct l_hashmap *eap_tls_session_index;
+static struct l_queue *eap_tls_session_lru;	/* Most recently used first */
+static struct l_timeout *eap_tls_session_sync_timeout;
+static bool eap_tls_session_cache_dirty;
+
+static struct {
+	unsigned int attempts;
+	unsigned int resumed;
+} eap_tls_session_stats;
+
+/*
+ * Daemon-wide cache of the certificates parsed from the CACert and
+ * ClientCert settings so that reconnecting and roaming don't re-read and
+ * re-parse the same, possibly large, CA bundles every time.  The settings
+ * checks use the cached objects directly.  l_tls takes ownership of the
+ * certificates it's given, and ell has no way to reference or duplicate
+ * them, so the connections get copies.
+ *
+ * File entries are keyed by path and revalidated against the file's
+ * inode, size and mtime on every lookup, embedded PEM values are keyed by
+ * their SHA256 so a changed value simply misses.  Encrypted containers are
+ * never cached since the passphrase has to be checked on every load.
+ */
+#define EAP_TLS_CERT_CACHE_MAX	32
+
+struct eap_tls_cert_cache_entry {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	struct l_queue *ca_certs;
+	struct l_certchain *chain;
+};
+
+static struct l_hashmap *eap_tls_cert_cache;
+
+static struct {
+	unsigned int hits;
+	unsigned int misses;
+} eap_tls_cert_cache_stats;
 
 static void __eap_tls_common_state_reset(struct eap_state *eap)
 {
@@ -186,6 +203,7 @@ static void __eap_tls_common_state_reset(struct eap_state *eap)
 	}
 
 	eap_tls->tls_session_resumed = false;
+	eap_tls->tls_session_cached = false;
 
 	eap_tls->tx_frag_offset = 0;
 	eap_tls->tx_frag_last_len = 0;
@@ -287,9 +305,24 @@ static void eap_tls_tunnel_ready(const char *peer_identity, void *user_data)
 	struct eap_state *eap = user_data;
 	struct eap_tls_state *eap_tls = eap_get_data(eap);
 
+	crypto_stat_record(CRYPTO_STAT_TLS_HANDSHAKE,
+				eap_tls->handshake_start);
+
 	eap_tls->tls_session_resumed =
 		l_tls_get_session_resumed(eap_tls->tunnel);
 
+	if (eap_tls->tls_session_cached) {
+		eap_tls_session_stats.attempts++;
+
+		if (eap_tls->tls_session_resumed)
+			eap_tls_session_stats.resumed++;
+
+		l_debug("TLS session resumed: %s, hit rate %u/%u",
+			eap_tls->tls_session_resumed ? "yes" : "no",
+			eap_tls_session_stats.resumed,
+			eap_tls_session_stats.attempts);
+	}
+
 	if (eap_tls->ca_cert && !peer_identity) {
 		l_error("%s: TLS did not verify AP identity",
 			eap_get_method_name(eap));
@@ -389,8 +422,8 @@ static void eap_tls_send_fragment(struct eap_state *eap)
 		header_len += 4;
 	}
 
-	memcpy(buf + header_len,
-		eap_tls->tx_pdu_buf->data + eap_tls->tx_frag_offset, len);
+	databuf_copy(eap_tls->tx_pdu_buf, eap_tls->tx_frag_offset,
+			buf + header_len, len);
 	eap_method_respond(eap, buf, header_len + len);
 
 	eap_tls->tx_frag_last_len = len;
@@ -415,9 +448,10 @@ static bool needs_workaround(struct eap_state *eap)
 }
 
 static void eap_tls_send_response(struct eap_state *eap,
-					const uint8_t *pdu, size_t pdu_len)
+					const struct databuf *pdu)
 {
 	struct eap_tls_state *eap_tls = eap_get_data(eap);
+	size_t pdu_len = pdu->len;
 	size_t msg_len = EAP_TLS_HEADER_LEN + pdu_len;
 	bool set_tls_msg_len = needs_workaround(eap);
 
@@ -446,7 +480,7 @@ static void eap_tls_send_response(struct eap_state *eap,
 			extra += 4;
 		}
 
-		memcpy(buf + EAP_TLS_HEADER_LEN + extra, pdu, pdu_len);
+		databuf_copy(pdu, 0, buf + EAP_TLS_HEADER_LEN + extra, pdu_len);
 
 		eap_method_respond(eap, buf, msg_len);
 		l_free(buf);
@@ -622,8 +656,24 @@ static int eap_tls_handle_fragmented_request(struct eap_state *eap,
 	return r;
 }
 
-static void eap_tls_session_cache_update(void *user_data)
+static void eap_tls_session_entry_free(void *data)
+{
+	struct eap_tls_session_entry *entry = data;
+
+	l_free(entry->peer_id);
+	l_free(entry);
+}
+
+static void eap_tls_session_cache_sync_now(void)
 {
+	l_timeout_remove(eap_tls_session_sync_timeout);
+	eap_tls_session_sync_timeout = NULL;
+
+	if (!eap_tls_session_cache_dirty)
+		return;
+
+	eap_tls_session_cache_dirty = false;
+
 	if (L_WARN_ON(!eap_tls_session_cache_sync) ||
 			L_WARN_ON(!eap_tls_session_cache))
 		return;
@@ -631,6 +681,187 @@ static void eap_tls_session_cache_update(void *user_data)
 	eap_tls_session_cache_sync(eap_tls_session_cache);
 }
 
+static void eap_tls_session_sync_timeout_cb(struct l_timeout *timeout,
+						void *user_data)
+{
+	eap_tls_session_cache_sync_now();
+}
+
+/*
+ * Don't extend the delay on further changes so that a steady stream of
+ * updates still gets written out every EAP_TLS_SESSION_SYNC_DELAY seconds.
+ */
+static void eap_tls_session_cache_schedule_sync(void)
+{
+	eap_tls_session_cache_dirty = true;
+
+	if (eap_tls_session_sync_timeout)
+		return;
+
+	eap_tls_session_sync_timeout =
+		l_timeout_create(EAP_TLS_SESSION_SYNC_DELAY,
+					eap_tls_session_sync_timeout_cb,
+					NULL, NULL);
+}
+
+static void eap_tls_session_remove(struct eap_tls_session_entry *entry)
+{
+	l_hashmap_remove(eap_tls_session_index, entry->peer_id);
+	l_queue_remove(eap_tls_session_lru, entry);
+	l_settings_remove_group(eap_tls_session_cache, entry->peer_id);
+	eap_tls_session_entry_free(entry);
+}
+
+static void eap_tls_session_touch(const char *peer_id)
+{
+	struct eap_tls_session_entry *entry;
+
+	entry = l_hashmap_lookup(eap_tls_session_index, peer_id);
+	if (entry)
+		l_queue_remove(eap_tls_session_lru, entry);
+	else {
+		entry = l_new(struct eap_tls_session_entry, 1);
+		entry->peer_id = l_strdup(peer_id);
+		l_hashmap_insert(eap_tls_session_index, peer_id, entry);
+	}
+
+	entry->expire_time = l_time_now() + EAP_TLS_SESSION_LIFETIME;
+	l_queue_push_head(eap_tls_session_lru, entry);
+
+	l_settings_set_uint64(eap_tls_session_cache, peer_id, "LastUsed",
+				(uint64_t) time(NULL));
+}
+
+/*
+ * Drop the least recently used peers over the limit or past the lifetime,
+ * returns whether any were dropped.
+ */
+static bool eap_tls_session_cache_trim(void)
+{
+	uint64_t now = l_time_now();
+	struct eap_tls_session_entry *entry;
+	bool removed = false;
+
+	while ((entry = l_queue_peek_tail(eap_tls_session_lru))) {
+		if (l_queue_length(eap_tls_session_lru) <=
+					EAP_TLS_SESSION_CACHE_MAX &&
+				l_time_before(now, entry->expire_time))
+			break;
+
+		eap_tls_session_remove(entry);
+		removed = true;
+	}
+
+	return removed;
+}
+
+static int eap_tls_session_entry_compare(const void *a, const void *b,
+						void *user_data)
+{
+	const struct eap_tls_session_entry *new_entry = a;
+	const struct eap_tls_session_entry *entry = b;
+
+	return l_time_after(new_entry->expire_time, entry->expire_time) ?
+									-1 : 1;
+}
+
+static void eap_tls_session_cache_ensure(void)
+{
+	uint64_t now;
+	uint64_t wall_now;
+	char **groups;
+	unsigned int i;
+	bool removed = false;
+
+	if (eap_tls_session_cache)
+		return;
+
+	eap_tls_session_cache = eap_tls_session_cache_load();
+	eap_tls_session_index = l_hashmap_string_new();
+	eap_tls_session_lru = l_queue_new();
+
+	/*
+	 * Convert the stored wall clock last use to a monotonic expiry time.
+	 * Peers stored without one are treated as just used and l_tls drops
+	 * their sessions if they have expired in the meantime.
+	 */
+	now = l_time_now();
+	wall_now = time(NULL);
+	groups = l_settings_get_groups(eap_tls_session_cache);
+
+	for (i = 0; groups && groups[i]; i++) {
+		struct eap_tls_session_entry *entry;
+		uint64_t last_used;
+		uint64_t age = 0;
+
+		if (l_settings_get_uint64(eap_tls_session_cache, groups[i],
+						"LastUsed", &last_used) &&
+				last_used < wall_now)
+			age = (wall_now - last_used) * L_USEC_PER_SEC;
+
+		if (age >= EAP_TLS_SESSION_LIFETIME) {
+			l_settings_remove_group(eap_tls_session_cache,
+						groups[i]);
+			removed = true;
+			continue;
+		}
+
+		entry = l_new(struct eap_tls_session_entry, 1);
+		entry->peer_id = l_strdup(groups[i]);
+		entry->expire_time = now + EAP_TLS_SESSION_LIFETIME - age;
+		l_hashmap_insert(eap_tls_session_index, groups[i], entry);
+		l_queue_insert(eap_tls_session_lru, entry,
+				eap_tls_session_entry_compare, NULL);
+	}
+
+	l_strfreev(groups);
+
+	if (eap_tls_session_cache_trim() || removed) {
+		eap_tls_session_cache_dirty = true;
+		eap_tls_session_cache_sync_now();
+	}
+}
+
+bool __eap_tls_session_cache_lookup(const char *peer_id)
+{
+	eap_tls_session_cache_ensure();
+
+	if (!peer_id || !l_hashmap_lookup(eap_tls_session_index, peer_id))
+		return false;
+
+	eap_tls_session_touch(peer_id);
+	eap_tls_session_cache_schedule_sync();
+	return true;
+}
+
+void __eap_tls_session_cache_update(const char *peer_id)
+{
+	if (L_WARN_ON(!eap_tls_session_cache) || L_WARN_ON(!peer_id))
+		return;
+
+	/* l_tls may have either stored or dropped this peer's session */
+	if (l_settings_has_group(eap_tls_session_cache, peer_id))
+		eap_tls_session_touch(peer_id);
+	else {
+		struct eap_tls_session_entry *entry =
+			l_hashmap_lookup(eap_tls_session_index, peer_id);
+
+		if (entry)
+			eap_tls_session_remove(entry);
+	}
+
+	eap_tls_session_cache_trim();
+	eap_tls_session_cache_dirty = true;
+	eap_tls_session_cache_sync_now();
+}
+
+static void eap_tls_session_cache_update(void *user_data)
+{
+	struct eap_state *eap = user_data;
+
+	__eap_tls_session_cache_update(eap_get_peer_id(eap));
+}
+
 static bool eap_tls_tunnel_init(struct eap_state *eap)
 {
 	struct eap_tls_state *eap_tls = eap_get_data(eap);
@@ -696,15 +927,17 @@ static bool eap_tls_tunnel_init(struct eap_state *eap)
 	if (!eap_tls_session_cache_load || eap_tls->tls_cache_disabled)
 		goto start;
 
-	if (!eap_tls_session_cache)
-		eap_tls_session_cache = eap_tls_session_cache_load();
+	if (__eap_tls_session_cache_lookup(eap_get_peer_id(eap)))
+		eap_tls->tls_session_cached = true;
 
 	l_tls_set_session_cache(eap_tls->tunnel, eap_tls_session_cache,
 				eap_get_peer_id(eap),
-				24 * 3600 * L_USEC_PER_SEC, 0,
-				eap_tls_session_cache_update, NULL);
+				EAP_TLS_SESSION_LIFETIME, 0,
+				eap_tls_session_cache_update, eap);
 
 start:
+	eap_tls->handshake_start = l_time_now();
+
 	if (!l_tls_start(eap_tls->tunnel)) {
 		l_error("%s: Failed to start the TLS client",
 						eap_get_method_name(eap));
@@ -797,7 +1030,8 @@ void eap_tls_common_handle_request(struct eap_state *eap,
 			goto error;
 		}
 
-		pkt = eap_tls->rx_pdu_buf->data;
+		/* Sized for the whole message up front, so never copied */
+		pkt = databuf_flatten(eap_tls->rx_pdu_buf);
 		len = eap_tls->rx_pdu_buf->len;
 	}
 
@@ -825,8 +1059,9 @@ proceed:
 		 * has been established and Phase 2 payload was transmitted
 		 * through it.
 		 */
-		eap_tls_handle_phase2_payload(eap, eap_tls->plain_buf->data,
-						eap_tls->plain_buf->len);
+		eap_tls_handle_phase2_payload(eap,
+					databuf_flatten(eap_tls->plain_buf),
+					eap_tls->plain_buf->len);
 
 		databuf_free(eap_tls->plain_buf);
 		eap_tls->plain_buf = NULL;
@@ -844,8 +1079,7 @@ proceed:
 		return;
 	}
 
-	eap_tls_send_response(eap, eap_tls->tx_pdu_buf->data,
-						eap_tls->tx_pdu_buf->len);
+	eap_tls_send_response(eap, eap_tls->tx_pdu_buf);
 
 	if (eap_tls->phase2_failed)
 		goto error;
@@ -885,15 +1119,13 @@ void eap_tls_common_handle_retransmit(struct eap_state *eap,
 		return;
 	}
 
-	if (!eap_tls->tx_pdu_buf || !eap_tls->tx_pdu_buf->data ||
-						!eap_tls->tx_pdu_buf->len)
+	if (!eap_tls->tx_pdu_buf || !eap_tls->tx_pdu_buf->len)
 		goto error;
 
 	if (EAP_TLS_HEADER_LEN + eap_tls->tx_pdu_buf->len > eap_get_mtu(eap))
 		eap_tls_send_fragment(eap);
 	else
-		eap_tls_send_response(eap, eap_tls->tx_pdu_buf->data,
-						eap_tls->tx_pdu_buf->len);
+		eap_tls_send_response(eap, eap_tls->tx_pdu_buf);
 
 	return;
 
@@ -931,19 +1163,209 @@ static bool is_embedded(const char *str)
 	return false;
 }
 
-static struct l_queue *eap_tls_load_ca_cert(struct l_settings *settings,
-						const char *value)
+static void eap_tls_cert_cache_entry_free(void *data)
 {
-	const char *pem;
+	struct eap_tls_cert_cache_entry *entry = data;
 
-	if (!is_embedded(value))
-		return l_pem_load_certificate_list(value);
+	l_queue_destroy(entry->ca_certs, (l_queue_destroy_func_t) l_cert_free);
+	l_certchain_free(entry->chain);
+	l_free(entry);
+}
 
-	pem = load_embedded_pem(settings, value);
-	if (!pem)
+/*
+ * Builds the cache key for a setting value, either a file path or the
+ * embedded PEM data, and fills in @st for files.  Returns NULL if the file
+ * can't be stat'ed, in which case the loader reports the error.
+ */
+static char *eap_tls_cert_cache_key(const char *kind, const char *path,
+					const char *pem, struct stat *st)
+{
+	struct l_checksum *sha;
+	_auto_(l_free) char *digest = NULL;
+
+	if (!pem) {
+		if (stat(path, st) < 0)
+			return NULL;
+
+		return l_strdup_printf("%s:file:%s", kind, path);
+	}
+
+	sha = l_checksum_new(L_CHECKSUM_SHA256);
+	if (!sha)
 		return NULL;
 
-	return l_pem_load_certificate_list_from_data(pem, strlen(pem));
+	l_checksum_update(sha, pem, strlen(pem));
+	digest = l_checksum_get_string(sha);
+	l_checksum_free(sha);
+
+	return l_strdup_printf("%s:embed:%s", kind, digest);
+}
+
+static struct eap_tls_cert_cache_entry *eap_tls_cert_cache_lookup(
+					const char *key, const struct stat *st)
+{
+	struct eap_tls_cert_cache_entry *entry;
+
+	entry = l_hashmap_lookup(eap_tls_cert_cache, key);
+	if (!entry)
+		goto miss;
+
+	if (!st || (entry->dev == st->st_dev && entry->ino == st->st_ino &&
+			entry->size == st->st_size &&
+			entry->mtime.tv_sec == st->st_mtim.tv_sec &&
+			entry->mtime.tv_nsec == st->st_mtim.tv_nsec)) {
+		eap_tls_cert_cache_stats.hits++;
+		return entry;
+	}
+
+	/* Stale, the file has been replaced or modified */
+	l_hashmap_remove(eap_tls_cert_cache, key);
+	eap_tls_cert_cache_entry_free(entry);
+
+miss:
+	eap_tls_cert_cache_stats.misses++;
+	return NULL;
+}
+
+static struct eap_tls_cert_cache_entry *eap_tls_cert_cache_add(
+					const char *key, const struct stat *st)
+{
+	struct eap_tls_cert_cache_entry *entry;
+
+	/* Every entry is cheap to recreate, no need for anything smarter */
+	if (l_hashmap_size(eap_tls_cert_cache) >= EAP_TLS_CERT_CACHE_MAX)
+		eap_tls_cert_cache_flush();
+
+	if (!eap_tls_cert_cache)
+		eap_tls_cert_cache = l_hashmap_string_new();
+
+	entry = l_new(struct eap_tls_cert_cache_entry, 1);
+
+	if (st) {
+		entry->dev = st->st_dev;
+		entry->ino = st->st_ino;
+		entry->size = st->st_size;
+		entry->mtime = st->st_mtim;
+	}
+
+	l_hashmap_insert(eap_tls_cert_cache, key, entry);
+	return entry;
+}
+
+static struct l_queue *eap_tls_cert_list_copy(struct l_queue *certs)
+{
+	struct l_queue *copy = l_queue_new();
+	const struct l_queue_entry *e;
+
+	for (e = l_queue_get_entries(certs); e; e = e->next) {
+		const uint8_t *der;
+		size_t der_len;
+		struct l_cert *cert;
+
+		der = l_cert_get_der_data(e->data, &der_len);
+		cert = l_cert_new_from_der(der, der_len);
+		if (!cert) {
+			l_queue_destroy(copy,
+					(l_queue_destroy_func_t) l_cert_free);
+			return NULL;
+		}
+
+		l_queue_push_tail(copy, cert);
+	}
+
+	return copy;
+}
+
+static bool eap_tls_cert_append_pem(struct l_cert *cert, void *user_data)
+{
+	struct l_string *pem = user_data;
+	const uint8_t *der;
+	size_t der_len;
+	_auto_(l_free) char *base64 = NULL;
+
+	der = l_cert_get_der_data(cert, &der_len);
+	base64 = l_base64_encode(der, der_len, 64);
+
+	l_string_append(pem, "-----BEGIN CERTIFICATE-----\n");
+	l_string_append(pem, base64);
+	l_string_append(pem, "\n-----END CERTIFICATE-----\n");
+
+	return false;
+}
+
+/*
+ * The PEM loader is the only way ell gives us to build a new chain, this
+ * only goes through the client's own few certificates.
+ */
+static struct l_certchain *eap_tls_certchain_copy(struct l_certchain *chain)
+{
+	struct l_string *pem = l_string_new(2048);
+	_auto_(l_free) char *data = NULL;
+
+	l_certchain_walk_from_leaf(chain, eap_tls_cert_append_pem, pem);
+	data = l_string_unwrap(pem);
+
+	return l_pem_load_certificate_chain_from_data(data, strlen(data));
+}
+
+/*
+ * Returns the CA certificate list for @value, either owned by the cache
+ * or, if it can't be cached, a new one in @out_uncached.
+ */
+static struct l_queue *eap_tls_cert_cache_get_ca(struct l_settings *settings,
+						const char *value,
+						struct l_queue **out_uncached)
+{
+	const char *pem = NULL;
+	struct stat st;
+	_auto_(l_free) char *key = NULL;
+	struct eap_tls_cert_cache_entry *entry;
+	struct l_queue *certs;
+
+	*out_uncached = NULL;
+
+	if (is_embedded(value)) {
+		pem = load_embedded_pem(settings, value);
+		if (!pem)
+			return NULL;
+	}
+
+	key = eap_tls_cert_cache_key("ca", value, pem, &st);
+
+	if (key) {
+		entry = eap_tls_cert_cache_lookup(key, pem ? NULL : &st);
+		if (entry)
+			return entry->ca_certs;
+	}
+
+	if (pem)
+		certs = l_pem_load_certificate_list_from_data(pem,
+								strlen(pem));
+	else
+		certs = l_pem_load_certificate_list(value);
+
+	if (!certs || !key) {
+		*out_uncached = certs;
+		return certs;
+	}
+
+	entry = eap_tls_cert_cache_add(key, pem ? NULL : &st);
+	entry->ca_certs = certs;
+
+	return certs;
+}
+
+static struct l_queue *eap_tls_load_ca_cert(struct l_settings *settings,
+						const char *value)
+{
+	struct l_queue *uncached;
+	struct l_queue *certs = eap_tls_cert_cache_get_ca(settings, value,
+								&uncached);
+
+	if (!certs || uncached)
+		return certs;
+
+	return eap_tls_cert_list_copy(certs);
 }
 
 struct l_certchain *eap_tls_load_client_cert(struct l_settings *settings,
@@ -951,27 +1373,48 @@ struct l_certchain *eap_tls_load_client_cert(struct l_settings *settings,
 						const char *passphrase,
 						bool *out_is_encrypted)
 {
-	const char *pem;
-
-	if (!is_embedded(value)) {
-		struct l_certchain *certchain;
+	const char *pem = NULL;
+	struct stat st;
+	_auto_(l_free) char *key = NULL;
+	struct eap_tls_cert_cache_entry *entry;
+	struct l_certchain *certchain;
+	bool is_encrypted = false;
+
+	if (is_embedded(value)) {
+		pem = load_embedded_pem(settings, value);
+		if (!pem)
+			return NULL;
+	}
 
-		if (l_cert_load_container_file(value, passphrase,
-						&certchain, NULL,
-						out_is_encrypted))
-			return certchain;
+	if (out_is_encrypted)
+		*out_is_encrypted = false;
 
-		if (out_is_encrypted)
-			*out_is_encrypted = false;
+	key = eap_tls_cert_cache_key("chain", value, pem, &st);
 
-		return NULL;
+	if (key) {
+		entry = eap_tls_cert_cache_lookup(key, pem ? NULL : &st);
+		if (entry)
+			return eap_tls_certchain_copy(entry->chain);
 	}
 
-	pem = load_embedded_pem(settings, value);
-	if (!pem)
+	if (pem)
+		certchain = l_pem_load_certificate_chain_from_data(pem,
+								strlen(pem));
+	else if (!l_cert_load_container_file(value, passphrase,
+						&certchain, NULL,
+						&is_encrypted))
 		return NULL;
 
-	return l_pem_load_certificate_chain_from_data(pem, strlen(pem));
+	if (out_is_encrypted)
+		*out_is_encrypted = is_encrypted;
+
+	if (!certchain || !key || is_encrypted)
+		return certchain;
+
+	entry = eap_tls_cert_cache_add(key, pem ? NULL : &st);
+	entry->chain = certchain;
+
+	return eap_tls_certchain_copy(certchain);
 }
 
 struct l_key *eap_tls_load_priv_key(struct l_settings *settings,
@@ -1015,14 +1458,14 @@ int eap_tls_common_settings_check(struct l_settings *settings,
 	snprintf(setting_key, sizeof(setting_key), "%sCACert", prefix);
 	value = l_settings_get_string(settings, "Security", setting_key);
 	if (value) {
-		struct l_queue *cacerts = eap_tls_load_ca_cert(settings, value);
+		struct l_queue *uncached;
 
-		if (!cacerts) {
+		if (!eap_tls_cert_cache_get_ca(settings, value, &uncached)) {
 			l_error("Failed to load %s", value);
 			return -EIO;
 		}
 
-		l_queue_destroy(cacerts,
+		l_queue_destroy(uncached,
 				(l_queue_destroy_func_t) l_cert_free);
 		have_cacerts = true;
 	}
@@ -1183,16 +1626,37 @@ void eap_tls_set_session_cache_ops(eap_tls_session_cache_load_func_t load,
 	eap_tls_session_cache_sync = sync;
 }
 
+void __eap_tls_cert_cache_get_stats(unsigned int *hits,
+					unsigned int *misses)
+{
+	*hits = eap_tls_cert_cache_stats.hits;
+	*misses = eap_tls_cert_cache_stats.misses;
+}
+
+void eap_tls_cert_cache_flush(void)
+{
+	l_hashmap_destroy(eap_tls_cert_cache, eap_tls_cert_cache_entry_free);
+	eap_tls_cert_cache = NULL;
+}
+
 void eap_tls_forget_peer(const char *peer_id)
 {
+	struct eap_tls_session_entry *entry;
+
 	if (L_WARN_ON(!eap_tls_session_cache_sync))
 		return;
 
-	if (!eap_tls_session_cache)
-		eap_tls_session_cache = eap_tls_session_cache_load();
+	eap_tls_session_cache_ensure();
 
-	if (l_settings_remove_group(eap_tls_session_cache, peer_id))
-		eap_tls_session_cache_sync(eap_tls_session_cache);
+	entry = l_hashmap_lookup(eap_tls_session_index, peer_id);
+	if (entry)
+		eap_tls_session_remove(entry);
+	else if (!l_settings_remove_group(eap_tls_session_cache, peer_id))
+		return;
+
+	/* Don't leave a session that failed around for the next attempt */
+	eap_tls_session_cache_dirty = true;
+	eap_tls_session_cache_sync_now();
 }
 
 static int eap_tls_common_init(void)
@@ -1202,8 +1666,27 @@ static int eap_tls_common_init(void)
 
 static void eap_tls_common_exit(void)
 {
+	eap_tls_session_cache_sync_now();
+
+	if (eap_tls_session_stats.attempts)
+		l_debug("TLS session cache hit rate %u/%u",
+			eap_tls_session_stats.resumed,
+			eap_tls_session_stats.attempts);
+
+	if (eap_tls_cert_cache_stats.hits || eap_tls_cert_cache_stats.misses)
+		l_debug("Certificate cache hits %u, misses %u",
+			eap_tls_cert_cache_stats.hits,
+			eap_tls_cert_cache_stats.misses);
+
+	l_queue_destroy(eap_tls_session_lru, eap_tls_session_entry_free);
+	eap_tls_session_lru = NULL;
+	l_hashmap_destroy(eap_tls_session_index, NULL);
+	eap_tls_session_index = NULL;
+
 	l_settings_free(eap_tls_session_cache);
 	eap_tls_session_cache = NULL;
+
+	eap_tls_cert_cache_flush();
 }
 
 IWD_MODULE(eap_tls_common, eap_tls_common_init, eap_tls_common_exit);
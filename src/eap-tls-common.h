@@ -89,3 +89,8 @@ void eap_tls_common_tunnel_close(struct eap_state *eap);
 void eap_tls_set_session_cache_ops(eap_tls_session_cache_load_func_t load,
 					eap_tls_session_cache_sync_func_t sync);
 void eap_tls_forget_peer(const char *peer_id);
+bool __eap_tls_session_cache_lookup(const char *peer_id);
+void __eap_tls_session_cache_update(const char *peer_id);
+void eap_tls_cert_cache_flush(void);
+void __eap_tls_cert_cache_get_stats(unsigned int *hits,
+					unsigned int *misses);
@@ -133,83 +133,90 @@ bool eapol_calculate_mic(enum ie_rsn_akm_suite akm, const uint8_t *kck,
 	}
 }
 
-bool eapol_verify_mic(enum ie_rsn_akm_suite akm, const uint8_t *kck,
-			const struct eapol_key *frame, size_t mic_len)
+/*
+ * Returns a checksum keyed with @kck for the MIC algorithm selected by the
+ * key descriptor version, and the AKM for AKM-defined descriptors.  It can
+ * be reused for every frame protected with the same KCK.
+ */
+struct l_checksum *eapol_mic_checksum_new(enum ie_rsn_akm_suite akm,
+						const uint8_t *kck,
+						uint8_t key_descriptor_version,
+						size_t mic_len)
 {
-	uint8_t mic[MIC_MAXLEN];
-	struct iovec iov[3];
-	struct l_checksum *checksum = NULL;
-
-	iov[0].iov_base = (void *) frame;
-	iov[0].iov_len = offsetof(struct eapol_key, key_data);
-
-	memset(mic, 0, sizeof(mic));
-	iov[1].iov_base = mic;
-	iov[1].iov_len = mic_len;
-
-	iov[2].iov_base = (void *) EAPOL_KEY_DATA(frame, mic_len) - 2;
-	iov[2].iov_len = EAPOL_KEY_DATA_LEN(frame, mic_len) + 2;
-
-	switch (frame->key_descriptor_version) {
+	switch (key_descriptor_version) {
 	case EAPOL_KEY_DESCRIPTOR_VERSION_HMAC_MD5_ARC4:
-		checksum = l_checksum_new_hmac(L_CHECKSUM_MD5, kck, 16);
-		break;
+		return l_checksum_new_hmac(L_CHECKSUM_MD5, kck, 16);
 	case EAPOL_KEY_DESCRIPTOR_VERSION_HMAC_SHA1_AES:
-		checksum = l_checksum_new_hmac(L_CHECKSUM_SHA1, kck, 16);
-		break;
+		return l_checksum_new_hmac(L_CHECKSUM_SHA1, kck, 16);
 	case EAPOL_KEY_DESCRIPTOR_VERSION_AES_128_CMAC_AES:
-		checksum = l_checksum_new_cmac_aes(kck, 16);
-		break;
+		return l_checksum_new_cmac_aes(kck, 16);
 	case EAPOL_KEY_DESCRIPTOR_VERSION_AKM_DEFINED:
 		switch (akm) {
 		case IE_RSN_AKM_SUITE_SAE_SHA256:
 		case IE_RSN_AKM_SUITE_FT_OVER_SAE_SHA256:
 		case IE_RSN_AKM_SUITE_OSEN:
-			checksum = l_checksum_new_cmac_aes(kck, 16);
-			break;
+			return l_checksum_new_cmac_aes(kck, 16);
 		case IE_RSN_AKM_SUITE_FT_OVER_8021X_SHA384:
-			checksum = l_checksum_new_hmac(L_CHECKSUM_SHA384,
-							kck, 24);
-			break;
+			return l_checksum_new_hmac(L_CHECKSUM_SHA384, kck, 24);
 		case IE_RSN_AKM_SUITE_OWE:
 			switch (mic_len) {
 			case 16:
-				checksum = l_checksum_new_hmac(
-							L_CHECKSUM_SHA256,
-							kck, 16);
-				break;
+				return l_checksum_new_hmac(L_CHECKSUM_SHA256,
+								kck, 16);
 			case 24:
-				checksum = l_checksum_new_hmac(
-							L_CHECKSUM_SHA384,
-							kck, 24);
-				break;
+				return l_checksum_new_hmac(L_CHECKSUM_SHA384,
+								kck, 24);
 			case 32:
-				checksum = l_checksum_new_hmac(
-							L_CHECKSUM_SHA512,
-							kck, 32);
-				break;
+				return l_checksum_new_hmac(L_CHECKSUM_SHA512,
+								kck, 32);
 			default:
 				l_error("Invalid MIC length of %zu for OWE",
 						mic_len);
-				return false;
+				return NULL;
 			}
-
-			break;
 		default:
-			return false;
+			return NULL;
 		}
-
-		break;
 	default:
-		return false;
+		return NULL;
 	}
+}
 
-	if (checksum == NULL)
-		return false;
+bool eapol_calculate_mic_checksum(struct l_checksum *checksum,
+					const struct eapol_key *frame,
+					uint8_t *mic, size_t mic_len)
+{
+	size_t frame_len = EAPOL_FRAME_LEN(mic_len) +
+					EAPOL_KEY_DATA_LEN(frame, mic_len);
+	bool r;
+
+	r = l_checksum_update(checksum, frame, frame_len) &&
+		l_checksum_get_digest(checksum, mic, mic_len) ==
+							(ssize_t) mic_len;
+	l_checksum_reset(checksum);
+
+	return r;
+}
+
+bool eapol_verify_mic_checksum(struct l_checksum *checksum,
+				const struct eapol_key *frame, size_t mic_len)
+{
+	uint8_t mic[MIC_MAXLEN];
+	struct iovec iov[3];
+
+	iov[0].iov_base = (void *) frame;
+	iov[0].iov_len = offsetof(struct eapol_key, key_data);
+
+	memset(mic, 0, sizeof(mic));
+	iov[1].iov_base = mic;
+	iov[1].iov_len = mic_len;
+
+	iov[2].iov_base = (void *) EAPOL_KEY_DATA(frame, mic_len) - 2;
+	iov[2].iov_len = EAPOL_KEY_DATA_LEN(frame, mic_len) + 2;
 
 	l_checksum_updatev(checksum, iov, 3);
 	l_checksum_get_digest(checksum, mic, mic_len);
-	l_checksum_free(checksum);
+	l_checksum_reset(checksum);
 
 	if (!memcmp(frame->key_data, mic, mic_len))
 		return true;
@@ -217,6 +224,24 @@ bool eapol_verify_mic(enum ie_rsn_akm_suite akm, const uint8_t *kck,
 	return false;
 }
 
+bool eapol_verify_mic(enum ie_rsn_akm_suite akm, const uint8_t *kck,
+			const struct eapol_key *frame, size_t mic_len)
+{
+	struct l_checksum *checksum;
+	bool r;
+
+	checksum = eapol_mic_checksum_new(akm, kck,
+					frame->key_descriptor_version,
+					mic_len);
+	if (!checksum)
+		return false;
+
+	r = eapol_verify_mic_checksum(checksum, frame, mic_len);
+	l_checksum_free(checksum);
+
+	return r;
+}
+
 /*
  * IEEE 802.11 Table 12-8 -- Integrity and key-wrap algorithms
  */
@@ -248,15 +273,12 @@ static size_t eapol_get_mic_length(enum ie_rsn_akm_suite akm, size_t pmk_len)
 	}
 }
 
-uint8_t *eapol_decrypt_key_data(enum ie_rsn_akm_suite akm, const uint8_t *kek,
-				const struct eapol_key *frame,
-				size_t *decrypted_size, size_t mic_len)
+static ssize_t eapol_decrypted_key_data_len(enum ie_rsn_akm_suite akm,
+						const struct eapol_key *frame,
+						size_t mic_len)
 {
 	size_t key_data_len = EAPOL_KEY_DATA_LEN(frame, mic_len);
-	const uint8_t *key_data = EAPOL_KEY_DATA(frame, mic_len);
 	size_t expected_len;
-	uint8_t *buf;
-	size_t kek_len;
 
 	switch (frame->key_descriptor_version) {
 	case EAPOL_KEY_DESCRIPTOR_VERSION_HMAC_MD5_ARC4:
@@ -269,7 +291,7 @@ uint8_t *eapol_decrypt_key_data(enum ie_rsn_akm_suite akm, const uint8_t *kek,
 		case IE_RSN_AKM_SUITE_FT_OVER_FILS_SHA256:
 		case IE_RSN_AKM_SUITE_FT_OVER_FILS_SHA384:
 			if (key_data_len < 16)
-				return NULL;
+				return -EINVAL;
 
 			expected_len = key_data_len - 16;
 			break;
@@ -279,27 +301,47 @@ uint8_t *eapol_decrypt_key_data(enum ie_rsn_akm_suite akm, const uint8_t *kek,
 		case IE_RSN_AKM_SUITE_OSEN:
 		case IE_RSN_AKM_SUITE_FT_OVER_8021X_SHA384:
 			if (key_data_len < 24 || key_data_len % 8)
-				return NULL;
+				return -EINVAL;
 
 			expected_len = key_data_len - 8;
 			break;
 		default:
-			return NULL;
+			return -EINVAL;
 		}
 
 		break;
 	case EAPOL_KEY_DESCRIPTOR_VERSION_HMAC_SHA1_AES:
 	case EAPOL_KEY_DESCRIPTOR_VERSION_AES_128_CMAC_AES:
 		if (key_data_len < 24 || key_data_len % 8)
-			return NULL;
+			return -EINVAL;
 
 		expected_len = key_data_len - 8;
 		break;
 	default:
-		return NULL;
+		return -EINVAL;
 	}
 
-	buf = l_new(uint8_t, expected_len);
+	return expected_len;
+}
+
+/*
+ * Decrypts the key data of @frame into @out, which must have room for at
+ * least EAPOL_KEY_DATA_LEN bytes.  Returns the decrypted length or a
+ * negative errno.
+ */
+ssize_t eapol_decrypt_key_data_into(enum ie_rsn_akm_suite akm,
+					const uint8_t *kek,
+					const struct eapol_key *frame,
+					size_t mic_len, uint8_t *out)
+{
+	size_t key_data_len = EAPOL_KEY_DATA_LEN(frame, mic_len);
+	const uint8_t *key_data = EAPOL_KEY_DATA(frame, mic_len);
+	ssize_t expected_len;
+	size_t kek_len;
+
+	expected_len = eapol_decrypted_key_data_len(akm, frame, mic_len);
+	if (expected_len < 0)
+		return expected_len;
 
 	switch (frame->key_descriptor_version) {
 	case EAPOL_KEY_DESCRIPTOR_VERSION_HMAC_MD5_ARC4:
@@ -310,7 +352,7 @@ uint8_t *eapol_decrypt_key_data(enum ie_rsn_akm_suite akm, const uint8_t *kek,
 		memcpy(key, frame->eapol_key_iv, 16);
 		memcpy(key + 16, kek, 16);
 
-		ret = arc4_skip(key, 32, 256, key_data, key_data_len, buf);
+		ret = arc4_skip(key, 32, 256, key_data, key_data_len, out);
 		explicit_bzero(key, sizeof(key));
 
 		if (!ret)
@@ -339,7 +381,7 @@ uint8_t *eapol_decrypt_key_data(enum ie_rsn_akm_suite akm, const uint8_t *kek,
 			}
 
 			if (!aes_unwrap(kek, kek_len, key_data,
-						key_data_len, buf))
+						key_data_len, out))
 				goto error;
 
 			break;
@@ -360,7 +402,7 @@ uint8_t *eapol_decrypt_key_data(enum ie_rsn_akm_suite akm, const uint8_t *kek,
 				kek_len = 64;
 
 			if (!aes_siv_decrypt(kek, kek_len, key_data,
-						key_data_len, ad, 1, buf))
+						key_data_len, ad, 1, out))
 				goto error;
 
 			break;
@@ -369,7 +411,7 @@ uint8_t *eapol_decrypt_key_data(enum ie_rsn_akm_suite akm, const uint8_t *kek,
 			kek_len = 16;
 
 			if (!aes_unwrap(kek, kek_len, key_data,
-						key_data_len, buf))
+						key_data_len, out))
 				goto error;
 			break;
 		}
@@ -377,14 +419,36 @@ uint8_t *eapol_decrypt_key_data(enum ie_rsn_akm_suite akm, const uint8_t *kek,
 		break;
 	}
 
+	return expected_len;
+
+error:
+	explicit_bzero(out, key_data_len);
+	return -EBADMSG;
+}
+
+uint8_t *eapol_decrypt_key_data(enum ie_rsn_akm_suite akm, const uint8_t *kek,
+				const struct eapol_key *frame,
+				size_t *decrypted_size, size_t mic_len)
+{
+	size_t key_data_len = EAPOL_KEY_DATA_LEN(frame, mic_len);
+	uint8_t *buf;
+	ssize_t len;
+
+	if (eapol_decrypted_key_data_len(akm, frame, mic_len) < 0)
+		return NULL;
+
+	buf = l_new(uint8_t, key_data_len);
+
+	len = eapol_decrypt_key_data_into(akm, kek, frame, mic_len, buf);
+	if (len <= 0) {
+		l_free(buf);
+		return NULL;
+	}
+
 	if (decrypted_size)
-		*decrypted_size = expected_len;
+		*decrypted_size = len;
 
 	return buf;
-
-error:
-	l_free(buf);
-	return NULL;
 }
 
 static int padded_aes_wrap(const uint8_t *kek, uint8_t *key_data,
@@ -912,6 +976,10 @@ struct eapol_sm {
 	uint8_t installed_igtk[CRYPTO_MAX_IGTK_LEN];
 	unsigned int mic_len;
 	bool rekey : 1;
+	/* MIC checksum keyed with the current KCK, reused across frames */
+	struct l_checksum *mic_checksum;
+	uint8_t mic_checksum_kck[32];
+	uint8_t mic_checksum_version;
 };
 
 static void eapol_sm_destroy(void *value)
@@ -933,9 +1001,66 @@ static void eapol_sm_destroy(void *value)
 	sm->installed_igtk_len = 0;
 	explicit_bzero(sm->installed_igtk, sizeof(sm->installed_igtk));
 
+	l_checksum_free(sm->mic_checksum);
+	explicit_bzero(sm->mic_checksum_kck, sizeof(sm->mic_checksum_kck));
+
 	l_free(sm);
 }
 
+/*
+ * The KCK changes with every PTK derivation, so check the key the cached
+ * checksum was created with instead of tracking every place that can
+ * derive a new PTK.  The KCK length always equals the MIC length.
+ */
+static struct l_checksum *eapol_sm_get_mic_checksum(struct eapol_sm *sm,
+						const struct eapol_key *ek)
+{
+	const uint8_t *kck = handshake_state_get_kck(sm->handshake);
+
+	if (L_WARN_ON(sm->mic_len > sizeof(sm->mic_checksum_kck)))
+		return NULL;
+
+	if (sm->mic_checksum &&
+			sm->mic_checksum_version == ek->key_descriptor_version &&
+			!memcmp(sm->mic_checksum_kck, kck, sm->mic_len))
+		return sm->mic_checksum;
+
+	l_checksum_free(sm->mic_checksum);
+	sm->mic_checksum = eapol_mic_checksum_new(sm->handshake->akm_suite,
+						kck, ek->key_descriptor_version,
+						sm->mic_len);
+	if (!sm->mic_checksum)
+		return NULL;
+
+	memcpy(sm->mic_checksum_kck, kck, sm->mic_len);
+	sm->mic_checksum_version = ek->key_descriptor_version;
+
+	return sm->mic_checksum;
+}
+
+static bool eapol_sm_calculate_mic(struct eapol_sm *sm,
+					const struct eapol_key *ek,
+					uint8_t *mic)
+{
+	struct l_checksum *checksum = eapol_sm_get_mic_checksum(sm, ek);
+
+	if (!checksum)
+		return false;
+
+	return eapol_calculate_mic_checksum(checksum, ek, mic, sm->mic_len);
+}
+
+static bool eapol_sm_verify_mic(struct eapol_sm *sm,
+				const struct eapol_key *ek)
+{
+	struct l_checksum *checksum = eapol_sm_get_mic_checksum(sm, ek);
+
+	if (!checksum)
+		return false;
+
+	return eapol_verify_mic_checksum(checksum, ek, sm->mic_len);
+}
+
 struct eapol_sm *eapol_sm_new(struct handshake_state *hs)
 {
 	struct eapol_sm *sm;
@@ -1198,7 +1323,6 @@ static void eapol_handle_ptk_1_of_4(struct eapol_sm *sm,
 					const struct eapol_key *ek,
 					bool unencrypted)
 {
-	const uint8_t *kck;
 	struct eapol_key *step2;
 	uint8_t mic[MIC_MAXLEN];
 	uint8_t ies[1024];
@@ -1358,11 +1482,8 @@ static void eapol_handle_ptk_1_of_4(struct eapol_sm *sm,
 					sm->handshake->wpa_ie, sm->mic_len,
 					sm->rekey);
 
-	kck = handshake_state_get_kck(sm->handshake);
-
 	if (sm->mic_len) {
-		if (!eapol_calculate_mic(sm->handshake->akm_suite, kck,
-				step2, mic, sm->mic_len)) {
+		if (!eapol_sm_calculate_mic(sm, step2, mic)) {
 			l_info("MIC calculation failed. "
 				"Ensure Kernel Crypto is available.");
 			l_free(step2);
@@ -1410,7 +1531,6 @@ static void eapol_send_ptk_3_of_4(struct eapol_sm *sm)
 				sm->handshake->pairwise_cipher);
 	enum crypto_cipher group_cipher = ie_rsn_cipher_suite_to_cipher(
 				sm->handshake->group_cipher);
-	const uint8_t *kck;
 	const uint8_t *kek;
 	uint8_t key_descriptor_version;
 
@@ -1511,10 +1631,7 @@ static void eapol_send_ptk_3_of_4(struct eapol_sm *sm)
 	ek->header.packet_len = L_CPU_TO_BE16(EAPOL_FRAME_LEN(sm->mic_len) +
 				key_data_len - 4);
 
-	kck = handshake_state_get_kck(sm->handshake);
-
-	if (!eapol_calculate_mic(sm->handshake->akm_suite, kck, ek,
-			EAPOL_KEY_MIC(ek), sm->mic_len))
+	if (!eapol_sm_calculate_mic(sm, ek, EAPOL_KEY_MIC(ek)))
 		return;
 
 	l_debug("STA: "MAC" retries=%u", MAC_STR(sm->handshake->spa),
@@ -1592,7 +1709,6 @@ static void eapol_handle_ptk_2_of_4(struct eapol_sm *sm,
 {
 	const uint8_t *rsne;
 	size_t ptk_size;
-	const uint8_t *kck;
 	const uint8_t *aa = sm->handshake->aa;
 	enum l_checksum_type type;
 
@@ -1618,10 +1734,7 @@ static void eapol_handle_ptk_2_of_4(struct eapol_sm *sm,
 					type))
 		return;
 
-	kck = handshake_state_get_kck(sm->handshake);
-
-	if (!eapol_verify_mic(sm->handshake->akm_suite, kck, ek,
-					sm->mic_len))
+	if (!eapol_sm_verify_mic(sm, ek))
 		return;
 
 	/*
@@ -2052,8 +2165,7 @@ retransmit:
 	kek = handshake_state_get_kek(hs);
 
 	if (sm->mic_len) {
-		if (!eapol_calculate_mic(hs->akm_suite, kck,
-						step4, mic, sm->mic_len)) {
+		if (!eapol_sm_calculate_mic(sm, step4, mic)) {
 			l_debug("MIC Calculation failed");
 			handshake_failed(sm, MMPDU_REASON_CODE_UNSPECIFIED);
 			return;
@@ -2121,7 +2233,6 @@ error_ie_different:
 static void eapol_handle_ptk_4_of_4(struct eapol_sm *sm,
 					const struct eapol_key *ek)
 {
-	const uint8_t *kck;
 
 	l_debug("ifindex=%u", sm->handshake->ifindex);
 
@@ -2135,10 +2246,7 @@ static void eapol_handle_ptk_4_of_4(struct eapol_sm *sm,
 	if (!sm->handshake->have_snonce)
 		return;
 
-	kck = handshake_state_get_kck(sm->handshake);
-
-	if (!eapol_verify_mic(sm->handshake->akm_suite, kck, ek,
-				sm->mic_len))
+	if (!eapol_sm_verify_mic(sm, ek))
 		return;
 
 	l_timeout_remove(sm->timeout);
@@ -2162,7 +2270,6 @@ static void eapol_handle_gtk_1_of_2(struct eapol_sm *sm,
 					bool unencrypted)
 {
 	struct handshake_state *hs = sm->handshake;
-	const uint8_t *kck;
 	struct eapol_key *step2;
 	uint8_t mic[MIC_MAXLEN];
 	const uint8_t *gtk;
@@ -2268,11 +2375,8 @@ static void eapol_handle_gtk_1_of_2(struct eapol_sm *sm,
 					hs->wpa_ie, ek->wpa_key_id,
 					sm->mic_len);
 
-	kck = handshake_state_get_kck(hs);
-
 	if (sm->mic_len) {
-		if (!eapol_calculate_mic(hs->akm_suite, kck,
-						step2, mic, sm->mic_len)) {
+		if (!eapol_sm_calculate_mic(sm, step2, mic)) {
 			l_debug("MIC calculation failed");
 			l_free(step2);
 			handshake_failed(sm, MMPDU_REASON_CODE_UNSPECIFIED);
@@ -2321,16 +2425,71 @@ static struct eapol_sm *eapol_find_sm(uint32_t ifindex, const uint8_t *aa)
 	return NULL;
 }
 
+static void eapol_key_dispatch(struct eapol_sm *sm,
+				const struct eapol_key *ek,
+				const uint8_t *decrypted_key_data,
+				size_t key_data_len, bool unencrypted)
+{
+	struct handshake_state *hs = sm->handshake;
+
+	if (ek->key_type == 0) {
+		/* GTK handshake allowed only after PTK handshake complete */
+		if (!hs->ptk_complete)
+			return;
+
+		if (hs->group_cipher == IE_RSN_CIPHER_SUITE_NO_GROUP_TRAFFIC)
+			return;
+
+		if (!decrypted_key_data)
+			return;
+
+		eapol_handle_gtk_1_of_2(sm, ek, decrypted_key_data,
+					key_data_len, unencrypted);
+		return;
+	}
+
+	/* If no MIC, then assume packet 1, otherwise packet 3 */
+	if (!ek->key_mic && !ek->encrypted_key_data)
+		eapol_handle_ptk_1_of_4(sm, ek, unencrypted);
+	else {
+		if (!key_data_len)
+			return;
+
+		eapol_handle_ptk_3_of_4(sm, ek,
+					decrypted_key_data ?:
+					EAPOL_KEY_DATA(ek, sm->mic_len),
+					key_data_len, unencrypted);
+	}
+}
+
+/*
+ * The key data is unwrapped onto the stack rather than into a heap copy,
+ * the plaintext is never longer than the wrapped key data
+ */
+static void eapol_key_decrypt_and_dispatch(struct eapol_sm *sm,
+						const struct eapol_key *ek,
+						bool unencrypted)
+{
+	struct handshake_state *hs = sm->handshake;
+	size_t key_data_len = EAPOL_KEY_DATA_LEN(ek, sm->mic_len);
+	uint8_t buf[key_data_len];
+	ssize_t len;
+
+	len = eapol_decrypt_key_data_into(hs->akm_suite,
+					handshake_state_get_kek(hs), ek,
+					sm->mic_len, buf);
+	if (len > 0)
+		eapol_key_dispatch(sm, ek, buf, len, unencrypted);
+
+	explicit_bzero(buf, key_data_len);
+}
+
 static void eapol_key_handle(struct eapol_sm *sm,
 				const struct eapol_frame *frame,
 				bool unencrypted)
 {
 	struct handshake_state *hs = sm->handshake;
 	const struct eapol_key *ek;
-	const uint8_t *kck;
-	const uint8_t *kek;
-	uint8_t *decrypted_key_data = NULL;
-	size_t key_data_len = 0;
 	uint64_t replay_counter;
 	uint8_t expected_key_descriptor_version;
 
@@ -2390,14 +2549,12 @@ static void eapol_key_handle(struct eapol_sm *sm,
 	if (sm->have_replay && sm->replay_counter >= replay_counter)
 		return;
 
-	kck = handshake_state_get_kck(hs);
-
 	if (ek->key_mic) {
 		/* Haven't received step 1 yet, so no ptk */
 		if (!hs->have_snonce)
 			return;
 
-		if (!eapol_verify_mic(hs->akm_suite, kck, ek, sm->mic_len))
+		if (!eapol_sm_verify_mic(sm, ek))
 			return;
 	}
 
@@ -2410,50 +2567,14 @@ static void eapol_key_handle(struct eapol_sm *sm,
 		if (sm->mic_len && !hs->have_snonce)
 			return;
 
-		kek = handshake_state_get_kek(hs);
+		if (EAPOL_KEY_DATA_LEN(ek, sm->mic_len))
+			eapol_key_decrypt_and_dispatch(sm, ek, unencrypted);
 
-		decrypted_key_data = eapol_decrypt_key_data(
-					hs->akm_suite, kek,
-					ek, &key_data_len, sm->mic_len);
-		if (!decrypted_key_data)
-			return;
-	} else
-		key_data_len = EAPOL_KEY_DATA_LEN(ek, sm->mic_len);
-
-	if (ek->key_type == 0) {
-		/* GTK handshake allowed only after PTK handshake complete */
-		if (!hs->ptk_complete)
-			goto done;
-
-		if (hs->group_cipher == IE_RSN_CIPHER_SUITE_NO_GROUP_TRAFFIC)
-			goto done;
-
-		if (!decrypted_key_data)
-			goto done;
-
-		eapol_handle_gtk_1_of_2(sm, ek, decrypted_key_data,
-					key_data_len, unencrypted);
-		goto done;
-	}
-
-	/* If no MIC, then assume packet 1, otherwise packet 3 */
-	if (!ek->key_mic && !ek->encrypted_key_data)
-		eapol_handle_ptk_1_of_4(sm, ek, unencrypted);
-	else {
-		if (!key_data_len)
-			goto done;
-
-		eapol_handle_ptk_3_of_4(sm, ek,
-					decrypted_key_data ?:
-					EAPOL_KEY_DATA(ek, sm->mic_len),
-					key_data_len, unencrypted);
+		return;
 	}
 
-done:
-	if (decrypted_key_data)
-		explicit_bzero(decrypted_key_data, key_data_len);
-
-	l_free(decrypted_key_data);
+	eapol_key_dispatch(sm, ek, NULL, EAPOL_KEY_DATA_LEN(ek, sm->mic_len),
+				unencrypted);
 }
 
 /* This respresentes the eapMsg message in 802.1X Figure 8-1 */
@@ -22,6 +22,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <sys/types.h>
 #include <asm/byteorder.h>
 #include <linux/types.h>
 #include "src/eapolutil.h"
@@ -29,6 +30,7 @@
 struct eapol_sm;
 struct handshake_state;
 struct preauth_sm;
+struct l_checksum;
 enum handshake_kde;
 enum ie_rsn_akm_suite;
 
@@ -61,9 +63,23 @@ bool eapol_calculate_mic(enum ie_rsn_akm_suite akm, const uint8_t *kck,
 bool eapol_verify_mic(enum ie_rsn_akm_suite akm, const uint8_t *kck,
 			const struct eapol_key *frame, size_t mic_len);
 
+struct l_checksum *eapol_mic_checksum_new(enum ie_rsn_akm_suite akm,
+						const uint8_t *kck,
+						uint8_t key_descriptor_version,
+						size_t mic_len);
+bool eapol_calculate_mic_checksum(struct l_checksum *checksum,
+					const struct eapol_key *frame,
+					uint8_t *mic, size_t mic_len);
+bool eapol_verify_mic_checksum(struct l_checksum *checksum,
+				const struct eapol_key *frame, size_t mic_len);
+
 uint8_t *eapol_decrypt_key_data(enum ie_rsn_akm_suite akm, const uint8_t *kek,
 				const struct eapol_key *frame,
 				size_t *decrypted_size, size_t mic_len);
+ssize_t eapol_decrypt_key_data_into(enum ie_rsn_akm_suite akm,
+					const uint8_t *kek,
+					const struct eapol_key *frame,
+					size_t mic_len, uint8_t *out);
 
 bool eapol_verify_ptk_1_of_4(const struct eapol_key *ek, size_t mic_len,
 				bool ptk_complete);
@@ -27,6 +27,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <errno.h>
+#include <time.h>
 
 #include <ell/ell.h>
 
@@ -40,8 +41,10 @@
 #include "src/util.h"
 
 #define ERP_DEFAULT_KEY_LIFETIME_US 86400000000
+#define ERP_CACHE_SYNC_DELAY 10	/* Seconds */
 
 struct erp_cache_entry {
+	char *key;
 	char *id;
 	void *emsk;
 	size_t emsk_len;
@@ -100,7 +103,19 @@ struct erp_tlv_iter {
 	const unsigned char *data;
 };
 
+/*
+ * key_cache holds every entry, including invalidated ones still referenced,
+ * while key_index maps an (identity, SSID) key to its newest valid entry
+ * which is the only one erp_cache_get() can return.  Valid entries are
+ * persisted, encrypted, through the cache ops so that ERP keeps working
+ * after a restart.  Changes are written out in batches, and on exit.
+ */
 static struct l_queue *key_cache;
+static struct l_hashmap *key_index;
+static erp_cache_load_func_t erp_cache_load;
+static erp_cache_sync_func_t erp_cache_sync;
+static struct l_timeout *sync_timeout;
+static bool key_cache_loaded;
 
 static void erp_tlv_iter_init(struct erp_tlv_iter *iter,
 				const unsigned char *tlv, unsigned int len)
@@ -150,6 +165,7 @@ static void erp_cache_entry_destroy(void *data)
 	if (entry->ref)
 		l_error("ERP entry still has a reference on cleanup!");
 
+	l_free(entry->key);
 	l_free(entry->id);
 	l_free(entry->emsk);
 	l_free(entry->session_id);
@@ -158,91 +174,233 @@ static void erp_cache_entry_destroy(void *data)
 	l_free(entry);
 }
 
-void erp_cache_add(const char *id, const void *session_id,
-			size_t session_len, const void *emsk, size_t emsk_len,
-			const uint8_t *ssid, size_t ssid_len)
+static void erp_cache_invalidate(struct erp_cache_entry *entry)
 {
-	struct erp_cache_entry *entry;
+	if (l_hashmap_lookup(key_index, entry->key) == entry)
+		l_hashmap_remove(key_index, entry->key);
 
-	if (!unlikely(id || session_id || emsk))
+	if (entry->ref) {
+		entry->invalid = true;
 		return;
+	}
 
-	if (!util_ssid_is_utf8(ssid_len, ssid))
+	l_queue_remove(key_cache, entry);
+	erp_cache_entry_destroy(entry);
+}
+
+static bool erp_cache_entry_expired(struct erp_cache_entry *entry)
+{
+	if (!l_time_after(l_time_now(), entry->expire_time))
+		return false;
+
+	erp_cache_invalidate(entry);
+	return true;
+}
+
+/* Also the persisted group name, hex encoded to keep it a valid one */
+static char *erp_cache_key(const char *id, const char *ssid)
+{
+	_auto_(l_free) char *id_hex = l_util_hexstring(id, strlen(id));
+	_auto_(l_free) char *ssid_hex = l_util_hexstring(ssid, strlen(ssid));
+
+	return l_strdup_printf("%s:%s", ssid_hex, id_hex);
+}
+
+static void erp_cache_save(void)
+{
+	_auto_(l_settings_free) struct l_settings *settings = NULL;
+	const struct l_queue_entry *e;
+	uint64_t now = l_time_now();
+	time_t wall = time(NULL);
+
+	l_timeout_remove(sync_timeout);
+	sync_timeout = NULL;
+
+	if (!erp_cache_sync)
 		return;
 
-	if (util_ssid_is_hidden(ssid_len, ssid))
+	settings = l_settings_new();
+
+	for (e = l_queue_get_entries(key_cache); e; e = e->next) {
+		struct erp_cache_entry *entry = e->data;
+
+		if (entry->invalid || l_time_after(now, entry->expire_time))
+			continue;
+
+		l_settings_set_bytes(settings, entry->key, "SessionId",
+					entry->session_id, entry->session_len);
+		l_settings_set_bytes(settings, entry->key, "EMSK",
+					entry->emsk, entry->emsk_len);
+		l_settings_set_uint64(settings, entry->key, "ExpiryTime", wall +
+				l_time_diff(now, entry->expire_time) /
+				L_USEC_PER_SEC);
+	}
+
+	erp_cache_sync(settings);
+}
+
+static void erp_cache_sync_timeout(struct l_timeout *timeout, void *user_data)
+{
+	erp_cache_save();
+}
+
+static void erp_cache_schedule_save(void)
+{
+	if (!erp_cache_sync || sync_timeout)
 		return;
 
-	entry = l_new(struct erp_cache_entry, 1);
+	sync_timeout = l_timeout_create(ERP_CACHE_SYNC_DELAY,
+					erp_cache_sync_timeout, NULL, NULL);
+}
 
-	entry->id = l_strdup(id);
-	entry->emsk = l_memdup(emsk, emsk_len);
-	entry->emsk_len = emsk_len;
-	entry->session_id = l_memdup(session_id, session_len);
-	entry->session_len = session_len;
-	entry->ssid = l_strndup((char *) ssid, ssid_len);
-	entry->expire_time = l_time_offset(l_time_now(),
-					ERP_DEFAULT_KEY_LIFETIME_US);
+static void erp_cache_insert(struct erp_cache_entry *entry)
+{
+	struct erp_cache_entry *old = l_hashmap_lookup(key_index, entry->key);
 
+	if (old)
+		erp_cache_invalidate(old);
+
+	l_hashmap_insert(key_index, entry->key, entry);
 	l_queue_push_head(key_cache, entry);
 }
 
-static struct erp_cache_entry *find_keycache(const char *id, const char *ssid)
+static char *erp_cache_key_part(const char *hex, size_t hex_len)
 {
-	const struct l_queue_entry *entry;
+	_auto_(l_free) char *str = l_strndup(hex, hex_len);
+	_auto_(l_free) uint8_t *bytes = NULL;
+	size_t len;
+
+	bytes = l_util_from_hexstring(str, &len);
 
-	if (!id && !ssid)
+	/* No embedded NULs, the identity and the SSID are strings here */
+	if (!bytes || !len || memchr(bytes, '\0', len))
 		return NULL;
 
-	for (entry = l_queue_get_entries(key_cache); entry;
-			entry = entry->next) {
-		struct erp_cache_entry *cache = entry->data;
+	return l_strndup((char *) bytes, len);
+}
 
-		if (cache->invalid)
-			continue;
+static struct erp_cache_entry *erp_cache_entry_from_settings(
+						struct l_settings *settings,
+						const char *group,
+						uint64_t now, time_t wall)
+{
+	struct erp_cache_entry *entry;
+	_auto_(l_free) char *ssid = NULL;
+	_auto_(l_free) char *id = NULL;
+	const char *sep;
+	uint64_t expiry;
 
-		if (l_time_after(l_time_now(), cache->expire_time)) {
-			if (!cache->ref) {
-				l_queue_remove(key_cache, cache);
-				erp_cache_entry_destroy(cache);
-			} else
-				cache->invalid = true;
+	if (!l_settings_get_uint64(settings, group, "ExpiryTime", &expiry) ||
+			expiry <= (uint64_t) wall)
+		return NULL;
 
-			continue;
-		}
+	sep = strchr(group, ':');
+	if (!sep)
+		return NULL;
 
-		if (id && !strcmp(cache->id, id))
-			return cache;
+	ssid = erp_cache_key_part(group, sep - group);
+	id = erp_cache_key_part(sep + 1, strlen(sep + 1));
+	if (!ssid || !id || !util_ssid_is_utf8(strlen(ssid),
+						(uint8_t *) ssid) ||
+			util_ssid_is_hidden(strlen(ssid), (uint8_t *) ssid))
+		return NULL;
 
-		if (ssid && !strcmp(cache->ssid, ssid))
-			return cache;
+	entry = l_new(struct erp_cache_entry, 1);
+	entry->key = erp_cache_key(id, ssid);
+	entry->id = l_steal_ptr(id);
+	entry->ssid = l_steal_ptr(ssid);
+	entry->session_id = l_settings_get_bytes(settings, group, "SessionId",
+							&entry->session_len);
+	entry->emsk = l_settings_get_bytes(settings, group, "EMSK",
+							&entry->emsk_len);
+
+	/* erp_derive_keys() assumes EMSK sized key buffers */
+	if (!entry->session_id || !entry->emsk || entry->emsk_len > 64) {
+		erp_cache_entry_destroy(entry);
+		return NULL;
 	}
 
-	return NULL;
+	/* Don't trust a far future expiry, e.g. after the clock was reset */
+	expiry = L_MIN(expiry - wall, ERP_DEFAULT_KEY_LIFETIME_US /
+					L_USEC_PER_SEC);
+	entry->expire_time = l_time_offset(now, expiry * L_USEC_PER_SEC);
+
+	return entry;
 }
 
-void erp_cache_remove(const char *id)
+static void erp_cache_load_once(void)
 {
-	struct erp_cache_entry *entry = find_keycache(id, NULL);
+	_auto_(l_settings_free) struct l_settings *settings = NULL;
+	_auto_(l_strv_free) char **groups = NULL;
+	uint64_t now = l_time_now();
+	time_t wall = time(NULL);
+	char **group;
 
-	if (!entry)
+	if (key_cache_loaded || !erp_cache_load)
 		return;
 
-	if (entry->ref) {
-		entry->invalid = true;
+	key_cache_loaded = true;
+
+	settings = erp_cache_load();
+	if (!settings)
 		return;
+
+	groups = l_settings_get_groups(settings);
+
+	for (group = groups; group && *group; group++) {
+		struct erp_cache_entry *entry =
+			erp_cache_entry_from_settings(settings, *group,
+							now, wall);
+
+		if (entry)
+			erp_cache_insert(entry);
 	}
 
-	l_queue_remove(key_cache, entry);
+	l_debug("Loaded %u ERP cache entries", l_queue_length(key_cache));
+}
 
-	erp_cache_entry_destroy(entry);
+void erp_cache_add(const char *id, const void *session_id,
+			size_t session_len, const void *emsk, size_t emsk_len,
+			const uint8_t *ssid, size_t ssid_len)
+{
+	struct erp_cache_entry *entry;
+
+	if (!unlikely(id || session_id || emsk))
+		return;
+
+	if (!util_ssid_is_utf8(ssid_len, ssid))
+		return;
+
+	if (util_ssid_is_hidden(ssid_len, ssid))
+		return;
+
+	erp_cache_load_once();
+
+	entry = l_new(struct erp_cache_entry, 1);
+
+	entry->id = l_strdup(id);
+	entry->emsk = l_memdup(emsk, emsk_len);
+	entry->emsk_len = emsk_len;
+	entry->session_id = l_memdup(session_id, session_len);
+	entry->session_len = session_len;
+	entry->ssid = l_strndup((char *) ssid, ssid_len);
+	entry->key = erp_cache_key(entry->id, entry->ssid);
+	entry->expire_time = l_time_offset(l_time_now(),
+					ERP_DEFAULT_KEY_LIFETIME_US);
+
+	erp_cache_insert(entry);
+	erp_cache_schedule_save();
 }
 
-struct erp_cache_entry *erp_cache_get(const char *ssid)
+struct erp_cache_entry *erp_cache_get(const char *id, const char *ssid)
 {
-	struct erp_cache_entry *cache = find_keycache(NULL, ssid);
+	_auto_(l_free) char *key = erp_cache_key(id, ssid);
+	struct erp_cache_entry *cache;
 
-	if (!cache)
+	erp_cache_load_once();
+
+	cache = l_hashmap_lookup(key_index, key);
+	if (!cache || erp_cache_entry_expired(cache))
 		return NULL;
 
 	cache->ref++;
@@ -268,6 +426,12 @@ void erp_cache_put(struct erp_cache_entry *cache)
 	erp_cache_entry_destroy(cache);
 }
 
+void erp_set_cache_ops(erp_cache_load_func_t load, erp_cache_sync_func_t sync)
+{
+	erp_cache_load = load;
+	erp_cache_sync = sync;
+}
+
 const char *erp_cache_entry_get_identity(struct erp_cache_entry *cache)
 {
 	return cache->id;
@@ -528,13 +692,21 @@ const void *erp_get_rmsk(struct erp_state *erp, size_t *rmsk_len)
 static int erp_init(void)
 {
 	key_cache = l_queue_new();
+	key_index = l_hashmap_string_new();
 
 	return 0;
 }
 
 static void erp_exit(void)
 {
+	if (sync_timeout)
+		erp_cache_save();
+
+	l_hashmap_destroy(key_index, NULL);
+	key_index = NULL;
 	l_queue_destroy(key_cache, erp_cache_entry_destroy);
+	key_cache = NULL;
+	key_cache_loaded = false;
 }
 
 IWD_MODULE(erp, erp_init, erp_exit)
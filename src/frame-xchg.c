@@ -39,6 +39,7 @@
 #include "src/mpdu.h"
 #include "src/util.h"
 #include "src/watchlist.h"
+#include "src/prefix-trie.h"
 #include "src/nl80211util.h"
 #include "src/netdev.h"
 #include "src/frame-xchg.h"
@@ -70,6 +71,18 @@ struct watch_group {
 	uint32_t nl_seq;
 	struct l_queue *write_queue;
 	struct watchlist watches;
+	struct l_queue *tries;
+};
+
+/*
+ * The watches in a group indexed by prefix, one trie per wdev and frame
+ * type, so that dispatching a frame doesn't require comparing it against
+ * every prefix registered in the group.
+ */
+struct frame_watch_trie {
+	uint64_t wdev_id;
+	uint16_t frame_type;
+	struct prefix_trie *trie;
 };
 
 struct frame_watch {
@@ -118,8 +131,22 @@ struct frame_xchg_data {
 	struct wiphy_radio_work_item work;
 	bool no_cck_rates;
 	unsigned int tx_cmd_id;
+	uint64_t roc_end;
+	struct frame_xchg_data *leader;
+	unsigned int pipelined_cnt;
+	bool done_pending;
+	struct l_idle *release_idle;
 };
 
+/*
+ * Maximum number of exchanges, including the one owning the radio work,
+ * allowed to be in progress at the same time on the same channel.
+ */
+#define FRAME_XCHG_PIPELINE_MAX	4
+
+/* How long to wait before retrying when another frame is being sent */
+#define FRAME_XCHG_TX_DEFER_MS	10
+
 struct frame_xchg_watch_data {
 	struct frame_xchg_prefix *prefix;
 	frame_xchg_resp_cb_t cb;
@@ -136,18 +163,177 @@ struct frame_prefix_info {
 	uint64_t wdev_id;
 };
 
-static bool frame_watch_match_prefix(const void *a, const void *b)
+struct frame_watch_matches {
+	struct watchlist_item **items;
+	unsigned int count;
+	unsigned int size;
+	struct watchlist_item *buf[16];
+};
+
+static bool frame_watch_trie_match(const void *a, const void *b)
 {
-	const struct watchlist_item *item = a;
-	const struct frame_watch *watch =
-		l_container_of(item, struct frame_watch, super);
+	const struct frame_watch_trie *trie = a;
 	const struct frame_prefix_info *info = b;
 
-	return watch->frame_type == info->frame_type &&
-		watch->prefix_len <= info->body_len &&
-		(watch->prefix_len == 0 ||
-		 !memcmp(watch->prefix, info->body, watch->prefix_len)) &&
-		info->wdev_id == watch->wdev_id;
+	return trie->wdev_id == info->wdev_id &&
+		trie->frame_type == info->frame_type;
+}
+
+static void frame_watch_trie_free(void *data)
+{
+	struct frame_watch_trie *trie = data;
+
+	prefix_trie_free(trie->trie);
+	l_free(trie);
+}
+
+static void frame_watch_index(struct watch_group *group,
+				struct frame_watch *watch)
+{
+	struct frame_prefix_info info = {
+		.frame_type = watch->frame_type,
+		.wdev_id = watch->wdev_id,
+	};
+	struct frame_watch_trie *trie = l_queue_find(group->tries,
+						frame_watch_trie_match, &info);
+
+	if (!trie) {
+		trie = l_new(struct frame_watch_trie, 1);
+		trie->wdev_id = watch->wdev_id;
+		trie->frame_type = watch->frame_type;
+		trie->trie = prefix_trie_new();
+		l_queue_push_tail(group->tries, trie);
+	}
+
+	prefix_trie_insert(trie->trie, watch->prefix, watch->prefix_len,
+				&watch->super);
+}
+
+static void frame_watch_unindex(struct watch_group *group,
+				struct frame_watch *watch)
+{
+	struct frame_prefix_info info = {
+		.frame_type = watch->frame_type,
+		.wdev_id = watch->wdev_id,
+	};
+	struct frame_watch_trie *trie = l_queue_find(group->tries,
+						frame_watch_trie_match, &info);
+
+	if (!trie || !prefix_trie_remove(trie->trie, watch->prefix,
+						watch->prefix_len,
+						&watch->super))
+		return;
+
+	if (prefix_trie_isempty(trie->trie)) {
+		l_queue_remove(group->tries, trie);
+		frame_watch_trie_free(trie);
+	}
+}
+
+static void frame_watch_collect_match(void *value, void *user_data)
+{
+	struct frame_watch_matches *matches = user_data;
+	struct watchlist_item *item = value;
+	unsigned int i;
+
+	if (matches->count == matches->size) {
+		struct watchlist_item **items =
+			l_new(struct watchlist_item *, matches->size * 2);
+
+		memcpy(items, matches->items,
+			matches->count * sizeof(*items));
+
+		if (matches->items != matches->buf)
+			l_free(matches->items);
+
+		matches->items = items;
+		matches->size *= 2;
+	}
+
+	/*
+	 * The trie returns the watches ordered by prefix length, restore the
+	 * registration order that the callers have always been getting.
+	 * Watchlist IDs are allocated in increasing order and there are
+	 * only ever a few matches so insertion sort is fine.
+	 */
+	for (i = matches->count; i > 0; i--) {
+		if (matches->items[i - 1]->id < item->id)
+			break;
+
+		matches->items[i] = matches->items[i - 1];
+	}
+
+	matches->items[i] = item;
+	matches->count++;
+}
+
+static void frame_watch_dispatch(struct watch_group *group,
+					const struct frame_prefix_info *info,
+					const struct mmpdu_header *mpdu,
+					size_t frame_len, int rssi)
+{
+	struct watchlist *watchlist = &group->watches;
+	struct frame_watch_trie *trie = l_queue_find(group->tries,
+						frame_watch_trie_match, info);
+	struct frame_watch_matches matches;
+	unsigned int i;
+
+	if (!trie)
+		return;
+
+	matches.items = matches.buf;
+	matches.count = 0;
+	matches.size = L_ARRAY_SIZE(matches.buf);
+	prefix_trie_foreach_match(trie->trie, info->body, info->body_len,
+					frame_watch_collect_match, &matches);
+
+	if (!matches.count)
+		return;
+
+	/*
+	 * Only the header has been checked so far.  Do the full validation,
+	 * including the IEs, once now that we know someone is interested,
+	 * instead of for every frame received, most of which get dropped
+	 * e.g. during a probe request flood.
+	 */
+	if (!mpdu_validate((const uint8_t *) mpdu, frame_len)) {
+		l_warn("Frame didn't validate as MMPDU");
+		goto done;
+	}
+
+	/* Same semantics as WATCHLIST_NOTIFY_MATCHES */
+	watchlist->in_notify = true;
+
+	for (i = 0; i < matches.count; i++) {
+		struct watchlist_item *item = matches.items[i];
+		frame_watch_cb_t cb = item->notify;
+
+		/* Removed by one of the previous callbacks */
+		if (item->id == 0)
+			continue;
+
+		cb(mpdu, info->body, info->body_len, rssi, item->notify_data);
+
+		if (watchlist->pending_destroy)
+			break;
+	}
+
+	watchlist->in_notify = false;
+
+done:
+	if (matches.items != matches.buf)
+		l_free(matches.items);
+
+	if (watchlist->pending_destroy)
+		watchlist_destroy(watchlist);
+	else if (watchlist->stale_items)
+		__watchlist_prune_stale(watchlist);
+}
+
+static void frame_watch_group_free(struct watch_group *group)
+{
+	l_queue_destroy(group->tries, frame_watch_trie_free);
+	l_free(group);
 }
 
 static void frame_watch_unicast_notify(struct l_genl_msg *msg, void *user_data)
@@ -186,7 +372,7 @@ static void frame_watch_unicast_notify(struct l_genl_msg *msg, void *user_data)
 			break;
 
 		case NL80211_ATTR_FRAME:
-			mpdu = mpdu_validate(data, len);
+			mpdu = mpdu_validate_header(data, len);
 			if (!mpdu) {
 				l_warn("Frame didn't validate as MMPDU");
 				return;
@@ -231,13 +417,11 @@ static void frame_watch_unicast_notify(struct l_genl_msg *msg, void *user_data)
 	info.body_len = (const uint8_t *) mpdu + frame_len - body;
 	info.wdev_id = *wdev_id;
 
-	WATCHLIST_NOTIFY_MATCHES(&group->watches, frame_watch_match_prefix,
-					&info, frame_watch_cb_t, mpdu,
-					info.body, info.body_len, rssi);
+	frame_watch_dispatch(group, &info, mpdu, frame_len, rssi);
 
 	/* Has frame_watch_group_destroy been called inside a frame CB? */
 	if (group->watches.pending_destroy)
-		l_free(group);
+		frame_watch_group_free(group);
 }
 
 static void frame_watch_group_destroy(void *data)
@@ -261,7 +445,7 @@ static void frame_watch_group_destroy(void *data)
 	if (group->watches.in_notify)
 		return;
 
-	l_free(group);
+	frame_watch_group_free(group);
 }
 
 static void frame_watch_free(struct watchlist_item *item)
@@ -269,6 +453,7 @@ static void frame_watch_free(struct watchlist_item *item)
 	struct frame_watch *watch =
 		l_container_of(item, struct frame_watch, super);
 
+	frame_watch_unindex(watch->group, watch);
 	l_free(watch->prefix);
 	l_free(watch);
 }
@@ -392,6 +577,7 @@ static struct watch_group *frame_watch_group_new(uint64_t wdev_id, uint32_t id)
 	group->id = id;
 	group->wdev_id = wdev_id;
 	watchlist_init(&group->watches, &frame_watch_ops);
+	group->tries = l_queue_new();
 
 	if (id == 0) {
 		group->unicast_watch_id = l_genl_add_unicast_watch(
@@ -603,6 +789,7 @@ bool frame_watch_add(uint64_t wdev_id, uint32_t group_id, uint16_t frame_type,
 	watch->group = group;
 	watchlist_link(&group->watches, &watch->super, handler, user_data,
 			destroy);
+	frame_watch_index(group, watch);
 
 	if (info.registered)
 		return true;
@@ -767,10 +954,8 @@ static void frame_xchg_wait_cancel(struct frame_xchg_data *fx)
 	fx->have_cookie = false;
 }
 
-static void frame_xchg_reset(struct frame_xchg_data *fx)
+static void frame_xchg_cancel_tx(struct frame_xchg_data *fx)
 {
-	frame_xchg_wait_cancel(fx);
-
 	if (fx->timeout)
 		l_timeout_remove(fx->timeout);
 
@@ -781,6 +966,11 @@ static void frame_xchg_reset(struct frame_xchg_data *fx)
 
 	l_free(fx->early_frame.mpdu);
 	fx->early_frame.mpdu = NULL;
+}
+
+static void frame_xchg_reset(struct frame_xchg_data *fx)
+{
+	frame_xchg_cancel_tx(fx);
 	l_queue_destroy(fx->rx_watches, l_free);
 	fx->rx_watches = NULL;
 	l_free(fx->tx_mpdu);
@@ -789,6 +979,56 @@ static void frame_xchg_reset(struct frame_xchg_data *fx)
 					frame_xchg_resp_cb, fx);
 }
 
+static void frame_xchg_release_cb(struct l_idle *idle, void *user_data)
+{
+	struct frame_xchg_data *fx = user_data;
+
+	l_idle_remove(idle);
+	fx->release_idle = NULL;
+
+	wiphy_radio_work_done(wiphy_find_by_wdev(fx->wdev_id), fx->work.id);
+}
+
+static void frame_xchg_pipeline_leave(struct frame_xchg_data *fx)
+{
+	struct frame_xchg_data *leader = fx->leader;
+
+	fx->leader = NULL;
+
+	if (--leader->pipelined_cnt || !leader->done_pending)
+		return;
+
+	/*
+	 * The last pipelined exchange is over, release the radio.  We're
+	 * called from that exchange's work item destroy callback so don't
+	 * re-enter the work queue from here.
+	 */
+	leader->release_idle = l_idle_create(frame_xchg_release_cb, leader,
+						NULL);
+}
+
+static void frame_xchg_requeue(void *data, void *user_data)
+{
+	struct frame_xchg_data *fx = data;
+
+	if (fx->leader != user_data)
+		return;
+
+	/*
+	 * The exchange can't go on using the channel without the radio work
+	 * it was pipelined with.  Stop it and start over from the beginning
+	 * once its own work item gets to run.
+	 */
+	l_debug("Requeuing work item %u", fx->work.id);
+
+	frame_xchg_wait_cancel(fx);
+	frame_xchg_cancel_tx(fx);
+	fx->leader = NULL;
+	fx->tx_acked = false;
+	fx->roc_end = 0;
+	fx->retry_cnt = 0;
+}
+
 static void frame_xchg_destroy(struct wiphy_radio_work_item *item)
 {
 	struct frame_xchg_data *fx = l_container_of(item,
@@ -797,7 +1037,19 @@ static void frame_xchg_destroy(struct wiphy_radio_work_item *item)
 	if (fx->destroy)
 		fx->destroy(fx->user_data);
 
+	if (fx->release_idle)
+		l_idle_remove(fx->release_idle);
+
+	frame_xchg_wait_cancel(fx);
 	frame_xchg_reset(fx);
+
+	/* Cancelled while exchanges we pipelined are still running */
+	if (fx->pipelined_cnt)
+		l_queue_foreach(frame_xchgs, frame_xchg_requeue, fx);
+
+	if (fx->leader)
+		frame_xchg_pipeline_leave(fx);
+
 	l_free(fx);
 }
 
@@ -808,6 +1060,19 @@ static void frame_xchg_done(struct frame_xchg_data *fx, int err)
 	if (fx->cb)
 		fx->cb(err, fx->user_data);
 
+	/*
+	 * Keep the radio work, and thus the channel, until the exchanges
+	 * that have been pipelined with this one are also done.  Don't
+	 * cancel the remain-on-channel period either as they may be
+	 * listening during it, it's cancelled when the work is released.
+	 */
+	if (fx->pipelined_cnt) {
+		fx->cb = NULL;
+		fx->done_pending = true;
+		frame_xchg_reset(fx);
+		return;
+	}
+
 	wiphy_radio_work_done(wiphy_find_by_wdev(fx->wdev_id), fx->work.id);
 }
 
@@ -846,7 +1111,9 @@ static void frame_xchg_listen_end_cb(struct l_timeout *timeout,
 static void frame_xchg_tx_status(struct frame_xchg_data *fx, bool acked)
 {
 	if (!acked) {
-		frame_xchg_wait_cancel(fx);
+		/* Pipelined exchanges may be listening on the channel */
+		if (!fx->pipelined_cnt)
+			frame_xchg_wait_cancel(fx);
 
 		if (!fx->retry_interval || fx->retry_cnt >= 15) {
 			if (!fx->resp_timeout)
@@ -874,6 +1141,10 @@ static void frame_xchg_tx_status(struct frame_xchg_data *fx, bool acked)
 
 	fx->tx_acked = true;
 
+	/* Listening during the owner's remain-on-channel, nothing to cancel */
+	if (!fx->roc_end)
+		fx->have_cookie = false;
+
 	/* Process frames received early for strange drivers */
 	if (fx->early_frame.mpdu) {
 		/* The command is now over so no need to cancel it */
@@ -897,6 +1168,86 @@ static void frame_xchg_tx_status(struct frame_xchg_data *fx, bool acked)
 						frame_xchg_timeout_destroy);
 }
 
+struct frame_xchg_pipeline_info {
+	const struct frame_xchg_data *leader;
+	const uint8_t *peer;
+};
+
+static bool frame_xchg_match_pipeline_peer(const void *a, const void *b)
+{
+	const struct frame_xchg_data *fx = a;
+	const struct frame_xchg_pipeline_info *info = b;
+
+	if (fx != info->leader && fx->leader != info->leader)
+		return false;
+
+	if (!fx->tx_mpdu)
+		return false;
+
+	return !memcmp(fx->tx_mpdu->address_1, info->peer, 6);
+}
+
+static bool frame_xchg_match_pipeline_candidate(const void *a, const void *b)
+{
+	const struct frame_xchg_data *fx = a;
+	const struct frame_xchg_data *leader = b;
+	struct frame_xchg_pipeline_info info;
+
+	if (fx == leader || fx->leader || fx->retry_cnt || !fx->tx_mpdu ||
+			fx->wdev_id != leader->wdev_id ||
+			fx->freq != leader->freq)
+		return false;
+
+	info.leader = leader;
+	info.peer = fx->tx_mpdu->address_1;
+
+	/*
+	 * Responses are told apart by the peer address, the dialog token
+	 * position being specific to each protocol, so only one exchange
+	 * per peer can be in progress.
+	 */
+	if (l_queue_find(frame_xchgs, frame_xchg_match_pipeline_peer, &info))
+		return false;
+
+	return wiphy_radio_work_is_running(wiphy_find_by_wdev(fx->wdev_id),
+						fx->work.id) == 0;
+}
+
+/*
+ * While the exchange owning the radio work is on @fx's channel, start the
+ * next queued exchange for the same channel straight away so that it shares
+ * the remain-on-channel period instead of waiting for its turn.  Frames are
+ * still only transmitted one at a time, the next one once the current one
+ * has been assigned a cookie, so that the TX status events can be matched.
+ * If the owner is cancelled the pipelined exchanges go back to waiting for
+ * their own work items.
+ */
+static void frame_xchg_pipeline_next(struct frame_xchg_data *fx)
+{
+	struct frame_xchg_data *leader = fx->leader ?: fx;
+	struct frame_xchg_data *next;
+
+	if (leader->done_pending ||
+			leader->pipelined_cnt + 1 >= FRAME_XCHG_PIPELINE_MAX)
+		return;
+
+	if (wiphy_radio_work_is_running(wiphy_find_by_wdev(leader->wdev_id),
+					leader->work.id) != 1)
+		return;
+
+	next = l_queue_find(frame_xchgs, frame_xchg_match_pipeline_candidate,
+				leader);
+	if (!next)
+		return;
+
+	l_debug("Pipelining work item %u with %u", next->work.id,
+		leader->work.id);
+
+	next->leader = leader;
+	leader->pipelined_cnt++;
+	frame_xchg_tx_retry(&next->work);
+}
+
 static void frame_xchg_tx_cb(struct l_genl_msg *msg, void *user_data)
 {
 	struct frame_xchg_data *fx = user_data;
@@ -931,6 +1282,8 @@ static void frame_xchg_tx_cb(struct l_genl_msg *msg, void *user_data)
 	fx->have_cookie = true;
 	fx->cookie = cookie;
 
+	frame_xchg_pipeline_next(fx);
+
 	if (early_status)
 		frame_xchg_tx_status(fx, fx->tx_acked);
 
@@ -939,12 +1292,42 @@ error:
 	frame_xchg_done(fx, error);
 }
 
+static bool frame_xchg_match_tx_pending(const void *a, const void *b)
+{
+	const struct frame_xchg_data *fx = a;
+	const struct frame_xchg_data *other = b;
+
+	return fx != other && fx->wdev_id == other->wdev_id && fx->tx_cmd_id;
+}
+
 static bool frame_xchg_tx_retry(struct wiphy_radio_work_item *item)
 {
 	struct frame_xchg_data *fx = l_container_of(item,
 						struct frame_xchg_data, work);
 	struct l_genl_msg *msg;
 	uint32_t duration = fx->resp_timeout;
+	uint64_t now = l_time_now();
+
+	/*
+	 * TX status events received before the cookie can only be matched
+	 * to an exchange if it's the only one waiting for its cookie.  If
+	 * an exchange pipelined with this one is sending, try again shortly.
+	 */
+	if (l_queue_find(frame_xchgs, frame_xchg_match_tx_pending, fx)) {
+		fx->timeout = l_timeout_create_ms(FRAME_XCHG_TX_DEFER_MS,
+						frame_xchg_timeout_cb, fx,
+						frame_xchg_timeout_destroy);
+		return false;
+	}
+
+	/*
+	 * A pipelined exchange that will be done listening before the
+	 * owner's remain-on-channel period ends doesn't need its own.
+	 */
+	if (fx->leader && duration && l_time_before(
+				l_time_offset(now, duration * L_USEC_PER_MSEC),
+				fx->leader->roc_end))
+		duration = 0;
 
 	/*
 	 * TODO: in Station, AP, P2P-Client, GO or Ad-Hoc modes if we're
@@ -971,6 +1354,9 @@ static bool frame_xchg_tx_retry(struct wiphy_radio_work_item *item)
 		l_genl_msg_append_attr(msg, NL80211_ATTR_DURATION, 4,
 					&duration);
 
+	fx->roc_end = duration ?
+		l_time_offset(now, duration * L_USEC_PER_MSEC) : 0;
+
 	fx->tx_cmd_id = l_genl_family_send(nl80211, msg, frame_xchg_tx_cb, fx,
 						NULL);
 	if (!fx->tx_cmd_id) {
@@ -1078,6 +1464,33 @@ static bool frame_xchg_match_running(const void *a, const void *b)
 	return fx->retry_cnt > 0 && fx->wdev_id == *wdev_id;
 }
 
+struct frame_xchg_cookie_info {
+	uint64_t wdev_id;
+	uint64_t cookie;
+};
+
+static bool frame_xchg_match_cookie(const void *a, const void *b)
+{
+	const struct frame_xchg_data *fx = a;
+	const struct frame_xchg_cookie_info *info = b;
+
+	return fx->retry_cnt > 0 && fx->wdev_id == info->wdev_id &&
+		fx->have_cookie && fx->cookie == info->cookie;
+}
+
+/*
+ * Only an exchange whose frame command is still pending can be missing the
+ * cookie of the frame the TX status is for.  One waiting to retry has
+ * cleared its cookie too but has nothing in flight.
+ */
+static bool frame_xchg_match_no_cookie(const void *a, const void *b)
+{
+	const struct frame_xchg_data *fx = a;
+
+	return frame_xchg_match_running(a, b) && !fx->have_cookie &&
+		fx->tx_cmd_id;
+}
+
 /*
  * Send an action frame described by @frame.  If @retry_interval is
  * non-zero and we receive no ACK from @peer to any of the retransmissions
@@ -1092,6 +1505,10 @@ static bool frame_xchg_match_running(const void *a, const void *b)
  * no frame callback returned @true, or immediately after the ACK if
  * @resp_timeout was 0.  @frame is an iovec array terminated by an iovec
  * struct with NULL-iov_base.
+ *
+ * Exchanges on the same wdev and frequency but with different peers may be
+ * started while another one is in progress, sharing its time on the channel,
+ * so the callbacks should not assume exchanges are strictly sequential.
  */
 uint32_t frame_xchg_start(uint64_t wdev_id, struct iovec *frame, uint32_t freq,
 			unsigned int retry_interval, unsigned int resp_timeout,
@@ -1213,8 +1630,8 @@ uint32_t frame_xchg_startv(uint64_t wdev_id, struct iovec *frame, uint32_t freq,
 	 * wait on channel) are introduced.
 	 */
 	return wiphy_radio_work_insert(wiphy_find_by_wdev(wdev_id),
-					&fx->work, WIPHY_WORK_PRIORITY_FRAME,
-					&work_ops);
+					&fx->work, wdev_id,
+					WIPHY_WORK_PRIORITY_FRAME, &work_ops);
 }
 
 static bool frame_xchg_cancel_by_wdev(void *data, void *user_data)
@@ -1261,6 +1678,7 @@ static void frame_xchg_mlme_notify(struct l_genl_msg *msg, void *user_data)
 	uint64_t cookie;
 	bool ack;
 	uint8_t cmd = l_genl_msg_get_command(msg);
+	struct frame_xchg_cookie_info info;
 
 	switch (cmd) {
 	case NL80211_CMD_FRAME_TX_STATUS:
@@ -1270,8 +1688,17 @@ static void frame_xchg_mlme_notify(struct l_genl_msg *msg, void *user_data)
 					NL80211_ATTR_UNSPEC) < 0)
 			return;
 
-		fx = l_queue_find(frame_xchgs, frame_xchg_match_running,
-					&wdev_id);
+		/*
+		 * With pipelining there may be multiple exchanges running,
+		 * at most one of which is still waiting for its cookie.
+		 */
+		info.wdev_id = wdev_id;
+		info.cookie = cookie;
+		fx = l_queue_find(frame_xchgs, frame_xchg_match_cookie, &info);
+		if (!fx)
+			fx = l_queue_find(frame_xchgs,
+						frame_xchg_match_no_cookie,
+						&wdev_id);
 		if (!fx)
 			return;
 
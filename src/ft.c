@@ -962,6 +962,7 @@ int ft_action(uint32_t ifindex, uint32_t freq, const struct scan_bss *target)
 	info->timeout = l_timeout_create_ms(200, ft_ds_timeout, info, NULL);
 
 	wiphy_radio_work_insert(netdev_get_wiphy(netdev), &info->work,
+				netdev_get_wdev_id(netdev),
 				WIPHY_WORK_PRIORITY_FT, &ft_ops);
 
 	return 0;
@@ -1112,6 +1113,7 @@ int ft_authenticate_onchannel(uint32_t ifindex, const struct scan_bss *target)
 	info->onchannel = true;
 
 	wiphy_radio_work_insert(netdev_get_wiphy(netdev), &info->work,
+				netdev_get_wdev_id(netdev),
 				WIPHY_WORK_PRIORITY_FT, &ft_onchannel_ops);
 	l_queue_push_tail(info_list, info);
 
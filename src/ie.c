@@ -87,6 +87,157 @@ bool ie_tlv_iter_next(struct ie_tlv_iter *iter)
 	return true;
 }
 
+void ie_index_init(struct ie_index *index, const unsigned char *ies,
+			size_t len)
+{
+	struct ie_tlv_iter iter;
+	unsigned int i;
+
+	index->ies = ies;
+	index->len = len;
+	index->entries = index->inline_entries;
+	index->n_entries = 0;
+	index->max_entries = L_ARRAY_SIZE(index->inline_entries);
+	memset(index->present, 0, sizeof(index->present));
+
+	ie_tlv_iter_init(&iter, ies, len);
+
+	while (ie_tlv_iter_next(&iter)) {
+		struct ie_index_entry *entry;
+
+		/* Positions are stored + 1 in a uint16_t */
+		if (L_WARN_ON(index->n_entries == UINT16_MAX))
+			break;
+
+		if (index->n_entries == index->max_entries) {
+			index->max_entries *= 4;
+
+			if (index->entries == index->inline_entries)
+				index->entries = l_memdup(index->inline_entries,
+						sizeof(index->inline_entries));
+
+			index->entries = l_realloc(index->entries,
+						index->max_entries *
+						sizeof(*index->entries));
+		}
+
+		entry = &index->entries[index->n_entries++];
+		entry->data = iter.data;
+		entry->tag = iter.tag;
+		entry->len = iter.len;
+	}
+
+	/*
+	 * Link the elements with the same tag walking backwards so that the
+	 * chain heads end up pointing at the first occurrence.
+	 */
+	for (i = index->n_entries; i > 0; i--) {
+		struct ie_index_entry *entry = &index->entries[i - 1];
+
+		if (test_bit(index->present, entry->tag))
+			entry->next = index->first[entry->tag];
+		else {
+			entry->next = 0;
+			set_bit(index->present, entry->tag);
+		}
+
+		index->first[entry->tag] = i;
+	}
+}
+
+void ie_index_free(struct ie_index *index)
+{
+	if (index->entries != index->inline_entries)
+		l_free(index->entries);
+
+	index->entries = NULL;
+	index->n_entries = 0;
+}
+
+const struct ie_index_entry *ie_index_find(const struct ie_index *index,
+						unsigned int tag)
+{
+	if (tag >= IE_INDEX_MAX_TAG || !test_bit(index->present, tag))
+		return NULL;
+
+	return &index->entries[index->first[tag] - 1];
+}
+
+/* Returns the next element with the same tag as @entry */
+const struct ie_index_entry *ie_index_next(const struct ie_index *index,
+					const struct ie_index_entry *entry)
+{
+	if (!entry->next)
+		return NULL;
+
+	return &index->entries[entry->next - 1];
+}
+
+/* Returns the first Vendor Specific element with a given OUI + type */
+const struct ie_index_entry *ie_index_find_vendor(const struct ie_index *index,
+						const unsigned char oui[],
+						uint8_t type)
+{
+	const struct ie_index_entry *entry;
+
+	for (entry = ie_index_find(index, IE_TYPE_VENDOR_SPECIFIC); entry;
+			entry = ie_index_next(index, entry))
+		if (entry->len >= 4 && !memcmp(entry->data, oui, 3) &&
+				entry->data[3] == type)
+			return entry;
+
+	return NULL;
+}
+
+static bool ie_is_vendor_ie(const unsigned char *data, unsigned int len,
+				const unsigned char oui[], unsigned char type)
+{
+	return len >= 4 && !memcmp(data, oui, 3) && data[3] == type;
+}
+
+/*
+ * Range of the IE buffer holding all the vendor IEs with a given OUI + type,
+ * the fragments are normally adjacent so copying the payloads only needs to
+ * look at the IEs within this range rather than the whole buffer again.
+ */
+struct ie_vendor_span {
+	const unsigned char *start;
+	const unsigned char *end;
+	size_t payload_len;
+	bool found;
+};
+
+static void ie_vendor_span_add(struct ie_vendor_span *span,
+				const struct ie_tlv_iter *iter)
+{
+	if (!span->found)
+		span->start = iter->data - 2;
+
+	span->end = iter->data + iter->len;
+	span->payload_len += iter->len - 4;
+	span->found = true;
+}
+
+static void ie_vendor_span_copy(const struct ie_vendor_span *span,
+				const unsigned char oui[], unsigned char type,
+				unsigned char *out)
+{
+	struct ie_tlv_iter iter;
+
+	ie_tlv_iter_init(&iter, span->start, span->end - span->start);
+
+	while (ie_tlv_iter_next(&iter)) {
+		if (ie_tlv_iter_get_tag(&iter) != IE_TYPE_VENDOR_SPECIFIC)
+			continue;
+
+		if (!ie_is_vendor_ie(iter.data, iter.len, oui, type))
+			continue;
+
+		memcpy(out, iter.data + 4, iter.len - 4);
+		out += iter.len - 4;
+	}
+}
+
 /*
  * Concatenate all vendor IEs with a given OUI + type.
  *
@@ -103,11 +254,8 @@ static void *ie_tlv_vendor_ie_concat(const unsigned char oui[],
 					ssize_t *out_len)
 {
 	struct ie_tlv_iter iter;
-	const unsigned char *data;
-	unsigned int ie_len;
-	unsigned int concat_len = 0;
+	struct ie_vendor_span span = {};
 	unsigned char *ret;
-	bool ie_found = false;
 
 	ie_tlv_iter_init(&iter, ies, len);
 
@@ -115,56 +263,22 @@ static void *ie_tlv_vendor_ie_concat(const unsigned char oui[],
 		if (ie_tlv_iter_get_tag(&iter) != IE_TYPE_VENDOR_SPECIFIC)
 			continue;
 
-		ie_len = ie_tlv_iter_get_length(&iter);
-		if (ie_len < 4)
-			continue;
-
-		data = ie_tlv_iter_get_data(&iter);
-
-		if (memcmp(data, oui, 3))
-			continue;
-
-		if (data[3] != type)
-			continue;
-
-		concat_len += ie_len - 4;
-		ie_found = true;
+		if (ie_is_vendor_ie(iter.data, iter.len, oui, type))
+			ie_vendor_span_add(&span, &iter);
 	}
 
-	if (concat_len == 0) {
+	if (span.payload_len == 0) {
 		if (out_len)
-			*out_len = (ie_found && empty_ok) ? 0 : -ENOENT;
+			*out_len = (span.found && empty_ok) ? 0 : -ENOENT;
 
 		return NULL;
 	}
 
-	ie_tlv_iter_init(&iter, ies, len);
-	ret = l_malloc(concat_len);
-
-	concat_len = 0;
-
-	while (ie_tlv_iter_next(&iter)) {
-		if (ie_tlv_iter_get_tag(&iter) != IE_TYPE_VENDOR_SPECIFIC)
-			continue;
-
-		ie_len = ie_tlv_iter_get_length(&iter);
-		if (ie_len < 4)
-			continue;
-
-		data = ie_tlv_iter_get_data(&iter);
-
-		if (memcmp(data, oui, 3))
-			continue;
-
-		if (data[3] != type)
-			continue;
-
-		memcpy(ret + concat_len, data + 4, ie_len - 4);
-		concat_len += ie_len - 4;
-	}
+	ret = l_malloc(span.payload_len);
+	ie_vendor_span_copy(&span, oui, type, ret);
 
 	if (out_len)
-		*out_len = concat_len;
+		*out_len = span.payload_len;
 
 	return ret;
 }
@@ -219,6 +333,121 @@ void *ie_tlv_extract_wfd_payload(const unsigned char *ies, size_t len,
 					ies, len, true, out_len);
 }
 
+enum ie_vendor_concat {
+	IE_VENDOR_CONCAT_WSC,
+	IE_VENDOR_CONCAT_P2P,
+	IE_VENDOR_CONCAT_WFD,
+	__IE_VENDOR_CONCAT_COUNT,
+};
+
+static const struct {
+	const unsigned char *oui;
+	unsigned char type;
+	bool empty_ok;
+} ie_vendor_concat_info[] = {
+	[IE_VENDOR_CONCAT_WSC] = { microsoft_oui, 0x04, false },
+	[IE_VENDOR_CONCAT_P2P] = { wifi_alliance_oui, 0x09, true },
+	[IE_VENDOR_CONCAT_WFD] = { wifi_alliance_oui, 0x0a, true },
+};
+
+static void ie_vendor_payload_set(const struct ie_vendor_span *spans,
+					const uint8_t **payloads,
+					enum ie_vendor_concat which,
+					const uint8_t **out, ssize_t *out_len)
+{
+	const struct ie_vendor_span *span = &spans[which];
+	bool empty_ok = ie_vendor_concat_info[which].empty_ok;
+
+	if (span->payload_len) {
+		*out = payloads[which];
+		*out_len = span->payload_len;
+	} else {
+		*out = NULL;
+		*out_len = (span->found && empty_ok) ? 0 : -ENOENT;
+	}
+}
+
+/*
+ * Extract the payloads of the WSC, P2P and WFD IEs, concatenated the same way
+ * as the ie_tlv_extract_*_payload functions, along with the first HS2.0
+ * Indication, OWE Transition Mode and DPP Configurator Connectivity IEs, all
+ * in one pass over @ies.
+ *
+ * The concatenated payloads are written into @scratch, @scratch_len equal to
+ * @len is always enough.  The pointers in @out are only valid as long as
+ * @scratch and @ies are.  Returns -EMSGSIZE if @scratch is too small.
+ */
+int ie_tlv_extract_vendor_payloads(const uint8_t *ies, size_t len,
+					uint8_t *scratch, size_t scratch_len,
+					struct ie_vendor_payloads *out)
+{
+	struct ie_vendor_span spans[__IE_VENDOR_CONCAT_COUNT] = {};
+	struct ie_tlv_iter iter;
+	const uint8_t *payloads[__IE_VENDOR_CONCAT_COUNT];
+	size_t total = 0;
+	unsigned int i;
+
+	memset(out, 0, sizeof(*out));
+
+	ie_tlv_iter_init(&iter, ies, len);
+
+	while (ie_tlv_iter_next(&iter)) {
+		const uint8_t *data = iter.data;
+
+		if (ie_tlv_iter_get_tag(&iter) != IE_TYPE_VENDOR_SPECIFIC ||
+				iter.len < 4)
+			continue;
+
+		for (i = 0; i < __IE_VENDOR_CONCAT_COUNT; i++)
+			if (ie_is_vendor_ie(data, iter.len,
+					ie_vendor_concat_info[i].oui,
+					ie_vendor_concat_info[i].type))
+				break;
+
+		if (i < __IE_VENDOR_CONCAT_COUNT) {
+			ie_vendor_span_add(&spans[i], &iter);
+			continue;
+		}
+
+		if (!out->hs20_indication && is_ie_wfa_ie(data, iter.len,
+						IE_WFA_OI_HS20_INDICATION))
+			out->hs20_indication = data - 2;
+		else if (!out->owe_transition && is_ie_wfa_ie(data, iter.len,
+						IE_WFA_OI_OWE_TRANSITION))
+			out->owe_transition = data - 2;
+		else if (!out->dpp_configurator_connectivity &&
+				is_ie_wfa_ie(data, iter.len,
+					IE_WFA_OI_CONFIGURATOR_CONNECTIVITY))
+			out->dpp_configurator_connectivity = data - 2;
+	}
+
+	for (i = 0; i < __IE_VENDOR_CONCAT_COUNT; i++)
+		total += spans[i].payload_len;
+
+	if (total > scratch_len)
+		return -EMSGSIZE;
+
+	for (i = 0; i < __IE_VENDOR_CONCAT_COUNT; i++) {
+		payloads[i] = scratch;
+
+		if (!spans[i].payload_len)
+			continue;
+
+		ie_vendor_span_copy(&spans[i], ie_vendor_concat_info[i].oui,
+					ie_vendor_concat_info[i].type, scratch);
+		scratch += spans[i].payload_len;
+	}
+
+	ie_vendor_payload_set(spans, payloads, IE_VENDOR_CONCAT_WSC,
+				&out->wsc, &out->wsc_len);
+	ie_vendor_payload_set(spans, payloads, IE_VENDOR_CONCAT_P2P,
+				&out->p2p, &out->p2p_len);
+	ie_vendor_payload_set(spans, payloads, IE_VENDOR_CONCAT_WFD,
+				&out->wfd, &out->wfd_len);
+
+	return 0;
+}
+
 /*
  * Encapsulate & Fragment data into Vendor IE with a given OUI + type
  *
@@ -438,6 +438,52 @@ struct ie_tlv_iter {
 	const unsigned char *data;
 };
 
+/*
+ * Tags 0..255 are the regular Element IDs, Extended Element IDs are mapped
+ * to 256 + Element ID Extension the same way ie_tlv_iter_next does it.
+ */
+#define IE_INDEX_MAX_TAG	512
+#define IE_INDEX_INLINE_ENTRIES	32
+
+struct ie_index_entry {
+	const unsigned char *data;
+	uint16_t tag;
+	uint8_t len;
+	uint16_t next;	/* Position + 1 of the next element with this tag */
+};
+
+/*
+ * One-pass index of an IE buffer.  All the elements are recorded in frame
+ * order in @entries, and the elements sharing a tag are chained through
+ * ie_index_entry.next so that lookups and duplicate checks don't need to
+ * walk the buffer again.  Elements past the first malformed one are not
+ * indexed, matching what ie_tlv_iter_next would return.
+ */
+struct ie_index {
+	const unsigned char *ies;
+	size_t len;
+	struct ie_index_entry *entries;
+	unsigned int n_entries;
+	unsigned int max_entries;
+	uint8_t present[IE_INDEX_MAX_TAG / 8];
+	uint16_t first[IE_INDEX_MAX_TAG];
+	struct ie_index_entry inline_entries[IE_INDEX_INLINE_ENTRIES];
+};
+
+struct ie_vendor_payloads {
+	/* Concatenated payloads, -ENOENT lengths if not present */
+	const uint8_t *wsc;
+	ssize_t wsc_len;
+	const uint8_t *p2p;
+	ssize_t p2p_len;
+	const uint8_t *wfd;
+	ssize_t wfd_len;
+	/* Whole IEs, first instance only */
+	const uint8_t *hs20_indication;
+	const uint8_t *owe_transition;
+	const uint8_t *dpp_configurator_connectivity;
+};
+
 #define MAX_BUILDER_SIZE (8 * 1024)
 
 struct ie_tlv_builder {
@@ -598,6 +644,29 @@ static inline const unsigned char *ie_tlv_iter_get_data(
 	return iter->data;
 }
 
+void ie_index_init(struct ie_index *index, const unsigned char *ies,
+			size_t len);
+void ie_index_free(struct ie_index *index);
+const struct ie_index_entry *ie_index_find(const struct ie_index *index,
+						unsigned int tag);
+const struct ie_index_entry *ie_index_next(const struct ie_index *index,
+					const struct ie_index_entry *entry);
+const struct ie_index_entry *ie_index_find_vendor(const struct ie_index *index,
+						const unsigned char oui[],
+						uint8_t type);
+
+/* Set up @iter so that it can be passed to the ie_parse_* functions */
+static inline void ie_index_entry_to_iter(const struct ie_index_entry *entry,
+						struct ie_tlv_iter *iter)
+{
+	iter->tlv = entry->data;
+	iter->max = entry->len;
+	iter->pos = entry->len;
+	iter->tag = entry->tag;
+	iter->len = entry->len;
+	iter->data = entry->data;
+}
+
 void *ie_tlv_extract_wsc_payload(const uint8_t *ies, size_t len,
 							ssize_t *out_len);
 void *ie_tlv_encapsulate_wsc_payload(const uint8_t *data, size_t len,
@@ -611,6 +680,10 @@ void *ie_tlv_encapsulate_p2p_payload(const uint8_t *data, size_t len,
 void *ie_tlv_extract_wfd_payload(const unsigned char *ies, size_t len,
 							ssize_t *out_len);
 
+int ie_tlv_extract_vendor_payloads(const uint8_t *ies, size_t len,
+					uint8_t *scratch, size_t scratch_len,
+					struct ie_vendor_payloads *out);
+
 bool ie_tlv_builder_init(struct ie_tlv_builder *builder, unsigned char *buf,
 				size_t len);
 bool ie_tlv_builder_set_length(struct ie_tlv_builder *builder,
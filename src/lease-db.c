@@ -0,0 +1,409 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  iwd contributors. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <ell/ell.h>
+
+#include "src/util.h"
+#include "src/lease-db.h"
+
+/*
+ * DHCP lease store for AP mode.  Leases are indexed both by client MAC and
+ * by address in hash tables so that lookups stay cheap with thousands of
+ * clients.
+ *
+ * Changes are persisted to an append-only log with one text record per line:
+ *
+ *	<mac> <address> <expiry>
+ *
+ * where an expiry of 0 marks the lease as released.  The log is replayed and
+ * rewritten in compacted form when opened, and compacted again once it has
+ * grown well beyond the number of live leases.
+ */
+
+#define LEASE_DB_MAX_POOL_SIZE	(1 << 24)
+#define LEASE_DB_COMPACT_SLACK	64
+
+struct lease_db {
+	uint32_t start;
+	uint32_t end;
+	struct l_hashmap *entries;
+	struct l_hashmap *addrs;
+	char *path;
+	int log_fd;
+	unsigned int log_records;
+};
+
+struct lease_db *lease_db_new(uint32_t start, uint32_t end)
+{
+	struct lease_db *db;
+
+	if (start == 0 || end < start ||
+			end - start >= LEASE_DB_MAX_POOL_SIZE)
+		return NULL;
+
+	db = l_new(struct lease_db, 1);
+	db->start = start;
+	db->end = end;
+	db->entries = l_hashmap_new();
+	db->addrs = l_hashmap_new();
+	db->log_fd = -1;
+
+	l_hashmap_set_hash_function(db->entries, util_address_hash);
+	l_hashmap_set_compare_function(db->entries, util_address_compare);
+
+	return db;
+}
+
+void lease_db_free(struct lease_db *db)
+{
+	if (!db)
+		return;
+
+	if (db->log_fd >= 0)
+		close(db->log_fd);
+
+	l_hashmap_destroy(db->addrs, NULL);
+	l_hashmap_destroy(db->entries, l_free);
+	l_free(db->path);
+	l_free(db);
+}
+
+static int lease_db_format(const uint8_t *mac, uint32_t addr, uint64_t expiry,
+				char *buf, size_t len)
+{
+	struct in_addr ia = { .s_addr = htonl(addr) };
+	char addr_str[INET_ADDRSTRLEN];
+
+	inet_ntop(AF_INET, &ia, addr_str, sizeof(addr_str));
+
+	return snprintf(buf, len, "%s %s %" PRIu64 "\n",
+			util_address_to_string(mac), addr_str, expiry);
+}
+
+static bool lease_db_parse(const char *line, uint8_t *mac, uint32_t *addr,
+				uint64_t *expiry)
+{
+	char mac_str[18];
+	char addr_str[INET_ADDRSTRLEN];
+	struct in_addr ia;
+
+	if (sscanf(line, "%17s %15s %" SCNu64, mac_str, addr_str,
+			expiry) != 3)
+		return false;
+
+	if (!util_string_to_address(mac_str, mac))
+		return false;
+
+	if (inet_pton(AF_INET, addr_str, &ia) != 1)
+		return false;
+
+	*addr = ntohl(ia.s_addr);
+	return true;
+}
+
+static void lease_db_log(struct lease_db *db, const uint8_t *mac,
+				uint32_t addr, uint64_t expiry)
+{
+	char buf[64];
+	int len;
+
+	if (db->log_fd < 0)
+		return;
+
+	len = lease_db_format(mac, addr, expiry, buf, sizeof(buf));
+
+	if (write(db->log_fd, buf, len) != len) {
+		l_error("Writing lease log %s failed: %s", db->path,
+			strerror(errno));
+		return;
+	}
+
+	db->log_records++;
+}
+
+static void lease_db_remove_entry(struct lease_db *db, const uint8_t *mac)
+{
+	struct lease_db_entry *entry = l_hashmap_remove(db->entries, mac);
+
+	if (!entry)
+		return;
+
+	l_hashmap_remove(db->addrs, L_UINT_TO_PTR(entry->addr));
+	l_free(entry);
+}
+
+static void lease_db_set_entry(struct lease_db *db, const uint8_t *mac,
+				uint32_t addr, uint64_t expiry)
+{
+	struct lease_db_entry *entry = l_hashmap_lookup(db->entries, mac);
+	struct lease_db_entry *other = l_hashmap_lookup(db->addrs,
+							L_UINT_TO_PTR(addr));
+
+	/* Each address is stored for one client at most, the newest wins */
+	if (other && other != entry)
+		lease_db_remove_entry(db, other->mac);
+
+	if (!entry) {
+		entry = l_new(struct lease_db_entry, 1);
+		memcpy(entry->mac, mac, 6);
+		l_hashmap_insert(db->entries, entry->mac, entry);
+	} else if (entry->addr != addr)
+		l_hashmap_remove(db->addrs, L_UINT_TO_PTR(entry->addr));
+
+	entry->addr = addr;
+	entry->expiry = expiry;
+	l_hashmap_replace(db->addrs, L_UINT_TO_PTR(addr), entry, NULL);
+}
+
+struct lease_db_compact_data {
+	struct l_string *buf;
+	unsigned int count;
+};
+
+static void lease_db_compact_entry(const void *key, void *value,
+					void *user_data)
+{
+	const struct lease_db_entry *entry = value;
+	struct lease_db_compact_data *data = user_data;
+	char line[64];
+
+	lease_db_format(entry->mac, entry->addr, entry->expiry,
+			line, sizeof(line));
+	l_string_append(data->buf, line);
+	data->count++;
+}
+
+/* Rewrite the log with only the live leases and reopen it for appending */
+static int lease_db_compact(struct lease_db *db)
+{
+	struct lease_db_compact_data data = {};
+	_auto_(l_free) char *tmp_path = l_strdup_printf("%s.tmp", db->path);
+	_auto_(l_free) char *contents = NULL;
+	size_t len;
+	int fd;
+
+	data.buf = l_string_new(l_hashmap_size(db->entries) * 48 + 1);
+	l_hashmap_foreach(db->entries, lease_db_compact_entry, &data);
+	contents = l_string_unwrap(data.buf);
+	len = strlen(contents);
+
+	fd = L_TFR(open(tmp_path, O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC,
+				0600));
+	if (fd < 0)
+		return -errno;
+
+	if (L_TFR(write(fd, contents, len)) != (ssize_t) len ||
+			L_TFR(fsync(fd)) < 0) {
+		int err = -errno;
+
+		close(fd);
+		unlink(tmp_path);
+		return err;
+	}
+
+	close(fd);
+
+	if (rename(tmp_path, db->path) < 0) {
+		int err = -errno;
+
+		unlink(tmp_path);
+		return err;
+	}
+
+	if (db->log_fd >= 0)
+		close(db->log_fd);
+
+	db->log_fd = L_TFR(open(db->path, O_WRONLY | O_APPEND | O_CLOEXEC));
+	if (db->log_fd < 0)
+		return -errno;
+
+	db->log_records = data.count;
+	return 0;
+}
+
+static void lease_db_maybe_compact(struct lease_db *db)
+{
+	if (db->log_fd < 0)
+		return;
+
+	if (db->log_records < 2 * l_hashmap_size(db->entries) +
+				LEASE_DB_COMPACT_SLACK)
+		return;
+
+	if (lease_db_compact(db) < 0)
+		l_error("Compacting lease log %s failed", db->path);
+}
+
+struct lease_db_expire_data {
+	struct lease_db *db;
+	uint64_t now;
+};
+
+static bool lease_db_expire_entry(const void *key, void *value,
+					void *user_data)
+{
+	struct lease_db_entry *entry = value;
+	struct lease_db_expire_data *data = user_data;
+
+	if (entry->expiry > data->now)
+		return false;
+
+	l_hashmap_remove(data->db->addrs, L_UINT_TO_PTR(entry->addr));
+	l_free(entry);
+	return true;
+}
+
+/*
+ * Replay the log at @path, dropping leases that expired before @now or that
+ * are outside of the current pool (the subnet may have changed since the
+ * leases were written), then compact it.  A missing log is not an error.
+ */
+int lease_db_open(struct lease_db *db, const char *path, uint64_t now)
+{
+	struct lease_db_expire_data expire_data = { .db = db, .now = now };
+	_auto_(l_free) char *contents = NULL;
+	size_t len;
+	char **lines;
+	unsigned int i;
+
+	if (L_WARN_ON(db->path))
+		return -EALREADY;
+
+	db->path = l_strdup(path);
+
+	contents = l_file_get_contents(path, &len);
+	if (contents) {
+		contents = l_realloc(contents, len + 1);
+		contents[len] = '\0';
+		lines = l_strsplit(contents, '\n');
+
+		for (i = 0; lines[i]; i++) {
+			uint8_t mac[6];
+			uint32_t addr;
+			uint64_t expiry;
+
+			if (!lease_db_parse(lines[i], mac, &addr, &expiry))
+				continue;
+
+			if (expiry == 0 || addr < db->start || addr > db->end) {
+				lease_db_remove_entry(db, mac);
+				continue;
+			}
+
+			lease_db_set_entry(db, mac, addr, expiry);
+		}
+
+		l_strfreev(lines);
+	}
+
+	l_hashmap_foreach_remove(db->entries, lease_db_expire_entry,
+					&expire_data);
+
+	return lease_db_compact(db);
+}
+
+const struct lease_db_entry *lease_db_lookup(struct lease_db *db,
+						const uint8_t *mac)
+{
+	return l_hashmap_lookup(db->entries, mac);
+}
+
+/*
+ * The DHCP server is authoritative: if it has handed out an address still
+ * stored for another client, which can happen once the stored client has
+ * been gone long enough, that stale lease is dropped.
+ */
+bool lease_db_set(struct lease_db *db, const uint8_t *mac, uint32_t addr,
+			uint64_t expiry)
+{
+	const struct lease_db_entry *other;
+
+	if (addr < db->start || addr > db->end)
+		return false;
+
+	other = l_hashmap_lookup(db->addrs, L_UINT_TO_PTR(addr));
+	if (other && memcmp(other->mac, mac, 6)) {
+		l_debug("Dropping the stored lease of "MAC", reassigned to "
+			MAC, MAC_STR(other->mac), MAC_STR(mac));
+		lease_db_log(db, other->mac, addr, 0);
+	}
+
+	lease_db_set_entry(db, mac, addr, expiry);
+	lease_db_log(db, mac, addr, expiry);
+	lease_db_maybe_compact(db);
+	return true;
+}
+
+bool lease_db_remove(struct lease_db *db, const uint8_t *mac)
+{
+	const struct lease_db_entry *entry = l_hashmap_lookup(db->entries, mac);
+
+	if (!entry)
+		return false;
+
+	lease_db_log(db, mac, entry->addr, 0);
+	lease_db_remove_entry(db, mac);
+	lease_db_maybe_compact(db);
+	return true;
+}
+
+unsigned int lease_db_count(struct lease_db *db)
+{
+	return l_hashmap_size(db->entries);
+}
+
+struct lease_db_foreach_data {
+	lease_db_foreach_func_t func;
+	void *user_data;
+};
+
+static void lease_db_foreach_entry(const void *key, void *value,
+					void *user_data)
+{
+	struct lease_db_foreach_data *data = user_data;
+
+	data->func(value, data->user_data);
+}
+
+void lease_db_foreach(struct lease_db *db, lease_db_foreach_func_t func,
+			void *user_data)
+{
+	struct lease_db_foreach_data data = {
+		.func = func,
+		.user_data = user_data,
+	};
+
+	l_hashmap_foreach(db->entries, lease_db_foreach_entry, &data);
+}
@@ -0,0 +1,46 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  iwd contributors. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+struct lease_db;
+
+struct lease_db_entry {
+	uint8_t mac[6];
+	uint32_t addr;		/* Host byte order */
+	uint64_t expiry;	/* Wall clock, seconds since the Epoch */
+};
+
+typedef void (*lease_db_foreach_func_t)(const struct lease_db_entry *entry,
+					void *user_data);
+
+struct lease_db *lease_db_new(uint32_t start, uint32_t end);
+void lease_db_free(struct lease_db *db);
+
+int lease_db_open(struct lease_db *db, const char *path, uint64_t now);
+
+const struct lease_db_entry *lease_db_lookup(struct lease_db *db,
+						const uint8_t *mac);
+bool lease_db_set(struct lease_db *db, const uint8_t *mac, uint32_t addr,
+			uint64_t expiry);
+bool lease_db_remove(struct lease_db *db, const uint8_t *mac);
+unsigned int lease_db_count(struct lease_db *db);
+void lease_db_foreach(struct lease_db *db, lease_db_foreach_func_t func,
+			void *user_data);
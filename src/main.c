@@ -93,6 +93,12 @@ static void iwd_shutdown(void)
 	timeout = l_timeout_create(1, main_loop_quit, NULL, NULL);
 }
 
+static void stats_signal_cb(void *user_data)
+{
+	crypto_stats_log();
+	wiphy_radio_work_stats_log();
+}
+
 static void signal_handler(uint32_t signo, void *user_data)
 {
 	switch (signo) {
@@ -242,10 +248,63 @@ static struct l_dbus_message *iwd_dbus_get_info(struct l_dbus *dbus,
 	return reply;
 }
 
+static struct l_dbus_message *iwd_dbus_get_crypto_stats(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct l_dbus_message *reply;
+	struct l_dbus_message_builder *builder;
+	unsigned int i, j;
+
+	reply = l_dbus_message_new_method_return(message);
+	builder = l_dbus_message_builder_new(reply);
+
+	l_dbus_message_builder_enter_array(builder, "a{sv}");
+
+	for (i = 0; i < __CRYPTO_STAT_MAX; i++) {
+		const struct crypto_stat_info *info = crypto_stat_get(i);
+
+		l_dbus_message_builder_enter_array(builder, "{sv}");
+		dbus_append_dict_basic(builder, "Name", 's',
+					crypto_stat_to_str(i));
+		dbus_append_dict_basic(builder, "Count", 't', &info->count);
+		dbus_append_dict_basic(builder, "TotalTime", 't',
+					&info->total_usec);
+		dbus_append_dict_basic(builder, "MaxTime", 't',
+					&info->max_usec);
+
+		l_dbus_message_builder_enter_dict(builder, "sv");
+		l_dbus_message_builder_append_basic(builder, 's', "Histogram");
+		l_dbus_message_builder_enter_variant(builder, "au");
+		l_dbus_message_builder_enter_array(builder, "u");
+
+		for (j = 0; j < CRYPTO_STAT_BUCKETS; j++)
+			l_dbus_message_builder_append_basic(builder, 'u',
+							&info->histogram[j]);
+
+		l_dbus_message_builder_leave_array(builder);
+		l_dbus_message_builder_leave_variant(builder);
+		l_dbus_message_builder_leave_dict(builder);
+
+		l_dbus_message_builder_leave_array(builder);
+	}
+
+	l_dbus_message_builder_leave_array(builder);
+	l_dbus_message_builder_finalize(builder);
+	l_dbus_message_builder_destroy(builder);
+
+	return reply;
+}
+
 static void iwd_setup_deamon_interface(struct l_dbus_interface *interface)
 {
 	l_dbus_interface_method(interface, "GetInfo", 0, iwd_dbus_get_info,
 				"a{sv}", "", "info");
+
+	if (iwd_is_developer_mode())
+		l_dbus_interface_method(interface, "GetCryptoStats", 0,
+					iwd_dbus_get_crypto_stats,
+					"aa{sv}", "", "stats");
 }
 
 static void dbus_ready(void *user_data)
@@ -410,6 +469,32 @@ done:
 	return r;
 }
 
+/*
+ * The AES key wrap, CMAC and AES-SIV helpers default to the fastest
+ * user-space implementation for this CPU.  IWD_AES_IMPL can force a
+ * different one, e.g. "kernel" to go through AF_ALG as before.
+ */
+static void setup_aes_impl(void)
+{
+	const char *str = getenv("IWD_AES_IMPL");
+	enum crypto_aes_impl impl;
+
+	if (!str)
+		goto done;
+
+	for (impl = CRYPTO_AES_IMPL_KERNEL;
+			impl <= CRYPTO_AES_IMPL_ARMV8_CE; impl++)
+		if (!strcmp(str, crypto_aes_impl_to_str(impl)))
+			break;
+
+	if (impl > CRYPTO_AES_IMPL_ARMV8_CE || !crypto_aes_set_impl(impl))
+		l_warn("AES implementation '%s' not available", str);
+
+done:
+	l_debug("Using %s AES implementation",
+			crypto_aes_impl_to_str(crypto_aes_get_impl()));
+}
+
 /*
  * Initialize a systemd encryption key for encrypting/decrypting credentials.
  */
@@ -474,6 +559,7 @@ int main(int argc, char *argv[])
 {
 	int exit_status;
 	struct l_dbus *dbus;
+	struct l_signal *stats_signal;
 	const char *config_dir;
 	char **config_dirs;
 	int i;
@@ -553,6 +639,8 @@ int main(int argc, char *argv[])
 
 	l_info("Wireless daemon version %s", VERSION);
 
+	setup_aes_impl();
+
 	config_dir = getenv("CONFIGURATION_DIRECTORY");
 	if (!config_dir)
 		config_dir = DAEMON_CONFIGDIR;
@@ -620,8 +708,13 @@ int main(int argc, char *argv[])
 	if (!setup_system_key())
 		goto failed_storage;
 
+	stats_signal = l_signal_create(SIGUSR1, stats_signal_cb,
+					NULL, NULL);
+
 	exit_status = l_main_run_with_signal(signal_handler, NULL);
 
+	l_signal_remove(stats_signal);
+
 	iwd_modules_exit();
 	storage_exit();
 
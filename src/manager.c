@@ -28,6 +28,7 @@
 #include <stdio.h>
 #include <errno.h>
 #include <linux/if_ether.h>
+#include <net/if.h>
 #include <fnmatch.h>
 
 #include <ell/ell.h>
@@ -49,6 +50,7 @@ static char **whitelist_filter;
 static char **blacklist_filter;
 static bool randomize;
 static bool use_default;
+static unsigned int extra_ap_interfaces;
 static unsigned int config_watch;
 
 struct wiphy_setup_state {
@@ -182,6 +184,25 @@ static void manager_new_p2p_interface_cb(struct l_genl_msg *msg,
 	p2p_device_update_from_genl(msg, true);
 }
 
+static void manager_new_ap_interface_cb(struct l_genl_msg *msg,
+						void *user_data)
+{
+	struct wiphy_setup_state *state = user_data;
+
+	l_debug("");
+
+	if (state->aborted)
+		return;
+
+	if (l_genl_msg_get_error(msg) < 0) {
+		l_error("NEW_INTERFACE failed for AP interface: %s",
+			strerror(-l_genl_msg_get_error(msg)));
+		return;
+	}
+
+	netdev_create_from_genl(msg, NULL);
+}
+
 static void manager_new_interface_done(void *user_data)
 {
 	struct wiphy_setup_state *state = user_data;
@@ -192,6 +213,62 @@ static void manager_new_interface_done(void *user_data)
 		wiphy_setup_state_destroy(state);
 }
 
+/*
+ * Additional AP-mode interfaces let a single radio host several BSSes, each
+ * with its own SSID and AccessPoint object.  All of them share the channel
+ * of whichever AP on the wiphy was started first.  Each BSS needs its own
+ * BSSID so this requires setting the address at interface creation time.
+ */
+static void manager_create_ap_interfaces(struct wiphy_setup_state *state)
+{
+	struct l_genl_msg *msg;
+	char ifname[IFNAMSIZ];
+	uint32_t iftype = NL80211_IFTYPE_AP;
+	uint8_t addr[6];
+	unsigned int cmd_id;
+	unsigned int i;
+
+	if (!extra_ap_interfaces)
+		return;
+
+	if (!wiphy_supports_iftype(state->wiphy, NL80211_IFTYPE_AP) ||
+			!wiphy_has_feature(state->wiphy,
+						NL80211_FEATURE_MAC_ON_CREATE)) {
+		l_warn("Wiphy %s can't host additional AP interfaces",
+			wiphy_get_name(state->wiphy));
+		return;
+	}
+
+	for (i = 1; i <= extra_ap_interfaces; i++) {
+		snprintf(ifname, sizeof(ifname), "wlan%i-ap%u",
+				(int) state->id, i);
+		l_debug("creating %s", ifname);
+
+		wiphy_generate_random_address(state->wiphy, addr);
+
+		msg = l_genl_msg_new(NL80211_CMD_NEW_INTERFACE);
+		l_genl_msg_append_attr(msg, NL80211_ATTR_WIPHY, 4, &state->id);
+		l_genl_msg_append_attr(msg, NL80211_ATTR_IFTYPE, 4, &iftype);
+		l_genl_msg_append_attr(msg, NL80211_ATTR_IFNAME,
+					strlen(ifname) + 1, ifname);
+		l_genl_msg_append_attr(msg, NL80211_ATTR_MAC, 6, addr);
+		l_genl_msg_append_attr(msg, NL80211_ATTR_4ADDR, 1, "\0");
+		l_genl_msg_append_attr(msg, NL80211_ATTR_SOCKET_OWNER, 0, "");
+
+		cmd_id = l_genl_family_send(nl80211, msg,
+						manager_new_ap_interface_cb,
+						state,
+						manager_new_interface_done);
+		if (!cmd_id) {
+			l_error("Error sending NEW_INTERFACE for %s", ifname);
+			l_genl_msg_unref(msg);
+			return;
+		}
+
+		state->pending_cmd_count++;
+	}
+}
+
 static void manager_create_interfaces(struct wiphy_setup_state *state)
 {
 	struct l_genl_msg *msg;
@@ -255,6 +332,8 @@ static void manager_create_interfaces(struct wiphy_setup_state *state)
 
 	state->pending_cmd_count++;
 
+	manager_create_ap_interfaces(state);
+
 try_create_p2p:
 	/*
 	 * Require the MAC on create feature so we can send our desired
@@ -900,6 +979,10 @@ static int manager_init(void)
 		use_default = false;
 	}
 
+	if (!l_settings_get_uint(config, "General", "ExtraAPInterfaces",
+					&extra_ap_interfaces))
+		extra_ap_interfaces = 0;
+
 	return 0;
 
 error:
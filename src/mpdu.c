@@ -313,10 +313,9 @@ static bool validate_mgmt_header(const struct mmpdu_header *mpdu,
 }
 
 /* 802.11-2016 13.11.2 */
-static bool skip_resource_req_resp(struct ie_tlv_iter *iter)
+static unsigned int skip_resource_req_resp(const struct ie_index *index,
+						unsigned int pos)
 {
-	struct ie_tlv_iter tmp;
-
 	/*
 	 * This is called when we've seen an RDE so we only need to validate
 	 * and skip IEs representing one or more Resource Descriptors up to
@@ -331,10 +330,8 @@ static bool skip_resource_req_resp(struct ie_tlv_iter *iter)
 	 * IE that doesn't seem to be part of this RDE.
 	 */
 
-	memcpy(&tmp, iter, sizeof(tmp));
-
-	while (ie_tlv_iter_next(&tmp)) {
-		switch (ie_tlv_iter_get_tag(&tmp)) {
+	while (pos + 1 < index->n_entries) {
+		switch (index->entries[pos + 1].tag) {
 		case IE_TYPE_TSPEC:
 		case IE_TYPE_TCLAS:
 		case IE_TYPE_TCLAS_PROCESSING:
@@ -343,7 +340,7 @@ static bool skip_resource_req_resp(struct ie_tlv_iter *iter)
 		case IE_TYPE_TS_DELAY:
 		case IE_TYPE_RIC_DESCRIPTOR:
 		case IE_TYPE_VENDOR_SPECIFIC:
-			memcpy(iter, &tmp, sizeof(tmp));
+			pos++;
 			continue;
 		default:
 			break;
@@ -351,22 +348,23 @@ static bool skip_resource_req_resp(struct ie_tlv_iter *iter)
 		break;
 	}
 
-	return true;
+	return pos;
 }
 
 static bool validate_mgmt_ies(const uint8_t *ies, size_t ies_len,
 				const enum ie_type tag_order[], int tag_count)
 {
-	struct ie_tlv_iter iter;
-	enum ie_type tag;
+	struct ie_index index;
+	unsigned int pos;
+	bool ret = true;
 
-	ie_tlv_iter_init(&iter, ies, ies_len);
+	ie_index_init(&index, ies, ies_len);
 
-	while (ie_tlv_iter_next(&iter)) {
+	for (pos = 0; pos < index.n_entries; pos++) {
+		const struct ie_index_entry *entry = &index.entries[pos];
+		enum ie_type tag = entry->tag;
 		int i = 0;
 
-		tag = ie_tlv_iter_get_tag(&iter);
-
 		/* Check that the tag is part of the valid set */
 		while (i < tag_count && tag_order[i] != tag)
 			i += 1;
@@ -393,24 +391,18 @@ static bool validate_mgmt_ies(const uint8_t *ies, size_t ies_len,
 				tag != IE_TYPE_MULTIPLE_BSSID &&
 				tag != IE_TYPE_NEIGHBOR_REPORT &&
 				tag != IE_TYPE_QUIET_CHANNEL &&
-				tag != IE_TYPE_FILS_HLP_CONTAINER) {
-			struct ie_tlv_iter clone;
-
-			memcpy(&clone, &iter, sizeof(clone));
-
-			while (ie_tlv_iter_next(&clone)) {
-				if (ie_tlv_iter_get_tag(&clone) != tag)
-					continue;
-
-				return false;
-			}
+				tag != IE_TYPE_FILS_HLP_CONTAINER &&
+				ie_index_next(&index, entry)) {
+			ret = false;
+			break;
 		}
 
-		if (tag == IE_TYPE_RIC_DATA && !skip_resource_req_resp(&iter))
-			return false;
+		if (tag == IE_TYPE_RIC_DATA)
+			pos = skip_resource_req_resp(&index, pos);
 	}
 
-	return true;
+	ie_index_free(&index);
+	return ret;
 }
 
 static bool validate_association_request_mmpdu(const struct mmpdu_header *mpdu,
@@ -787,6 +779,32 @@ const struct mmpdu_header *mpdu_validate(const uint8_t *frame, int len)
 	}
 }
 
+/*
+ * Only check that @frame is a management frame and is long enough for the
+ * header, leaving the frame body unvalidated.  This is enough to look at the
+ * frame type and the body prefix before deciding whether the frame is of any
+ * interest, in which case mpdu_validate() should still be used on it.
+ */
+const struct mmpdu_header *mpdu_validate_header(const uint8_t *frame, int len)
+{
+	const struct mpdu_fc *fc;
+	int offset = 2;
+
+	if (!frame || len < 2)
+		return NULL;
+
+	fc = (const struct mpdu_fc *) frame;
+
+	if (fc->type != MPDU_TYPE_MANAGEMENT)
+		return NULL;
+
+	if (!validate_mgmt_header((const struct mmpdu_header *) frame, len,
+					&offset))
+		return NULL;
+
+	return (const struct mmpdu_header *) frame;
+}
+
 size_t mmpdu_header_len(const struct mmpdu_header *mmpdu)
 {
 	return mmpdu->fc.order == 0 ? 24 : 28;
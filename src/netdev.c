@@ -70,6 +70,9 @@
 #define ENOTSUPP 524
 #endif
 
+/* How long a queued connection may wait for the radio, in ms */
+#define NETDEV_CONNECT_WORK_DEADLINE 1000
+
 enum connection_type {
 	CONNECTION_TYPE_SOFTMAC,
 	CONNECTION_TYPE_FULLMAC,
@@ -3995,8 +3998,12 @@ done:
 					NL80211_EXT_FEATURE_CAN_REPLACE_PTK0))
 		handshake_state_set_no_rekey(hs, true);
 
-	wiphy_radio_work_insert(netdev->wiphy, &netdev->work,
+	wiphy_radio_work_insert(netdev->wiphy, &netdev->work, netdev->wdev_id,
 				WIPHY_WORK_PRIORITY_CONNECT, &connect_work_ops);
+
+	/* Don't let a stream of offchannel frame exchanges hold us back */
+	wiphy_radio_work_set_deadline(netdev->wiphy, netdev->work.id,
+					NETDEV_CONNECT_WORK_DEADLINE);
 }
 
 int netdev_connect(struct netdev *netdev, const struct scan_bss *bss,
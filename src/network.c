@@ -1228,44 +1228,22 @@ static bool match_bss(const void *a, const void *b)
 
 struct erp_cache_entry *network_get_erp_cache(struct network *network)
 {
-	struct erp_cache_entry *cache;
+	_auto_(l_free) char *identity = NULL;
 	struct l_settings *settings;
-	char *check_id;
-	const char *identity;
-	bool ret;
 
 	settings = network_get_settings(network);
 	if (!settings)
 		return NULL;
 
-	check_id = l_settings_get_string(settings, "Security", "EAP-Identity");
-	if (!check_id)
-		return NULL;
-
-	cache = erp_cache_get(network_get_ssid(network));
-	if (!cache) {
-		l_free(check_id);
-		return NULL;
-	}
-
-	identity = erp_cache_entry_get_identity(cache);
-
-	ret = strcmp(check_id, identity) == 0;
-
-	l_free(check_id);
-
 	/*
-	 * The settings file must have change out from under us. In this
-	 * case we want to remove the ERP entry because it is no longer
-	 * valid.
+	 * Entries are looked up by the configured identity so that one left
+	 * behind by a change to the settings file is never used.
 	 */
-	if (!ret) {
-		erp_cache_put(cache);
-		erp_cache_remove(identity);
+	identity = l_settings_get_string(settings, "Security", "EAP-Identity");
+	if (!identity)
 		return NULL;
-	}
 
-	return cache;
+	return erp_cache_get(identity, network_get_ssid(network));
 }
 
 const struct l_queue_entry *network_bss_list_get_entries(
@@ -181,7 +181,8 @@ uint32_t offchannel_start(uint64_t wdev_id, int priority, uint32_t freq,
 	info->error = -ECANCELED;
 
 	return wiphy_radio_work_insert(wiphy_find_by_wdev(wdev_id), &info->work,
-					priority, &offchannel_work_ops);
+					wdev_id, priority,
+					&offchannel_work_ops);
 }
 
 void offchannel_cancel(uint64_t wdev_id, uint32_t id)
@@ -1276,6 +1276,7 @@ static void p2p_group_start(struct p2p_device *dev)
 
 	/* Enable netconfig, set maximum usable DHCP lease time */
 	l_settings_set_uint(config, "IPv4", "LeaseTime", 0x7fffffff);
+	l_settings_set_bool(config, "IPv4", "PersistentLeases", false);
 
 	l_settings_set_string(config, "Security", "PairwiseCiphers", "CCMP");
 	l_settings_set_string(config, "Security", "GroupCipher", "CCMP");
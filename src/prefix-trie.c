@@ -0,0 +1,203 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  iwd contributors. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <ell/ell.h>
+
+#include "src/prefix-trie.h"
+
+/*
+ * A byte-wise trie mapping binary keys to sets of values.  The only lookup
+ * operation is finding all of the values whose key is a prefix of a given
+ * buffer, which costs O(key length) instead of a comparison against every
+ * key.  The keys we deal with are short and the number of distinct bytes at
+ * any position is small so children are kept in a simple sibling list.
+ */
+
+struct prefix_trie_node {
+	uint8_t byte;
+	struct l_queue *values;
+	struct prefix_trie_node *children;
+	struct prefix_trie_node *next;
+};
+
+struct prefix_trie {
+	struct prefix_trie_node root;
+};
+
+static struct prefix_trie_node *prefix_trie_node_child(
+					const struct prefix_trie_node *node,
+					uint8_t byte)
+{
+	struct prefix_trie_node *child;
+
+	for (child = node->children; child; child = child->next)
+		if (child->byte == byte)
+			return child;
+
+	return NULL;
+}
+
+static void prefix_trie_node_free(struct prefix_trie_node *node)
+{
+	while (node->children) {
+		struct prefix_trie_node *child = node->children;
+
+		node->children = child->next;
+		prefix_trie_node_free(child);
+		l_free(child);
+	}
+
+	l_queue_destroy(node->values, NULL);
+	node->values = NULL;
+}
+
+struct prefix_trie *prefix_trie_new(void)
+{
+	return l_new(struct prefix_trie, 1);
+}
+
+void prefix_trie_free(struct prefix_trie *trie)
+{
+	if (!trie)
+		return;
+
+	prefix_trie_node_free(&trie->root);
+	l_free(trie);
+}
+
+void prefix_trie_insert(struct prefix_trie *trie, const uint8_t *key,
+			size_t key_len, void *value)
+{
+	struct prefix_trie_node *node = &trie->root;
+	size_t i;
+
+	for (i = 0; i < key_len; i++) {
+		struct prefix_trie_node *child =
+			prefix_trie_node_child(node, key[i]);
+
+		if (!child) {
+			child = l_new(struct prefix_trie_node, 1);
+			child->byte = key[i];
+			child->next = node->children;
+			node->children = child;
+		}
+
+		node = child;
+	}
+
+	if (!node->values)
+		node->values = l_queue_new();
+
+	l_queue_push_tail(node->values, value);
+}
+
+static bool prefix_trie_node_remove(struct prefix_trie_node *node,
+					const uint8_t *key, size_t key_len,
+					void *value)
+{
+	struct prefix_trie_node **link;
+	struct prefix_trie_node *child;
+
+	if (!key_len) {
+		if (!l_queue_remove(node->values, value))
+			return false;
+
+		if (l_queue_isempty(node->values)) {
+			l_queue_destroy(node->values, NULL);
+			node->values = NULL;
+		}
+
+		return true;
+	}
+
+	for (link = &node->children; *link; link = &(*link)->next)
+		if ((*link)->byte == key[0])
+			break;
+
+	child = *link;
+	if (!child)
+		return false;
+
+	if (!prefix_trie_node_remove(child, key + 1, key_len - 1, value))
+		return false;
+
+	/* Prune the branch once nothing is left under it */
+	if (!child->values && !child->children) {
+		*link = child->next;
+		l_free(child);
+	}
+
+	return true;
+}
+
+bool prefix_trie_remove(struct prefix_trie *trie, const uint8_t *key,
+			size_t key_len, void *value)
+{
+	return prefix_trie_node_remove(&trie->root, key, key_len, value);
+}
+
+bool prefix_trie_isempty(struct prefix_trie *trie)
+{
+	return !trie->root.values && !trie->root.children;
+}
+
+static unsigned int prefix_trie_node_call(const struct prefix_trie_node *node,
+					prefix_trie_match_func_t func,
+					void *user_data)
+{
+	const struct l_queue_entry *entry;
+	unsigned int count = 0;
+
+	for (entry = l_queue_get_entries(node->values); entry;
+			entry = entry->next, count++)
+		func(entry->data, user_data);
+
+	return count;
+}
+
+/*
+ * Call @func for every value whose key is a prefix of @data, shortest keys
+ * first.  @func must not modify the trie.
+ */
+unsigned int prefix_trie_foreach_match(struct prefix_trie *trie,
+					const uint8_t *data, size_t len,
+					prefix_trie_match_func_t func,
+					void *user_data)
+{
+	const struct prefix_trie_node *node = &trie->root;
+	unsigned int count = prefix_trie_node_call(node, func, user_data);
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		node = prefix_trie_node_child(node, data[i]);
+		if (!node)
+			break;
+
+		count += prefix_trie_node_call(node, func, user_data);
+	}
+
+	return count;
+}
@@ -0,0 +1,39 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  iwd contributors. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+struct prefix_trie;
+
+typedef void (*prefix_trie_match_func_t)(void *value, void *user_data);
+
+struct prefix_trie *prefix_trie_new(void);
+void prefix_trie_free(struct prefix_trie *trie);
+
+void prefix_trie_insert(struct prefix_trie *trie, const uint8_t *key,
+			size_t key_len, void *value);
+bool prefix_trie_remove(struct prefix_trie *trie, const uint8_t *key,
+			size_t key_len, void *value);
+bool prefix_trie_isempty(struct prefix_trie *trie);
+
+unsigned int prefix_trie_foreach_match(struct prefix_trie *trie,
+					const uint8_t *data, size_t len,
+					prefix_trie_match_func_t func,
+					void *user_data);
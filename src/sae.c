@@ -277,6 +277,7 @@ static ssize_t sae_cn(struct sae_sm *sm, uint16_t send_confirm,
 			struct l_ecc_point *element2,
 			uint8_t *confirm)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_SAE_CONFIRM);
 	enum l_checksum_type hash =
 		crypto_sae_hash_from_ecc_prime_len(sm->sae_type,
 				l_ecc_curve_get_scalar_bytes(sm->curve));
@@ -410,6 +411,7 @@ static struct l_ecc_point *sae_compute_pwe(const struct l_ecc_curve *curve,
 						const uint8_t *addr1,
 						const uint8_t *addr2)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_SAE_PWE);
 	uint8_t found = 0;
 	uint8_t is_residue;
 	uint8_t is_odd = 0;
@@ -539,6 +541,7 @@ static int sae_build_commit(struct sae_sm *sm, const uint8_t *addr1,
 				const uint8_t *addr2, uint8_t *commit,
 				size_t len, bool retry)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_SAE_COMMIT);
 	struct l_ecc_scalar *mask;
 	uint8_t *ptr = commit;
 	struct l_ecc_scalar *order;
@@ -679,6 +682,7 @@ static bool sae_send_confirm(struct sae_sm *sm)
 
 static int sae_calculate_keys(struct sae_sm *sm)
 {
+	CRYPTO_STAT_TIMER(CRYPTO_STAT_SAE_KEYS);
 	unsigned int nbytes = l_ecc_curve_get_scalar_bytes(sm->curve);
 	enum l_checksum_type hash =
 		crypto_sae_hash_from_ecc_prime_len(sm->sae_type, nbytes);
@@ -283,26 +283,19 @@ static void scan_request_triggered(struct l_genl_msg *msg, void *userdata)
 	}
 }
 
-struct scan_freq_append_data {
-	struct l_genl_msg *msg;
-	int count;
-};
-
-static void scan_freq_append(uint32_t freq, void *user_data)
-{
-	struct scan_freq_append_data *data = user_data;
-
-	l_genl_msg_append_attr(data->msg, data->count++, 4, &freq);
-}
-
 static void scan_build_attr_scan_frequencies(struct l_genl_msg *msg,
 					const struct scan_freq_set *freqs)
 {
-	struct scan_freq_append_data append_data = { msg, 0 };
+	struct scan_freq_set_iter iter;
+	uint32_t freq;
+	int count = 0;
 
 	l_genl_msg_enter_nested(msg, NL80211_ATTR_SCAN_FREQUENCIES);
 
-	scan_freq_set_foreach(freqs, scan_freq_append, &append_data);
+	scan_freq_set_iter_init(&iter, freqs);
+
+	while (scan_freq_set_iter_next(&iter, &freq))
+		l_genl_msg_append_attr(msg, count++, 4, &freq);
 
 	l_genl_msg_leave_nested(msg);
 }
@@ -544,7 +537,7 @@ static bool scan_cmds_add_hidden(const struct network_info *network,
 }
 
 static void scan_build_next_cmd(struct l_queue *cmds, struct scan_context *sc,
-				bool passive,
+				bool passive, bool ignore_flush,
 				const struct scan_parameters *params,
 				const struct scan_freq_set *freqs)
 {
@@ -557,7 +550,7 @@ static void scan_build_next_cmd(struct l_queue *cmds, struct scan_context *sc,
 		wiphy_get_max_num_ssids_per_scan(sc->wiphy),
 	};
 
-	cmd = scan_build_cmd(sc, false, passive, params, freqs);
+	cmd = scan_build_cmd(sc, ignore_flush, passive, params, freqs);
 
 	if (passive) {
 		/* passive scan */
@@ -591,9 +584,11 @@ static void scan_cmds_add(struct scan_request *sr, struct scan_context *sc,
 {
 	uint32_t bands = BAND_FREQ_2_4_GHZ | BAND_FREQ_5_GHZ | BAND_FREQ_6_GHZ;
 	unsigned int i;
-	struct scan_freq_set *subsets[2] = { 0 };
+	struct scan_freq_set *subsets[3] = { 0 };
 	const struct scan_freq_set *supported =
 					wiphy_get_supported_freqs(sc->wiphy);
+	bool split_6ghz;
+	bool ignore_flush = false;
 
 	/*
 	 * No frequencies, just include the entire supported list and let the
@@ -604,9 +599,14 @@ static void scan_cmds_add(struct scan_request *sr, struct scan_context *sc,
 	else
 		sr->scan_freqs = scan_freq_set_clone(params->freqs, bands);
 
-	/* If 6GHz is not possible or already allowed don't split the request */
-	if (wiphy_band_is_disabled(sc->wiphy, BAND_FREQ_6_GHZ) != 1) {
-		scan_build_next_cmd(sr->cmds, sc, passive,
+	split_6ghz = wiphy_band_is_disabled(sc->wiphy, BAND_FREQ_6_GHZ) == 1;
+
+	/*
+	 * If 6GHz is not possible or already allowed don't split the request
+	 * unless the caller asked for a chunked scan
+	 */
+	if (!split_6ghz && !params->chunked) {
+		scan_build_next_cmd(sr->cmds, sc, passive, false,
 						params, sr->scan_freqs);
 		return;
 	}
@@ -622,19 +622,31 @@ static void scan_cmds_add(struct scan_request *sr, struct scan_context *sc,
 	 * the earlier requests. If it does update to allow 6GHz an
 	 * extra 6GHz-only passive scan can be appended to this request
 	 * at that time.
+	 *
+	 * A chunked scan is split the same way so that other radio work
+	 * can run between the bands (see wiphy_radio_work_yield).  Only
+	 * the first command may flush, the kernel then accumulates the
+	 * results of all the chunks for the final GET_SCAN.
 	 */
 	subsets[0] = scan_freq_set_clone(sr->scan_freqs, BAND_FREQ_2_4_GHZ);
 	subsets[1] = scan_freq_set_clone(sr->scan_freqs, BAND_FREQ_5_GHZ);
 
+	if (!split_6ghz)
+		subsets[2] = scan_freq_set_clone(sr->scan_freqs,
+							BAND_FREQ_6_GHZ);
+
 	for(i = 0; i < L_ARRAY_SIZE(subsets); i++) {
-		if (!scan_freq_set_isempty(subsets[i]))
-			scan_build_next_cmd(sr->cmds, sc, passive, params,
-								subsets[i]);
+		if (subsets[i] && !scan_freq_set_isempty(subsets[i])) {
+			scan_build_next_cmd(sr->cmds, sc, passive,
+						ignore_flush, params,
+						subsets[i]);
+			ignore_flush = true;
+		}
 
 		scan_freq_set_free(subsets[i]);
 	}
 
-	sr->split = true;
+	sr->split = split_6ghz;
 }
 
 static int scan_request_send_trigger(struct scan_context *sc,
@@ -691,7 +703,8 @@ static int insert_by_priority(const void *a, const void *b, void *user_data)
 	const struct scan_request *cur = b;
 	int priority = L_PTR_TO_INT(user_data);
 
-	if (cur->work.priority <= priority)
+	/* Never insert ahead of the request currently being run */
+	if (cur->work.running || cur->work.priority <= priority)
 		return 1;
 
 	return -1;
@@ -723,7 +736,7 @@ static uint32_t scan_common(uint64_t wdev_id, bool passive,
 	l_queue_insert(sc->requests, sr, insert_by_priority,
 						L_INT_TO_PTR(priority));
 
-	return wiphy_radio_work_insert(sc->wiphy, &sr->work,
+	return wiphy_radio_work_insert(sc->wiphy, &sr->work, sc->wdev_id,
 					priority, &work_ops);
 }
 
@@ -895,7 +908,7 @@ done:
 	l_queue_insert(sc->requests, sr, insert_by_priority,
 				L_INT_TO_PTR(WIPHY_WORK_PRIORITY_SCAN));
 
-	return wiphy_radio_work_insert(sc->wiphy, &sr->work,
+	return wiphy_radio_work_insert(sc->wiphy, &sr->work, sc->wdev_id,
 					WIPHY_WORK_PRIORITY_SCAN, &work_ops);
 }
 
@@ -1042,6 +1055,7 @@ static bool scan_periodic_queue(struct scan_context *sc)
 		return false;
 
 	params.freqs = freqs;
+	params.chunked = true;
 
 	if (sc->sp.needs_active_scan && known_networks_has_hidden()) {
 		params.randomize_mac_addr_hint = true;
@@ -1200,6 +1214,17 @@ static bool start_next_scan_request(struct wiphy_radio_work_item *item)
 						struct scan_request, work);
 	struct scan_context *sc = sr->sc;
 
+	/*
+	 * The radio work scheduler may start our requests in a different
+	 * order than they were queued in, e.g. after one has yielded to
+	 * higher priority work.  The request being run is always expected
+	 * at the head of sc->requests.
+	 */
+	if (l_queue_peek_head(sc->requests) != sr) {
+		l_queue_remove(sc->requests, sr);
+		l_queue_push_head(sc->requests, sr);
+	}
+
 	if (sc->state != SCAN_STATE_NOT_RUNNING)
 		return false;
 
@@ -1216,7 +1241,6 @@ static void scan_parse_vendor_specific(struct scan_bss *bss, const void *data,
 {
 	uint16_t cost_level;
 	uint16_t cost_flags;
-	bool dgaf_disable;
 
 	if (!bss->wpa && is_ie_wpa_ie(data, len)) {
 		bss->wpa = l_memdup(data - 2, len + 2);
@@ -1228,41 +1252,72 @@ static void scan_parse_vendor_specific(struct scan_bss *bss, const void *data,
 		return;
 	}
 
-	if (is_ie_wfa_ie(data, len, IE_WFA_OI_HS20_INDICATION)) {
-		if (ie_parse_hs20_indication_from_data(data - 2, len + 2,
-					&bss->hs20_version, NULL, NULL,
-					&dgaf_disable) < 0)
-			return;
+	if (!ie_parse_network_cost(data, len, &cost_level, &cost_flags)) {
+		bss->cost_level = cost_level;
+		bss->cost_flags = cost_flags;
+		return;
+	}
+}
+
+/*
+ * Extracts all the vendor IE payloads in one pass.  Returns false if the
+ * frame has no P2P IE.  Only the first HS2.0 Indication and OWE Transition
+ * Mode IEs are looked at.
+ */
+static bool scan_parse_vendor_payloads(struct scan_bss *bss,
+					const uint8_t *ies, size_t len)
+{
+	uint8_t scratch[1024];
+	_auto_(l_free) uint8_t *heap_scratch = NULL;
+	struct ie_vendor_payloads vendor;
+	const uint8_t *ie;
+	bool dgaf_disable;
+
+	/*
+	 * The concatenated WSC, P2P and WFD payloads fit the stack buffer in
+	 * all but unusual frames.  They can never be larger than the IEs.
+	 */
+	if (ie_tlv_extract_vendor_payloads(ies, len, scratch, sizeof(scratch),
+						&vendor) == -EMSGSIZE) {
+		heap_scratch = l_malloc(len);
+		ie_tlv_extract_vendor_payloads(ies, len, heap_scratch, len,
+						&vendor);
+	}
+
+	if (vendor.wsc)
+		bss->wsc = l_memdup(vendor.wsc, vendor.wsc_len);
+
+	bss->wsc_size = vendor.wsc_len;
 
+	if (vendor.wfd)
+		bss->wfd = l_memdup(vendor.wfd, vendor.wfd_len);
+
+	bss->wfd_size = vendor.wfd_len;
+
+	ie = vendor.hs20_indication;
+	if (ie && ie_parse_hs20_indication_from_data(ie, ie[1] + 2,
+					&bss->hs20_version, NULL, NULL,
+					&dgaf_disable) == 0) {
 		bss->hs20_dgaf_disable = dgaf_disable;
 		bss->hs20_capable = true;
-		return;
 	}
 
-	if (is_ie_wfa_ie(data, len, IE_WFA_OI_OWE_TRANSITION)) {
+	ie = vendor.owe_transition;
+	if (ie) {
 		_auto_(l_free) struct ie_owe_transition_info *owe_trans =
 				l_new(struct ie_owe_transition_info, 1);
 
-		if (ie_parse_owe_transition(data - 2, len + 2, owe_trans) < 0)
-			return;
-
-		if (owe_trans->oper_class &&
+		if (ie_parse_owe_transition(ie, ie[1] + 2, owe_trans) == 0 &&
+				(!owe_trans->oper_class ||
 				oci_to_frequency(owe_trans->oper_class,
-						owe_trans->channel) < 0)
-			return;
-
-		bss->owe_trans = l_steal_ptr(owe_trans);
-		return;
+						owe_trans->channel) >= 0))
+			bss->owe_trans = l_steal_ptr(owe_trans);
 	}
 
-	if (is_ie_wfa_ie(data, len, IE_WFA_OI_CONFIGURATOR_CONNECTIVITY))
+	if (vendor.dpp_configurator_connectivity)
 		bss->dpp_configurator = true;
 
-	if (!ie_parse_network_cost(data, len, &cost_level, &cost_flags)) {
-		bss->cost_level = cost_level;
-		bss->cost_flags = cost_flags;
-		return;
-	}
+	return vendor.p2p_len >= 0;
 }
 
 /*
@@ -1313,15 +1368,19 @@ static bool scan_parse_advertisement_protocol(struct scan_bss *bss,
 }
 
 static bool scan_parse_bss_information_elements(struct scan_bss *bss,
-					const void *data, uint16_t len)
+						const struct ie_index *index)
 {
+	const uint8_t *data = index->ies;
+	size_t len = index->len;
 	struct ie_tlv_iter iter;
 	bool have_ssid = false;
+	unsigned int i;
 
-	ie_tlv_iter_init(&iter, data, len);
+	for (i = 0; i < index->n_entries; i++) {
+		uint8_t tag;
 
-	while (ie_tlv_iter_next(&iter)) {
-		uint8_t tag = ie_tlv_iter_get_tag(&iter);
+		ie_index_entry_to_iter(&index->entries[i], &iter);
+		tag = ie_tlv_iter_get_tag(&iter);
 
 		switch (tag) {
 		case IE_TYPE_SSID:
@@ -1445,7 +1504,12 @@ static bool scan_parse_bss_information_elements(struct scan_bss *bss,
 		}
 	}
 
-	bss->wsc = ie_tlv_extract_wsc_payload(data, len, &bss->wsc_size);
+	/*
+	 * BSSes without an SSID are dropped so don't bother with the rest.
+	 * The P2P parsers below all fail with -ENOENT if there's no P2P IE.
+	 */
+	if (!have_ssid || !scan_parse_vendor_payloads(bss, data, len))
+		return have_ssid;
 
 	switch (bss->source_frame) {
 	case SCAN_BSS_PROBE_RESP:
@@ -1504,8 +1568,6 @@ static bool scan_parse_bss_information_elements(struct scan_bss *bss,
 	}
 	}
 
-	bss->wfd = ie_tlv_extract_wfd_payload(data, len, &bss->wfd_size);
-
 	return have_ssid;
 }
 
@@ -1620,15 +1682,22 @@ static struct scan_bss *scan_parse_attr_bss(struct l_genl_attr *attr,
 	bss->data_rate = 2000000;
 
 	if (ies) {
+		struct ie_index index;
 		int ret;
 
-		if (!scan_parse_bss_information_elements(bss, ies, ies_len))
+		ie_index_init(&index, ies, ies_len);
+
+		if (!scan_parse_bss_information_elements(bss, &index)) {
+			ie_index_free(&index);
 			goto fail;
+		}
 
-		ret = wiphy_estimate_data_rate(wiphy, ies, ies_len, bss,
+		ret = wiphy_estimate_data_rate(wiphy, &index, bss,
 						&bss->data_rate);
 		if (ret < 0 && ret != -ENETUNREACH)
 			l_warn("wiphy_estimate_data_rate() failed");
+
+		ie_index_free(&index);
 	}
 
 	return bss;
@@ -1737,6 +1806,8 @@ struct scan_bss *scan_bss_new_from_probe_req(const struct mmpdu_header *mpdu,
 
 {
 	struct scan_bss *bss;
+	struct ie_index index;
+	bool r;
 
 	bss = l_new(struct scan_bss, 1);
 	memcpy(bss->addr, mpdu->address_2, 6);
@@ -1744,7 +1815,11 @@ struct scan_bss *scan_bss_new_from_probe_req(const struct mmpdu_header *mpdu,
 	bss->frequency = frequency;
 	bss->signal_strength = rssi;
 
-	if (!scan_parse_bss_information_elements(bss, body, body_len))
+	ie_index_init(&index, body, body_len);
+	r = scan_parse_bss_information_elements(bss, &index);
+	ie_index_free(&index);
+
+	if (!r)
 		goto fail;
 
 	return bss;
@@ -2343,6 +2418,19 @@ static void scan_notify(struct l_genl_msg *msg, void *user_data)
 			else {
 				scan_parse_result_frequencies(msg,
 							sr->freqs_scanned);
+
+				/*
+				 * Between two commands is a good point to
+				 * let a connection or an FT, that would
+				 * otherwise have to wait for the whole scan,
+				 * use the radio.  We get resumed through
+				 * start_next_scan_request afterwards.
+				 */
+				if (wiphy_radio_work_yield(sc->wiphy,
+						sr->work.id,
+						WIPHY_WORK_PRIORITY_SCAN))
+					break;
+
 				send_next = true;
 			}
 		} else {
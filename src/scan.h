@@ -106,6 +106,12 @@ struct scan_parameters {
 	bool no_cck_rates : 1;
 	bool duration_mandatory : 1;
 	bool ap_scan : 1;
+	/*
+	 * Scan one band per trigger so that higher priority radio work,
+	 * e.g. a connect or a roam, can run in between.  Results are still
+	 * reported once, for all bands, when the last chunk completes.
+	 */
+	bool chunked : 1;
 	const uint8_t *ssid;	/* Used for direct probe request */
 	size_t ssid_len;
 	const uint8_t *source_mac;
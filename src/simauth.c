@@ -27,31 +27,142 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <errno.h>
+#include <limits.h>
 #include <ell/ell.h>
 
+#include "src/missing.h"
 #include "src/iwd.h"
 #include "src/module.h"
 #include "src/watchlist.h"
 #include "src/simauth.h"
 
+#define SIM_AUTH_RAND_LEN		16
+#define SIM_AUTH_RES_LEN		8
+#define SIM_AUTH_CK_LEN			16
+#define SIM_AUTH_IK_LEN			16
+
+/*
+ * Results of recent GSM challenges are kept for a short while so that a
+ * server restarting the exchange with the same triplets is answered
+ * locally.  AKA results are never cached, the SIM's sequence number check
+ * is what protects against a replayed AUTN and must see every challenge.
+ */
+#define SIM_AUTH_CACHE_MAX		4
+#define SIM_AUTH_CACHE_LIFETIME		(30 * L_USEC_PER_SEC)
+
 static struct l_queue *auth_providers;
 
+/*
+ * Pseudonyms and fast re-authentication state of every SIM seen, including
+ * ones not currently present, one group per NAI and method.  Persisted,
+ * encrypted, through the cache ops so that fast re-authentication keeps
+ * working after a restart.
+ */
+static struct l_settings *identity_cache;
+static sim_auth_cache_load_func_t identity_cache_load;
+static sim_auth_cache_sync_func_t identity_cache_sync;
+
+struct sim_auth_result {
+	bool aka;
+	uint8_t rands[SIM_AUTH_RAND_LEN * NUM_RANDS_MAX];
+	int num_rands;
+	uint64_t timestamp;
+
+	/* AKA results */
+	uint8_t res[SIM_AUTH_RES_LEN];
+	uint8_t ck[SIM_AUTH_CK_LEN];
+	uint8_t ik[SIM_AUTH_IK_LEN];
+
+	/* GSM results */
+	uint8_t sres[EAP_SIM_SRES_LEN * NUM_RANDS_MAX];
+	uint8_t kc[EAP_SIM_KC_LEN * NUM_RANDS_MAX];
+};
+
+struct sim_auth_request {
+	struct iwd_sim_auth *auth;
+	int id;
+	int driver_id;
+	struct l_idle *idle;
+	struct sim_auth_result *result;
+	sim_auth_check_milenage_cb_t milenage_cb;
+	sim_auth_run_gsm_cb_t gsm_cb;
+	void *data;
+};
+
+struct sim_auth_identities {
+	char *pseudonym;
+	struct sim_auth_reauth *reauth;
+};
+
 struct iwd_sim_auth {
 	const struct iwd_sim_auth_driver *driver;
 	void *driver_data;
 	bool aka_supported : 1;
 	bool sim_supported : 1;
 	char *nai;
-	int pending;
+	int next_request_id;
+	struct l_queue *requests;
+	struct l_queue *results;
+	struct sim_auth_identities identities[__SIM_AUTH_METHOD_MAX];
+	bool identities_loaded : 1;
 	struct watchlist auth_watchers;
 };
 
+static void sim_auth_result_free(void *data)
+{
+	struct sim_auth_result *result = data;
+
+	explicit_bzero(result, sizeof(*result));
+	l_free(result);
+}
+
+static void sim_auth_request_free(struct sim_auth_request *req)
+{
+	l_idle_remove(req->idle);
+
+	if (req->result)
+		sim_auth_result_free(req->result);
+
+	l_free(req);
+}
+
+static void sim_auth_request_cancel(void *data)
+{
+	struct sim_auth_request *req = data;
+	struct iwd_sim_auth *auth = req->auth;
+
+	if (!req->idle && auth->driver->cancel_request)
+		auth->driver->cancel_request(auth, req->driver_id);
+
+	sim_auth_request_free(req);
+}
+
+static void sim_auth_reauth_free(struct sim_auth_reauth *reauth)
+{
+	if (!reauth)
+		return;
+
+	l_free(reauth->id);
+	explicit_bzero(reauth, sizeof(*reauth));
+	l_free(reauth);
+}
+
+static void sim_auth_identities_clear(struct sim_auth_identities *ids)
+{
+	l_free(ids->pseudonym);
+	ids->pseudonym = NULL;
+	sim_auth_reauth_free(ids->reauth);
+	ids->reauth = NULL;
+}
+
 struct iwd_sim_auth *iwd_sim_auth_create(
 		const struct iwd_sim_auth_driver *driver)
 {
 	struct iwd_sim_auth *auth = l_new(struct iwd_sim_auth, 1);
 
 	auth->driver = driver;
+	auth->requests = l_queue_new();
+	auth->results = l_queue_new();
 	watchlist_init(&auth->auth_watchers, NULL);
 
 	return auth;
@@ -87,20 +198,26 @@ void *iwd_sim_auth_get_data(struct iwd_sim_auth *auth)
 static void destroy_provider(void *data)
 {
 	struct iwd_sim_auth *auth = data;
+	enum sim_auth_method method;
+
+	l_queue_destroy(l_steal_ptr(auth->requests), sim_auth_request_cancel);
 
 	if (auth->driver->remove)
 		auth->driver->remove(auth);
 
 	watchlist_destroy(&auth->auth_watchers);
 
+	l_queue_destroy(auth->results, sim_auth_result_free);
+	for (method = 0; method < __SIM_AUTH_METHOD_MAX; method++)
+		sim_auth_identities_clear(&auth->identities[method]);
+
 	l_free(auth->nai);
 	l_free(auth);
 }
 
 void iwd_sim_auth_remove(struct iwd_sim_auth *auth)
 {
-	if (auth->driver && auth->driver->cancel_request)
-		auth->driver->cancel_request(auth, auth->pending);
+	l_queue_destroy(l_steal_ptr(auth->requests), sim_auth_request_cancel);
 
 	WATCHLIST_NOTIFY_NO_ARGS(&auth->auth_watchers,
 			sim_auth_unregistered_cb_t);
@@ -148,36 +265,530 @@ void sim_auth_unregistered_watch_remove(struct iwd_sim_auth *auth,
 	watchlist_remove(&auth->auth_watchers, id);
 }
 
+static bool sim_auth_result_expired(const void *data,
+						const void *user_data)
+{
+	const struct sim_auth_result *result = data;
+	const uint64_t *now = user_data;
+
+	return l_time_diff(result->timestamp, *now) > SIM_AUTH_CACHE_LIFETIME;
+}
+
+static void sim_auth_cache_expire(struct iwd_sim_auth *auth)
+{
+	uint64_t now = l_time_now();
+
+	while (l_queue_remove_if(auth->results, sim_auth_result_expired, &now))
+		;
+}
+
+static bool sim_auth_result_match(const void *a, const void *b)
+{
+	const struct sim_auth_result *result = a;
+	const struct sim_auth_result *key = b;
+
+	if (result->num_rands != key->num_rands)
+		return false;
+
+	return !memcmp(result->rands, key->rands,
+				SIM_AUTH_RAND_LEN * key->num_rands);
+}
+
+static void sim_auth_cache_add(struct iwd_sim_auth *auth,
+				struct sim_auth_result *result)
+{
+	sim_auth_cache_expire(auth);
+
+	if (l_queue_length(auth->results) >= SIM_AUTH_CACHE_MAX) {
+		struct sim_auth_result *oldest =
+					l_queue_peek_tail(auth->results);
+
+		l_queue_remove(auth->results, oldest);
+		sim_auth_result_free(oldest);
+	}
+
+	l_queue_push_head(auth->results, result);
+}
+
+static bool sim_auth_request_match(const void *a, const void *b)
+{
+	const struct sim_auth_request *req = a;
+
+	return req->id == L_PTR_TO_INT(b);
+}
+
+static struct sim_auth_request *sim_auth_request_new(
+						struct iwd_sim_auth *auth,
+						struct sim_auth_result *key,
+						void *data)
+{
+	struct sim_auth_request *req = l_new(struct sim_auth_request, 1);
+
+	req->auth = auth;
+	req->result = key;
+	req->data = data;
+
+	/* Keep request IDs positive, negative values signal errors */
+	if (auth->next_request_id == INT_MAX)
+		auth->next_request_id = 0;
+
+	req->id = ++auth->next_request_id;
+
+	return req;
+}
+
+static void sim_auth_request_done(struct sim_auth_request *req, bool success)
+{
+	struct sim_auth_result *result = req->result;
+	sim_auth_check_milenage_cb_t milenage_cb = req->milenage_cb;
+	sim_auth_run_gsm_cb_t gsm_cb = req->gsm_cb;
+	void *data = req->data;
+
+	l_queue_remove(req->auth->requests, req);
+
+	/* The callback may remove the provider, finish with it first */
+	if (success && !result->aka)
+		sim_auth_cache_add(req->auth,
+					l_memdup(result, sizeof(*result)));
+
+	if (milenage_cb) {
+		if (success)
+			milenage_cb(result->res, result->ck, result->ik, NULL,
+					data);
+		else
+			milenage_cb(NULL, NULL, NULL, NULL, data);
+	} else {
+		if (success)
+			gsm_cb(result->sres, result->kc, data);
+		else
+			gsm_cb(NULL, NULL, data);
+	}
+
+	sim_auth_request_free(req);
+}
+
+static void sim_auth_cached_result_cb(void *user_data)
+{
+	struct sim_auth_request *req = user_data;
+
+	l_idle_remove(l_steal_ptr(req->idle));
+	sim_auth_request_done(req, true);
+}
+
+/* Answer the request from the cache on the next main loop iteration */
+static bool sim_auth_request_from_cache(struct iwd_sim_auth *auth,
+					struct sim_auth_request *req)
+{
+	const struct sim_auth_result *cached;
+
+	sim_auth_cache_expire(auth);
+
+	cached = l_queue_find(auth->results, sim_auth_result_match,
+				req->result);
+	if (!cached)
+		return false;
+
+	req->idle = l_idle_create(sim_auth_cached_result_cb, req, NULL);
+	if (!req->idle)
+		return false;
+
+	l_debug("Using cached GSM result");
+
+	/* Take the entry, it goes back into the cache once delivered */
+	l_queue_remove(auth->results, (void *) cached);
+	sim_auth_result_free(req->result);
+	req->result = (struct sim_auth_result *) cached;
+
+	return true;
+}
+
+static void sim_auth_milenage_cb(const uint8_t *res, const uint8_t *ck,
+		const uint8_t *ik, const uint8_t *auts, void *data)
+{
+	struct sim_auth_request *req = data;
+
+	if (auts) {
+		sim_auth_check_milenage_cb_t cb = req->milenage_cb;
+		void *user_data = req->data;
+
+		l_queue_remove(req->auth->requests, req);
+		sim_auth_request_free(req);
+		cb(NULL, NULL, NULL, auts, user_data);
+		return;
+	}
+
+	if (!res || !ck || !ik) {
+		sim_auth_request_done(req, false);
+		return;
+	}
+
+	memcpy(req->result->res, res, SIM_AUTH_RES_LEN);
+	memcpy(req->result->ck, ck, SIM_AUTH_CK_LEN);
+	memcpy(req->result->ik, ik, SIM_AUTH_IK_LEN);
+	req->result->timestamp = l_time_now();
+
+	sim_auth_request_done(req, true);
+}
+
 int sim_auth_check_milenage(struct iwd_sim_auth *auth,
 		const uint8_t *rand, const uint8_t *autn,
 		sim_auth_check_milenage_cb_t cb, void *data)
 {
+	struct sim_auth_result *key;
+	struct sim_auth_request *req;
+
 	if (!auth->aka_supported)
 		return -1;
 
-	/* save ID in case simauth is destroyed */
-	auth->pending = auth->driver->check_milenage(auth, rand, autn,
-			cb, data);
+	key = l_new(struct sim_auth_result, 1);
+	key->aka = true;
+	key->num_rands = 1;
+	memcpy(key->rands, rand, SIM_AUTH_RAND_LEN);
+
+	req = sim_auth_request_new(auth, key, data);
+	req->milenage_cb = cb;
 
-	return auth->pending;
+	req->driver_id = auth->driver->check_milenage(auth, rand, autn,
+						sim_auth_milenage_cb, req);
+	if (req->driver_id < 0) {
+		sim_auth_request_free(req);
+		return -1;
+	}
+
+	l_queue_push_tail(auth->requests, req);
+
+	return req->id;
+}
+
+static void sim_auth_gsm_cb(const uint8_t *sres, const uint8_t *kc,
+				void *data)
+{
+	struct sim_auth_request *req = data;
+	int num_rands = req->result->num_rands;
+
+	if (!sres || !kc) {
+		sim_auth_request_done(req, false);
+		return;
+	}
+
+	memcpy(req->result->sres, sres, EAP_SIM_SRES_LEN * num_rands);
+	memcpy(req->result->kc, kc, EAP_SIM_KC_LEN * num_rands);
+	req->result->timestamp = l_time_now();
+
+	sim_auth_request_done(req, true);
 }
 
 int sim_auth_run_gsm(struct iwd_sim_auth *auth, const uint8_t *rands,
 		int num_rands, sim_auth_run_gsm_cb_t cb, void *data)
 {
+	struct sim_auth_result *key;
+	struct sim_auth_request *req;
+
 	if (!auth->sim_supported)
 		return -1;
 
-	/* save ID in case simauth is destroyed */
-	auth->pending = auth->driver->run_gsm(auth, rands, num_rands, cb, data);
+	if (num_rands < 1 || num_rands > NUM_RANDS_MAX)
+		return -1;
+
+	key = l_new(struct sim_auth_result, 1);
+	key->num_rands = num_rands;
+	memcpy(key->rands, rands, SIM_AUTH_RAND_LEN * num_rands);
 
-	return auth->pending;
+	req = sim_auth_request_new(auth, key, data);
+	req->gsm_cb = cb;
+
+	if (!sim_auth_request_from_cache(auth, req)) {
+		req->driver_id = auth->driver->run_gsm(auth, rands, num_rands,
+							sim_auth_gsm_cb, req);
+		if (req->driver_id < 0) {
+			sim_auth_request_free(req);
+			return -1;
+		}
+	}
+
+	l_queue_push_tail(auth->requests, req);
+
+	return req->id;
 }
 
 void sim_auth_cancel_request(struct iwd_sim_auth *auth, int id)
 {
-	if (auth->driver->cancel_request)
-		auth->driver->cancel_request(auth, id);
+	struct sim_auth_request *req = l_queue_remove_if(auth->requests,
+						sim_auth_request_match,
+						L_INT_TO_PTR(id));
+
+	if (req)
+		sim_auth_request_cancel(req);
+}
+
+static struct l_settings *sim_auth_identity_cache(void)
+{
+	if (identity_cache)
+		return identity_cache;
+
+	if (identity_cache_load)
+		identity_cache = identity_cache_load();
+
+	if (!identity_cache)
+		identity_cache = l_settings_new();
+
+	return identity_cache;
+}
+
+static const char *sim_auth_method_to_str(enum sim_auth_method method)
+{
+	switch (method) {
+	case SIM_AUTH_METHOD_SIM:
+		return "SIM";
+	case SIM_AUTH_METHOD_AKA:
+		return "AKA";
+	case SIM_AUTH_METHOD_AKA_PRIME:
+		return "AKAPrime";
+	case __SIM_AUTH_METHOD_MAX:
+		break;
+	}
+
+	return NULL;
+}
+
+static char *sim_auth_identity_group(struct iwd_sim_auth *auth,
+					enum sim_auth_method method)
+{
+	_auto_(l_free) char *hex = NULL;
+
+	if (!auth->nai)
+		return NULL;
+
+	hex = l_util_hexstring(auth->nai, strlen(auth->nai));
+
+	return l_strdup_printf("%s-%s", sim_auth_method_to_str(method), hex);
+}
+
+static uint8_t *sim_auth_get_key(struct l_settings *settings,
+					const char *group, const char *key,
+					size_t min_len, size_t max_len,
+					size_t *out_len)
+{
+	uint8_t *value = l_settings_get_bytes(settings, group, key, out_len);
+
+	if (value && (*out_len < min_len || *out_len > max_len)) {
+		explicit_bzero(value, *out_len);
+		l_free(value);
+		return NULL;
+	}
+
+	return value;
+}
+
+static struct sim_auth_reauth *sim_auth_reauth_from_settings(
+						struct l_settings *settings,
+						const char *group)
+{
+	struct sim_auth_reauth *reauth = NULL;
+	_auto_(l_free) char *id = NULL;
+	uint8_t *key = NULL;
+	uint8_t *k_encr = NULL;
+	uint8_t *k_aut = NULL;
+	size_t key_len = 0;
+	size_t k_encr_len = 0;
+	size_t k_aut_len = 0;
+	unsigned int counter;
+
+	id = l_settings_get_string(settings, group, "ReauthId");
+	if (!id)
+		return NULL;
+
+	if (!l_settings_get_uint(settings, group, "Counter", &counter) ||
+			counter > UINT16_MAX)
+		return NULL;
+
+	key = sim_auth_get_key(settings, group, "Key", 16,
+					SIM_AUTH_REAUTH_KEY_MAX, &key_len);
+	k_encr = sim_auth_get_key(settings, group, "EncryptionKey", 16, 16,
+					&k_encr_len);
+	k_aut = sim_auth_get_key(settings, group, "AuthenticationKey", 16,
+					SIM_AUTH_REAUTH_KEY_MAX, &k_aut_len);
+	if (!key || !k_encr || !k_aut)
+		goto done;
+
+	reauth = l_new(struct sim_auth_reauth, 1);
+	reauth->id = l_steal_ptr(id);
+	reauth->counter = counter;
+	memcpy(reauth->key, key, key_len);
+	reauth->key_len = key_len;
+	memcpy(reauth->k_encr, k_encr, k_encr_len);
+	memcpy(reauth->k_aut, k_aut, k_aut_len);
+	reauth->k_aut_len = k_aut_len;
+
+done:
+	if (key) {
+		explicit_bzero(key, key_len);
+		l_free(key);
+	}
+
+	if (k_encr) {
+		explicit_bzero(k_encr, k_encr_len);
+		l_free(k_encr);
+	}
+
+	if (k_aut) {
+		explicit_bzero(k_aut, k_aut_len);
+		l_free(k_aut);
+	}
+
+	return reauth;
+}
+
+static void sim_auth_identities_load(struct iwd_sim_auth *auth)
+{
+	struct l_settings *cache;
+	enum sim_auth_method method;
+
+	if (auth->identities_loaded || !auth->nai || !identity_cache_load)
+		return;
+
+	auth->identities_loaded = true;
+	cache = sim_auth_identity_cache();
+
+	for (method = 0; method < __SIM_AUTH_METHOD_MAX; method++) {
+		struct sim_auth_identities *ids = &auth->identities[method];
+		_auto_(l_free) char *group =
+			sim_auth_identity_group(auth, method);
+
+		if (!l_settings_has_group(cache, group))
+			continue;
+
+		sim_auth_identities_clear(ids);
+		ids->pseudonym = l_settings_get_string(cache, group,
+								"Pseudonym");
+		ids->reauth = sim_auth_reauth_from_settings(cache, group);
+	}
+}
+
+static void sim_auth_identities_save(struct iwd_sim_auth *auth,
+					enum sim_auth_method method)
+{
+	const struct sim_auth_identities *ids = &auth->identities[method];
+	_auto_(l_free) char *group = sim_auth_identity_group(auth, method);
+	struct l_settings *cache;
+
+	if (!group || !identity_cache_sync)
+		return;
+
+	cache = sim_auth_identity_cache();
+	l_settings_remove_group(cache, group);
+
+	if (ids->pseudonym)
+		l_settings_set_string(cache, group, "Pseudonym",
+					ids->pseudonym);
+
+	if (ids->reauth) {
+		const struct sim_auth_reauth *reauth = ids->reauth;
+
+		l_settings_set_string(cache, group, "ReauthId", reauth->id);
+		l_settings_set_uint(cache, group, "Counter", reauth->counter);
+		l_settings_set_bytes(cache, group, "Key", reauth->key,
+					reauth->key_len);
+		l_settings_set_bytes(cache, group, "EncryptionKey",
+					reauth->k_encr, sizeof(reauth->k_encr));
+		l_settings_set_bytes(cache, group, "AuthenticationKey",
+					reauth->k_aut, reauth->k_aut_len);
+	}
+
+	identity_cache_sync(cache);
+}
+
+void sim_auth_set_pseudonym(struct iwd_sim_auth *auth,
+				enum sim_auth_method method,
+				const char *pseudonym)
+{
+	struct sim_auth_identities *ids = &auth->identities[method];
+
+	sim_auth_identities_load(auth);
+
+	l_free(ids->pseudonym);
+	ids->pseudonym = l_strdup(pseudonym);
+
+	sim_auth_identities_save(auth, method);
+}
+
+const char *sim_auth_get_pseudonym(struct iwd_sim_auth *auth,
+					enum sim_auth_method method)
+{
+	sim_auth_identities_load(auth);
+
+	return auth->identities[method].pseudonym;
+}
+
+void sim_auth_set_reauth(struct iwd_sim_auth *auth,
+				enum sim_auth_method method,
+				const struct sim_auth_reauth *reauth)
+{
+	struct sim_auth_identities *ids = &auth->identities[method];
+	struct sim_auth_reauth *copy = NULL;
+
+	sim_auth_identities_load(auth);
+
+	/* reauth may point to the current state, copy before freeing it */
+	if (reauth) {
+		copy = l_memdup(reauth, sizeof(*reauth));
+		copy->id = l_strdup(reauth->id);
+	}
+
+	sim_auth_reauth_free(ids->reauth);
+	ids->reauth = copy;
+
+	sim_auth_identities_save(auth, method);
+}
+
+const struct sim_auth_reauth *sim_auth_get_reauth(struct iwd_sim_auth *auth,
+						enum sim_auth_method method)
+{
+	sim_auth_identities_load(auth);
+
+	return auth->identities[method].reauth;
+}
+
+char *sim_auth_get_identity(struct iwd_sim_auth *auth,
+				enum sim_auth_method method,
+				enum sim_auth_identity_type type)
+{
+	/*
+	 * RFC 4186 Section 4.2.1.6, RFC 4187 Section 4.1.1.6 and RFC 5448
+	 * Section 3: the permanent username is prefixed by '1' for EAP-SIM,
+	 * '0' for EAP-AKA and '6' for EAP-AKA'
+	 */
+	static const char prefix[] = { '1', '0', '6' };
+	const struct sim_auth_reauth *reauth;
+	const char *pseudonym;
+	const char *realm;
+
+	if (!auth->nai)
+		return NULL;
+
+	reauth = sim_auth_get_reauth(auth, method);
+	if (type == SIM_AUTH_IDENTITY_ANY && reauth)
+		return l_strdup(reauth->id);
+
+	pseudonym = sim_auth_get_pseudonym(auth, method);
+	if (type != SIM_AUTH_IDENTITY_PERMANENT && pseudonym) {
+		/* Pseudonyms are usernames, the realm is added by the peer */
+		realm = strchr(auth->nai, '@');
+
+		if (realm && !strchr(pseudonym, '@'))
+			return l_strdup_printf("%s%s", pseudonym, realm);
+
+		return l_strdup(pseudonym);
+	}
+
+	return l_strdup_printf("%c%s", prefix[method], auth->nai);
+}
+
+void sim_auth_set_cache_ops(sim_auth_cache_load_func_t load,
+				sim_auth_cache_sync_func_t sync)
+{
+	identity_cache_load = load;
+	identity_cache_sync = sync;
 }
 
 static int sim_auth_init(void)
@@ -192,6 +803,9 @@ static void sim_auth_exit(void)
 		l_warn("Auth provider queue was not empty on exit!");
 
 	l_queue_destroy(auth_providers, destroy_provider);
+
+	l_settings_free(identity_cache);
+	identity_cache = NULL;
 }
 
 IWD_MODULE(simauth, sim_auth_init, sim_auth_exit)
@@ -33,6 +33,7 @@
 #define NUM_RANDS_MAX		3
 
 struct iwd_sim_auth;
+struct l_settings;
 
 typedef void (*sim_auth_unregistered_cb_t)(void *data);
 
@@ -147,3 +148,71 @@ int sim_auth_run_gsm(struct iwd_sim_auth *auth, const uint8_t *rands,
 		int num_rands, sim_auth_run_gsm_cb_t cb, void *data);
 
 void sim_auth_cancel_request(struct iwd_sim_auth *auth, int id);
+
+/*
+ * Fast re-authentication state kept from the last full authentication.
+ * 'key' is MK for EAP-SIM and EAP-AKA, K_re for EAP-AKA'.  'counter' is
+ * the last counter value the server used with this state.
+ */
+#define SIM_AUTH_REAUTH_KEY_MAX		32
+
+struct sim_auth_reauth {
+	char *id;
+	uint16_t counter;
+	uint8_t key[SIM_AUTH_REAUTH_KEY_MAX];
+	size_t key_len;
+	uint8_t k_encr[16];
+	uint8_t k_aut[SIM_AUTH_REAUTH_KEY_MAX];
+	size_t k_aut_len;
+};
+
+enum sim_auth_method {
+	SIM_AUTH_METHOD_SIM,
+	SIM_AUTH_METHOD_AKA,
+	SIM_AUTH_METHOD_AKA_PRIME,
+	__SIM_AUTH_METHOD_MAX
+};
+
+/*
+ * Pseudonym and fast re-authentication state handed out by the server for
+ * this SIM, kept separately for each method.  Pass NULL to forget.  When
+ * cache ops are set, both are persisted per NAI.
+ */
+void sim_auth_set_pseudonym(struct iwd_sim_auth *auth,
+				enum sim_auth_method method,
+				const char *pseudonym);
+const char *sim_auth_get_pseudonym(struct iwd_sim_auth *auth,
+					enum sim_auth_method method);
+void sim_auth_set_reauth(struct iwd_sim_auth *auth,
+				enum sim_auth_method method,
+				const struct sim_auth_reauth *reauth);
+const struct sim_auth_reauth *sim_auth_get_reauth(struct iwd_sim_auth *auth,
+						enum sim_auth_method method);
+
+/*
+ * Identities the server may ask for, following AT_PERMANENT_ID_REQ,
+ * AT_FULLAUTH_ID_REQ and AT_ANY_ID_REQ.
+ */
+enum sim_auth_identity_type {
+	SIM_AUTH_IDENTITY_PERMANENT,
+	SIM_AUTH_IDENTITY_FULLAUTH,
+	SIM_AUTH_IDENTITY_ANY
+};
+
+/*
+ * Pick the most private identity of the requested type: the fast
+ * re-authentication identity, then the pseudonym, then the permanent
+ * identity.
+ *
+ * @returns		Newly allocated identity, NULL if the NAI is unknown
+ */
+char *sim_auth_get_identity(struct iwd_sim_auth *auth,
+				enum sim_auth_method method,
+				enum sim_auth_identity_type type);
+
+typedef struct l_settings *(*sim_auth_cache_load_func_t)(void);
+typedef void (*sim_auth_cache_sync_func_t)(
+					const struct l_settings *cache);
+
+void sim_auth_set_cache_ops(sim_auth_cache_load_func_t load,
+				sim_auth_cache_sync_func_t sync);
@@ -192,47 +192,37 @@ bool eap_aka_derive_primes(const uint8_t *ck, const uint8_t *ik,
 	return true;
 }
 
-bool eap_aka_prf_prime(const uint8_t *ik_p, const uint8_t *ck_p,
-		const char *identity, uint8_t *k_encr, uint8_t *k_aut,
-		uint8_t *k_re, uint8_t *msk, uint8_t *emsk)
+/* RFC 5448, Section 3.4.1, PRF'(K,S) with S given as a list of iovecs */
+static bool eap_aka_prf_prime_expand(const uint8_t *key,
+					const struct iovec *s, size_t n_s,
+					uint8_t *out, size_t out_len)
 {
 	struct l_checksum *hmac;
-	uint8_t key[32];
-	struct iovec iov[4];
+	struct iovec iov[n_s + 2];
 	/* digest continues to be reused each iteration */
 	uint8_t digest[32];
 	uint8_t i = 0x01;
-	/* 7 iterations will be 224 bytes, 208 of which will get used */
-	uint8_t out[224];
-	uint8_t *pos = out;
-
-	/* K = (IK'|CK') */
-	memcpy(key, ik_p, EAP_AKA_IK_LEN);
-	memcpy(key + EAP_AKA_IK_LEN, ck_p, EAP_AKA_CK_LEN);
 
 	hmac = l_checksum_new_hmac(L_CHECKSUM_SHA256, key, 32);
-	explicit_bzero(key, sizeof(key));
-
 	if (!hmac)
 		return false;
 
 	iov[0].iov_base = digest;
 	/* initial iteration digest is not used */
 	iov[0].iov_len = 0;
-	iov[1].iov_base = (void *)"EAP-AKA'";
-	iov[1].iov_len = strlen("EAP-AKA'");
-	iov[2].iov_base = (void *)identity;
-	iov[2].iov_len = strlen(identity);
-	iov[3].iov_base = &i;
-	iov[3].iov_len = 1;
+	memcpy(iov + 1, s, n_s * sizeof(struct iovec));
+	iov[n_s + 1].iov_base = &i;
+	iov[n_s + 1].iov_len = 1;
+
+	while (out_len) {
+		size_t len = L_MIN(out_len, sizeof(digest));
 
-	/* need 208 bytes for all keys */
-	while (pos < out + 224) {
 		l_checksum_reset(hmac);
-		l_checksum_updatev(hmac, iov, 4);
+		l_checksum_updatev(hmac, iov, n_s + 2);
 		l_checksum_get_digest(hmac, digest, 32);
-		memcpy(pos, digest, 32);
-		pos += 32;
+		memcpy(out, digest, len);
+		out += len;
+		out_len -= len;
 		i++;
 		/* set the digest length so it can be prepended as Tn */
 		iov[0].iov_len = 32;
@@ -241,7 +231,35 @@ bool eap_aka_prf_prime(const uint8_t *ik_p, const uint8_t *ck_p,
 	explicit_bzero(digest, sizeof(digest));
 	l_checksum_free(hmac);
 
-	pos = out;
+	return true;
+}
+
+bool eap_aka_prf_prime(const uint8_t *ik_p, const uint8_t *ck_p,
+		const char *identity, uint8_t *k_encr, uint8_t *k_aut,
+		uint8_t *k_re, uint8_t *msk, uint8_t *emsk)
+{
+	uint8_t key[32];
+	struct iovec s[2];
+	/* need 208 bytes for all keys */
+	uint8_t out[208];
+	uint8_t *pos = out;
+	bool r;
+
+	/* K = (IK'|CK') */
+	memcpy(key, ik_p, EAP_AKA_IK_LEN);
+	memcpy(key + EAP_AKA_IK_LEN, ck_p, EAP_AKA_CK_LEN);
+
+	s[0].iov_base = (void *)"EAP-AKA'";
+	s[0].iov_len = strlen("EAP-AKA'");
+	s[1].iov_base = (void *)identity;
+	s[1].iov_len = strlen(identity);
+
+	r = eap_aka_prf_prime_expand(key, s, 2, out, sizeof(out));
+	explicit_bzero(key, sizeof(key));
+
+	if (!r)
+		return false;
+
 	memcpy(k_encr, pos, EAP_SIM_K_ENCR_LEN);
 	pos += EAP_SIM_K_ENCR_LEN;
 	memcpy(k_aut, pos, EAP_AKA_PRIME_K_AUT_LEN);
@@ -256,6 +274,81 @@ bool eap_aka_prf_prime(const uint8_t *ik_p, const uint8_t *ck_p,
 	return true;
 }
 
+bool eap_aka_prime_derive_reauth_keys(const uint8_t *k_re,
+					const char *identity, uint16_t counter,
+					const uint8_t *nonce_s, uint8_t *msk,
+					uint8_t *emsk)
+{
+	struct iovec s[4];
+	uint8_t counter_be[2];
+	uint8_t out[EAP_SIM_MSK_LEN + EAP_SIM_EMSK_LEN];
+
+	l_put_be16(counter, counter_be);
+
+	s[0].iov_base = (void *)"EAP-AKA' re-auth";
+	s[0].iov_len = strlen("EAP-AKA' re-auth");
+	s[1].iov_base = (void *)identity;
+	s[1].iov_len = strlen(identity);
+	s[2].iov_base = counter_be;
+	s[2].iov_len = 2;
+	s[3].iov_base = (void *)nonce_s;
+	s[3].iov_len = EAP_SIM_NONCE_S_LEN;
+
+	if (!eap_aka_prf_prime_expand(k_re, s, 4, out, sizeof(out)))
+		return false;
+
+	memcpy(msk, out, EAP_SIM_MSK_LEN);
+	memcpy(emsk, out + EAP_SIM_MSK_LEN, EAP_SIM_EMSK_LEN);
+
+	explicit_bzero(out, sizeof(out));
+	return true;
+}
+
+bool eap_sim_derive_reauth_keys(const uint8_t *mk, const char *identity,
+				uint16_t counter, const uint8_t *nonce_s,
+				uint8_t *msk, uint8_t *emsk)
+{
+	struct l_checksum *checksum;
+	struct iovec iov[4];
+	uint8_t counter_be[2];
+	uint8_t xkey[20];
+	/* the PRF generates output in 40 byte blocks, 128 bytes are used */
+	uint8_t prng_buf[160];
+	bool r;
+
+	checksum = l_checksum_new(L_CHECKSUM_SHA1);
+	if (!checksum)
+		return false;
+
+	l_put_be16(counter, counter_be);
+
+	iov[0].iov_base = (void *)identity;
+	iov[0].iov_len = strlen(identity);
+	iov[1].iov_base = counter_be;
+	iov[1].iov_len = 2;
+	iov[2].iov_base = (void *)nonce_s;
+	iov[2].iov_len = EAP_SIM_NONCE_S_LEN;
+	iov[3].iov_base = (void *)mk;
+	iov[3].iov_len = EAP_SIM_MK_LEN;
+
+	r = l_checksum_updatev(checksum, iov, 4) &&
+		l_checksum_get_digest(checksum, xkey, sizeof(xkey)) ==
+							sizeof(xkey);
+	l_checksum_free(checksum);
+
+	if (!r)
+		return false;
+
+	eap_sim_fips_prf(xkey, sizeof(xkey), prng_buf, sizeof(prng_buf));
+	explicit_bzero(xkey, sizeof(xkey));
+
+	memcpy(msk, prng_buf, EAP_SIM_MSK_LEN);
+	memcpy(emsk, prng_buf + EAP_SIM_MSK_LEN, EAP_SIM_EMSK_LEN);
+
+	explicit_bzero(prng_buf, sizeof(prng_buf));
+	return true;
+}
+
 void eap_sim_fips_prf(const void *seed, size_t slen, uint8_t *out, size_t olen)
 {
 	uint8_t xkey[64];
@@ -503,3 +596,434 @@ const void *eap_sim_tlv_iter_get_data(struct eap_sim_tlv_iter *iter)
 {
 	return iter->data;
 }
+
+bool eap_sim_decrypt_encr_data(const uint8_t *k_encr, const uint8_t *iv,
+				const uint8_t *data, size_t len, uint8_t *out)
+{
+	struct l_cipher *cipher;
+	bool r;
+
+	if (!len || len % 16)
+		return false;
+
+	cipher = l_cipher_new(L_CIPHER_AES_CBC, k_encr, EAP_SIM_K_ENCR_LEN);
+	if (!cipher)
+		return false;
+
+	r = l_cipher_set_iv(cipher, iv, EAP_SIM_IV_LEN) &&
+			l_cipher_decrypt(cipher, data, out, len);
+	l_cipher_free(cipher);
+
+	return r;
+}
+
+static char *eap_sim_parse_identity_attr(const uint8_t *data, uint16_t len)
+{
+	uint16_t id_len;
+
+	if (len < 2)
+		return NULL;
+
+	id_len = l_get_be16(data);
+	if (!id_len || id_len > len - 2)
+		return NULL;
+
+	return l_strndup((const char *) data + 2, id_len);
+}
+
+static bool eap_sim_decrypt_next_ids(const uint8_t *k_encr,
+					const uint8_t *iv,
+					const uint8_t *encr, uint16_t encr_len,
+					char **pseudonym, char **reauth_id)
+{
+	uint8_t decrypted[encr_len];
+	struct eap_sim_tlv_iter iter;
+	bool r = false;
+
+	if (!eap_sim_decrypt_encr_data(k_encr, iv, encr, encr_len, decrypted))
+		goto done;
+
+	eap_sim_tlv_iter_init(&iter, decrypted, encr_len);
+
+	while (eap_sim_tlv_iter_next(&iter)) {
+		const uint8_t *contents = eap_sim_tlv_iter_get_data(&iter);
+		uint16_t length = eap_sim_tlv_iter_get_length(&iter);
+		char **id;
+
+		switch (eap_sim_tlv_iter_get_type(&iter)) {
+		case EAP_SIM_AT_NEXT_PSEUDONYM:
+			id = pseudonym;
+			break;
+		case EAP_SIM_AT_NEXT_REAUTH_ID:
+			id = reauth_id;
+			break;
+		default:
+			continue;
+		}
+
+		l_free(*id);
+		*id = eap_sim_parse_identity_attr(contents, length);
+		if (!*id)
+			goto done;
+	}
+
+	r = true;
+
+done:
+	explicit_bzero(decrypted, encr_len);
+	return r;
+}
+
+bool eap_sim_get_next_ids(const uint8_t *pkt, size_t len,
+				const uint8_t *k_encr, char **pseudonym,
+				char **reauth_id)
+{
+	struct eap_sim_tlv_iter iter;
+	const uint8_t *iv = NULL;
+	const uint8_t *encr = NULL;
+	uint16_t encr_len = 0;
+
+	*pseudonym = NULL;
+	*reauth_id = NULL;
+
+	if (len < 3)
+		return false;
+
+	eap_sim_tlv_iter_init(&iter, pkt + 3, len - 3);
+
+	while (eap_sim_tlv_iter_next(&iter)) {
+		const uint8_t *contents = eap_sim_tlv_iter_get_data(&iter);
+		uint16_t length = eap_sim_tlv_iter_get_length(&iter);
+
+		switch (eap_sim_tlv_iter_get_type(&iter)) {
+		case EAP_SIM_AT_IV:
+			if (length < EAP_SIM_IV_LEN + 2)
+				return false;
+
+			iv = contents + 2;
+			break;
+		case EAP_SIM_AT_ENCR_DATA:
+			if (length < 2)
+				return false;
+
+			encr = contents + 2;
+			encr_len = length - 2;
+			break;
+		}
+	}
+
+	if (!encr)
+		return true;
+
+	if (!iv || !encr_len)
+		return false;
+
+	if (eap_sim_decrypt_next_ids(k_encr, iv, encr, encr_len,
+					pseudonym, reauth_id))
+		return true;
+
+	l_free(l_steal_ptr(*pseudonym));
+	l_free(l_steal_ptr(*reauth_id));
+
+	return false;
+}
+
+bool eap_sim_encrypt_encr_data(const uint8_t *k_encr, const uint8_t *iv,
+				const uint8_t *data, size_t len, uint8_t *out)
+{
+	struct l_cipher *cipher;
+	bool r;
+
+	if (!len || len % 16)
+		return false;
+
+	cipher = l_cipher_new(L_CIPHER_AES_CBC, k_encr, EAP_SIM_K_ENCR_LEN);
+	if (!cipher)
+		return false;
+
+	r = l_cipher_set_iv(cipher, iv, EAP_SIM_IV_LEN) &&
+			l_cipher_encrypt(cipher, data, out, len);
+	l_cipher_free(cipher);
+
+	return r;
+}
+
+void eap_sim_reauth_request_clear(struct eap_sim_reauth_request *req)
+{
+	l_free(req->next_pseudonym);
+	l_free(req->next_reauth_id);
+	explicit_bzero(req, sizeof(*req));
+}
+
+static bool eap_sim_decrypt_reauth_attrs(const uint8_t *k_encr,
+					const uint8_t *iv,
+					const uint8_t *encr, uint16_t encr_len,
+					struct eap_sim_reauth_request *req)
+{
+	uint8_t decrypted[encr_len];
+	struct eap_sim_tlv_iter iter;
+	bool have_counter = false;
+	bool have_nonce = false;
+	bool r = false;
+
+	if (!eap_sim_decrypt_encr_data(k_encr, iv, encr, encr_len, decrypted))
+		goto done;
+
+	eap_sim_tlv_iter_init(&iter, decrypted, encr_len);
+
+	while (eap_sim_tlv_iter_next(&iter)) {
+		const uint8_t *contents = eap_sim_tlv_iter_get_data(&iter);
+		uint16_t length = eap_sim_tlv_iter_get_length(&iter);
+		uint8_t type = eap_sim_tlv_iter_get_type(&iter);
+		char **id;
+
+		switch (type) {
+		case EAP_SIM_AT_COUNTER:
+			if (length < 2)
+				goto done;
+
+			req->counter = l_get_be16(contents);
+			have_counter = true;
+			continue;
+		case EAP_SIM_AT_NONCE_S:
+			if (length < EAP_SIM_NONCE_S_LEN + 2)
+				goto done;
+
+			memcpy(req->nonce_s, contents + 2,
+					EAP_SIM_NONCE_S_LEN);
+			have_nonce = true;
+			continue;
+		case EAP_SIM_AT_NEXT_PSEUDONYM:
+			id = &req->next_pseudonym;
+			break;
+		case EAP_SIM_AT_NEXT_REAUTH_ID:
+			id = &req->next_reauth_id;
+			break;
+		case EAP_SIM_AT_PADDING:
+			continue;
+		default:
+			/* RFC 4187 Section 8.1, only skippable attributes */
+			if (type < 128)
+				goto done;
+
+			continue;
+		}
+
+		l_free(*id);
+		*id = eap_sim_parse_identity_attr(contents, length);
+		if (!*id)
+			goto done;
+	}
+
+	r = have_counter && have_nonce;
+
+done:
+	explicit_bzero(decrypted, encr_len);
+	return r;
+}
+
+bool eap_sim_parse_reauth_request(const uint8_t *pkt, size_t len,
+					const uint8_t *k_encr,
+					struct eap_sim_reauth_request *req)
+{
+	struct eap_sim_tlv_iter iter;
+	const uint8_t *iv = NULL;
+	const uint8_t *encr = NULL;
+	const uint8_t *mac = NULL;
+	uint16_t encr_len = 0;
+
+	memset(req, 0, sizeof(*req));
+
+	if (len < 3)
+		return false;
+
+	eap_sim_tlv_iter_init(&iter, pkt + 3, len - 3);
+
+	while (eap_sim_tlv_iter_next(&iter)) {
+		const uint8_t *contents = eap_sim_tlv_iter_get_data(&iter);
+		uint16_t length = eap_sim_tlv_iter_get_length(&iter);
+		uint8_t type = eap_sim_tlv_iter_get_type(&iter);
+
+		switch (type) {
+		case EAP_SIM_AT_IV:
+			if (length < EAP_SIM_IV_LEN + 2)
+				return false;
+
+			iv = contents + 2;
+			break;
+		case EAP_SIM_AT_ENCR_DATA:
+			if (length < 2)
+				return false;
+
+			encr = contents + 2;
+			encr_len = length - 2;
+			break;
+		case EAP_SIM_AT_MAC:
+			if (length < EAP_SIM_MAC_LEN + 2)
+				return false;
+
+			mac = contents + 2;
+			break;
+		case EAP_SIM_AT_RESULT_IND:
+			req->result_ind = true;
+			break;
+		case EAP_SIM_AT_CHECKCODE:
+		case EAP_SIM_AT_PADDING:
+			break;
+		default:
+			if (type < 128) {
+				l_error("attribute %u was found in "
+					"Re-authentication", type);
+				return false;
+			}
+
+			break;
+		}
+	}
+
+	if (!iv || !encr || !encr_len || !mac)
+		return false;
+
+	memcpy(req->mac, mac, EAP_SIM_MAC_LEN);
+
+	if (eap_sim_decrypt_reauth_attrs(k_encr, iv, encr, encr_len, req))
+		return true;
+
+	eap_sim_reauth_request_clear(req);
+	return false;
+}
+
+static bool eap_sim_decrypt_counter(const uint8_t *k_encr, const uint8_t *iv,
+					const uint8_t *encr, uint16_t encr_len,
+					uint16_t *counter)
+{
+	uint8_t decrypted[encr_len];
+	struct eap_sim_tlv_iter iter;
+	bool r = false;
+
+	if (!eap_sim_decrypt_encr_data(k_encr, iv, encr, encr_len, decrypted))
+		goto done;
+
+	eap_sim_tlv_iter_init(&iter, decrypted, encr_len);
+
+	while (eap_sim_tlv_iter_next(&iter)) {
+		if (eap_sim_tlv_iter_get_type(&iter) != EAP_SIM_AT_COUNTER)
+			continue;
+
+		if (eap_sim_tlv_iter_get_length(&iter) < 2)
+			goto done;
+
+		*counter = l_get_be16(eap_sim_tlv_iter_get_data(&iter));
+		r = true;
+		break;
+	}
+
+done:
+	explicit_bzero(decrypted, encr_len);
+	return r;
+}
+
+bool eap_sim_get_encr_counter(const uint8_t *pkt, size_t len,
+				const uint8_t *k_encr, uint16_t *counter)
+{
+	struct eap_sim_tlv_iter iter;
+	const uint8_t *iv = NULL;
+	const uint8_t *encr = NULL;
+	uint16_t encr_len = 0;
+
+	if (len < 3)
+		return false;
+
+	eap_sim_tlv_iter_init(&iter, pkt + 3, len - 3);
+
+	while (eap_sim_tlv_iter_next(&iter)) {
+		const uint8_t *contents = eap_sim_tlv_iter_get_data(&iter);
+		uint16_t length = eap_sim_tlv_iter_get_length(&iter);
+
+		switch (eap_sim_tlv_iter_get_type(&iter)) {
+		case EAP_SIM_AT_IV:
+			if (length < EAP_SIM_IV_LEN + 2)
+				return false;
+
+			iv = contents + 2;
+			break;
+		case EAP_SIM_AT_ENCR_DATA:
+			if (length < 2)
+				return false;
+
+			encr = contents + 2;
+			encr_len = length - 2;
+			break;
+		}
+	}
+
+	if (!iv || !encr || !encr_len)
+		return false;
+
+	return eap_sim_decrypt_counter(k_encr, iv, encr, encr_len, counter);
+}
+
+size_t eap_sim_build_counter_response(struct eap_state *eap,
+					enum eap_type type, uint8_t subtype,
+					uint16_t counter, bool too_small,
+					bool result_ind, const uint8_t *k_encr,
+					const uint8_t *k_aut,
+					const uint8_t *nonce_s, uint8_t *buf)
+{
+	size_t len = EAP_SIM_COUNTER_RESPONSE_LEN_MAX - (result_ind ? 0 : 4);
+	/* AT_COUNTER [+ AT_COUNTER_TOO_SMALL] + AT_PADDING, one AES block */
+	uint8_t plain[16];
+	uint8_t encr[16];
+	uint8_t iv[EAP_SIM_IV_LEN];
+	uint8_t counter_be[2];
+	uint8_t *pos = plain;
+	uint8_t *mac_pos;
+	bool r;
+
+	l_put_be16(counter, counter_be);
+
+	pos += eap_sim_add_attribute(pos, EAP_SIM_AT_COUNTER,
+			EAP_SIM_PAD_NONE, counter_be, 2);
+
+	if (too_small)
+		pos += eap_sim_add_attribute(pos, EAP_SIM_AT_COUNTER_TOO_SMALL,
+				EAP_SIM_PAD_NONE, NULL, 2);
+
+	eap_sim_add_attribute(pos, EAP_SIM_AT_PADDING, EAP_SIM_PAD_NONE,
+			NULL, plain + sizeof(plain) - pos - 2);
+
+	l_getrandom(iv, sizeof(iv));
+
+	r = eap_sim_encrypt_encr_data(k_encr, iv, plain, sizeof(plain), encr);
+	explicit_bzero(plain, sizeof(plain));
+
+	if (!r)
+		return 0;
+
+	pos = buf;
+	pos += eap_sim_build_header(eap, type, subtype, pos, len);
+	pos += eap_sim_add_attribute(pos, EAP_SIM_AT_IV, EAP_SIM_PAD_ZERO,
+			iv, EAP_SIM_IV_LEN);
+	pos += eap_sim_add_attribute(pos, EAP_SIM_AT_ENCR_DATA,
+			EAP_SIM_PAD_ZERO, encr, sizeof(encr));
+
+	if (result_ind)
+		pos += eap_sim_add_attribute(pos, EAP_SIM_AT_RESULT_IND,
+				EAP_SIM_PAD_NONE, NULL, 2);
+
+	/* save MAC position to know where to write it to */
+	mac_pos = pos;
+	pos += eap_sim_add_attribute(pos, EAP_SIM_AT_MAC, EAP_SIM_PAD_NONE,
+			NULL, EAP_SIM_MAC_LEN);
+
+	/* NONCE_S is only appended for the MAC derivation */
+	if (nonce_s) {
+		memcpy(pos, nonce_s, EAP_SIM_NONCE_S_LEN);
+		pos += EAP_SIM_NONCE_S_LEN;
+	}
+
+	if (!eap_sim_derive_mac(type, buf, pos - buf, k_aut, mac_pos + 4))
+		return 0;
+
+	return len;
+}
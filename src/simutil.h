@@ -35,6 +35,7 @@
 #define EAP_AKA_K_RE_LEN	32
 #define EAP_AKA_IK_LEN		16
 #define EAP_AKA_CK_LEN		16
+#define EAP_SIM_NONCE_S_LEN	16
 
 /*
  * Possible pad types for EAP-SIM/EAP-AKA attributes
@@ -81,6 +82,7 @@ enum eap_sim_at {
 	EAP_SIM_AT_SELECTED_VERSION	= 0x10,
 	EAP_SIM_AT_FULLAUTH_ID_REQ	= 0x11,
 	EAP_SIM_AT_COUNTER		= 0x13,
+	EAP_SIM_AT_COUNTER_TOO_SMALL	= 0x14,
 	EAP_SIM_AT_NONCE_S		= 0x15,
 	EAP_SIM_AT_CLIENT_ERROR_CODE	= 0x16,
 	EAP_SIM_AT_KDF_INPUT		= 0x17,
@@ -279,3 +281,133 @@ uint8_t eap_sim_tlv_iter_get_type(struct eap_sim_tlv_iter *iter);
 uint16_t eap_sim_tlv_iter_get_length(struct eap_sim_tlv_iter *iter);
 
 const void *eap_sim_tlv_iter_get_data(struct eap_sim_tlv_iter *iter);
+
+/*
+ * Decrypt the contents of AT_ENCR_DATA, AES-128-CBC without padding
+ *
+ * k_encr - K_encr derived for this session
+ * iv - IV from the AT_IV attribute
+ * data - encrypted data, following the two reserved bytes of AT_ENCR_DATA
+ * len - length of data, a multiple of 16
+ * out - buffer for len bytes of decrypted attributes
+ */
+bool eap_sim_decrypt_encr_data(const uint8_t *k_encr, const uint8_t *iv,
+				const uint8_t *data, size_t len, uint8_t *out);
+
+/*
+ * Extract AT_NEXT_PSEUDONYM and AT_NEXT_REAUTH_ID from the encrypted data
+ * of a (MAC verified) Challenge or Re-authentication packet.
+ *
+ * pkt - EAP-SIM/AKA packet starting at the subtype
+ * len - length of pkt
+ * k_encr - K_encr derived for this session
+ * pseudonym, reauth_id - set to newly allocated identities, or NULL if the
+ *			server didn't send one
+ *
+ * Returns false if the encrypted data was malformed.
+ */
+bool eap_sim_get_next_ids(const uint8_t *pkt, size_t len,
+				const uint8_t *k_encr, char **pseudonym,
+				char **reauth_id);
+
+/*
+ * Encrypt attributes for AT_ENCR_DATA, AES-128-CBC without padding.  The
+ * caller is expected to have added AT_PADDING as needed.
+ *
+ * k_encr - K_encr derived for this session
+ * iv - IV sent in the AT_IV attribute
+ * data - plaintext attributes
+ * len - length of data, a multiple of 16
+ * out - buffer for len bytes of encrypted data
+ */
+bool eap_sim_encrypt_encr_data(const uint8_t *k_encr, const uint8_t *iv,
+				const uint8_t *data, size_t len, uint8_t *out);
+
+/*
+ * RFC 4186 Section 7 / RFC 4187 Section 7
+ *
+ * Fast re-authentication keys for EAP-SIM and EAP-AKA:
+ *
+ * XKEY' = SHA1(Identity|counter|NONCE_S|MK)
+ * MSK | EMSK = PRF(XKEY')
+ *
+ * identity - the fast re-authentication identity in use
+ */
+bool eap_sim_derive_reauth_keys(const uint8_t *mk, const char *identity,
+				uint16_t counter, const uint8_t *nonce_s,
+				uint8_t *msk, uint8_t *emsk);
+
+/*
+ * RFC 5448 Section 3.3
+ *
+ * Fast re-authentication keys for EAP-AKA':
+ *
+ * MK = PRF'(K_re,"EAP-AKA' re-auth"|Identity|counter|NONCE_S)
+ *      MSK  = MK[0..511]
+ *      EMSK = MK[512..1023]
+ */
+bool eap_aka_prime_derive_reauth_keys(const uint8_t *k_re,
+					const char *identity, uint16_t counter,
+					const uint8_t *nonce_s, uint8_t *msk,
+					uint8_t *emsk);
+
+/*
+ * Contents of an EAP-SIM/AKA Re-authentication request, including the
+ * attributes from AT_ENCR_DATA.
+ */
+struct eap_sim_reauth_request {
+	uint16_t counter;
+	uint8_t nonce_s[EAP_SIM_NONCE_S_LEN];
+	uint8_t mac[EAP_SIM_MAC_LEN];
+	char *next_pseudonym;
+	char *next_reauth_id;
+	bool result_ind : 1;
+};
+
+/*
+ * Parse a (MAC verified) Re-authentication request.
+ *
+ * pkt - EAP-SIM/AKA packet starting at the subtype
+ * len - length of pkt
+ * k_encr - K_encr kept from the last full authentication
+ * req - filled in on success, release with eap_sim_reauth_request_clear()
+ */
+bool eap_sim_parse_reauth_request(const uint8_t *pkt, size_t len,
+					const uint8_t *k_encr,
+					struct eap_sim_reauth_request *req);
+
+void eap_sim_reauth_request_clear(struct eap_sim_reauth_request *req);
+
+/*
+ * Extract AT_COUNTER from the encrypted data of a (MAC verified) packet,
+ * such as a Notification sent during fast re-authentication.
+ *
+ * pkt - EAP-SIM/AKA packet starting at the subtype
+ * len - length of pkt
+ * k_encr - K_encr in use for this session
+ *
+ * Returns false if AT_COUNTER is missing or the encrypted data malformed.
+ */
+bool eap_sim_get_encr_counter(const uint8_t *pkt, size_t len,
+				const uint8_t *k_encr, uint16_t *counter);
+
+/* header + AT_IV + AT_ENCR_DATA + AT_RESULT_IND + AT_MAC */
+#define EAP_SIM_COUNTER_RESPONSE_LEN_MAX	(8 + 20 + 20 + 4 + 20)
+
+/*
+ * Build a response carrying AT_COUNTER (and AT_COUNTER_TOO_SMALL if
+ * too_small is set) in AT_ENCR_DATA, as used to answer Re-authentication
+ * requests and Notifications during fast re-authentication.
+ *
+ * subtype - EAP-SIM/AKA subtype of the response
+ * nonce_s - NONCE_S to include in the MAC calculation, or NULL
+ * buf - room for EAP_SIM_COUNTER_RESPONSE_LEN_MAX + EAP_SIM_NONCE_S_LEN
+ *
+ * Returns the length of the packet in buf, 0 on error.
+ */
+size_t eap_sim_build_counter_response(struct eap_state *eap,
+					enum eap_type type, uint8_t subtype,
+					uint16_t counter, bool too_small,
+					bool result_ind, const uint8_t *k_encr,
+					const uint8_t *k_aut,
+					const uint8_t *nonce_s, uint8_t *buf);
@@ -30,6 +30,7 @@
 #include <time.h>
 #include <sys/time.h>
 #include <limits.h>
+#include <inttypes.h>
 #include <linux/if_ether.h>
 
 #include <ell/ell.h>
@@ -52,6 +53,7 @@
 #include "src/blacklist.h"
 #include "src/mpdu.h"
 #include "src/erp.h"
+#include "src/simauth.h"
 #include "src/netconfig.h"
 #include "src/anqp.h"
 #include "src/anqputil.h"
@@ -78,6 +80,37 @@ static struct watchlist event_watches;
 static uint32_t known_networks_watch;
 static uint32_t allowed_bands;
 
+/*
+ * Phases of a connection attempt, in the order they are entered.  The scan
+ * phase runs from the last scan results to the connect request.
+ */
+enum station_connect_phase {
+	STATION_CONNECT_PHASE_SCAN,
+	STATION_CONNECT_PHASE_CONNECT,
+	STATION_CONNECT_PHASE_AUTHENTICATE,
+	STATION_CONNECT_PHASE_ASSOCIATE,
+	STATION_CONNECT_PHASE_HANDSHAKE,
+	STATION_CONNECT_PHASE_SET_KEYS,
+	STATION_CONNECT_PHASE_NETCONFIG,
+	STATION_CONNECT_PHASE_CONNECTED,
+	__STATION_CONNECT_PHASE_MAX,
+};
+
+/* Monotonic timestamps of each phase, zero if the phase was skipped */
+struct station_connect_trace {
+	uint64_t timestamps[__STATION_CONNECT_PHASE_MAX];
+	unsigned int attempts;
+};
+
+/*
+ * Connect times over the daemon lifetime.  Bucket 0 counts connections that
+ * took less than 1ms, bucket n those that took [2^(n-1), 2^n) ms and the
+ * last bucket everything slower.
+ */
+#define STATION_CONNECT_TIME_BUCKETS	16
+
+static uint32_t connect_time_histogram[STATION_CONNECT_TIME_BUCKETS];
+
 struct station {
 	enum station_state state;
 	struct watchlist state_watches;
@@ -126,6 +159,9 @@ struct station {
 	struct wiphy_radio_work_item ft_work;
 
 	uint64_t last_roam_scan;
+	uint64_t last_scan_results;
+
+	struct station_connect_trace connect_trace;
 
 	struct l_queue *affinities;
 	unsigned int affinity_watch;
@@ -236,6 +272,133 @@ static bool station_debug_event(struct station *station, const char *name)
 	return l_dbus_send(dbus_get_bus(), signal) != 0;
 }
 
+static const char *station_connect_phase_to_string(
+					enum station_connect_phase phase)
+{
+	switch (phase) {
+	case STATION_CONNECT_PHASE_SCAN:
+		return "scan";
+	case STATION_CONNECT_PHASE_CONNECT:
+		return "connect";
+	case STATION_CONNECT_PHASE_AUTHENTICATE:
+		return "authenticate";
+	case STATION_CONNECT_PHASE_ASSOCIATE:
+		return "associate";
+	case STATION_CONNECT_PHASE_HANDSHAKE:
+		return "handshake";
+	case STATION_CONNECT_PHASE_SET_KEYS:
+		return "set-keys";
+	case STATION_CONNECT_PHASE_NETCONFIG:
+		return "netconfig";
+	case STATION_CONNECT_PHASE_CONNECTED:
+	case __STATION_CONNECT_PHASE_MAX:
+		break;
+	}
+
+	return NULL;
+}
+
+static bool station_connect_trace_active(struct station *station)
+{
+	const struct station_connect_trace *trace = &station->connect_trace;
+
+	return trace->timestamps[STATION_CONNECT_PHASE_CONNECT] &&
+			!trace->timestamps[STATION_CONNECT_PHASE_CONNECTED];
+}
+
+static void station_connect_trace_start(struct station *station)
+{
+	struct station_connect_trace *trace = &station->connect_trace;
+
+	/* Retrying with another BSS, restart the per-BSS phases */
+	if (station_connect_trace_active(station)) {
+		memset(&trace->timestamps[STATION_CONNECT_PHASE_AUTHENTICATE],
+			0, sizeof(trace->timestamps) -
+			STATION_CONNECT_PHASE_AUTHENTICATE * sizeof(uint64_t));
+		trace->attempts++;
+		return;
+	}
+
+	memset(trace, 0, sizeof(*trace));
+	trace->timestamps[STATION_CONNECT_PHASE_SCAN] =
+						station->last_scan_results;
+	trace->timestamps[STATION_CONNECT_PHASE_CONNECT] = l_time_now();
+	trace->attempts = 1;
+}
+
+static void station_connect_trace_mark(struct station *station,
+					enum station_connect_phase phase)
+{
+	if (!station_connect_trace_active(station))
+		return;
+
+	station->connect_trace.timestamps[phase] = l_time_now();
+}
+
+/* Time spent in @phase in microseconds, 0 if the phase was skipped */
+static uint64_t station_connect_phase_time(
+				const struct station_connect_trace *trace,
+				enum station_connect_phase phase)
+{
+	unsigned int i;
+
+	if (!trace->timestamps[phase])
+		return 0;
+
+	for (i = phase + 1; i < __STATION_CONNECT_PHASE_MAX; i++)
+		if (trace->timestamps[i])
+			return l_time_diff(trace->timestamps[phase],
+						trace->timestamps[i]);
+
+	return 0;
+}
+
+/* Time from the connect request to the connection being usable */
+static uint64_t station_connect_trace_total(
+				const struct station_connect_trace *trace)
+{
+	return l_time_diff(trace->timestamps[STATION_CONNECT_PHASE_CONNECT],
+			trace->timestamps[STATION_CONNECT_PHASE_CONNECTED]);
+}
+
+static void station_connect_trace_finish(struct station *station)
+{
+	struct station_connect_trace *trace = &station->connect_trace;
+	struct l_string *phases;
+	uint64_t total_ms;
+	unsigned int bucket;
+	unsigned int i;
+	char *str;
+
+	if (!station_connect_trace_active(station))
+		return;
+
+	trace->timestamps[STATION_CONNECT_PHASE_CONNECTED] = l_time_now();
+	total_ms = station_connect_trace_total(trace) / L_USEC_PER_MSEC;
+
+	bucket = total_ms ? 64 - __builtin_clzll(total_ms) : 0;
+	connect_time_histogram[L_MIN(bucket,
+				STATION_CONNECT_TIME_BUCKETS - 1U)]++;
+
+	phases = l_string_new(128);
+
+	for (i = 0; i < STATION_CONNECT_PHASE_CONNECTED; i++) {
+		if (!trace->timestamps[i])
+			continue;
+
+		l_string_append_printf(phases, ", %s %" PRIu64 " ms",
+					station_connect_phase_to_string(i),
+					station_connect_phase_time(trace, i) /
+					L_USEC_PER_MSEC);
+	}
+
+	str = l_string_unwrap(phases);
+	l_info("Connected to %s in %" PRIu64 " ms, %u attempt(s)%s",
+		network_get_ssid(station->connected_network), total_ms,
+		trace->attempts, str);
+	l_free(str);
+}
+
 static void station_property_set_scanning(struct station *station,
 								bool scanning)
 {
@@ -1030,6 +1193,8 @@ void station_set_scan_results(struct station *station,
 
 	l_queue_foreach_remove(new_bss_list, bss_free_if_ssid_not_utf8, NULL);
 
+	station->last_scan_results = l_time_now();
+
 	while ((network = l_queue_pop_head(station->networks_sorted)))
 		network_bss_list_clear(network);
 
@@ -1109,9 +1274,13 @@ static void station_handshake_event(struct handshake_state *hs,
 	case HANDSHAKE_EVENT_STARTED:
 		l_debug("Handshaking");
 		station_debug_event(station, "handshake-started");
+		station_connect_trace_mark(station,
+					STATION_CONNECT_PHASE_HANDSHAKE);
 		break;
 	case HANDSHAKE_EVENT_SETTING_KEYS:
 		l_debug("Setting keys");
+		station_connect_trace_mark(station,
+					STATION_CONNECT_PHASE_SET_KEYS);
 
 		/* If we got here, then our settings work.  Update if needed */
 		network_sync_settings(network);
@@ -1469,6 +1638,8 @@ static uint32_t station_scan_trigger(struct station *station,
 	memset(&params, 0, sizeof(params));
 	params.flush = true;
 	params.freqs = freqs;
+	/* Don't hold up connections or roams for a full spectrum scan */
+	params.chunked = !freqs;
 
 	if (wiphy_can_randomize_mac_addr(station->wiphy) ||
 			station->connected_bss ||
@@ -1727,6 +1898,7 @@ static void station_enter_state(struct station *station,
 		periodic_scan_stop(station);
 		break;
 	case STATION_STATE_CONNECTED:
+		station_connect_trace_finish(station);
 #ifdef HAVE_DBUS
 		l_dbus_object_add_interface(dbus,
 					netdev_get_path(station->netdev),
@@ -1905,6 +2077,8 @@ static void station_reset_connection_state(struct station *station)
 	station->connected_bss = NULL;
 	station->connected_network = NULL;
 
+	memset(&station->connect_trace, 0, sizeof(station->connect_trace));
+
 #ifdef HAVE_DBUS
 	l_dbus_property_changed(dbus, netdev_get_path(station->netdev),
 				IWD_STATION_INTERFACE, "ConnectedNetwork");
@@ -2624,6 +2798,7 @@ done:
 		wiphy_radio_work_reschedule(station->wiphy, &station->ft_work);
 	else
 		wiphy_radio_work_insert(station->wiphy, &station->ft_work,
+					netdev_get_wdev_id(station->netdev),
 					WIPHY_WORK_PRIORITY_CONNECT,
 					&ft_work_ops);
 
@@ -3438,6 +3613,9 @@ static void station_connect_ok(struct station *station)
 	network_connected(station->connected_network);
 
 	if (station->netconfig) {
+		station_connect_trace_mark(station,
+					STATION_CONNECT_PHASE_NETCONFIG);
+
 		if (hs->fils_ip_req_ie && hs->fils_ip_resp_ie) {
 			struct ie_fils_ip_addr_response_info info;
 			struct ie_tlv_iter iter;
@@ -3679,9 +3857,13 @@ static void station_netdev_event(struct netdev *netdev, enum netdev_event event,
 	switch (event) {
 	case NETDEV_EVENT_AUTHENTICATING:
 		station_debug_event(station, "authenticating");
+		station_connect_trace_mark(station,
+					STATION_CONNECT_PHASE_AUTHENTICATE);
 		break;
 	case NETDEV_EVENT_ASSOCIATING:
 		station_debug_event(station, "associating");
+		station_connect_trace_mark(station,
+					STATION_CONNECT_PHASE_ASSOCIATE);
 		break;
 	case NETDEV_EVENT_DISCONNECT_BY_AP:
 	case NETDEV_EVENT_DISCONNECT_BY_SME:
@@ -3751,6 +3933,8 @@ int __station_connect_network(struct station *station, struct network *network,
 	station->connected_bss = bss;
 	station->connected_network = network;
 
+	station_connect_trace_start(station);
+
 	if (station->state != state)
 		station_enter_state(station, state);
 
@@ -4846,15 +5030,6 @@ int station_hide_network(struct station *station, struct network *network)
 	return 0;
 }
 
-static void station_add_2_4ghz_freq(uint32_t freq, void *user_data)
-{
-	struct scan_freq_set *set = user_data;
-
-	/* exclude social channels added in initial scan request */
-	if (freq < 3000 && freq != 2412 && freq != 2437 && freq != 2462)
-		scan_freq_set_add(set, freq);
-}
-
 static void station_fill_scan_freq_subsets(struct station *station)
 {
 	const struct scan_freq_set *supported =
@@ -4890,11 +5065,16 @@ static void station_fill_scan_freq_subsets(struct station *station)
 			station->scan_freqs_order[subset_idx++] = set;
 	}
 
-	/* Add remaining 2.4ghz channels to subset */
+	/*
+	 * Add remaining 2.4ghz channels to subset, excluding the social
+	 * channels added in the initial scan request
+	 */
 	if (allowed_bands & BAND_FREQ_2_4_GHZ) {
-		station->scan_freqs_order[subset_idx] = scan_freq_set_new();
-		scan_freq_set_foreach(supported, station_add_2_4ghz_freq,
-					station->scan_freqs_order[subset_idx]);
+		struct scan_freq_set *set = scan_freq_set_clone(supported,
+							BAND_FREQ_2_4_GHZ);
+
+		scan_freq_set_subtract(set, station->scan_freqs_order[0]);
+		station->scan_freqs_order[subset_idx] = set;
 	}
 
 	/*
@@ -5137,6 +5317,62 @@ static void station_destroy_interface(void *user_data)
 	station_free(station);
 }
 
+static void station_append_connect_trace(struct station *station,
+				struct l_dbus_message_builder *builder)
+{
+	const struct station_connect_trace *trace = &station->connect_trace;
+	uint32_t total_ms;
+	unsigned int i;
+
+	/* Only report completed traces */
+	if (!trace->timestamps[STATION_CONNECT_PHASE_CONNECTED])
+		return;
+
+	total_ms = station_connect_trace_total(trace) / L_USEC_PER_MSEC;
+
+	dbus_append_dict_basic(builder, "ConnectTime", 'u', &total_ms);
+	dbus_append_dict_basic(builder, "ConnectAttempts", 'u',
+				&trace->attempts);
+
+	l_dbus_message_builder_enter_dict(builder, "sv");
+	l_dbus_message_builder_append_basic(builder, 's', "ConnectPhases");
+	l_dbus_message_builder_enter_variant(builder, "a{su}");
+	l_dbus_message_builder_enter_array(builder, "{su}");
+
+	for (i = 0; i < STATION_CONNECT_PHASE_CONNECTED; i++) {
+		uint32_t ms;
+
+		if (!trace->timestamps[i])
+			continue;
+
+		ms = station_connect_phase_time(trace, i) / L_USEC_PER_MSEC;
+
+		l_dbus_message_builder_enter_dict(builder, "su");
+		l_dbus_message_builder_append_basic(builder, 's',
+					station_connect_phase_to_string(i));
+		l_dbus_message_builder_append_basic(builder, 'u', &ms);
+		l_dbus_message_builder_leave_dict(builder);
+	}
+
+	l_dbus_message_builder_leave_array(builder);
+	l_dbus_message_builder_leave_variant(builder);
+	l_dbus_message_builder_leave_dict(builder);
+
+	l_dbus_message_builder_enter_dict(builder, "sv");
+	l_dbus_message_builder_append_basic(builder, 's',
+						"ConnectTimeHistogram");
+	l_dbus_message_builder_enter_variant(builder, "au");
+	l_dbus_message_builder_enter_array(builder, "u");
+
+	for (i = 0; i < STATION_CONNECT_TIME_BUCKETS; i++)
+		l_dbus_message_builder_append_basic(builder, 'u',
+						&connect_time_histogram[i]);
+
+	l_dbus_message_builder_leave_array(builder);
+	l_dbus_message_builder_leave_variant(builder);
+	l_dbus_message_builder_leave_dict(builder);
+}
+
 static void station_get_diagnostic_cb(
 				const struct diagnostic_station_info *info,
 				void *user_data)
@@ -5188,6 +5424,7 @@ static void station_get_diagnostic_cb(
 						's', str);
 	}
 
+	station_append_connect_trace(station, builder);
 	diagnostic_info_to_dict(info, builder);
 
 	l_dbus_message_builder_leave_array(builder);
@@ -5762,10 +5999,17 @@ static void station_known_networks_changed(enum known_networks_event event,
 {
 	_auto_(l_free) char *network_id = NULL;
 
-	if (event != KNOWN_NETWORKS_EVENT_REMOVED)
+	if (info->type != SECURITY_8021X)
 		return;
 
-	if (info->type != SECURITY_8021X)
+	/*
+	 * Certificate files are revalidated on use but an edited profile may
+	 * point to different ones now, drop the parsed certificates either way
+	 */
+	if (event != KNOWN_NETWORKS_EVENT_ADDED)
+		eap_tls_cert_cache_flush();
+
+	if (event != KNOWN_NETWORKS_EVENT_REMOVED)
 		return;
 
 	network_id = l_util_hexstring(info->ssid, strlen(info->ssid));
@@ -5841,6 +6085,9 @@ static int station_init(void)
 
 	eap_tls_set_session_cache_ops(storage_eap_tls_cache_load,
 					storage_eap_tls_cache_sync);
+	erp_set_cache_ops(storage_erp_cache_load, storage_erp_cache_sync);
+	sim_auth_set_cache_ops(storage_sim_identity_cache_load,
+				storage_sim_identity_cache_sync);
 	known_networks_watch = known_networks_watch_add(
 						station_known_networks_changed,
 						NULL, NULL);
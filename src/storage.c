@@ -55,9 +55,12 @@
 
 #define KNOWN_FREQ_FILENAME ".known_network.freq"
 #define EAP_TLS_CACHE_FILENAME ".eap-tls-session-cache"
+#define ERP_CACHE_FILENAME ".erp-cache"
+#define SIM_IDENTITY_CACHE_FILENAME ".sim-identity-cache"
 
 static char *storage_path = NULL;
 static char *storage_hotspot_path = NULL;
+static char *storage_ap_path = NULL;
 static uint8_t system_key[32];
 static bool system_key_set = false;
 
@@ -231,6 +234,18 @@ bool storage_create_dirs(void)
 		return false;
 	}
 
+	storage_ap_path = l_strdup_printf("%s/ap/", storage_path);
+
+	if (create_dirs(storage_ap_path)) {
+		l_error("Failed to create %s", storage_ap_path);
+
+		l_free(storage_path);
+		l_free(storage_hotspot_path);
+		l_free(storage_ap_path);
+
+		return false;
+	}
+
 	return true;
 }
 
@@ -238,6 +253,7 @@ void storage_cleanup_dirs(void)
 {
 	l_free(storage_path);
 	l_free(storage_hotspot_path);
+	l_free(storage_ap_path);
 }
 
 char *storage_get_path(const char *format, ...)
@@ -744,6 +760,137 @@ void storage_eap_tls_cache_sync(const struct l_settings *cache)
 	explicit_bzero(data, len);
 }
 
+/*
+ * Caches holding key material are only persisted when a system key is
+ * available.  The whole cache is encrypted with AES-SIV using the system
+ * key, a random salt and the file name as the associated data, and written
+ * as [<group>].EncryptedSalt and [<group>].EncryptedCache.
+ */
+static struct l_settings *storage_encrypted_cache_load(const char *filename,
+							const char *group)
+{
+	_auto_(l_free) char *path = storage_get_path("%s", filename);
+	_auto_(l_settings_free) struct l_settings *file = NULL;
+	_auto_(l_free) uint8_t *encrypted = NULL;
+	_auto_(l_free) uint8_t *salt = NULL;
+	_auto_(l_free) char *decrypted = NULL;
+	struct l_settings *cache;
+	size_t elen, slen;
+	struct iovec ad[2];
+
+	if (!system_key_set)
+		return NULL;
+
+	file = l_settings_new();
+
+	if (!l_settings_load_from_file(file, path)) {
+		l_debug("No %s cache loaded from %s", group, path);
+		return NULL;
+	}
+
+	encrypted = l_settings_get_bytes(file, group, "EncryptedCache", &elen);
+	salt = l_settings_get_bytes(file, group, "EncryptedSalt", &slen);
+
+	if (!encrypted || !salt || elen < 16) {
+		l_warn("%s cache %s is corrupted, ignoring", group, path);
+		return NULL;
+	}
+
+	decrypted = l_malloc(elen - 16 + 1);
+
+	ad[0].iov_base = (void *) salt;
+	ad[0].iov_len = slen;
+	ad[1].iov_base = (void *) filename;
+	ad[1].iov_len = strlen(filename);
+
+	if (!aes_siv_decrypt(system_key, sizeof(system_key), encrypted, elen,
+				ad, 2, decrypted)) {
+		l_debug("Could not decrypt the %s cache, did the secret "
+			"change?", group);
+		return NULL;
+	}
+
+	decrypted[elen - 16] = '\0';
+	cache = l_settings_new();
+
+	if (!l_settings_load_from_data(cache, decrypted, elen - 16)) {
+		l_settings_free(cache);
+		cache = NULL;
+	}
+
+	explicit_bzero(decrypted, elen - 16);
+	return cache;
+}
+
+static void storage_encrypted_cache_sync(const char *filename,
+						const char *group,
+						const struct l_settings *cache)
+{
+	_auto_(l_free) char *path = storage_get_path("%s", filename);
+	_auto_(l_settings_free) struct l_settings *file = NULL;
+	_auto_(l_free) char *plaintext = NULL;
+	_auto_(l_free) uint8_t *enc = NULL;
+	_auto_(l_free) char *data = NULL;
+	uint8_t salt[32];
+	struct iovec ad[2];
+	size_t len;
+
+	if (!system_key_set)
+		return;
+
+	plaintext = l_settings_to_data(cache, &len);
+	if (!plaintext)
+		return;
+
+	l_getrandom(salt, sizeof(salt));
+
+	ad[0].iov_base = (void *) salt;
+	ad[0].iov_len = sizeof(salt);
+	ad[1].iov_base = (void *) filename;
+	ad[1].iov_len = strlen(filename);
+
+	enc = l_malloc(len + 16);
+
+	if (!aes_siv_encrypt(system_key, sizeof(system_key), plaintext, len,
+				ad, 2, enc)) {
+		l_error("Could not encrypt the %s cache", group);
+		goto done;
+	}
+
+	file = l_settings_new();
+	l_settings_set_bytes(file, group, "EncryptedSalt", salt, sizeof(salt));
+	l_settings_set_bytes(file, group, "EncryptedCache", enc, len + 16);
+
+	data = l_settings_to_data(file, &len);
+	write_file(data, len, false, "%s", path);
+
+done:
+	explicit_bzero(plaintext, strlen(plaintext));
+}
+
+struct l_settings *storage_erp_cache_load(void)
+{
+	return storage_encrypted_cache_load(ERP_CACHE_FILENAME, "ERP");
+}
+
+void storage_erp_cache_sync(const struct l_settings *cache)
+{
+	storage_encrypted_cache_sync(ERP_CACHE_FILENAME, "ERP", cache);
+}
+
+/* Holds the EAP-SIM/AKA fast re-authentication keys */
+struct l_settings *storage_sim_identity_cache_load(void)
+{
+	return storage_encrypted_cache_load(SIM_IDENTITY_CACHE_FILENAME,
+						"SIM");
+}
+
+void storage_sim_identity_cache_sync(const struct l_settings *cache)
+{
+	storage_encrypted_cache_sync(SIM_IDENTITY_CACHE_FILENAME, "SIM",
+					cache);
+}
+
 bool storage_is_file(const char *filename)
 {
 	char *path;
@@ -54,6 +54,12 @@ void storage_known_frequencies_sync(struct l_settings *known_freqs);
 struct l_settings *storage_eap_tls_cache_load(void);
 void storage_eap_tls_cache_sync(const struct l_settings *cache);
 
+struct l_settings *storage_erp_cache_load(void);
+void storage_erp_cache_sync(const struct l_settings *cache);
+
+struct l_settings *storage_sim_identity_cache_load(void);
+void storage_sim_identity_cache_sync(const struct l_settings *cache);
+
 int __storage_decrypt(struct l_settings *settings, const char *ssid,
 				bool *changed);
 char *__storage_encrypt(const struct l_settings *settings, const char *ssid,
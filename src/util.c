@@ -176,6 +176,24 @@ bool util_is_valid_sta_address(const uint8_t *addr)
 	return !util_is_broadcast_address(addr) && !util_is_group_address(addr);
 }
 
+/* Hash and compare functions for l_hashmaps keyed by a MAC address */
+unsigned int util_address_hash(const void *addr)
+{
+	const uint8_t *p = addr;
+	unsigned int h = 0;
+	unsigned int i;
+
+	for (i = 0; i < 6; i++)
+		h = (h << 5) - h + p[i];
+
+	return h;
+}
+
+int util_address_compare(const void *a, const void *b)
+{
+	return memcmp(a, b, 6);
+}
+
 /* This function assumes that identity is not bigger than 253 bytes */
 const char *util_get_domain(const char *identity)
 {
@@ -312,292 +330,406 @@ bool util_ip_prefix_tohl(const char *ip, uint8_t *prefix_out,
 	return true;
 }
 
+/*
+ * Channels of each band are kept in a fixed size bitmap indexed by channel
+ * number, so that all the set operations are word-wise bit operations and
+ * none of them need to allocate.
+ */
+#define SCAN_FREQ_SET_WORDS	(256 / 64)
+
+enum scan_freq_set_band {
+	SCAN_FREQ_SET_2_4_GHZ,
+	SCAN_FREQ_SET_5_GHZ,
+	SCAN_FREQ_SET_6_GHZ,
+	SCAN_FREQ_SET_BANDS,
+};
+
 struct scan_freq_set {
-	uint16_t channels_2ghz;
-	struct l_uintset *channels_5ghz;
-	struct l_uintset *channels_6ghz;
+	uint64_t channels[SCAN_FREQ_SET_BANDS][SCAN_FREQ_SET_WORDS];
 };
 
-struct scan_freq_set *scan_freq_set_new(void)
+static const enum band_freq scan_freq_set_band_freq[] = {
+	[SCAN_FREQ_SET_2_4_GHZ] = BAND_FREQ_2_4_GHZ,
+	[SCAN_FREQ_SET_5_GHZ] = BAND_FREQ_5_GHZ,
+	[SCAN_FREQ_SET_6_GHZ] = BAND_FREQ_6_GHZ,
+};
+
+/* Order in which the bands are iterated */
+static const enum scan_freq_set_band scan_freq_set_iter_order[] = {
+	SCAN_FREQ_SET_5_GHZ,
+	SCAN_FREQ_SET_6_GHZ,
+	SCAN_FREQ_SET_2_4_GHZ,
+};
+
+static uint64_t *scan_freq_set_lookup(const struct scan_freq_set *freqs,
+					uint32_t freq, uint8_t *out_channel)
 {
-	struct scan_freq_set *ret = l_new(struct scan_freq_set, 1);
+	enum band_freq band;
+	uint8_t channel;
+	unsigned int i;
 
-	/* 802.11-2012, 8.4.2.10 hints that 200 is the largest channel number */
-	ret->channels_5ghz = l_uintset_new_from_range(1, 200);
-	ret->channels_6ghz = l_uintset_new_from_range(1, 233);
+	channel = band_freq_to_channel(freq, &band);
+	if (!channel)
+		return NULL;
 
-	return ret;
+	for (i = 0; i < SCAN_FREQ_SET_BANDS; i++)
+		if (scan_freq_set_band_freq[i] == band)
+			break;
+
+	if (i == SCAN_FREQ_SET_BANDS)
+		return NULL;
+
+	*out_channel = channel;
+	return (uint64_t *) freqs->channels[i] + channel / 64;
 }
 
-void scan_freq_set_free(struct scan_freq_set *freqs)
+struct scan_freq_set *scan_freq_set_new(void)
 {
-	if (!freqs)
-		return;
+	return l_new(struct scan_freq_set, 1);
+}
 
-	l_uintset_free(freqs->channels_5ghz);
-	l_uintset_free(freqs->channels_6ghz);
+void scan_freq_set_free(struct scan_freq_set *freqs)
+{
 	l_free(freqs);
 }
 
 bool scan_freq_set_add(struct scan_freq_set *freqs, uint32_t freq)
 {
-	enum band_freq band;
 	uint8_t channel;
+	uint64_t *word = scan_freq_set_lookup(freqs, freq, &channel);
 
-	channel = band_freq_to_channel(freq, &band);
-	if (!channel)
+	if (!word)
 		return false;
 
-	switch (band) {
-	case BAND_FREQ_2_4_GHZ:
-		freqs->channels_2ghz |= 1 << (channel - 1);
-		return true;
-	case BAND_FREQ_5_GHZ:
-		return l_uintset_put(freqs->channels_5ghz, channel);
-	case BAND_FREQ_6_GHZ:
-		return l_uintset_put(freqs->channels_6ghz, channel);
-	}
-
-	return false;
+	*word |= 1ULL << (channel % 64);
+	return true;
 }
 
 bool scan_freq_set_remove(struct scan_freq_set *freqs, uint32_t freq)
 {
-	enum band_freq band;
 	uint8_t channel;
+	uint64_t *word = scan_freq_set_lookup(freqs, freq, &channel);
 
-	channel = band_freq_to_channel(freq, &band);
-	if (!channel)
+	if (!word)
 		return false;
 
-	switch (band) {
-	case BAND_FREQ_2_4_GHZ:
-		freqs->channels_2ghz &= ~(1 << (channel - 1));
-		return true;
-	case BAND_FREQ_5_GHZ:
-		return l_uintset_take(freqs->channels_5ghz, channel);
-	case BAND_FREQ_6_GHZ:
-		return l_uintset_take(freqs->channels_6ghz, channel);
-	}
-
-	return false;
+	*word &= ~(1ULL << (channel % 64));
+	return true;
 }
 
 bool scan_freq_set_contains(const struct scan_freq_set *freqs, uint32_t freq)
 {
-	enum band_freq band;
 	uint8_t channel;
+	const uint64_t *word = scan_freq_set_lookup(freqs, freq, &channel);
 
-	channel = band_freq_to_channel(freq, &band);
-	if (!channel)
+	if (!word)
 		return false;
 
-	switch (band) {
-	case BAND_FREQ_2_4_GHZ:
-		return freqs->channels_2ghz & (1 << (channel - 1));
-	case BAND_FREQ_5_GHZ:
-		return l_uintset_contains(freqs->channels_5ghz, channel);
-	case BAND_FREQ_6_GHZ:
-		return l_uintset_contains(freqs->channels_6ghz, channel);
-	}
-
-	return false;
+	return *word & (1ULL << (channel % 64));
 }
 
-uint32_t scan_freq_set_get_bands(const struct scan_freq_set *freqs)
+static bool scan_freq_set_band_isempty(const struct scan_freq_set *freqs,
+					enum scan_freq_set_band band)
 {
-	uint32_t bands = 0;
-	uint32_t max;
-
-	if (freqs->channels_2ghz)
-		bands |= BAND_FREQ_2_4_GHZ;
-
-	max = l_uintset_get_max(freqs->channels_5ghz);
-
-	if (l_uintset_find_min(freqs->channels_5ghz) <= max)
-		bands |= BAND_FREQ_5_GHZ;
-
-	max = l_uintset_get_max(freqs->channels_6ghz);
+	unsigned int i;
 
-	if (l_uintset_find_min(freqs->channels_6ghz) <= max)
-		bands |= BAND_FREQ_6_GHZ;
+	for (i = 0; i < SCAN_FREQ_SET_WORDS; i++)
+		if (freqs->channels[band][i])
+			return false;
 
-	return bands;
+	return true;
 }
 
-static void scan_channels_add(uint32_t channel, void *user_data)
+uint32_t scan_freq_set_get_bands(const struct scan_freq_set *freqs)
 {
-	struct l_uintset *to = user_data;
+	uint32_t bands = 0;
+	unsigned int i;
+
+	for (i = 0; i < SCAN_FREQ_SET_BANDS; i++)
+		if (!scan_freq_set_band_isempty(freqs, i))
+			bands |= scan_freq_set_band_freq[i];
 
-	l_uintset_put(to, channel);
+	return bands;
 }
 
 void scan_freq_set_merge(struct scan_freq_set *to,
 					const struct scan_freq_set *from)
 {
-	to->channels_2ghz |= from->channels_2ghz;
+	unsigned int i;
+	unsigned int j;
 
-	l_uintset_foreach(from->channels_5ghz, scan_channels_add,
-							to->channels_5ghz);
-	l_uintset_foreach(from->channels_6ghz, scan_channels_add,
-							to->channels_6ghz);
+	for (i = 0; i < SCAN_FREQ_SET_BANDS; i++)
+		for (j = 0; j < SCAN_FREQ_SET_WORDS; j++)
+			to->channels[i][j] |= from->channels[i][j];
 }
 
 bool scan_freq_set_isempty(const struct scan_freq_set *set)
 {
-	if (set->channels_2ghz == 0 && l_uintset_isempty(set->channels_5ghz) &&
-					l_uintset_isempty(set->channels_6ghz))
-		return true;
+	return !scan_freq_set_get_bands(set);
+}
 
-	return false;
+unsigned int scan_freq_set_size(const struct scan_freq_set *set)
+{
+	unsigned int count = 0;
+	unsigned int i;
+	unsigned int j;
+
+	for (i = 0; i < SCAN_FREQ_SET_BANDS; i++)
+		for (j = 0; j < SCAN_FREQ_SET_WORDS; j++)
+			count += __builtin_popcountll(set->channels[i][j]);
+
+	return count;
 }
 
-struct channels_foreach_data {
-	scan_freq_set_func_t func;
-	enum band_freq band;
-	void *user_data;
-};
+void scan_freq_set_iter_init(struct scan_freq_set_iter *iter,
+				const struct scan_freq_set *set)
+{
+	iter->set = set;
+	iter->band = 0;
+	iter->channel = 0;
+}
 
-static void scan_channels_foreach(uint32_t channel, void *user_data)
+/*
+ * Returns the frequencies in the set one at a time: 5GHz first, then 6GHz
+ * and 2.4GHz last, each in ascending channel order.
+ */
+bool scan_freq_set_iter_next(struct scan_freq_set_iter *iter,
+				uint32_t *out_freq)
 {
-	const struct channels_foreach_data *channels_data = user_data;
-	uint32_t freq;
+	while (iter->band < L_ARRAY_SIZE(scan_freq_set_iter_order)) {
+		enum scan_freq_set_band band =
+				scan_freq_set_iter_order[iter->band];
+		const uint64_t *words = iter->set->channels[band];
+
+		while (iter->channel < SCAN_FREQ_SET_WORDS * 64) {
+			unsigned int idx = iter->channel / 64;
+			uint64_t bits = words[idx] >> (iter->channel % 64);
+
+			if (!bits) {
+				iter->channel = (idx + 1) * 64;
+				continue;
+			}
+
+			iter->channel += __builtin_ctzll(bits);
+			*out_freq = band_channel_to_freq(iter->channel++,
+						scan_freq_set_band_freq[band]);
+			return true;
+		}
 
-	freq = band_channel_to_freq(channel, channels_data->band);
+		iter->band++;
+		iter->channel = 0;
+	}
 
-	channels_data->func(freq, channels_data->user_data);
+	return false;
 }
 
 void scan_freq_set_foreach(const struct scan_freq_set *freqs,
 				scan_freq_set_func_t func, void *user_data)
 {
-	struct channels_foreach_data data = { };
-	uint8_t channel;
+	struct scan_freq_set_iter iter;
 	uint32_t freq;
 
 	if (unlikely(!freqs || !func))
 		return;
 
-	data.func = func;
-	data.band = BAND_FREQ_5_GHZ;
-	data.user_data = user_data;
-
-	l_uintset_foreach(freqs->channels_5ghz, scan_channels_foreach, &data);
+	scan_freq_set_iter_init(&iter, freqs);
 
-	data.band = BAND_FREQ_6_GHZ;
+	while (scan_freq_set_iter_next(&iter, &freq))
+		func(freq, user_data);
+}
 
-	l_uintset_foreach(freqs->channels_6ghz, scan_channels_foreach, &data);
+void scan_freq_set_constrain(struct scan_freq_set *set,
+					const struct scan_freq_set *constraint)
+{
+	unsigned int i;
+	unsigned int j;
 
-	if (!freqs->channels_2ghz)
-		return;
+	for (i = 0; i < SCAN_FREQ_SET_BANDS; i++)
+		for (j = 0; j < SCAN_FREQ_SET_WORDS; j++)
+			set->channels[i][j] &= constraint->channels[i][j];
+}
 
-	for (channel = 1; channel <= 14; channel++) {
-		if (freqs->channels_2ghz & (1 << (channel - 1))) {
-			freq = band_channel_to_freq(channel, BAND_FREQ_2_4_GHZ);
+void scan_freq_set_subtract(struct scan_freq_set *set,
+					const struct scan_freq_set *subtract)
+{
+	unsigned int i;
+	unsigned int j;
 
-			func(freq, user_data);
-		}
-	}
+	for (i = 0; i < SCAN_FREQ_SET_BANDS; i++)
+		for (j = 0; j < SCAN_FREQ_SET_WORDS; j++)
+			set->channels[i][j] &= ~subtract->channels[i][j];
 }
 
-void scan_freq_set_constrain(struct scan_freq_set *set,
-					const struct scan_freq_set *constraint)
+uint32_t *scan_freq_set_to_fixed_array(const struct scan_freq_set *set,
+					size_t *len_out)
 {
-	struct l_uintset *intersection;
+	unsigned int count = scan_freq_set_size(set);
+	struct scan_freq_set_iter iter;
+	uint32_t *freqs;
+	unsigned int i = 0;
 
-	intersection = l_uintset_intersect(constraint->channels_5ghz,
-							set->channels_5ghz);
-	if (!intersection)
-		/* This shouldn't ever be the case. */
-		return;
+	if (!count)
+		return NULL;
 
-	l_uintset_free(set->channels_5ghz);
-	set->channels_5ghz = intersection;
+	freqs = l_new(uint32_t, count);
 
-	intersection = l_uintset_intersect(constraint->channels_6ghz,
-							set->channels_6ghz);
-	if (!intersection)
-		return;
+	scan_freq_set_iter_init(&iter, set);
 
-	l_uintset_free(set->channels_6ghz);
-	set->channels_6ghz = intersection;
+	while (scan_freq_set_iter_next(&iter, &freqs[i]))
+		i++;
+
+	*len_out = count;
 
-	set->channels_2ghz &= constraint->channels_2ghz;
+	return freqs;
 }
 
-void scan_freq_set_subtract(struct scan_freq_set *set,
-					const struct scan_freq_set *subtract)
+struct scan_freq_set *scan_freq_set_clone(const struct scan_freq_set *set,
+							uint32_t band_mask)
 {
-	struct l_uintset *sub;
+	struct scan_freq_set *new = l_new(struct scan_freq_set, 1);
+	unsigned int i;
 
-	sub = l_uintset_subtract(set->channels_6ghz, subtract->channels_6ghz);
-	if (L_WARN_ON(!sub))
-		return;
+	for (i = 0; i < SCAN_FREQ_SET_BANDS; i++)
+		if (band_mask & scan_freq_set_band_freq[i])
+			memcpy(new->channels[i], set->channels[i],
+						sizeof(set->channels[i]));
 
-	l_uintset_free(set->channels_6ghz);
-	set->channels_6ghz = sub;
+	return new;
+}
 
-	sub = l_uintset_subtract(set->channels_5ghz, subtract->channels_5ghz);
-	if (L_WARN_ON(!sub))
-		return;
+/* Minimum size of the segments added when a databuf runs out of room */
+#define DATABUF_SEG_MIN_CAPACITY	4096
+
+static struct databuf_seg *databuf_add_seg(struct databuf *databuf,
+						size_t capacity)
+{
+	struct databuf_seg *seg = l_malloc(sizeof(*seg) + capacity);
 
-	l_uintset_free(set->channels_5ghz);
-	set->channels_5ghz = sub;
+	seg->next = NULL;
+	seg->len = 0;
+	seg->capacity = capacity;
 
-	set->channels_2ghz &= ~subtract->channels_2ghz;
+	if (databuf->tail)
+		databuf->tail->next = seg;
+	else
+		databuf->head = seg;
+
+	databuf->tail = seg;
+	databuf->capacity += capacity;
+
+	return seg;
 }
 
-static void add_foreach(uint32_t freq, void *user_data)
+/*
+ * The initial segment is sized for @capacity so that a buffer whose final
+ * size is known up front, such as a reassembled message, is contiguous
+ * and takes a single allocation for the data.
+ */
+struct databuf *databuf_new(size_t capacity)
 {
-	uint32_t **list = user_data;
+	struct databuf *databuf;
 
-	**list = freq;
+	if (!capacity)
+		return NULL;
 
-	*list = *list + 1;
+	databuf = l_new(struct databuf, 1);
+	databuf_add_seg(databuf, capacity);
+
+	return databuf;
 }
 
-uint32_t *scan_freq_set_to_fixed_array(const struct scan_freq_set *set,
-					size_t *len_out)
+void databuf_append(struct databuf *databuf, const uint8_t *data,
+								size_t data_len)
 {
-	uint8_t count = 0;
-	uint32_t *freqs;
+	struct databuf_seg *seg;
+	size_t n;
+
+	if (!databuf)
+		return;
 
-	count = __builtin_popcount(set->channels_2ghz) +
-				l_uintset_size(set->channels_5ghz) +
-				l_uintset_size(set->channels_6ghz);
+	seg = databuf->tail;
+	n = L_MIN(seg->capacity - seg->len, data_len);
+	memcpy(seg->data + seg->len, data, n);
+	seg->len += n;
+	databuf->len += n;
 
-	if (!count)
-		return NULL;
+	if (n == data_len)
+		return;
 
-	freqs = l_new(uint32_t, count);
+	data += n;
+	data_len -= n;
 
-	scan_freq_set_foreach(set, add_foreach, &freqs);
+	seg = databuf_add_seg(databuf, L_MAX(data_len,
+						DATABUF_SEG_MIN_CAPACITY));
+	memcpy(seg->data, data, data_len);
+	seg->len = data_len;
+	databuf->len += data_len;
+}
 
-	/* Move pointer back to start of list */
-	freqs -= count;
+/*
+ * Gathers up to @out_len bytes starting at @offset into @out, returns the
+ * number of bytes copied.
+ */
+size_t databuf_copy(const struct databuf *databuf, size_t offset,
+					uint8_t *out, size_t out_len)
+{
+	const struct databuf_seg *seg;
+	size_t copied = 0;
 
-	*len_out = count;
+	for (seg = databuf->head; seg && copied < out_len; seg = seg->next) {
+		size_t n;
 
-	return freqs;
+		if (offset >= seg->len) {
+			offset -= seg->len;
+			continue;
+		}
+
+		n = L_MIN(seg->len - offset, out_len - copied);
+		memcpy(out + copied, seg->data + offset, n);
+		copied += n;
+		offset = 0;
+	}
+
+	return copied;
 }
 
-struct scan_freq_set *scan_freq_set_clone(const struct scan_freq_set *set,
-							uint32_t band_mask)
+/* Returns the data as one contiguous block, merging segments if needed */
+const uint8_t *databuf_flatten(struct databuf *databuf)
 {
-	struct scan_freq_set *new = l_new(struct scan_freq_set, 1);
+	struct databuf_seg *seg;
+	struct databuf_seg *next;
 
-	if (band_mask & BAND_FREQ_2_4_GHZ)
-		new->channels_2ghz = set->channels_2ghz;
+	if (databuf->head == databuf->tail)
+		return databuf->head->data;
 
-	if (band_mask & BAND_FREQ_5_GHZ)
-		new->channels_5ghz = l_uintset_clone(set->channels_5ghz);
-	else
-		new->channels_5ghz = l_uintset_new_from_range(1, 200);
+	seg = l_malloc(sizeof(*seg) + databuf->len);
+	seg->next = NULL;
+	seg->len = databuf_copy(databuf, 0, seg->data, databuf->len);
+	seg->capacity = databuf->len;
 
-	if (band_mask & BAND_FREQ_6_GHZ)
-		new->channels_6ghz = l_uintset_clone(set->channels_6ghz);
-	else
-		new->channels_6ghz = l_uintset_new_from_range(1, 233);
+	for (next = databuf->head; next; next = databuf->head) {
+		databuf->head = next->next;
+		l_free(next);
+	}
 
-	return new;
+	databuf->head = seg;
+	databuf->tail = seg;
+	databuf->capacity = seg->capacity;
+
+	return seg->data;
+}
+
+void databuf_free(struct databuf *databuf)
+{
+	struct databuf_seg *seg;
+
+	if (!databuf)
+		return;
+
+	while ((seg = databuf->head)) {
+		databuf->head = seg->next;
+		l_free(seg);
+	}
+
+	l_free(databuf);
 }
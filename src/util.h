@@ -44,6 +44,8 @@ bool util_string_to_address(const char *str, uint8_t *addr);
 bool util_is_group_address(const uint8_t *addr);
 bool util_is_broadcast_address(const uint8_t *addr);
 bool util_is_valid_sta_address(const uint8_t *addr);
+unsigned int util_address_hash(const void *addr);
+int util_address_compare(const void *a, const void *b);
 
 const char *util_get_domain(const char *identity);
 const char *util_get_username(const char *identity);
@@ -108,6 +110,12 @@ static inline bool util_ip_subnet_match(uint8_t prefix_len,
 
 typedef void (*scan_freq_set_func_t)(uint32_t freq, void *userdata);
 
+struct scan_freq_set_iter {
+	const struct scan_freq_set *set;
+	unsigned int band;
+	unsigned int channel;
+};
+
 struct scan_freq_set *scan_freq_set_new(void);
 void scan_freq_set_free(struct scan_freq_set *freqs);
 bool scan_freq_set_add(struct scan_freq_set *freqs, uint32_t freq);
@@ -123,6 +131,11 @@ void scan_freq_set_constrain(struct scan_freq_set *set,
 void scan_freq_set_subtract(struct scan_freq_set *set,
 					const struct scan_freq_set *subtract);
 bool scan_freq_set_isempty(const struct scan_freq_set *set);
+unsigned int scan_freq_set_size(const struct scan_freq_set *set);
+void scan_freq_set_iter_init(struct scan_freq_set_iter *iter,
+				const struct scan_freq_set *set);
+bool scan_freq_set_iter_next(struct scan_freq_set_iter *iter,
+				uint32_t *out_freq);
 uint32_t *scan_freq_set_to_fixed_array(const struct scan_freq_set *set,
 					size_t *len_out);
 struct scan_freq_set *scan_freq_set_clone(const struct scan_freq_set *set,
@@ -130,4 +143,31 @@ struct scan_freq_set *scan_freq_set_clone(const struct scan_freq_set *set,
 
 DEFINE_CLEANUP_FUNC(scan_freq_set_free);
 
+/*
+ * A byte buffer kept as a chain of segments so that appending never moves
+ * data that is already buffered.  Walk the segments directly to consume
+ * the data without copying.
+ */
+struct databuf_seg {
+	struct databuf_seg *next;
+	size_t len;
+	size_t capacity;
+	uint8_t data[];
+};
+
+struct databuf {
+	struct databuf_seg *head;
+	struct databuf_seg *tail;
+	size_t len;
+	size_t capacity;
+};
+
+struct databuf *databuf_new(size_t capacity);
+void databuf_append(struct databuf *databuf, const uint8_t *data,
+								size_t data_len);
+size_t databuf_copy(const struct databuf *databuf, size_t offset,
+					uint8_t *out, size_t out_len);
+const uint8_t *databuf_flatten(struct databuf *databuf);
+void databuf_free(struct databuf *databuf);
+
 #endif /* __UTIL_H */
@@ -33,6 +33,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <limits.h>
+#include <inttypes.h>
 
 #include <ell/ell.h>
 
@@ -66,6 +67,7 @@ static char **blacklist_filter;
 static int mac_randomize_bytes = 6;
 static char regdom_country[2];
 static uint32_t work_ids;
+static struct wiphy_radio_work_stat_info work_stats[__WIPHY_WORK_PRIORITY_MAX];
 static unsigned int wiphy_dump_id;
 
 enum driver_flag {
@@ -132,6 +134,7 @@ struct wiphy {
 	char regdom_country[2];
 	/* Work queue for this radio */
 	struct l_queue *work;
+	uint64_t work_last_wdev;
 	bool work_in_callback;
 	unsigned int get_reg_id;
 	unsigned int dump_id;
@@ -981,18 +984,38 @@ const uint8_t *wiphy_get_ht_capabilities(const struct wiphy *wiphy,
 	return ht_capa;
 }
 
+/*
+ * Returns the last @tag element with a length between @min_len and @max_len,
+ * or NULL.  Later occurrences override earlier ones, same as a single pass
+ * over the IEs would.
+ */
+static const void *wiphy_find_last_ie(const struct ie_index *index,
+					unsigned int tag, unsigned int min_len,
+					unsigned int max_len)
+{
+	const struct ie_index_entry *entry;
+	const void *found = NULL;
+
+	for (entry = ie_index_find(index, tag); entry;
+			entry = ie_index_next(index, entry))
+		if (entry->len >= min_len && entry->len <= max_len)
+			found = entry->data - 2;
+
+	return found;
+}
+
 int wiphy_estimate_data_rate(struct wiphy *wiphy,
-				const void *ies, uint16_t ies_len,
+				const struct ie_index *index,
 				const struct scan_bss *bss,
 				uint64_t *out_data_rate)
 {
-	struct ie_tlv_iter iter;
-	const void *supported_rates = NULL;
-	const void *ext_supported_rates = NULL;
-	const void *vht_capabilities = NULL;
-	const void *vht_operation = NULL;
-	const void *ht_capabilities = NULL;
-	const void *ht_operation = NULL;
+	const struct ie_index_entry *entry;
+	const void *supported_rates;
+	const void *ext_supported_rates;
+	const void *vht_capabilities;
+	const void *vht_operation;
+	const void *ht_capabilities;
+	const void *ht_operation;
 	const void *he_capabilities = NULL;
 	const struct band *bandp;
 	enum band_freq band;
@@ -1005,57 +1028,27 @@ int wiphy_estimate_data_rate(struct wiphy *wiphy,
 	if (!bandp)
 		return -ENOTSUP;
 
-	ie_tlv_iter_init(&iter, ies, ies_len);
-
-	while (ie_tlv_iter_next(&iter)) {
-		uint16_t tag = ie_tlv_iter_get_tag(&iter);
-
-		switch (tag) {
-		case IE_TYPE_SUPPORTED_RATES:
-			if (iter.len > 8)
-				continue;
-
-			supported_rates = iter.data - 2;
-			break;
-		case IE_TYPE_EXTENDED_SUPPORTED_RATES:
-			ext_supported_rates = iter.data - 2;
-			break;
-		case IE_TYPE_HT_CAPABILITIES:
-			if (iter.len != 26)
-				continue;
-
-			ht_capabilities = iter.data - 2;
-			break;
-		case IE_TYPE_HT_OPERATION:
-			if (iter.len != 22)
-				continue;
-
-			ht_operation = iter.data - 2;
-			break;
-		case IE_TYPE_VHT_CAPABILITIES:
-			if (iter.len != 12)
-				continue;
-
-			vht_capabilities = iter.data - 2;
-			break;
-		case IE_TYPE_VHT_OPERATION:
-			if (iter.len != 5)
-				continue;
-
-			vht_operation = iter.data - 2;
-			break;
-		case IE_TYPE_HE_CAPABILITIES:
-			if (!ie_validate_he_capabilities(iter.data, iter.len)) {
-				l_warn("invalid HE capabilities for "MAC,
-					MAC_STR(bss->addr));
-				continue;
-			}
-
-			he_capabilities = iter.data;
-			break;
-		default:
-			break;
+	supported_rates = wiphy_find_last_ie(index, IE_TYPE_SUPPORTED_RATES,
+						0, 8);
+	ext_supported_rates = wiphy_find_last_ie(index,
+					IE_TYPE_EXTENDED_SUPPORTED_RATES,
+					0, UINT8_MAX);
+	ht_capabilities = wiphy_find_last_ie(index, IE_TYPE_HT_CAPABILITIES,
+						26, 26);
+	ht_operation = wiphy_find_last_ie(index, IE_TYPE_HT_OPERATION, 22, 22);
+	vht_capabilities = wiphy_find_last_ie(index, IE_TYPE_VHT_CAPABILITIES,
+						12, 12);
+	vht_operation = wiphy_find_last_ie(index, IE_TYPE_VHT_OPERATION, 5, 5);
+
+	for (entry = ie_index_find(index, IE_TYPE_HE_CAPABILITIES); entry;
+			entry = ie_index_next(index, entry)) {
+		if (!ie_validate_he_capabilities(entry->data, entry->len)) {
+			l_warn("invalid HE capabilities for "MAC,
+				MAC_STR(bss->addr));
+			continue;
 		}
+
+		he_capabilities = entry->data;
 	}
 
 	ret = band_estimate_he_rx_rate(bandp, he_capabilities,
@@ -2656,19 +2649,136 @@ static void wiphy_reg_notify(struct l_genl_msg *msg, void *user_data)
 	wiphy_dump_after_regdom(wiphy);
 }
 
-static void wiphy_radio_work_next(struct wiphy *wiphy)
+/*
+ * Queued work gains one priority level for every WIPHY_WORK_AGING_INTERVAL
+ * spent waiting so that e.g. periodic scans can't be starved forever by a
+ * steady stream of higher priority work.
+ */
+#define WIPHY_WORK_AGING_INTERVAL	(5 * L_USEC_PER_SEC)
+
+static int wiphy_radio_work_effective_priority(
+				const struct wiphy_radio_work_item *work,
+				uint64_t now)
+{
+	uint64_t boost;
+
+	/* Past its deadline, run ahead of anything else */
+	if (work->deadline && !l_time_before(now, work->deadline))
+		return INT_MIN;
+
+	boost = l_time_diff(work->queued_time, now) /
+		WIPHY_WORK_AGING_INTERVAL;
+
+	if (boost >= (uint64_t) (work->priority - WIPHY_WORK_PRIORITY_FT))
+		return L_MIN(work->priority, WIPHY_WORK_PRIORITY_FT);
+
+	return work->priority - boost;
+}
+
+/*
+ * Picks the queued item to run next: the best effective priority wins.  On
+ * a tie an item of another wdev is preferred over one of the wdev whose
+ * work was started last, so that e.g. the AP and the station interfaces
+ * on one radio take turns instead of one of them running a whole burst of
+ * equal priority work first.  Otherwise ties are FIFO.
+ */
+static struct wiphy_radio_work_item *wiphy_radio_work_pick(
+						struct wiphy *wiphy,
+						uint64_t now)
+{
+	const struct l_queue_entry *entry;
+	struct wiphy_radio_work_item *best = NULL;
+	int best_priority = INT_MAX;
+
+	/* The queue is in static priority order so ties are FIFO */
+	for (entry = l_queue_get_entries(wiphy->work); entry;
+			entry = entry->next) {
+		struct wiphy_radio_work_item *work = entry->data;
+		int priority;
+
+		if (work->running)
+			continue;
+
+		priority = wiphy_radio_work_effective_priority(work, now);
+
+		if (!best || priority < best_priority ||
+				(priority == best_priority &&
+				 best->wdev_id == wiphy->work_last_wdev &&
+				 work->wdev_id != wiphy->work_last_wdev)) {
+			best = work;
+			best_priority = priority;
+		}
+	}
+
+	return best;
+}
+
+static struct wiphy_radio_work_stat_info *wiphy_radio_work_stat(
+				const struct wiphy_radio_work_item *work)
+{
+	if (L_WARN_ON(work->priority < 0 ||
+			work->priority >= __WIPHY_WORK_PRIORITY_MAX))
+		return NULL;
+
+	return &work_stats[work->priority];
+}
+
+static void wiphy_radio_work_stat_start(
+				const struct wiphy_radio_work_item *work,
+				uint64_t now)
+{
+	struct wiphy_radio_work_stat_info *info = wiphy_radio_work_stat(work);
+	uint64_t usec = l_time_diff(work->queued_time, now);
+	uint64_t msec = usec / L_USEC_PER_MSEC;
+	unsigned int bucket = msec ? 64 - __builtin_clzll(msec) : 0;
+
+	if (!info)
+		return;
+
+	info->count++;
+	info->total_wait_usec += usec;
+	info->max_wait_usec = L_MAX(info->max_wait_usec, usec);
+	info->wait_histogram[L_MIN(bucket, WIPHY_WORK_STAT_BUCKETS - 1U)]++;
+
+	if (work->deadline && !l_time_before(now, work->deadline))
+		info->late++;
+}
+
+/* Accounts for the time since the item was last started, if it was */
+static void wiphy_radio_work_stat_stop(
+				const struct wiphy_radio_work_item *work,
+				uint64_t now)
+{
+	struct wiphy_radio_work_stat_info *info = wiphy_radio_work_stat(work);
+	uint64_t usec;
+
+	if (!info || !work->start_time)
+		return;
+
+	usec = l_time_diff(work->start_time, now);
+	info->total_run_usec += usec;
+	info->max_run_usec = L_MAX(info->max_run_usec, usec);
+}
+
+static void wiphy_radio_work_next(struct wiphy *wiphy);
+
+static void wiphy_radio_work_start(struct wiphy *wiphy,
+					struct wiphy_radio_work_item *work,
+					uint64_t now)
 {
-	struct wiphy_radio_work_item *work;
 	bool done;
 	uint32_t id;
 
-	work = l_queue_pop_head(wiphy->work);
-	if (!work)
-		return;
+	l_queue_remove(wiphy->work, work);
 
 	id = work->id;
+	work->start_time = now;
+	wiphy->work_last_wdev = work->wdev_id;
+	wiphy_radio_work_stat_start(work, now);
 
-	l_debug("Starting work item %u", work->id);
+	l_debug("Starting work item %u, priority %i, waited %" PRIu64 " ms",
+		work->id, work->priority,
+		l_time_diff(work->queued_time, now) / L_USEC_PER_MSEC);
 
 	wiphy->work_in_callback = true;
 	done = work->ops->do_work(work);
@@ -2679,6 +2789,7 @@ static void wiphy_radio_work_next(struct wiphy *wiphy)
 		if (work->id != id)
 			goto next;
 
+		wiphy_radio_work_stat_stop(work, l_time_now());
 		work->id = 0;
 
 		wiphy->work_in_callback = true;
@@ -2689,33 +2800,53 @@ next:
 		wiphy_radio_work_next(wiphy);
 	} else {
 		/*
-		 * Ensures no other work item will get inserted before this one
-		 * while the work is being done.
+		 * The running item stays at the head of the queue, no other
+		 * work item will get inserted before it while the work is
+		 * being done.
 		 */
-		work->priority = INT_MIN;
+		work->running = true;
 		l_queue_push_head(wiphy->work, work);
 	}
 }
 
+static void wiphy_radio_work_next(struct wiphy *wiphy)
+{
+	uint64_t now = l_time_now();
+	struct wiphy_radio_work_item *work = wiphy_radio_work_pick(wiphy, now);
+
+	if (work)
+		wiphy_radio_work_start(wiphy, work, now);
+}
+
 static int insert_by_priority(const void *a, const void *b, void *user_data)
 {
 	const struct wiphy_radio_work_item *new = a;
 	const struct wiphy_radio_work_item *work = b;
 
-	if (work->priority <= new->priority)
+	if (work->running || work->priority <= new->priority)
 		return 1;
 
 	return -1;
 }
 
+static void wiphy_radio_work_queued(struct wiphy_radio_work_item *item)
+{
+	item->queued_time = l_time_now();
+	item->start_time = 0;
+	item->running = false;
+}
+
 uint32_t wiphy_radio_work_insert(struct wiphy *wiphy,
 				struct wiphy_radio_work_item *item,
-				int priority,
+				uint64_t wdev_id, int priority,
 				const struct wiphy_radio_work_item_ops *ops)
 {
+	item->wdev_id = wdev_id;
 	item->priority = priority;
 	item->ops = ops;
 	item->id = ++work_ids;
+	item->deadline = 0;
+	wiphy_radio_work_queued(item);
 
 	l_debug("Inserting work item %u", item->id);
 
@@ -2741,6 +2872,7 @@ void wiphy_radio_work_done(struct wiphy *wiphy, uint32_t id)
 {
 	struct wiphy_radio_work_item *item;
 	bool next = false;
+	uint64_t now;
 
 	item = l_queue_peek_head(wiphy->work);
 	if (!item)
@@ -2755,9 +2887,20 @@ void wiphy_radio_work_done(struct wiphy *wiphy, uint32_t id)
 	if (!item)
 		return;
 
-	l_debug("Work item %u done", id);
+	now = l_time_now();
+
+	if (item->start_time)
+		l_debug("Work item %u done, ran for %" PRIu64 " ms", id,
+			l_time_diff(item->start_time, now) / L_USEC_PER_MSEC);
+	else
+		l_debug("Work item %u removed after waiting %" PRIu64 " ms",
+			id, l_time_diff(item->queued_time, now) /
+			L_USEC_PER_MSEC);
+
+	wiphy_radio_work_stat_stop(item, now);
 
 	item->id = 0;
+	item->running = false;
 
 	wiphy->work_in_callback = true;
 	destroy_work(item);
@@ -2774,7 +2917,7 @@ int wiphy_radio_work_is_running(struct wiphy *wiphy, uint32_t id)
 	if (!item)
 		return -ENOENT;
 
-	return item == l_queue_peek_head(wiphy->work) ? 1 : 0;
+	return item->running ? 1 : 0;
 }
 
 uint32_t wiphy_radio_work_reschedule(struct wiphy *wiphy,
@@ -2792,13 +2935,158 @@ uint32_t wiphy_radio_work_reschedule(struct wiphy *wiphy,
 
 	l_debug("Rescheduling work item %u, new id %u", item->id, work_ids);
 
+	wiphy_radio_work_stat_stop(item, l_time_now());
 	item->id = work_ids;
+	wiphy_radio_work_queued(item);
 
 	l_queue_insert(wiphy->work, item, insert_by_priority, NULL);
 
 	return item->id;
 }
 
+/*
+ * Let queued work item @id run ahead of other work of the same or lower
+ * priority once it has been waiting for @timeout_ms.  Has no effect once the
+ * item is running.
+ */
+void wiphy_radio_work_set_deadline(struct wiphy *wiphy, uint32_t id,
+					unsigned int timeout_ms)
+{
+	struct wiphy_radio_work_item *item = l_queue_find(wiphy->work, match_id,
+							L_UINT_TO_PTR(id));
+
+	if (!item || item->running)
+		return;
+
+	item->deadline = l_time_offset(l_time_now(),
+					timeout_ms * L_USEC_PER_MSEC);
+}
+
+/*
+ * To be called by the running work item @id at a point where it can be
+ * interrupted, such as between the individual commands of a split scan.
+ * If the queued work that would be picked next (see wiphy_radio_work_pick)
+ * has a better effective priority than @priority, e.g. because it is past
+ * its deadline, the running item is put back in the queue and the radio is
+ * handed to that work.  In that case true is returned and the item's
+ * do_work will be called again to resume once it's its turn.
+ *
+ * Only scans are preemptible this way, they yield between the trigger
+ * commands of a split scan.  Frame exchanges, offchannel and connect work
+ * hold the radio through a single kernel operation and run to completion.
+ */
+bool wiphy_radio_work_yield(struct wiphy *wiphy, uint32_t id, int priority)
+{
+	struct wiphy_radio_work_item *item = l_queue_peek_head(wiphy->work);
+	struct wiphy_radio_work_item *next;
+	struct wiphy_radio_work_stat_info *info;
+	uint64_t now = l_time_now();
+
+	/* The radio can't be handed over from inside a work callback */
+	if (wiphy->work_in_callback)
+		return false;
+
+	if (!item || item->id != id || !item->running)
+		return false;
+
+	next = wiphy_radio_work_pick(wiphy, now);
+	if (!next || wiphy_radio_work_effective_priority(next, now) >=
+			priority)
+		return false;
+
+	l_debug("Work item %u yielding to %u after %" PRIu64 " ms", id,
+		next->id, l_time_diff(item->start_time, now) / L_USEC_PER_MSEC);
+
+	l_queue_pop_head(wiphy->work);
+	wiphy_radio_work_stat_stop(item, now);
+
+	info = wiphy_radio_work_stat(item);
+	if (info)
+		info->yields++;
+
+	/* Restart aging so that the item doesn't immediately take over again */
+	wiphy_radio_work_queued(item);
+	l_queue_insert(wiphy->work, item, insert_by_priority, NULL);
+
+	wiphy_radio_work_start(wiphy, next, now);
+
+	return true;
+}
+
+const struct wiphy_radio_work_stat_info *wiphy_radio_work_stat_get(
+								int priority)
+{
+	if (priority < 0 || priority >= __WIPHY_WORK_PRIORITY_MAX)
+		return NULL;
+
+	return &work_stats[priority];
+}
+
+static const char *wiphy_radio_work_priority_to_str(int priority)
+{
+	switch (priority) {
+	case WIPHY_WORK_PRIORITY_FT:
+		return "ft";
+	case WIPHY_WORK_PRIORITY_FRAME:
+		return "frame/offchannel";
+	case WIPHY_WORK_PRIORITY_CONNECT:
+		return "connect";
+	case WIPHY_WORK_PRIORITY_SCAN:
+		return "scan";
+	case WIPHY_WORK_PRIORITY_PERIODIC_SCAN:
+		return "periodic-scan";
+	}
+
+	return NULL;
+}
+
+/*
+ * One line per priority class that had work started, with the non-empty
+ * wait histogram buckets printed as <upper bound in ms>:<count>
+ */
+void wiphy_radio_work_stats_log(void)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < __WIPHY_WORK_PRIORITY_MAX; i++) {
+		const struct wiphy_radio_work_stat_info *info = &work_stats[i];
+		struct l_string *buckets;
+		char *str;
+
+		if (!info->count)
+			continue;
+
+		buckets = l_string_new(64);
+
+		for (j = 0; j < WIPHY_WORK_STAT_BUCKETS; j++) {
+			if (!info->wait_histogram[j])
+				continue;
+
+			if (j == WIPHY_WORK_STAT_BUCKETS - 1)
+				l_string_append_printf(buckets, " inf:%u",
+						info->wait_histogram[j]);
+			else
+				l_string_append_printf(buckets, " %llu:%u",
+						1ULL << j,
+						info->wait_histogram[j]);
+		}
+
+		str = l_string_unwrap(buckets);
+
+		l_info("radio work %s: %" PRIu64 " started, %" PRIu64 " late, "
+			"%" PRIu64 " yields, %" PRIu64 " ms avg wait, %" PRIu64
+			" ms max wait, %" PRIu64 " ms total run, %" PRIu64
+			" ms max run, wait histogram%s",
+			wiphy_radio_work_priority_to_str(i), info->count,
+			info->late, info->yields,
+			info->total_wait_usec / info->count / L_USEC_PER_MSEC,
+			info->max_wait_usec / L_USEC_PER_MSEC,
+			info->total_run_usec / L_USEC_PER_MSEC,
+			info->max_run_usec / L_USEC_PER_MSEC, str);
+		l_free(str);
+	}
+}
+
 static int wiphy_init(void)
 {
 	struct l_genl *genl = iwd_get_genl();
@@ -28,6 +28,7 @@ struct scan_bss;
 struct scan_freq_set;
 struct wiphy_radio_work_item;
 struct ie_rsn_info;
+struct ie_index;
 struct band_freq_attrs;
 enum security;
 enum band_freq;
@@ -45,6 +46,11 @@ struct wiphy_radio_work_item {
 	uint32_t id;
 	int priority;
 	const struct wiphy_radio_work_item_ops *ops;
+	uint64_t queued_time;
+	uint64_t start_time;
+	uint64_t deadline;
+	uint64_t wdev_id;
+	bool running : 1;
 };
 
 enum {
@@ -54,6 +60,26 @@ enum {
 	WIPHY_WORK_PRIORITY_CONNECT = 2,
 	WIPHY_WORK_PRIORITY_SCAN = 3,
 	WIPHY_WORK_PRIORITY_PERIODIC_SCAN = 4,
+	__WIPHY_WORK_PRIORITY_MAX,
+};
+
+/*
+ * Radio work latencies per priority class, see wiphy_radio_work_stat_get.
+ * Bucket 0 of the histogram counts items that waited less than 1ms to
+ * start, bucket n those that waited [2^(n-1), 2^n) ms and the last bucket
+ * everything longer.
+ */
+#define WIPHY_WORK_STAT_BUCKETS	16
+
+struct wiphy_radio_work_stat_info {
+	uint64_t count;
+	uint64_t late;
+	uint64_t yields;
+	uint64_t total_wait_usec;
+	uint64_t max_wait_usec;
+	uint64_t total_run_usec;
+	uint64_t max_run_usec;
+	uint32_t wait_histogram[WIPHY_WORK_STAT_BUCKETS];
 };
 
 enum wiphy_state_watch_event {
@@ -152,7 +178,7 @@ void wiphy_generate_address_from_ssid(struct wiphy *wiphy,
 					uint8_t addr[static 6]);
 
 int wiphy_estimate_data_rate(struct wiphy *wiphy,
-				const void *ies, uint16_t ies_len,
+				const struct ie_index *index,
 				const struct scan_bss *bss,
 				uint64_t *out_data_rate);
 bool wiphy_regdom_is_updating(struct wiphy *wiphy);
@@ -164,9 +190,15 @@ bool wiphy_state_watch_remove(struct wiphy *wiphy, uint32_t id);
 
 uint32_t wiphy_radio_work_insert(struct wiphy *wiphy,
 				struct wiphy_radio_work_item *item,
-				int priority,
+				uint64_t wdev_id, int priority,
 				const struct wiphy_radio_work_item_ops *ops);
 void wiphy_radio_work_done(struct wiphy *wiphy, uint32_t id);
 int wiphy_radio_work_is_running(struct wiphy *wiphy, uint32_t id);
 uint32_t wiphy_radio_work_reschedule(struct wiphy *wiphy,
 					struct wiphy_radio_work_item *item);
+void wiphy_radio_work_set_deadline(struct wiphy *wiphy, uint32_t id,
+					unsigned int timeout_ms);
+bool wiphy_radio_work_yield(struct wiphy *wiphy, uint32_t id, int priority);
+const struct wiphy_radio_work_stat_info *wiphy_radio_work_stat_get(
+								int priority);
+void wiphy_radio_work_stats_log(void);
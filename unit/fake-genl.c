@@ -0,0 +1,355 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  iwd contributors. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <assert.h>
+#include <ell/ell.h>
+
+#include "unit/fake-genl.h"
+
+struct fake_genl_watch {
+	unsigned int id;
+	char *name;
+	l_genl_msg_func_t callback;
+	void *user_data;
+	l_genl_destroy_func_t destroy;
+};
+
+static struct l_queue *cmds;
+static struct l_queue *watches;
+static struct l_queue *unicast_watches;
+static unsigned int fake_ids;
+static int fake_family;
+
+static void fake_genl_cmd_free(void *data)
+{
+	struct fake_genl_cmd *cmd = data;
+
+	l_genl_msg_unref(cmd->msg);
+	l_free(cmd);
+}
+
+static void fake_genl_watch_free(void *data)
+{
+	struct fake_genl_watch *watch = data;
+
+	l_free(watch->name);
+	l_free(watch);
+}
+
+void fake_genl_init(void)
+{
+	cmds = l_queue_new();
+	watches = l_queue_new();
+	unicast_watches = l_queue_new();
+}
+
+void fake_genl_exit(void)
+{
+	l_queue_destroy(cmds, fake_genl_cmd_free);
+	l_queue_destroy(watches, fake_genl_watch_free);
+	l_queue_destroy(unicast_watches, fake_genl_watch_free);
+	cmds = NULL;
+	watches = NULL;
+	unicast_watches = NULL;
+}
+
+static bool fake_genl_cmd_match(const struct fake_genl_cmd *cmd, uint8_t type)
+{
+	return !type || l_genl_msg_get_command(cmd->msg) == type;
+}
+
+/* Number of commands of type @type sent so far, of any type if 0 */
+unsigned int fake_genl_count(uint8_t type)
+{
+	const struct l_queue_entry *entry;
+	unsigned int n = 0;
+
+	for (entry = l_queue_get_entries(cmds); entry; entry = entry->next)
+		if (fake_genl_cmd_match(entry->data, type))
+			n++;
+
+	return n;
+}
+
+/* The @n-th command, from 0, of type @type, or of any type if 0 */
+struct fake_genl_cmd *fake_genl_get(uint8_t type, unsigned int n)
+{
+	const struct l_queue_entry *entry;
+
+	for (entry = l_queue_get_entries(cmds); entry; entry = entry->next)
+		if (fake_genl_cmd_match(entry->data, type) && !n--)
+			return entry->data;
+
+	assert(false);
+	return NULL;
+}
+
+struct fake_genl_cmd *fake_genl_last(void)
+{
+	struct fake_genl_cmd *cmd = l_queue_peek_tail(cmds);
+
+	assert(cmd);
+	return cmd;
+}
+
+/*
+ * Completes @cmd the way the kernel would: the callback is called with
+ * @reply, if not NULL, and then the destroy function.  A dump completed
+ * with a NULL @reply returned no results.
+ */
+void fake_genl_reply(struct fake_genl_cmd *cmd, struct l_genl_msg *reply)
+{
+	assert(!cmd->done && !cmd->cancelled);
+	cmd->done = true;
+
+	if (reply && cmd->callback)
+		cmd->callback(reply, cmd->user_data);
+
+	if (cmd->destroy)
+		cmd->destroy(cmd->user_data);
+}
+
+static bool fake_genl_watch_match_id(const void *a, const void *b)
+{
+	const struct fake_genl_watch *watch = a;
+
+	return watch->id == L_PTR_TO_UINT(b);
+}
+
+/* The handlers may unregister themselves or others while being called */
+static void fake_genl_dispatch(struct l_queue *list, const char *name,
+				struct l_genl_msg *msg)
+{
+	const struct l_queue_entry *entry;
+	unsigned int ids[16];
+	unsigned int i, n = 0;
+
+	for (entry = l_queue_get_entries(list); entry; entry = entry->next) {
+		struct fake_genl_watch *watch = entry->data;
+
+		if (name && strcmp(watch->name, name))
+			continue;
+
+		assert(n < L_ARRAY_SIZE(ids));
+		ids[n++] = watch->id;
+	}
+
+	for (i = 0; i < n; i++) {
+		struct fake_genl_watch *watch = l_queue_find(list,
+						fake_genl_watch_match_id,
+						L_UINT_TO_PTR(ids[i]));
+
+		if (watch)
+			watch->callback(msg, watch->user_data);
+	}
+}
+
+/* Delivers @msg to everyone registered for the multicast @group */
+void fake_genl_notify(const char *group, struct l_genl_msg *msg)
+{
+	fake_genl_dispatch(watches, group, msg);
+}
+
+void fake_genl_unicast(struct l_genl_msg *msg)
+{
+	fake_genl_dispatch(unicast_watches, NULL, msg);
+}
+
+static unsigned int fake_genl_watch_add(struct l_queue *list,
+					const char *name,
+					l_genl_msg_func_t callback,
+					void *user_data,
+					l_genl_destroy_func_t destroy)
+{
+	struct fake_genl_watch *watch = l_new(struct fake_genl_watch, 1);
+
+	watch->id = ++fake_ids;
+	watch->name = l_strdup(name);
+	watch->callback = callback;
+	watch->user_data = user_data;
+	watch->destroy = destroy;
+	l_queue_push_tail(list, watch);
+
+	return watch->id;
+}
+
+static bool fake_genl_watch_remove(struct l_queue *list, unsigned int id)
+{
+	struct fake_genl_watch *watch = l_queue_remove_if(list,
+						fake_genl_watch_match_id,
+						L_UINT_TO_PTR(id));
+
+	if (!watch)
+		return false;
+
+	if (watch->destroy)
+		watch->destroy(watch->user_data);
+
+	fake_genl_watch_free(watch);
+	return true;
+}
+
+struct l_genl_family *__wrap_l_genl_family_new(struct l_genl *genl,
+						const char *name);
+void __wrap_l_genl_family_free(struct l_genl_family *family);
+const struct l_genl_family_info *__wrap_l_genl_family_get_info(
+						struct l_genl_family *family);
+uint16_t __wrap_l_genl_family_info_get_id(
+				const struct l_genl_family_info *info);
+unsigned int __wrap_l_genl_family_register(struct l_genl_family *family,
+						const char *group,
+						l_genl_msg_func_t callback,
+						void *user_data,
+						l_genl_destroy_func_t destroy);
+bool __wrap_l_genl_family_unregister(struct l_genl_family *family,
+					unsigned int id);
+unsigned int __wrap_l_genl_family_send(struct l_genl_family *family,
+					struct l_genl_msg *msg,
+					l_genl_msg_func_t callback,
+					void *user_data,
+					l_genl_destroy_func_t destroy);
+unsigned int __wrap_l_genl_family_dump(struct l_genl_family *family,
+					struct l_genl_msg *msg,
+					l_genl_msg_func_t callback,
+					void *user_data,
+					l_genl_destroy_func_t destroy);
+bool __wrap_l_genl_family_cancel(struct l_genl_family *family,
+					unsigned int id);
+unsigned int __wrap_l_genl_add_unicast_watch(struct l_genl *genl,
+						const char *family,
+						l_genl_msg_func_t handler,
+						void *user_data,
+						l_genl_destroy_func_t destroy);
+bool __wrap_l_genl_remove_unicast_watch(struct l_genl *genl,
+					unsigned int id);
+
+struct l_genl_family *__wrap_l_genl_family_new(struct l_genl *genl,
+						const char *name)
+{
+	return (struct l_genl_family *) &fake_family;
+}
+
+void __wrap_l_genl_family_free(struct l_genl_family *family)
+{
+}
+
+const struct l_genl_family_info *__wrap_l_genl_family_get_info(
+						struct l_genl_family *family)
+{
+	return NULL;
+}
+
+uint16_t __wrap_l_genl_family_info_get_id(
+				const struct l_genl_family_info *info)
+{
+	return 0x1c;
+}
+
+unsigned int __wrap_l_genl_family_register(struct l_genl_family *family,
+						const char *group,
+						l_genl_msg_func_t callback,
+						void *user_data,
+						l_genl_destroy_func_t destroy)
+{
+	return fake_genl_watch_add(watches, group, callback, user_data,
+					destroy);
+}
+
+bool __wrap_l_genl_family_unregister(struct l_genl_family *family,
+					unsigned int id)
+{
+	return fake_genl_watch_remove(watches, id);
+}
+
+unsigned int __wrap_l_genl_family_send(struct l_genl_family *family,
+					struct l_genl_msg *msg,
+					l_genl_msg_func_t callback,
+					void *user_data,
+					l_genl_destroy_func_t destroy)
+{
+	struct fake_genl_cmd *cmd = l_new(struct fake_genl_cmd, 1);
+
+	cmd->msg = msg;
+	cmd->id = ++fake_ids;
+	cmd->callback = callback;
+	cmd->user_data = user_data;
+	cmd->destroy = destroy;
+	l_queue_push_tail(cmds, cmd);
+
+	return cmd->id;
+}
+
+unsigned int __wrap_l_genl_family_dump(struct l_genl_family *family,
+					struct l_genl_msg *msg,
+					l_genl_msg_func_t callback,
+					void *user_data,
+					l_genl_destroy_func_t destroy)
+{
+	return __wrap_l_genl_family_send(family, msg, callback, user_data,
+						destroy);
+}
+
+static bool fake_genl_cmd_match_id(const void *a, const void *b)
+{
+	const struct fake_genl_cmd *cmd = a;
+
+	return cmd->id == L_PTR_TO_UINT(b);
+}
+
+/* Like the real one, the destroy function is called for a pending command */
+bool __wrap_l_genl_family_cancel(struct l_genl_family *family,
+					unsigned int id)
+{
+	struct fake_genl_cmd *cmd = l_queue_find(cmds, fake_genl_cmd_match_id,
+							L_UINT_TO_PTR(id));
+
+	if (!cmd || cmd->done || cmd->cancelled)
+		return false;
+
+	cmd->cancelled = true;
+
+	if (cmd->destroy)
+		cmd->destroy(cmd->user_data);
+
+	return true;
+}
+
+unsigned int __wrap_l_genl_add_unicast_watch(struct l_genl *genl,
+						const char *family,
+						l_genl_msg_func_t handler,
+						void *user_data,
+						l_genl_destroy_func_t destroy)
+{
+	return fake_genl_watch_add(unicast_watches, family, handler,
+					user_data, destroy);
+}
+
+bool __wrap_l_genl_remove_unicast_watch(struct l_genl *genl,
+					unsigned int id)
+{
+	return fake_genl_watch_remove(unicast_watches, id);
+}
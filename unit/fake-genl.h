@@ -0,0 +1,50 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  iwd contributors. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Stands in for the kernel's nl80211 family in the unit tests.  The tests
+ * link with -Wl,-wrap for the l_genl functions below (fake_genl_ldflags in
+ * Makefile.am) so that the commands sent by the code under test are kept
+ * for the test to inspect and answer, and the test can feed multicast and
+ * unicast events to the handlers that were registered.
+ */
+
+struct fake_genl_cmd {
+	struct l_genl_msg *msg;
+	unsigned int id;
+	l_genl_msg_func_t callback;
+	void *user_data;
+	l_genl_destroy_func_t destroy;
+	bool done : 1;
+	bool cancelled : 1;
+};
+
+void fake_genl_init(void);
+void fake_genl_exit(void);
+
+unsigned int fake_genl_count(uint8_t cmd);
+struct fake_genl_cmd *fake_genl_get(uint8_t cmd, unsigned int n);
+struct fake_genl_cmd *fake_genl_last(void);
+void fake_genl_reply(struct fake_genl_cmd *cmd, struct l_genl_msg *reply);
+
+void fake_genl_notify(const char *group, struct l_genl_msg *msg);
+void fake_genl_unicast(struct l_genl_msg *msg);
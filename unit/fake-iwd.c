@@ -0,0 +1,148 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  iwd contributors. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <ell/ell.h>
+
+#include "src/iwd.h"
+#include "src/dbus.h"
+#include "src/rfkill.h"
+#include "src/storage.h"
+#include "src/netdev.h"
+
+/*
+ * Daemon functions called by the modules that the unit tests link whole,
+ * such as src/wiphy.c for the real radio work queue.  No configuration,
+ * no D-Bus, no rtnl and no rfkill switches.
+ */
+
+struct l_genl *iwd_get_genl(void)
+{
+	return NULL;
+}
+
+const struct l_settings *iwd_get_config(void)
+{
+	return NULL;
+}
+
+const char *iwd_get_phy_whitelist(void)
+{
+	return NULL;
+}
+
+const char *iwd_get_phy_blacklist(void)
+{
+	return NULL;
+}
+
+struct l_netlink *iwd_get_rtnl(void)
+{
+	return NULL;
+}
+
+struct l_dbus *dbus_get_bus(void)
+{
+	return NULL;
+}
+
+void dbus_pending_reply(struct l_dbus_message **msg,
+				struct l_dbus_message *reply)
+{
+}
+
+bool dbus_append_dict_basic(struct l_dbus_message_builder *builder,
+				const char *name, char type,
+				const void *data)
+{
+	return false;
+}
+
+struct l_dbus_message *dbus_error_aborted(struct l_dbus_message *msg)
+{
+	return NULL;
+}
+
+struct l_dbus_message *dbus_error_already_exists(struct l_dbus_message *msg)
+{
+	return NULL;
+}
+
+struct l_dbus_message *dbus_error_busy(struct l_dbus_message *msg)
+{
+	return NULL;
+}
+
+struct l_dbus_message *dbus_error_failed(struct l_dbus_message *msg)
+{
+	return NULL;
+}
+
+struct l_dbus_message *dbus_error_invalid_args(struct l_dbus_message *msg)
+{
+	return NULL;
+}
+
+struct l_dbus_message *dbus_error_not_available(struct l_dbus_message *msg)
+{
+	return NULL;
+}
+
+struct l_dbus_message *dbus_error_from_errno(int err,
+						struct l_dbus_message *msg)
+{
+	return NULL;
+}
+
+const char *netdev_iftype_to_string(uint32_t iftype)
+{
+	return "unknown";
+}
+
+ssize_t read_file(void *buffer, size_t len, const char *path_fmt, ...)
+{
+	return -ENOENT;
+}
+
+uint32_t rfkill_watch_add(rfkill_state_cb_t func, void *user_data)
+{
+	return 1;
+}
+
+bool rfkill_get_soft_state(unsigned int wiphy_id)
+{
+	return false;
+}
+
+bool rfkill_get_hard_state(unsigned int wiphy_id)
+{
+	return false;
+}
+
+bool rfkill_set_soft_state(unsigned int wiphy_id, bool state)
+{
+	return true;
+}
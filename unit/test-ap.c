@@ -0,0 +1,765 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  iwd contributors. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <assert.h>
+#include <ell/ell.h>
+
+#include "linux/nl80211.h"
+#include "src/iwd.h"
+#include "src/module.h"
+#include "src/ie.h"
+#include "src/mpdu.h"
+#include "src/util.h"
+#include "src/band.h"
+#include "src/scan.h"
+#include "src/netdev.h"
+#include "src/wiphy.h"
+#include "src/handshake.h"
+#include "src/eapol.h"
+#include "src/frame-xchg.h"
+#include "src/ip-pool.h"
+#include "src/netconfig.h"
+#include "src/storage.h"
+#include "src/diagnostic.h"
+#include "src/ap.h"
+#include "unit/fake-genl.h"
+
+/*
+ * The AP is started on a netdev and a wiphy that only exist as the stubs
+ * below, with its nl80211 traffic captured by unit/fake-genl.c.  Stations
+ * come in through NEW_STATION events, the way they do with drivers that
+ * handle the association themselves, and the EAPoL state machine is a stub
+ * that only counts the handshakes started, the tests finish them by
+ * sending the handshake events to the AP.  l_time_now and the l_timeout
+ * functions are wrapped so that the tests run the rekey timers.
+ */
+
+#define TEST_IFINDEX		3
+#define TEST_WDEV_ID		1
+#define TEST_GTK_TX_TIMEOUT	5	/* AP_GTK_TX_TIMEOUT in src/ap.c */
+
+struct eapol_sm {
+	struct handshake_state *hs;
+	unsigned int starts;
+};
+
+struct test_timeout {
+	l_timeout_notify_cb_t callback;
+	void *user_data;
+	l_timeout_destroy_cb_t destroy;
+	uint64_t expiry;
+};
+
+struct test_sta {
+	uint8_t addr[6];
+	struct eapol_sm *sm;
+};
+
+static const uint8_t test_own_addr[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+static const uint8_t test_rates[] = { 2, 4, 11, 22, 12, 18, 24, 36 };
+static int test_netdev;
+static int test_wiphy;
+
+static uint64_t test_now;
+static struct l_queue *test_timeouts;
+static struct eapol_sm *test_last_sm;
+static struct ap_state *test_ap;
+static bool test_started;
+
+uint64_t __wrap_l_time_now(void);
+struct l_timeout *__wrap_l_timeout_create_ms(uint64_t ms,
+					l_timeout_notify_cb_t callback,
+					void *user_data,
+					l_timeout_destroy_cb_t destroy);
+struct l_timeout *__wrap_l_timeout_create(unsigned int seconds,
+					l_timeout_notify_cb_t callback,
+					void *user_data,
+					l_timeout_destroy_cb_t destroy);
+void __wrap_l_timeout_modify_ms(struct l_timeout *timeout, uint64_t ms);
+void __wrap_l_timeout_modify(struct l_timeout *timeout, unsigned int seconds);
+void __wrap_l_timeout_remove(struct l_timeout *timeout);
+
+uint64_t __wrap_l_time_now(void)
+{
+	return test_now;
+}
+
+struct l_timeout *__wrap_l_timeout_create_ms(uint64_t ms,
+					l_timeout_notify_cb_t callback,
+					void *user_data,
+					l_timeout_destroy_cb_t destroy)
+{
+	struct test_timeout *timeout = l_new(struct test_timeout, 1);
+
+	timeout->callback = callback;
+	timeout->user_data = user_data;
+	timeout->destroy = destroy;
+	timeout->expiry = test_now + ms * L_USEC_PER_MSEC;
+	l_queue_push_tail(test_timeouts, timeout);
+
+	return (struct l_timeout *) timeout;
+}
+
+struct l_timeout *__wrap_l_timeout_create(unsigned int seconds,
+					l_timeout_notify_cb_t callback,
+					void *user_data,
+					l_timeout_destroy_cb_t destroy)
+{
+	return __wrap_l_timeout_create_ms(seconds * 1000ULL, callback,
+						user_data, destroy);
+}
+
+void __wrap_l_timeout_modify_ms(struct l_timeout *timeout, uint64_t ms)
+{
+	((struct test_timeout *) timeout)->expiry =
+					test_now + ms * L_USEC_PER_MSEC;
+}
+
+void __wrap_l_timeout_modify(struct l_timeout *timeout, unsigned int seconds)
+{
+	__wrap_l_timeout_modify_ms(timeout, seconds * 1000ULL);
+}
+
+void __wrap_l_timeout_remove(struct l_timeout *timeout)
+{
+	struct test_timeout *t = (struct test_timeout *) timeout;
+
+	if (!t)
+		return;
+
+	assert(l_queue_remove(test_timeouts, t));
+
+	if (t->destroy)
+		t->destroy(t->user_data);
+
+	l_free(t);
+}
+
+static bool test_timeout_expired(const void *data, const void *user_data)
+{
+	const struct test_timeout *timeout = data;
+
+	return timeout->expiry && timeout->expiry <= test_now;
+}
+
+/* Moves the clock forward and runs the timeouts that expire on the way */
+static void test_advance(unsigned int seconds)
+{
+	struct test_timeout *timeout;
+
+	test_now += seconds * L_USEC_PER_SEC;
+
+	/* Like with l_timeout, a fired timeout stays disarmed until modified */
+	while ((timeout = l_queue_find(test_timeouts, test_timeout_expired,
+					NULL))) {
+		timeout->expiry = 0;
+		timeout->callback((struct l_timeout *) timeout,
+					timeout->user_data);
+	}
+}
+
+struct eapol_sm *eapol_sm_new(struct handshake_state *hs)
+{
+	test_last_sm = l_new(struct eapol_sm, 1);
+	test_last_sm->hs = hs;
+
+	return test_last_sm;
+}
+
+void eapol_sm_free(struct eapol_sm *sm)
+{
+	l_free(sm);
+}
+
+void eapol_sm_set_listen_interval(struct eapol_sm *sm, uint16_t interval)
+{
+}
+
+void eapol_sm_set_use_eapol_start(struct eapol_sm *sm, bool enabled)
+{
+}
+
+void eapol_register(struct eapol_sm *sm)
+{
+}
+
+bool eapol_start(struct eapol_sm *sm)
+{
+	sm->starts++;
+	return true;
+}
+
+struct handshake_state *netdev_handshake_state_new(struct netdev *netdev)
+{
+	return l_new(struct handshake_state, 1);
+}
+
+void handshake_state_free(struct handshake_state *s)
+{
+	l_free(s);
+}
+
+void handshake_state_set_event_func(struct handshake_state *s,
+					handshake_event_func_t func,
+					void *user_data)
+{
+	s->event_func = func;
+	s->user_data = user_data;
+}
+
+void handshake_state_set_authenticator(struct handshake_state *s, bool auth)
+{
+}
+
+void handshake_state_set_authenticator_address(struct handshake_state *s,
+						const uint8_t *aa)
+{
+}
+
+bool handshake_state_set_authenticator_ie(struct handshake_state *s,
+						const uint8_t *ie)
+{
+	return true;
+}
+
+void handshake_state_set_supplicant_address(struct handshake_state *s,
+						const uint8_t *spa)
+{
+}
+
+bool handshake_state_set_supplicant_ie(struct handshake_state *s,
+						const uint8_t *ie)
+{
+	return true;
+}
+
+void handshake_state_set_ssid(struct handshake_state *s,
+					const uint8_t *ssid, size_t ssid_len)
+{
+}
+
+void handshake_state_set_pmk(struct handshake_state *s, const uint8_t *pmk,
+				size_t pmk_len)
+{
+}
+
+void handshake_state_set_gtk(struct handshake_state *s, const uint8_t *key,
+				unsigned int key_index, const uint8_t *rsc)
+{
+}
+
+void handshake_state_set_8021x_config(struct handshake_state *s,
+					struct l_settings *settings)
+{
+}
+
+uint32_t netdev_get_ifindex(struct netdev *netdev)
+{
+	return TEST_IFINDEX;
+}
+
+uint64_t netdev_get_wdev_id(struct netdev *netdev)
+{
+	return TEST_WDEV_ID;
+}
+
+const uint8_t *netdev_get_address(struct netdev *netdev)
+{
+	return test_own_addr;
+}
+
+const char *netdev_get_name(struct netdev *netdev)
+{
+	return "wlan0";
+}
+
+const char *netdev_get_path(struct netdev *netdev)
+{
+	return "/net/connman/iwd/0/3";
+}
+
+struct wiphy *netdev_get_wiphy(struct netdev *netdev)
+{
+	return (struct wiphy *) &test_wiphy;
+}
+
+int netdev_get_all_stations(struct netdev *netdev, netdev_get_station_cb_t cb,
+				void *user_data, netdev_destroy_func_t destroy)
+{
+	return -ENOTSUP;
+}
+
+void netdev_handshake_failed(struct handshake_state *hs, uint16_t reason_code)
+{
+}
+
+uint32_t netdev_watch_add(netdev_watch_func_t func,
+				void *user_data, netdev_destroy_func_t destroy)
+{
+	return 1;
+}
+
+bool netdev_watch_remove(uint32_t id)
+{
+	return true;
+}
+
+struct wiphy *wiphy_find(int wiphy_id)
+{
+	return NULL;
+}
+
+uint32_t wiphy_get_supported_bands(struct wiphy *wiphy)
+{
+	return BAND_FREQ_2_4_GHZ;
+}
+
+const struct band_freq_attrs *wiphy_get_frequency_info(
+						const struct wiphy *wiphy,
+						uint32_t freq)
+{
+	static const struct band_freq_attrs attrs = {};
+
+	return &attrs;
+}
+
+const struct band_freq_attrs *wiphy_get_frequency_info_list(
+						const struct wiphy *wiphy,
+						enum band_freq band,
+						size_t *size)
+{
+	return NULL;
+}
+
+const uint8_t *wiphy_get_supported_rates(struct wiphy *wiphy,
+						enum band_freq band,
+						unsigned int *out_num)
+{
+	*out_num = L_ARRAY_SIZE(test_rates);
+	return test_rates;
+}
+
+const uint8_t *wiphy_get_ht_capabilities(const struct wiphy *wiphy,
+						enum band_freq band,
+						size_t *size)
+{
+	return NULL;
+}
+
+uint16_t wiphy_get_supported_ciphers(struct wiphy *wiphy, uint16_t mask)
+{
+	return IE_RSN_CIPHER_SUITE_CCMP & mask;
+}
+
+bool wiphy_has_feature(struct wiphy *wiphy, uint32_t feature)
+{
+	return false;
+}
+
+bool wiphy_has_ext_feature(struct wiphy *wiphy, uint32_t feature)
+{
+	return false;
+}
+
+bool wiphy_supports_probe_resp_offload(struct wiphy *wiphy)
+{
+	return true;
+}
+
+bool wiphy_supports_uapsd(const struct wiphy *wiphy)
+{
+	return false;
+}
+
+bool wiphy_country_is_unknown(struct wiphy *wiphy)
+{
+	return true;
+}
+
+void wiphy_get_reg_domain_country(struct wiphy *wiphy, char *out)
+{
+	out[0] = 'X';
+	out[1] = 'X';
+}
+
+bool frame_watch_add(uint64_t wdev_id, uint32_t group, uint16_t frame_type,
+			const uint8_t *prefix, size_t prefix_len,
+			frame_watch_cb_t handler, void *user_data,
+			frame_xchg_destroy_func_t destroy)
+{
+	return true;
+}
+
+bool frame_watch_wdev_remove(uint64_t wdev_id)
+{
+	return true;
+}
+
+uint32_t frame_xchg_start(uint64_t wdev_id, struct iovec *frame, uint32_t freq,
+			unsigned int retry_interval, unsigned int resp_timeout,
+			unsigned int retries_on_ack, uint32_t group_id,
+			frame_xchg_cb_t cb, void *user_data,
+			frame_xchg_destroy_func_t destroy, ...)
+{
+	return 0;
+}
+
+uint32_t scan_active_full(uint64_t wdev_id,
+			const struct scan_parameters *params,
+			scan_trigger_func_t trigger, scan_notify_func_t notify,
+			void *userdata, scan_destroy_func_t destroy)
+{
+	return 0;
+}
+
+bool scan_cancel(uint64_t wdev_id, uint32_t id)
+{
+	return false;
+}
+
+int scan_bss_get_security(const struct scan_bss *bss, enum security *security)
+{
+	return -ENOTSUP;
+}
+
+bool netconfig_enabled(void)
+{
+	return false;
+}
+
+struct l_rtnl_address *ip_pool_get_addr4(uint32_t ifindex)
+{
+	return NULL;
+}
+
+int ip_pool_select_addr4(const char **addr_str_list, uint8_t subnet_prefix_len,
+				struct l_rtnl_address **out_addr)
+{
+	return -ENOTSUP;
+}
+
+char *storage_get_path(const char *format, ...)
+{
+	return NULL;
+}
+
+bool diagnostic_info_to_dict(const struct diagnostic_station_info *info,
+				struct l_dbus_message_builder *builder)
+{
+	return false;
+}
+
+extern struct iwd_module_desc __start___iwd_module[];
+extern struct iwd_module_desc __stop___iwd_module[];
+
+static struct iwd_module_desc *test_module(const char *name)
+{
+	struct iwd_module_desc *desc;
+
+	for (desc = __start___iwd_module; desc < __stop___iwd_module; desc++)
+		if (!strcmp(desc->name, name))
+			return desc;
+
+	return NULL;
+}
+
+static void test_ap_event(enum ap_event_type type, const void *event_data,
+				void *user_data)
+{
+	if (type == AP_EVENT_STARTED)
+		test_started = true;
+}
+
+static const struct ap_ops test_ap_ops = {
+	.handle_event = test_ap_event,
+};
+
+static void test_setup(void)
+{
+	struct l_settings *config = l_settings_new();
+	struct l_genl_msg *msg;
+	struct fake_genl_cmd *cmd;
+	int err;
+
+	test_now = 1000 * L_USEC_PER_SEC;
+	test_timeouts = l_queue_new();
+	test_started = false;
+
+	fake_genl_init();
+	assert(test_module("ap")->init() == 0);
+
+	l_settings_set_string(config, "General", "SSID", "TestAP");
+	l_settings_set_string(config, "General", "DisableHT", "true");
+	l_settings_set_string(config, "General", "GroupRekeyTimeout", "100");
+	l_settings_set_string(config, "Security", "PreSharedKey",
+				"0001020304050607080910111213141516171819"
+				"202122232425262728293031");
+
+	test_ap = ap_start((struct netdev *) &test_netdev, config,
+				&test_ap_ops, &err, NULL);
+	assert(test_ap && !err);
+	l_settings_free(config);
+
+	cmd = fake_genl_last();
+	assert(l_genl_msg_get_command(cmd->msg) == NL80211_CMD_START_AP);
+
+	msg = l_genl_msg_new(NL80211_CMD_START_AP);
+	fake_genl_reply(cmd, msg);
+	l_genl_msg_unref(msg);
+	assert(test_started);
+}
+
+static void test_teardown(void)
+{
+	ap_free(test_ap);
+	test_module("ap")->exit();
+	fake_genl_exit();
+
+	assert(l_queue_isempty(test_timeouts));
+	l_queue_destroy(test_timeouts, NULL);
+}
+
+static void test_reply(uint8_t type)
+{
+	struct fake_genl_cmd *cmd = fake_genl_last();
+	struct l_genl_msg *msg;
+
+	assert(l_genl_msg_get_command(cmd->msg) == type);
+
+	msg = l_genl_msg_new(type);
+	fake_genl_reply(cmd, msg);
+	l_genl_msg_unref(msg);
+}
+
+/* Reports the Tx RSC of the GTK as it's queried for a new station */
+static void test_reply_get_key(void)
+{
+	struct fake_genl_cmd *cmd = fake_genl_last();
+	static const uint8_t seq[6] = {};
+	struct l_genl_msg *msg;
+
+	assert(l_genl_msg_get_command(cmd->msg) == NL80211_CMD_GET_KEY);
+
+	msg = l_genl_msg_new(NL80211_CMD_GET_KEY);
+	l_genl_msg_enter_nested(msg, NL80211_ATTR_KEY);
+	l_genl_msg_append_attr(msg, NL80211_KEY_SEQ, sizeof(seq), seq);
+	l_genl_msg_leave_nested(msg);
+	fake_genl_reply(cmd, msg);
+	l_genl_msg_unref(msg);
+}
+
+/*
+ * Associates a station the way a driver with its own AP SME reports it and
+ * completes its initial 4-Way Handshake
+ */
+static void test_sta_add(struct test_sta *sta, uint8_t id)
+{
+	struct ie_rsn_info info = {
+		.akm_suites = IE_RSN_AKM_SUITE_PSK,
+		.pairwise_ciphers = IE_RSN_CIPHER_SUITE_CCMP,
+		.group_cipher = IE_RSN_CIPHER_SUITE_CCMP,
+	};
+	uint32_t ifindex = TEST_IFINDEX;
+	uint8_t rsne[64];
+	struct l_genl_msg *msg;
+
+	memcpy(sta->addr, test_own_addr, 6);
+	sta->addr[5] = 0x10 + id;
+
+	assert(ie_build_rsne(&info, rsne));
+
+	msg = l_genl_msg_new(NL80211_CMD_NEW_STATION);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_IFINDEX, 4, &ifindex);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_MAC, 6, sta->addr);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_IE, rsne[1] + 2, rsne);
+	fake_genl_notify("mlme", msg);
+	l_genl_msg_unref(msg);
+
+	test_reply(NL80211_CMD_SET_STATION);
+
+	test_last_sm = NULL;
+	test_reply_get_key();
+	assert(test_last_sm && test_last_sm->starts == 1);
+	sta->sm = test_last_sm;
+
+	handshake_event(sta->sm->hs, HANDSHAKE_EVENT_COMPLETE);
+}
+
+static void test_sta_del(struct test_sta *sta)
+{
+	uint32_t ifindex = TEST_IFINDEX;
+	struct l_genl_msg *msg;
+
+	msg = l_genl_msg_new(NL80211_CMD_DEL_STATION);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_IFINDEX, 4, &ifindex);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_MAC, 6, sta->addr);
+	fake_genl_notify("mlme", msg);
+	l_genl_msg_unref(msg);
+
+	sta->sm = NULL;
+}
+
+static void test_sta_rekeyed(struct test_sta *sta)
+{
+	handshake_event(sta->sm->hs, HANDSHAKE_EVENT_REKEY_COMPLETE);
+}
+
+/* The NL80211_KEY_IDX from inside the NL80211_ATTR_KEY of @cmd */
+static uint8_t test_key_index(const struct fake_genl_cmd *cmd)
+{
+	struct l_genl_attr attr, nested;
+	uint16_t type, len;
+	const void *data;
+
+	assert(l_genl_attr_init(&attr, cmd->msg));
+
+	while (l_genl_attr_next(&attr, &type, &len, &data)) {
+		if (type != NL80211_ATTR_KEY)
+			continue;
+
+		assert(l_genl_attr_recurse(&attr, &nested));
+
+		while (l_genl_attr_next(&nested, &type, &len, &data))
+			if (type == NL80211_KEY_IDX) {
+				assert(len == 1);
+				return l_get_u8(data);
+			}
+	}
+
+	assert(false);
+	return 0;
+}
+
+/*
+ * Runs the clock to the GTK rekey and checks that the new key was only
+ * installed, not made the default, and handed to both stations
+ */
+static uint8_t test_gtk_rekey(struct test_sta *sta1, struct test_sta *sta2)
+{
+	struct fake_genl_cmd *cmd;
+	uint8_t index;
+
+	assert(fake_genl_count(NL80211_CMD_NEW_KEY) == 1);
+	assert(fake_genl_count(NL80211_CMD_SET_KEY) == 1);
+	assert(test_key_index(fake_genl_get(NL80211_CMD_SET_KEY, 0)) == 1);
+
+	test_advance(100);
+
+	assert(fake_genl_count(NL80211_CMD_NEW_KEY) == 2);
+	cmd = fake_genl_get(NL80211_CMD_NEW_KEY, 1);
+	index = test_key_index(cmd);
+	assert(index == 2);
+
+	assert(fake_genl_count(NL80211_CMD_SET_KEY) == 1);
+	assert(sta1->sm->starts == 2);
+	assert(sta2->sm->starts == 2);
+
+	return index;
+}
+
+static void test_gtk_tx_after_stations(const void *data)
+{
+	struct test_sta sta1, sta2;
+	uint8_t index;
+
+	test_setup();
+	test_sta_add(&sta1, 1);
+	test_sta_add(&sta2, 2);
+	index = test_gtk_rekey(&sta1, &sta2);
+
+	test_sta_rekeyed(&sta1);
+	assert(fake_genl_count(NL80211_CMD_SET_KEY) == 1);
+
+	test_sta_rekeyed(&sta2);
+	assert(fake_genl_count(NL80211_CMD_SET_KEY) == 2);
+	assert(test_key_index(fake_genl_get(NL80211_CMD_SET_KEY, 1)) == index);
+
+	/* The fallback timer is gone, the key isn't set again */
+	test_advance(TEST_GTK_TX_TIMEOUT);
+	assert(fake_genl_count(NL80211_CMD_SET_KEY) == 2);
+
+	test_teardown();
+}
+
+static void test_gtk_tx_timeout(const void *data)
+{
+	struct test_sta sta1, sta2;
+	uint8_t index;
+
+	test_setup();
+	test_sta_add(&sta1, 1);
+	test_sta_add(&sta2, 2);
+	index = test_gtk_rekey(&sta1, &sta2);
+
+	test_sta_rekeyed(&sta1);
+	test_advance(TEST_GTK_TX_TIMEOUT - 1);
+	assert(fake_genl_count(NL80211_CMD_SET_KEY) == 1);
+
+	/* A station that doesn't answer doesn't hold the new key back */
+	test_advance(1);
+	assert(fake_genl_count(NL80211_CMD_SET_KEY) == 2);
+	assert(test_key_index(fake_genl_get(NL80211_CMD_SET_KEY, 1)) == index);
+
+	test_sta_rekeyed(&sta2);
+	assert(fake_genl_count(NL80211_CMD_SET_KEY) == 2);
+
+	test_teardown();
+}
+
+static void test_gtk_tx_station_left(const void *data)
+{
+	struct test_sta sta1, sta2;
+	uint8_t index;
+
+	test_setup();
+	test_sta_add(&sta1, 1);
+	test_sta_add(&sta2, 2);
+	index = test_gtk_rekey(&sta1, &sta2);
+
+	test_sta_rekeyed(&sta1);
+	assert(fake_genl_count(NL80211_CMD_SET_KEY) == 1);
+
+	test_sta_del(&sta2);
+	assert(fake_genl_count(NL80211_CMD_SET_KEY) == 2);
+	assert(test_key_index(fake_genl_get(NL80211_CMD_SET_KEY, 1)) == index);
+
+	test_teardown();
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("/ap/gtk-rekey/tx-after-stations",
+			test_gtk_tx_after_stations, NULL);
+	l_test_add("/ap/gtk-rekey/tx-timeout", test_gtk_tx_timeout, NULL);
+	l_test_add("/ap/gtk-rekey/tx-station-left",
+			test_gtk_tx_station_left, NULL);
+
+	return l_test_run();
+}
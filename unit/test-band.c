@@ -29,8 +29,10 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <ell/ell.h>
 
+#include "ell/useful.h"
 #include "src/band.h"
 #include "src/netdev.h"
 #include "src/ie.h"
@@ -508,6 +510,253 @@ static void band_test_he(const void *data)
 	l_free(band);
 }
 
+/*
+ * Reference implementations of the MCS search as done before the RSSI
+ * lookup table was introduced, built on the unchanged band_ofdm_rate()
+ */
+static bool ref_best_mcs(int max_index, enum ofdm_channel_width width,
+				int32_t rssi, uint8_t nss, bool sgi,
+				uint64_t *out_data_rate)
+{
+	int i;
+
+	for (i = max_index; i >= 0; i--)
+		if (band_ofdm_rate(i, width, rssi, nss, sgi, out_data_rate))
+			return true;
+
+	return false;
+}
+
+static bool ref_best_mcs_ht(const struct band *band,
+				const uint8_t *tx_mcs_set, int max_mcs,
+				enum ofdm_channel_width width, int32_t rssi,
+				bool sgi, uint64_t *out_data_rate)
+{
+	int i;
+
+	for (i = max_mcs; i >= 0; i--) {
+		if (!test_bit(band->ht_mcs_set, i) || !test_bit(tx_mcs_set, i))
+			continue;
+
+		if (band_ofdm_rate(i % 8, width, rssi, (i / 8) + 1, sgi,
+					out_data_rate))
+			return true;
+	}
+
+	return false;
+}
+
+#define SYNTHETIC_BSS_COUNT	1000
+
+struct synthetic_bss {
+	uint8_t htc[28];
+	uint8_t hto[24];
+	uint8_t vhtc[14];
+	uint8_t vhto[7];
+	uint8_t hec[32];
+	int32_t rssi;
+	bool vht : 1;
+	bool he : 1;
+};
+
+static uint32_t synthetic_seed = 0x12345678;
+
+static uint32_t synthetic_rand(void)
+{
+	synthetic_seed = synthetic_seed * 1103515245 + 12345;
+
+	return synthetic_seed >> 8;
+}
+
+static void synthetic_bss_init(struct synthetic_bss *bss)
+{
+	uint8_t nss = synthetic_rand() % 4 + 1;
+	uint8_t mcs_val = synthetic_rand() % 3;
+	uint16_t map = 0xffff;
+	int i;
+
+	memset(bss, 0, sizeof(*bss));
+
+	bss->rssi = -95 + (int32_t) (synthetic_rand() % 65);
+
+	bss->htc[0] = IE_TYPE_HT_CAPABILITIES;
+	bss->htc[1] = 26;
+	bss->htc[2] = synthetic_rand() & 0x60;	/* SGI 20/40 */
+
+	for (i = 0; i < 4; i++)
+		bss->htc[5 + i] = synthetic_rand();
+
+	/* Tx MCS Set Defined, sometimes with Tx Rx MCS Set Not Equal */
+	if (synthetic_rand() % 2)
+		bss->htc[5 + 12] = 0x01 | ((synthetic_rand() % 2) << 1) |
+					((synthetic_rand() % 4) << 2);
+
+	bss->hto[0] = IE_TYPE_HT_OPERATION;
+	bss->hto[1] = 22;
+	bss->hto[2] = 36;
+	/* 40 MHz with a secondary channel above, or 20 MHz */
+	bss->hto[3] = synthetic_rand() % 2 ? 0x05 : 0x00;
+
+	for (i = 0; i < nss; i++)
+		map &= ~(3 << (i * 2)) | (mcs_val << (i * 2));
+
+	bss->vht = synthetic_rand() % 2;
+	bss->vhtc[0] = IE_TYPE_VHT_CAPABILITIES;
+	bss->vhtc[1] = 12;
+	bss->vhtc[2] = synthetic_rand() & 0x60;	/* SGI 80/160 */
+	l_put_le16(map, bss->vhtc + 6);
+	l_put_le16(map, bss->vhtc + 10);
+
+	bss->vhto[0] = IE_TYPE_VHT_OPERATION;
+	bss->vhto[1] = 5;
+	bss->vhto[2] = synthetic_rand() % 2;
+
+	bss->he = synthetic_rand() % 2;
+	bss->hec[6] = (synthetic_rand() & 0x7) << 1;
+	l_put_le16(map, bss->hec + 17);
+	l_put_le16(map, bss->hec + 19);
+}
+
+/* Same order of attempts as wiphy_estimate_data_rate() */
+static int synthetic_bss_estimate(const struct band *band,
+					const struct synthetic_bss *bss,
+					uint64_t *out_data_rate)
+{
+	if (bss->he && !band_estimate_he_rx_rate(band, bss->hec, bss->rssi,
+							out_data_rate))
+		return 0;
+
+	if (bss->vht && !band_estimate_vht_rx_rate(band, bss->vhtc, bss->vhto,
+							bss->htc, bss->hto,
+							bss->rssi,
+							out_data_rate))
+		return 0;
+
+	return band_estimate_ht_rx_rate(band, bss->htc, bss->hto, bss->rssi,
+					out_data_rate);
+}
+
+static int synthetic_bss_estimate_ref(const struct band *band,
+					const struct synthetic_bss *bss,
+					uint64_t *out_data_rate)
+{
+	const uint8_t *tx_mcs_set = bss->htc + 5;
+	uint8_t unequal_tx_mcs_set[16] = {};
+	int max_mcs = 31;
+	bool ht40 = bss->hto[3] & 0x04;
+	bool sgi20 = test_bit(band->ht_capabilities, 5) &&
+						test_bit(bss->htc + 2, 5);
+	bool sgi40 = test_bit(band->ht_capabilities, 6) &&
+						test_bit(bss->htc + 2, 6);
+
+	if (bss->vht) {
+		uint8_t rx = bit_field(band->vht_mcs_set[0], 0, 2);
+		uint8_t tx = bss->vhtc[10] & 3;
+		uint8_t nss = (~band->vht_mcs_set[0] & 0x0c) &&
+				(~bss->vhtc[10] & 0x0c) ? 2 : 1;
+		int vht_max = 7 + (rx < tx ? rx : tx);
+		bool sgi80 = test_bit(band->vht_capabilities, 5) &&
+						test_bit(bss->vhtc + 2, 5);
+
+		if (bss->vhto[2] == 1 && ref_best_mcs(vht_max,
+						OFDM_CHANNEL_WIDTH_80MHZ,
+						bss->rssi, nss, sgi80,
+						out_data_rate))
+			return 0;
+
+		if (ht40 && ref_best_mcs(vht_max, OFDM_CHANNEL_WIDTH_40MHZ,
+						bss->rssi, nss, sgi40,
+						out_data_rate))
+			return 0;
+
+		if (ref_best_mcs(vht_max, OFDM_CHANNEL_WIDTH_20MHZ,
+					bss->rssi, nss, sgi20, out_data_rate))
+			return 0;
+	}
+
+	if (test_bit(tx_mcs_set, 96)) {
+		if (test_bit(tx_mcs_set, 97)) {
+			uint8_t max_nss = bit_field(tx_mcs_set[12], 2, 2);
+
+			max_mcs = max_nss * 4 + 7;
+			memset(unequal_tx_mcs_set, 0xff, max_nss + 1);
+			tx_mcs_set = unequal_tx_mcs_set;
+		}
+	} else
+		max_mcs = 7;
+
+	if (ht40 && ref_best_mcs_ht(band, tx_mcs_set, max_mcs,
+					OFDM_CHANNEL_WIDTH_40MHZ, bss->rssi,
+					sgi40, out_data_rate))
+		return 0;
+
+	if (ref_best_mcs_ht(band, tx_mcs_set, max_mcs,
+				OFDM_CHANNEL_WIDTH_20MHZ, bss->rssi,
+				sgi20, out_data_rate))
+		return 0;
+
+	return -ENETUNREACH;
+}
+
+static void band_test_rate_tables(const void *data)
+{
+	static struct band_he_capabilities he_cap = {
+		.he_phy_capa = { 0x0e },	/* 40/80/160 MHz */
+		.he_mcs_set = { 0xfa, 0xff, 0xfa, 0xff, 0xfa, 0xff },
+		.iftypes = 1 << NETDEV_IFTYPE_STATION,
+	};
+	struct synthetic_bss *bss = l_new(struct synthetic_bss,
+						SYNTHETIC_BSS_COUNT);
+	struct band *band = new_band();
+	uint64_t start_time;
+	uint64_t rate;
+	uint64_t ref_rate;
+	unsigned int i;
+	unsigned int round;
+	unsigned int reachable = 0;
+
+	band->freq = BAND_FREQ_5_GHZ;
+	band->he_capabilities = l_queue_new();
+	l_queue_push_tail(band->he_capabilities, &he_cap);
+
+	for (i = 0; i < SYNTHETIC_BSS_COUNT; i++)
+		synthetic_bss_init(&bss[i]);
+
+	/* HT and VHT results must match the exhaustive MCS search */
+	for (i = 0; i < SYNTHETIC_BSS_COUNT; i++) {
+		struct synthetic_bss no_he = bss[i];
+		int ret;
+
+		no_he.he = false;
+
+		ret = synthetic_bss_estimate(band, &no_he, &rate);
+		assert(ret == synthetic_bss_estimate_ref(band, &no_he,
+								&ref_rate));
+
+		if (ret == 0) {
+			assert(rate == ref_rate);
+			reachable++;
+		}
+	}
+
+	assert(reachable > SYNTHETIC_BSS_COUNT / 2);
+
+	start_time = l_time_now();
+
+	for (round = 0; round < 100; round++)
+		for (i = 0; i < SYNTHETIC_BSS_COUNT; i++)
+			synthetic_bss_estimate(band, &bss[i], &rate);
+
+	printf("%u rate estimations in %" PRIu64 " usec\n",
+		100 * SYNTHETIC_BSS_COUNT,
+		l_time_diff(start_time, l_time_now()));
+
+	l_queue_destroy(band->he_capabilities, NULL);
+	band->he_capabilities = NULL;
+	band_free(band);
+	l_free(bss);
+}
+
 struct oci2freq_data {
 	unsigned int op;
 	unsigned int chan;
@@ -683,6 +932,147 @@ static void test_conversion_fallback(const void *data)
 	assert(band == BAND_FREQ_5_GHZ);
 }
 
+/*
+ * Run every conversion over its whole input space and fold the results into
+ * a hash.  The expected values were obtained with the linear searches over
+ * the E-4 table that the direct-indexed lookups replaced.
+ */
+#define E4_SWEEP_CONVERSIONS_HASH	0x366d58fc
+#define E4_SWEEP_OCI_HASH		0xae011509
+#define E4_SWEEP_CHANDEF_HASH		0xc256f646
+#define E4_SWEEP_OPER_CLASS_HASH	0xef566fb9
+
+static void sweep_hash(uint32_t *hash, uint32_t value)
+{
+	*hash = (*hash ^ value) * 16777619;
+}
+
+static void test_e4_sweep_conversions(const void *data)
+{
+	static const enum band_freq bands[] = {
+		BAND_FREQ_2_4_GHZ, BAND_FREQ_5_GHZ, BAND_FREQ_6_GHZ,
+	};
+	uint32_t hash = 2166136261;
+	uint32_t freq;
+	unsigned int i;
+	unsigned int channel;
+
+	for (freq = 2300; freq <= 7300; freq++) {
+		enum band_freq band = 0;
+
+		sweep_hash(&hash, band_freq_to_channel(freq, &band));
+		sweep_hash(&hash, band);
+	}
+
+	for (i = 0; i < L_ARRAY_SIZE(bands); i++)
+		for (channel = 0; channel < 256; channel++)
+			sweep_hash(&hash, band_channel_to_freq(channel,
+								bands[i]));
+
+	printf("Conversions hash: 0x%08x\n", hash);
+	assert(hash == E4_SWEEP_CONVERSIONS_HASH);
+}
+
+static void test_e4_sweep_oci(const void *data)
+{
+	static const int32_t center_offsets[] = {
+		0, -10, 10, -30, 30, -70, 70, -50, 50,
+	};
+	uint32_t hash = 2166136261;
+	unsigned int op;
+	unsigned int channel;
+	uint32_t freq;
+	unsigned int width;
+	unsigned int i;
+
+	for (op = 0; op < 256; op++)
+		for (channel = 0; channel < 256; channel++)
+			sweep_hash(&hash, oci_to_frequency(op, channel));
+
+	for (freq = 2407; freq <= 7120; freq += 5) {
+		for (width = BAND_CHANDEF_WIDTH_20NOHT;
+				width <= BAND_CHANDEF_WIDTH_160; width++) {
+			for (i = 0; i < L_ARRAY_SIZE(center_offsets); i++) {
+				struct band_chandef chandef = {
+					.frequency = freq,
+					.channel_width = width,
+					.center1_frequency = freq +
+							center_offsets[i],
+				};
+				uint8_t oci[3] = {};
+				int r;
+
+				if (width == BAND_CHANDEF_WIDTH_80P80)
+					chandef.center2_frequency =
+						chandef.center1_frequency + 160;
+
+				r = oci_from_chandef(&chandef, oci);
+				sweep_hash(&hash, r);
+				sweep_hash(&hash, oci[0] | oci[1] << 8 |
+							oci[2] << 16);
+
+				if (r == 0)
+					sweep_hash(&hash,
+						oci_verify(oci, &chandef));
+			}
+		}
+	}
+
+	printf("OCI hash: 0x%08x\n", hash);
+	assert(hash == E4_SWEEP_OCI_HASH);
+}
+
+static void test_e4_sweep_ht_chandef(const void *data)
+{
+	uint32_t hash = 2166136261;
+	uint32_t freq;
+	unsigned int flags;
+
+	for (freq = 2400; freq <= 7200; freq++) {
+		for (flags = 0; flags < 4; flags++) {
+			struct band_freq_attrs attr = {
+				.supported = true,
+				.no_ht40_plus = flags & 1,
+				.no_ht40_minus = flags & 2,
+			};
+			struct band_chandef chandef = {};
+
+			sweep_hash(&hash, band_freq_to_ht_chandef(freq, &attr,
+								&chandef));
+			sweep_hash(&hash, chandef.channel_width);
+			sweep_hash(&hash, chandef.center1_frequency);
+		}
+	}
+
+	printf("HT chandef hash: 0x%08x\n", hash);
+	assert(hash == E4_SWEEP_CHANDEF_HASH);
+}
+
+static void test_e4_sweep_oper_class(const void *data)
+{
+	static const uint8_t countries[][3] = {
+		{ 'U', 'S', ' ' }, { 'C', 'A', ' ' }, { 'D', 'E', ' ' },
+		{ 'U', 'K', 'I' }, { 'A', 'L', ' ' }, { 'J', 'P', ' ' },
+		{ 'C', 'N', ' ' }, { 'X', 'X', 0x04 }, { 'B', 'R', ' ' },
+		{ 'U', 'S', 0x01 }, { 'F', 'R', 0x02 },
+	};
+	uint32_t hash = 2166136261;
+	unsigned int i;
+	unsigned int oper_class;
+
+	for (oper_class = 0; oper_class < 256; oper_class++)
+		sweep_hash(&hash, band_oper_class_to_band(NULL, oper_class));
+
+	for (i = 0; i < L_ARRAY_SIZE(countries); i++)
+		for (oper_class = 0; oper_class < 256; oper_class++)
+			sweep_hash(&hash,
+				band_oper_class_to_band(countries[i],
+							oper_class));
+
+	printf("Operating class hash: 0x%08x\n", hash);
+	assert(hash == E4_SWEEP_OPER_CLASS_HASH);
+}
+
 int main(int argc, char *argv[])
 {
 	l_test_init(&argc, &argv);
@@ -712,6 +1102,8 @@ int main(int argc, char *argv[])
 	l_test_add("/band/HE/test/low RSSI", band_test_he,
 					&he_test_5_low_rssi);
 
+	l_test_add("/band/rate tables", band_test_rate_tables, NULL);
+
 	l_test_add("/band/oci2freq 1", test_oci2freq, &oci2freq_data_1);
 	l_test_add("/band/oci2freq 2", test_oci2freq, &oci2freq_data_2);
 	l_test_add("/band/oci2freq 3", test_oci2freq, &oci2freq_data_3);
@@ -751,5 +1143,11 @@ int main(int argc, char *argv[])
 	l_test_add("/band/conversions", test_conversions, NULL);
 	l_test_add("/band/conversion fallback", test_conversion_fallback, NULL);
 
+	l_test_add("/band/E-4/conversions", test_e4_sweep_conversions, NULL);
+	l_test_add("/band/E-4/OCI", test_e4_sweep_oci, NULL);
+	l_test_add("/band/E-4/HT chandef", test_e4_sweep_ht_chandef, NULL);
+	l_test_add("/band/E-4/operating class", test_e4_sweep_oper_class,
+									NULL);
+
 	return l_test_run();
 }
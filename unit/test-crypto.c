@@ -26,6 +26,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 #include <assert.h>
 #include <ell/ell.h>
 
@@ -364,6 +365,34 @@ static void aes_wrap_test(const void *data)
 	assert(!memcmp(buf, key_data, sizeof(key_data)));
 }
 
+static void aes_unwrap_256_test(const void *data)
+{
+	/* RFC3394 section 4.6 test vector */
+	static const uint8_t kek[32] = {
+		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+		0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+		0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+		0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+	};
+	static const uint8_t key_data[32] = {
+		0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+		0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff,
+		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+		0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+	};
+	static const uint8_t ciphertext[40] = {
+		0x28, 0xc9, 0xf4, 0x04, 0xc4, 0xb8, 0x10, 0xf4,
+		0xcb, 0xcc, 0xb3, 0x5c, 0xfb, 0x87, 0xf8, 0x26,
+		0x3f, 0x57, 0x86, 0xe2, 0xd8, 0x0e, 0xd3, 0x26,
+		0xcb, 0xc7, 0xf0, 0xe7, 0x1a, 0x99, 0xf4, 0x3b,
+		0xfb, 0x98, 0x8b, 0x9b, 0x7a, 0x02, 0xdd, 0x21,
+	};
+	uint8_t buf[40];
+
+	assert(aes_unwrap(kek, 32, ciphertext, sizeof(ciphertext), buf));
+	assert(!memcmp(buf, key_data, sizeof(key_data)));
+}
+
 static void aes_siv_test(const void *data)
 {
 	/* RFC5297 Appendix A.1 Test Vectors */
@@ -403,6 +432,153 @@ static void aes_siv_test(const void *data)
 	assert(memcmp(decrypted, plaintext, sizeof(decrypted)) == 0);
 }
 
+static void cmac_aes_test(const void *data)
+{
+	/* RFC4493 section 4 Example 3 */
+	static const uint8_t key[16] = {
+		0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+		0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c,
+	};
+	static const uint8_t msg[40] = {
+		0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96,
+		0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+		0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c,
+		0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+		0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11,
+	};
+	static const uint8_t tag[16] = {
+		0xdf, 0xa6, 0x67, 0x47, 0xde, 0x9a, 0xe6, 0x30,
+		0x30, 0xca, 0x32, 0x61, 0x14, 0x97, 0xc8, 0x27,
+	};
+	uint8_t out[16];
+
+	assert(cmac_aes(key, sizeof(key), msg, sizeof(msg), out, sizeof(out)));
+	assert(!memcmp(out, tag, sizeof(tag)));
+}
+
+static const enum crypto_aes_impl aes_impl_ids[] = {
+	CRYPTO_AES_IMPL_KERNEL,
+	CRYPTO_AES_IMPL_GENERIC,
+	CRYPTO_AES_IMPL_AESNI,
+	CRYPTO_AES_IMPL_ARMV8_CE,
+};
+
+/* Run the known answer tests against every implementation this CPU has */
+static void aes_impl_test(const void *data)
+{
+	enum crypto_aes_impl saved = crypto_aes_get_impl();
+	unsigned int i;
+
+	for (i = 0; i < L_ARRAY_SIZE(aes_impl_ids); i++) {
+		if (!crypto_aes_set_impl(aes_impl_ids[i]))
+			continue;
+
+		printf("Testing %s\n", crypto_aes_impl_to_str(aes_impl_ids[i]));
+
+		aes_wrap_test(NULL);
+		aes_unwrap_256_test(NULL);
+		cmac_aes_test(NULL);
+		aes_siv_test(NULL);
+	}
+
+	assert(crypto_aes_set_impl(saved));
+}
+
+#define AES_BENCH_ITERATIONS	1000
+
+static void aes_bench_test(const void *data)
+{
+	static const uint8_t key[32] = {
+		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+		0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+		0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+		0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+	};
+	enum crypto_aes_impl saved = crypto_aes_get_impl();
+	uint8_t plaintext[32] = { 0 };
+	uint8_t wrapped[sizeof(plaintext) + 16];
+	uint8_t unwrapped[sizeof(plaintext)];
+	uint8_t mic[16];
+	unsigned int i, j;
+
+	for (i = 0; i < L_ARRAY_SIZE(aes_impl_ids); i++) {
+		uint64_t wrap_usec, cmac_usec, siv_usec;
+		uint64_t start_time;
+
+		if (!crypto_aes_set_impl(aes_impl_ids[i]))
+			continue;
+
+		start_time = l_time_now();
+
+		for (j = 0; j < AES_BENCH_ITERATIONS; j++) {
+			assert(aes_wrap(key, plaintext, sizeof(plaintext),
+						wrapped));
+			assert(aes_unwrap(key, 16, wrapped,
+						sizeof(plaintext) + 8,
+						unwrapped));
+		}
+
+		wrap_usec = l_time_diff(start_time, l_time_now());
+		start_time = l_time_now();
+
+		for (j = 0; j < AES_BENCH_ITERATIONS; j++)
+			assert(cmac_aes(key, 16, wrapped, sizeof(wrapped),
+					mic, sizeof(mic)));
+
+		cmac_usec = l_time_diff(start_time, l_time_now());
+		start_time = l_time_now();
+
+		for (j = 0; j < AES_BENCH_ITERATIONS; j++) {
+			assert(aes_siv_encrypt(key, sizeof(key), plaintext,
+						sizeof(plaintext), NULL, 0,
+						wrapped));
+			assert(aes_siv_decrypt(key, sizeof(key), wrapped,
+						sizeof(wrapped), NULL, 0,
+						unwrapped));
+		}
+
+		siv_usec = l_time_diff(start_time, l_time_now());
+
+		printf("%-8s %u iterations: key wrap %" PRIu64 " usec, "
+			"CMAC %" PRIu64 " usec, AES-SIV %" PRIu64 " usec\n",
+			crypto_aes_impl_to_str(aes_impl_ids[i]),
+			AES_BENCH_ITERATIONS, wrap_usec, cmac_usec, siv_usec);
+	}
+
+	assert(crypto_aes_set_impl(saved));
+}
+
+static void crypto_stats_test(const void *data)
+{
+	const struct crypto_stat_info *info;
+	uint64_t count, histogram_total = 0;
+	unsigned int i;
+
+	for (i = 0; i < __CRYPTO_STAT_MAX; i++)
+		assert(crypto_stat_to_str(i));
+
+	assert(!crypto_stat_get(__CRYPTO_STAT_MAX));
+
+	info = crypto_stat_get(CRYPTO_STAT_AES_CMAC);
+	count = info->count;
+
+	cmac_aes_test(NULL);
+	assert(info->count == count + 1);
+
+	/* A run that took ten seconds lands in the catch-all bucket */
+	count = info->histogram[CRYPTO_STAT_BUCKETS - 1];
+	crypto_stat_record(CRYPTO_STAT_AES_CMAC,
+				l_time_now() - 10 * L_USEC_PER_SEC);
+	assert(info->histogram[CRYPTO_STAT_BUCKETS - 1] == count + 1);
+	assert(info->max_usec >= 10 * L_USEC_PER_SEC);
+	assert(info->total_usec >= info->max_usec);
+
+	for (i = 0; i < CRYPTO_STAT_BUCKETS; i++)
+		histogram_total += info->histogram[i];
+
+	assert(histogram_total == info->count);
+}
+
 int main(int argc, char *argv[])
 {
 	l_test_init(&argc, &argv);
@@ -435,7 +611,12 @@ int main(int argc, char *argv[])
 
 	l_test_add("/AES Key-wrap/Wrap & unwrap",
 			aes_wrap_test, NULL);
+	l_test_add("/AES Key-wrap/Unwrap 256-bit KEK",
+			aes_unwrap_256_test, NULL);
 	l_test_add("/AES-SIV", aes_siv_test, NULL);
+	l_test_add("/AES/Implementations", aes_impl_test, NULL);
+	l_test_add("/AES/Benchmark", aes_bench_test, NULL);
+	l_test_add("/Crypto/Statistics", crypto_stats_test, NULL);
 
 done:
 	return l_test_run();
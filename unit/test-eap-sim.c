@@ -32,6 +32,7 @@
 #include "src/eap.h"
 #include "src/eap-private.h"
 #include "src/simutil.h"
+#include "src/simauth.h"
 
 static uint8_t attr_data[] = {
 		EAP_SIM_AT_RAND,		/* attribute type */
@@ -354,6 +355,430 @@ static void test_aka_prf_prime(const void *data)
 	assert(memcmp(emsk, vals->emsk, EAP_SIM_EMSK_LEN) == 0);
 }
 
+static void test_next_ids(const void *data)
+{
+	static const uint8_t k_encr[EAP_SIM_K_ENCR_LEN] = {
+		0x53, 0x6e, 0x5e, 0xbc, 0x44, 0x65, 0x58, 0x2a,
+		0xa6, 0xa8, 0xec, 0x99, 0x86, 0xeb, 0xb6, 0x20,
+	};
+	static const uint8_t iv[EAP_SIM_IV_LEN] = {
+		0x9e, 0x18, 0xb0, 0xc2, 0x9a, 0x65, 0x22, 0x63,
+		0xc0, 0x6e, 0xfb, 0x54, 0xdd, 0x00, 0xa8, 0x95,
+	};
+	const char *pseudonym = "w8w49PexCazWJ&xCIARmxuMKht5S1sxR";
+	const char *reauth_id = "Y24fNSrz8BP274jOJaF17WfxI8YO7QX00pMXk9XMMVOw7"
+				"broaUQ@example.com";
+	uint8_t plain[128];
+	uint8_t pkt[3 + 20 + 4 + sizeof(plain)];
+	size_t plain_len;
+	uint8_t *pos = pkt;
+	struct l_cipher *cipher;
+	char *out_pseudonym;
+	char *out_reauth_id;
+
+	plain_len = eap_sim_add_attribute(plain, EAP_SIM_AT_NEXT_PSEUDONYM,
+					EAP_SIM_PAD_LENGTH,
+					(const uint8_t *) pseudonym,
+					strlen(pseudonym));
+	plain_len += eap_sim_add_attribute(plain + plain_len,
+					EAP_SIM_AT_NEXT_REAUTH_ID,
+					EAP_SIM_PAD_LENGTH,
+					(const uint8_t *) reauth_id,
+					strlen(reauth_id));
+	plain_len += eap_sim_add_attribute(plain + plain_len,
+					EAP_SIM_AT_PADDING, EAP_SIM_PAD_NONE,
+					NULL, 16 - plain_len % 16 - 2);
+	assert(plain_len % 16 == 0);
+
+	/* Challenge subtype, reserved, AT_IV, AT_ENCR_DATA */
+	*pos++ = 1;
+	*pos++ = 0;
+	*pos++ = 0;
+	pos += eap_sim_add_attribute(pos, EAP_SIM_AT_IV, EAP_SIM_PAD_ZERO,
+					iv, sizeof(iv));
+	*pos++ = EAP_SIM_AT_ENCR_DATA;
+	*pos++ = (plain_len + 4) / 4;
+	*pos++ = 0;
+	*pos++ = 0;
+
+	cipher = l_cipher_new(L_CIPHER_AES_CBC, k_encr, sizeof(k_encr));
+	assert(cipher);
+	assert(l_cipher_set_iv(cipher, iv, sizeof(iv)));
+	assert(l_cipher_encrypt(cipher, plain, pos, plain_len));
+	l_cipher_free(cipher);
+	pos += plain_len;
+
+	assert(eap_sim_get_next_ids(pkt, pos - pkt, k_encr, &out_pseudonym,
+					&out_reauth_id));
+	assert(!strcmp(out_pseudonym, pseudonym));
+	assert(!strcmp(out_reauth_id, reauth_id));
+	l_free(out_pseudonym);
+	l_free(out_reauth_id);
+
+	/* No AT_ENCR_DATA at all is not an error */
+	assert(eap_sim_get_next_ids(pkt, 3 + 20, k_encr, &out_pseudonym,
+					&out_reauth_id));
+	assert(!out_pseudonym && !out_reauth_id);
+}
+
+static void test_reauth(const void *data)
+{
+	static const uint8_t k_encr[EAP_SIM_K_ENCR_LEN] = {
+		0x53, 0x6e, 0x5e, 0xbc, 0x44, 0x65, 0x58, 0x2a,
+		0xa6, 0xa8, 0xec, 0x99, 0x86, 0xeb, 0xb6, 0x20,
+	};
+	static const uint8_t iv[EAP_SIM_IV_LEN] = {
+		0x9e, 0x18, 0xb0, 0xc2, 0x9a, 0x65, 0x22, 0x63,
+		0xc0, 0x6e, 0xfb, 0x54, 0xdd, 0x00, 0xa8, 0x95,
+	};
+	static const uint8_t nonce_s[EAP_SIM_NONCE_S_LEN] = {
+		0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef,
+		0xfe, 0xdc, 0xba, 0x98, 0x76, 0x54, 0x32, 0x10,
+	};
+	const char *reauth_id = "Y24fNSrz8BP274jOJaF17WfxI8YO7QX00pMXk9XMMVOw7"
+				"broaUQ@example.com";
+	struct eap_sim_reauth_request req;
+	struct eap_state *eap;
+	uint8_t counter[2];
+	uint8_t plain[96];
+	uint8_t pkt[3 + 20 + 4 + sizeof(plain) + 4 + 20];
+	uint8_t response[EAP_SIM_COUNTER_RESPONSE_LEN_MAX +
+						EAP_SIM_NONCE_S_LEN];
+	uint8_t mac[EAP_SIM_MAC_LEN];
+	size_t plain_len;
+	size_t resp_len;
+	uint16_t value;
+	uint8_t *pos = pkt;
+
+	l_put_be16(5, counter);
+	plain_len = eap_sim_add_attribute(plain, EAP_SIM_AT_COUNTER,
+					EAP_SIM_PAD_NONE, counter, 2);
+	plain_len += eap_sim_add_attribute(plain + plain_len,
+					EAP_SIM_AT_NONCE_S, EAP_SIM_PAD_ZERO,
+					nonce_s, sizeof(nonce_s));
+	plain_len += eap_sim_add_attribute(plain + plain_len,
+					EAP_SIM_AT_NEXT_REAUTH_ID,
+					EAP_SIM_PAD_LENGTH,
+					(const uint8_t *) reauth_id,
+					strlen(reauth_id));
+	plain_len += eap_sim_add_attribute(plain + plain_len,
+					EAP_SIM_AT_PADDING, EAP_SIM_PAD_NONE,
+					NULL, 16 - plain_len % 16 - 2);
+	assert(plain_len % 16 == 0);
+
+	/* Re-authentication subtype, reserved, AT_IV, AT_ENCR_DATA */
+	*pos++ = 13;
+	*pos++ = 0;
+	*pos++ = 0;
+	pos += eap_sim_add_attribute(pos, EAP_SIM_AT_IV, EAP_SIM_PAD_ZERO,
+					iv, sizeof(iv));
+	*pos++ = EAP_SIM_AT_ENCR_DATA;
+	*pos++ = (plain_len + 4) / 4;
+	*pos++ = 0;
+	*pos++ = 0;
+	assert(eap_sim_encrypt_encr_data(k_encr, iv, plain, plain_len, pos));
+	pos += plain_len;
+	pos += eap_sim_add_attribute(pos, EAP_SIM_AT_RESULT_IND,
+					EAP_SIM_PAD_NONE, NULL, 2);
+	pos += eap_sim_add_attribute(pos, EAP_SIM_AT_MAC, EAP_SIM_PAD_ZERO,
+					ex_mac, EAP_SIM_MAC_LEN);
+
+	assert(eap_sim_parse_reauth_request(pkt, pos - pkt, k_encr, &req));
+	assert(req.counter == 5);
+	assert(!memcmp(req.nonce_s, nonce_s, sizeof(nonce_s)));
+	assert(!memcmp(req.mac, ex_mac, EAP_SIM_MAC_LEN));
+	assert(!strcmp(req.next_reauth_id, reauth_id));
+	assert(!req.next_pseudonym);
+	assert(req.result_ind);
+	eap_sim_reauth_request_clear(&req);
+
+	/* A truncated packet is rejected */
+	assert(!eap_sim_parse_reauth_request(pkt, 3 + 20 + 4 + 16, k_encr,
+						&req));
+
+	/* AT_COUNTER alone, as checked in Notifications */
+	assert(eap_sim_get_encr_counter(pkt, pos - pkt, k_encr, &value));
+	assert(value == 5);
+	assert(!eap_sim_get_encr_counter(pkt, 3 + 20, k_encr, &value));
+
+	/* The response carries the counter and a MAC over NONCE_S */
+	eap = eap_new(NULL, NULL, NULL);
+	resp_len = eap_sim_build_counter_response(eap, EAP_TYPE_SIM, 13, 5,
+						true, false, k_encr, ex_k_aut,
+						nonce_s, response);
+	eap_free(eap);
+	assert(resp_len == EAP_SIM_COUNTER_RESPONSE_LEN_MAX - 4);
+	assert(l_get_be16(response + 2) == resp_len);
+	assert(response[8] == EAP_SIM_AT_IV);
+	assert(response[28] == EAP_SIM_AT_ENCR_DATA);
+	assert(response[48] == EAP_SIM_AT_MAC);
+
+	assert(eap_sim_decrypt_encr_data(k_encr, response + 12, response + 32,
+						16, plain));
+	assert(plain[0] == EAP_SIM_AT_COUNTER && l_get_be16(plain + 2) == 5);
+	assert(plain[4] == EAP_SIM_AT_COUNTER_TOO_SMALL);
+	assert(plain[8] == EAP_SIM_AT_PADDING && plain[9] == 2);
+
+	memcpy(mac, response + 52, EAP_SIM_MAC_LEN);
+	memset(response + 52, 0, EAP_SIM_MAC_LEN);
+	memcpy(response + resp_len, nonce_s, sizeof(nonce_s));
+	assert(eap_sim_derive_mac(EAP_TYPE_SIM, response,
+					resp_len + sizeof(nonce_s), ex_k_aut,
+					response + 52));
+	assert(!memcmp(mac, response + 52, EAP_SIM_MAC_LEN));
+}
+
+/* Local stand-in for a SIM provider, answers are given by the test */
+struct test_sim {
+	unsigned int milenage_calls;
+	unsigned int gsm_calls;
+	unsigned int cancel_calls;
+	sim_auth_check_milenage_cb_t cb;
+	sim_auth_run_gsm_cb_t gsm_cb;
+	void *cb_data;
+};
+
+static const uint8_t test_res[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+static const uint8_t test_ck[16] = { [0] = 0xc0, [15] = 0xcf };
+static const uint8_t test_ik[16] = { [0] = 0x10, [15] = 0x1f };
+static const uint8_t test_sres[8] = { 0x51, [7] = 0x58 };
+static const uint8_t test_kc[16] = { 0x6b, [15] = 0xc6 };
+
+static int test_sim_check_milenage(struct iwd_sim_auth *auth,
+					const uint8_t *rand,
+					const uint8_t *autn,
+					sim_auth_check_milenage_cb_t cb,
+					void *data)
+{
+	struct test_sim *sim = iwd_sim_auth_get_data(auth);
+
+	sim->cb = cb;
+	sim->cb_data = data;
+
+	return ++sim->milenage_calls;
+}
+
+static int test_sim_run_gsm(struct iwd_sim_auth *auth, const uint8_t *rands,
+				int num_rands, sim_auth_run_gsm_cb_t cb,
+				void *data)
+{
+	struct test_sim *sim = iwd_sim_auth_get_data(auth);
+
+	sim->gsm_cb = cb;
+	sim->cb_data = data;
+
+	return ++sim->gsm_calls;
+}
+
+static void test_sim_cancel_request(struct iwd_sim_auth *auth, int id)
+{
+	struct test_sim *sim = iwd_sim_auth_get_data(auth);
+
+	sim->cancel_calls++;
+}
+
+static const struct iwd_sim_auth_driver test_sim_driver = {
+	.name = "test",
+	.check_milenage = test_sim_check_milenage,
+	.run_gsm = test_sim_run_gsm,
+	.cancel_request = test_sim_cancel_request,
+};
+
+static void test_milenage_cb(const uint8_t *res, const uint8_t *ck,
+				const uint8_t *ik, const uint8_t *auts,
+				void *data)
+{
+	unsigned int *results = data;
+
+	assert(res && !memcmp(res, test_res, sizeof(test_res)));
+	assert(ck && !memcmp(ck, test_ck, sizeof(test_ck)));
+	assert(ik && !memcmp(ik, test_ik, sizeof(test_ik)));
+	assert(!auts);
+
+	(*results)++;
+}
+
+static void test_gsm_cb(const uint8_t *sres, const uint8_t *kc, void *data)
+{
+	unsigned int *results = data;
+
+	assert(sres && !memcmp(sres, test_sres, sizeof(test_sres)));
+	assert(kc && !memcmp(kc, test_kc, sizeof(test_kc)));
+
+	(*results)++;
+}
+
+static struct l_settings *test_identity_cache;
+static unsigned int test_identity_cache_syncs;
+
+static struct l_settings *test_identity_cache_load(void)
+{
+	struct l_settings *settings = l_settings_new();
+	char *data;
+	size_t len;
+
+	if (!test_identity_cache)
+		return settings;
+
+	data = l_settings_to_data(test_identity_cache, &len);
+	assert(l_settings_load_from_data(settings, data, len));
+	l_free(data);
+
+	return settings;
+}
+
+static void test_identity_cache_sync(const struct l_settings *cache)
+{
+	char *data;
+	size_t len;
+
+	l_settings_free(test_identity_cache);
+	test_identity_cache = l_settings_new();
+
+	data = l_settings_to_data(cache, &len);
+	assert(l_settings_load_from_data(test_identity_cache, data, len));
+	l_free(data);
+
+	test_identity_cache_syncs++;
+}
+
+static void test_simauth_cache(const void *data)
+{
+	struct test_sim sim = {};
+	struct iwd_sim_auth *auth;
+	uint8_t rand[16] = { 0x42 };
+	uint8_t autn[16] = { 0x24 };
+	uint8_t rands[32] = { 0x42, [16] = 0x43 };
+	unsigned int results = 0;
+	int id;
+
+	assert(l_main_init());
+
+	auth = iwd_sim_auth_create(&test_sim_driver);
+	iwd_sim_auth_set_capabilities(auth, true, true);
+	iwd_sim_auth_set_data(auth, &sim);
+
+	/* First GSM challenge goes to the SIM */
+	assert(sim_auth_run_gsm(auth, rands, 2, test_gsm_cb, &results) > 0);
+	assert(sim.gsm_calls == 1);
+	sim.gsm_cb(test_sres, test_kc, sim.cb_data);
+	assert(results == 1);
+
+	/* A repeated GSM challenge is answered from the cache */
+	assert(sim_auth_run_gsm(auth, rands, 2, test_gsm_cb, &results) > 0);
+	assert(sim.gsm_calls == 1);
+	assert(results == 1);
+	l_main_iterate(0);
+	assert(results == 2);
+
+	/* Different RANDs are a new challenge */
+	rands[0] ^= 0xff;
+	id = sim_auth_run_gsm(auth, rands, 2, test_gsm_cb, &results);
+	assert(id > 0);
+	assert(sim.gsm_calls == 2);
+
+	sim_auth_cancel_request(auth, id);
+	assert(sim.cancel_calls == 1);
+
+	/* AKA challenges always go to the SIM for its SQN check */
+	results = 0;
+	assert(sim_auth_check_milenage(auth, rand, autn, test_milenage_cb,
+					&results) > 0);
+	assert(sim.milenage_calls == 1);
+	sim.cb(test_res, test_ck, test_ik, NULL, sim.cb_data);
+	assert(results == 1);
+
+	id = sim_auth_check_milenage(auth, rand, autn, test_milenage_cb,
+					&results);
+	assert(id > 0);
+	assert(sim.milenage_calls == 2);
+	assert(results == 1);
+
+	sim_auth_cancel_request(auth, id);
+	assert(sim.cancel_calls == 2);
+
+	iwd_sim_auth_remove(auth);
+
+	l_main_exit();
+}
+
+static void test_simauth_identities(const void *data)
+{
+	struct sim_auth_reauth reauth = {
+		.id = "reauth@example.com",
+		.counter = 3,
+		.key = { 0x11, [19] = 0x99 },
+		.key_len = 20,
+		.k_encr = { 0x22 },
+		.k_aut = { 0x33, [15] = 0x77 },
+		.k_aut_len = 16,
+	};
+	const struct sim_auth_reauth *stored;
+	struct iwd_sim_auth *auth;
+	char *identity;
+
+	sim_auth_set_cache_ops(test_identity_cache_load,
+				test_identity_cache_sync);
+
+	auth = iwd_sim_auth_create(&test_sim_driver);
+	iwd_sim_auth_set_nai(auth, "001010000000001@example.com");
+
+	/* Without any state the permanent identity is used */
+	identity = sim_auth_get_identity(auth, SIM_AUTH_METHOD_SIM,
+						SIM_AUTH_IDENTITY_ANY);
+	assert(!strcmp(identity, "1001010000000001@example.com"));
+	l_free(identity);
+
+	sim_auth_set_pseudonym(auth, SIM_AUTH_METHOD_AKA, "pseudonym");
+	sim_auth_set_reauth(auth, SIM_AUTH_METHOD_SIM, &reauth);
+	assert(test_identity_cache_syncs == 2);
+	assert(!sim_auth_get_pseudonym(auth, SIM_AUTH_METHOD_SIM));
+	assert(!sim_auth_get_reauth(auth, SIM_AUTH_METHOD_AKA));
+
+	/* Pseudonyms get the realm of the NAI */
+	identity = sim_auth_get_identity(auth, SIM_AUTH_METHOD_AKA,
+						SIM_AUTH_IDENTITY_ANY);
+	assert(!strcmp(identity, "pseudonym@example.com"));
+	l_free(identity);
+
+	identity = sim_auth_get_identity(auth, SIM_AUTH_METHOD_SIM,
+						SIM_AUTH_IDENTITY_ANY);
+	assert(!strcmp(identity, reauth.id));
+	l_free(identity);
+
+	identity = sim_auth_get_identity(auth, SIM_AUTH_METHOD_SIM,
+						SIM_AUTH_IDENTITY_FULLAUTH);
+	assert(!strcmp(identity, "1001010000000001@example.com"));
+	l_free(identity);
+
+	iwd_sim_auth_remove(auth);
+
+	/* A new provider for the same SIM finds the persisted state */
+	auth = iwd_sim_auth_create(&test_sim_driver);
+	iwd_sim_auth_set_nai(auth, "001010000000001@example.com");
+
+	assert(!strcmp(sim_auth_get_pseudonym(auth, SIM_AUTH_METHOD_AKA),
+			"pseudonym"));
+	stored = sim_auth_get_reauth(auth, SIM_AUTH_METHOD_SIM);
+	assert(stored);
+	assert(!strcmp(stored->id, reauth.id));
+	assert(stored->counter == reauth.counter);
+	assert(stored->key_len == reauth.key_len &&
+		!memcmp(stored->key, reauth.key, reauth.key_len));
+	assert(!memcmp(stored->k_encr, reauth.k_encr, sizeof(reauth.k_encr)));
+	assert(stored->k_aut_len == reauth.k_aut_len &&
+		!memcmp(stored->k_aut, reauth.k_aut, reauth.k_aut_len));
+
+	sim_auth_set_reauth(auth, SIM_AUTH_METHOD_SIM, NULL);
+	assert(!sim_auth_get_reauth(auth, SIM_AUTH_METHOD_SIM));
+
+	iwd_sim_auth_remove(auth);
+
+	sim_auth_set_cache_ops(NULL, NULL);
+	l_settings_free(test_identity_cache);
+	test_identity_cache = NULL;
+}
+
 int main(int argc, char *argv[])
 {
 	l_test_init(&argc, &argv);
@@ -364,6 +789,11 @@ int main(int argc, char *argv[])
 	l_test_add("EAP-SIM PRNG test", test_prng, NULL);
 	l_test_add("EAP-AKA' Test Case 1", test_aka_prf_prime, &test_case_1);
 	l_test_add("EAP-AKA' Test Case 2", test_aka_prf_prime, &test_case_2);
+	l_test_add("EAP-SIM next identities test", test_next_ids, NULL);
+	l_test_add("EAP-SIM re-authentication test", test_reauth, NULL);
+	l_test_add("SIM auth challenge cache test", test_simauth_cache, NULL);
+	l_test_add("SIM auth identity cache test", test_simauth_identities,
+			NULL);
 
 	return l_test_run();
 }
@@ -0,0 +1,482 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  iwd contributors. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <inttypes.h>
+#include <assert.h>
+#include <time.h>
+#include <ell/ell.h>
+
+#include "src/module.h"
+#include "src/eap.h"
+#include "src/eap-tls-common.h"
+
+/*
+ * The TLS session cache is driven the way l_tls drives it: a session is
+ * stored or dropped by changing the peer's group in the l_settings object
+ * handed out by the load function and then calling the update callback.
+ * The sync function keeps the written data so that the tests can restart
+ * the cache by running the module exit, and l_timeout is wrapped so that
+ * the tests run the batched writes.
+ */
+
+#define TEST_CACHE_MAX		64
+#define TEST_SYNC_DELAY		10
+#define TEST_LIFETIME		(24 * 3600)
+
+struct test_timeout {
+	l_timeout_notify_cb_t callback;
+	void *user_data;
+	l_timeout_destroy_cb_t destroy;
+	uint64_t expiry;
+};
+
+static struct l_settings *test_cache;
+static char *test_stored;
+static unsigned int test_syncs;
+static struct l_queue *test_timeouts;
+static uint64_t test_now;
+
+uint64_t __wrap_l_time_now(void);
+struct l_timeout *__wrap_l_timeout_create(unsigned int seconds,
+					l_timeout_notify_cb_t callback,
+					void *user_data,
+					l_timeout_destroy_cb_t destroy);
+void __wrap_l_timeout_remove(struct l_timeout *timeout);
+
+uint64_t __wrap_l_time_now(void)
+{
+	return test_now;
+}
+
+struct l_timeout *__wrap_l_timeout_create(unsigned int seconds,
+					l_timeout_notify_cb_t callback,
+					void *user_data,
+					l_timeout_destroy_cb_t destroy)
+{
+	struct test_timeout *timeout = l_new(struct test_timeout, 1);
+
+	timeout->callback = callback;
+	timeout->user_data = user_data;
+	timeout->destroy = destroy;
+	timeout->expiry = test_now + seconds * L_USEC_PER_SEC;
+	l_queue_push_tail(test_timeouts, timeout);
+
+	return (struct l_timeout *) timeout;
+}
+
+void __wrap_l_timeout_remove(struct l_timeout *timeout)
+{
+	struct test_timeout *t = (struct test_timeout *) timeout;
+
+	if (!t)
+		return;
+
+	l_queue_remove(test_timeouts, t);
+
+	if (t->destroy)
+		t->destroy(t->user_data);
+
+	l_free(t);
+}
+
+static bool test_timeout_expired(const void *data, const void *user_data)
+{
+	const struct test_timeout *timeout = data;
+
+	return timeout->expiry && timeout->expiry <= test_now;
+}
+
+static void test_advance(unsigned int seconds)
+{
+	struct test_timeout *timeout;
+
+	test_now += seconds * L_USEC_PER_SEC;
+
+	while ((timeout = l_queue_find(test_timeouts, test_timeout_expired,
+					NULL))) {
+		timeout->expiry = 0;
+		timeout->callback((struct l_timeout *) timeout,
+					timeout->user_data);
+	}
+}
+
+static struct l_settings *test_load(void)
+{
+	test_cache = l_settings_new();
+
+	if (test_stored)
+		assert(l_settings_load_from_data(test_cache, test_stored,
+							strlen(test_stored)));
+
+	return test_cache;
+}
+
+static void test_sync(const struct l_settings *settings)
+{
+	size_t len;
+
+	assert(settings == test_cache);
+
+	l_free(test_stored);
+	test_stored = l_settings_to_data(settings, &len);
+	test_syncs++;
+}
+
+static bool test_stored_has_peer(const char *peer_id)
+{
+	struct l_settings *settings = l_settings_new();
+	bool ret;
+
+	assert(l_settings_load_from_data(settings, test_stored,
+						strlen(test_stored)));
+	ret = l_settings_has_group(settings, peer_id);
+	l_settings_free(settings);
+
+	return ret;
+}
+
+extern struct iwd_module_desc __start___iwd_module[];
+extern struct iwd_module_desc __stop___iwd_module[];
+
+static struct iwd_module_desc *test_module(const char *name)
+{
+	struct iwd_module_desc *desc;
+
+	for (desc = __start___iwd_module; desc < __stop___iwd_module; desc++)
+		if (!strcmp(desc->name, name))
+			return desc;
+
+	return NULL;
+}
+
+/* Frees the cache after writing out any batched changes, like on exit */
+static void test_restart(void)
+{
+	test_module("eap_tls_common")->exit();
+	test_cache = NULL;
+}
+
+static void test_setup(void)
+{
+	test_timeouts = l_queue_new();
+	test_now = 1000 * L_USEC_PER_SEC;
+	test_syncs = 0;
+
+	eap_tls_set_session_cache_ops(test_load, test_sync);
+}
+
+static void test_teardown(void)
+{
+	test_restart();
+	eap_tls_set_session_cache_ops(NULL, NULL);
+
+	assert(l_queue_isempty(test_timeouts));
+	l_queue_destroy(test_timeouts, NULL);
+	test_timeouts = NULL;
+
+	l_free(test_stored);
+	test_stored = NULL;
+}
+
+/* Store or drop a session for @peer_id like l_tls would */
+static void test_store(const char *peer_id)
+{
+	assert(!__eap_tls_session_cache_lookup(peer_id));
+
+	l_settings_set_string(test_cache, peer_id, "SessionID", "00");
+	__eap_tls_session_cache_update(peer_id);
+}
+
+static void test_drop(const char *peer_id)
+{
+	l_settings_remove_group(test_cache, peer_id);
+	__eap_tls_session_cache_update(peer_id);
+}
+
+static char *test_peer(unsigned int i)
+{
+	return l_strdup_printf("peer%u", i);
+}
+
+/*
+ * Every group in the settings has to be in the index, and the other way
+ * around, both for the running cache and for what was written out.
+ */
+static void test_check_consistent(unsigned int n_peers)
+{
+	char **groups = l_settings_get_groups(test_cache);
+	unsigned int i;
+
+	for (i = 0; groups[i]; i++) {
+		assert(__eap_tls_session_cache_lookup(groups[i]));
+		assert(test_stored_has_peer(groups[i]));
+	}
+
+	assert(i == n_peers);
+	l_strfreev(groups);
+}
+
+static void test_store_sync(const void *data)
+{
+	test_setup();
+
+	test_store("peer");
+	assert(test_syncs == 1);
+	assert(test_stored_has_peer("peer"));
+	assert(l_queue_isempty(test_timeouts));
+
+	test_drop("peer");
+	assert(test_syncs == 2);
+	assert(!test_stored_has_peer("peer"));
+	assert(!__eap_tls_session_cache_lookup("peer"));
+
+	test_teardown();
+}
+
+static void test_lru_eviction(const void *data)
+{
+	unsigned int i;
+
+	test_setup();
+
+	for (i = 0; i < TEST_CACHE_MAX; i++) {
+		_auto_(l_free) char *peer_id = test_peer(i);
+
+		test_store(peer_id);
+		test_advance(1);
+	}
+
+	/* A cached session being used makes the peer the most recent one */
+	assert(__eap_tls_session_cache_lookup("peer0"));
+
+	test_store("new0");
+	assert(__eap_tls_session_cache_lookup("peer0"));
+	assert(!__eap_tls_session_cache_lookup("peer1"));
+	assert(!l_settings_has_group(test_cache, "peer1"));
+	assert(!test_stored_has_peer("peer1"));
+
+	test_store("new1");
+	assert(!__eap_tls_session_cache_lookup("peer2"));
+	assert(!l_settings_has_group(test_cache, "peer2"));
+
+	test_check_consistent(TEST_CACHE_MAX);
+
+	/* Peers not seen for the session lifetime go on the next update */
+	test_advance(TEST_LIFETIME);
+	test_store("new2");
+	test_check_consistent(1);
+
+	test_teardown();
+}
+
+static void test_index_consistency(const void *data)
+{
+	unsigned int i;
+
+	test_setup();
+
+	for (i = 0; i < 8; i++) {
+		_auto_(l_free) char *peer_id = test_peer(i);
+
+		test_store(peer_id);
+	}
+
+	test_drop("peer2");
+	eap_tls_forget_peer("peer5");
+	test_check_consistent(6);
+
+	/* And the index rebuilt from storage matches too */
+	test_restart();
+	assert(!__eap_tls_session_cache_lookup("peer2"));
+	assert(!__eap_tls_session_cache_lookup("peer5"));
+	test_check_consistent(6);
+
+	test_teardown();
+}
+
+static void test_debounce(const void *data)
+{
+	test_setup();
+
+	test_store("peer0");
+	test_store("peer1");
+	assert(test_syncs == 2);
+
+	/* Last use updates within the delay are written out together */
+	assert(__eap_tls_session_cache_lookup("peer0"));
+	assert(l_queue_length(test_timeouts) == 1);
+	test_advance(TEST_SYNC_DELAY - 1);
+
+	assert(__eap_tls_session_cache_lookup("peer1"));
+	assert(__eap_tls_session_cache_lookup("peer0"));
+	assert(l_queue_length(test_timeouts) == 1);
+	assert(test_syncs == 2);
+
+	/* Further updates don't push the write out */
+	test_advance(1);
+	assert(test_syncs == 3);
+	assert(l_queue_isempty(test_timeouts));
+
+	assert(__eap_tls_session_cache_lookup("peer1"));
+	test_advance(TEST_SYNC_DELAY);
+	assert(test_syncs == 4);
+
+	/* A pending batch is written out on exit */
+	assert(__eap_tls_session_cache_lookup("peer1"));
+	test_restart();
+	assert(test_syncs == 5);
+
+	test_teardown();
+}
+
+static void test_forget(const void *data)
+{
+	test_setup();
+
+	test_store("peer0");
+	test_store("peer1");
+	assert(__eap_tls_session_cache_lookup("peer1"));
+	assert(l_queue_length(test_timeouts) == 1);
+	assert(test_syncs == 2);
+
+	/* Forgetting a peer is written out right away, with the batch */
+	eap_tls_forget_peer("peer0");
+	assert(test_syncs == 3);
+	assert(l_queue_isempty(test_timeouts));
+	assert(!test_stored_has_peer("peer0"));
+	assert(test_stored_has_peer("peer1"));
+	assert(!__eap_tls_session_cache_lookup("peer0"));
+
+	/* Nothing to write for an unknown peer */
+	eap_tls_forget_peer("peer0");
+	assert(test_syncs == 3);
+
+	/* Even when the cache hasn't been loaded yet */
+	test_restart();
+	eap_tls_forget_peer("peer1");
+	assert(test_syncs == 4);
+	assert(!test_stored_has_peer("peer1"));
+
+	test_teardown();
+}
+
+static void test_last_used(const void *data)
+{
+	uint64_t now = time(NULL);
+	uint64_t last_used;
+
+	test_setup();
+
+	test_store("peer");
+	assert(l_settings_get_uint64(test_cache, "peer", "LastUsed",
+					&last_used));
+	assert(last_used >= now);
+	test_restart();
+
+	l_free(test_stored);
+	test_stored = l_strdup_printf(
+		"[old]\nSessionID=00\nLastUsed=%" PRIu64 "\n"
+		"[expired]\nSessionID=00\nLastUsed=%" PRIu64 "\n"
+		"[unknown]\nSessionID=00\n",
+		now - 3600, now - TEST_LIFETIME - 1);
+	test_syncs = 0;
+
+	/* Peers past the session lifetime are dropped when loading */
+	assert(!__eap_tls_session_cache_lookup("expired"));
+	assert(test_syncs == 1);
+	assert(!test_stored_has_peer("expired"));
+
+	/* The others only have the remaining lifetime left */
+	test_advance(TEST_LIFETIME - 3600 - TEST_SYNC_DELAY);
+	test_store("new");
+	assert(l_settings_has_group(test_cache, "old"));
+
+	test_advance(TEST_SYNC_DELAY);
+	test_drop("new");
+	assert(!l_settings_has_group(test_cache, "old"));
+	assert(!test_stored_has_peer("old"));
+
+	/* Peers stored without the last use count as just used */
+	assert(__eap_tls_session_cache_lookup("unknown"));
+
+	test_teardown();
+}
+
+static void test_last_used_order(const void *data)
+{
+	uint64_t now = time(NULL);
+	unsigned int i;
+
+	test_setup();
+
+	test_stored = l_strdup_printf(
+		"[old]\nSessionID=00\nLastUsed=%" PRIu64 "\n"
+		"[older]\nSessionID=00\nLastUsed=%" PRIu64 "\n"
+		"[unknown]\nSessionID=00\n",
+		now - 3600, now - 7200);
+
+	for (i = 0; i < TEST_CACHE_MAX - 3; i++) {
+		_auto_(l_free) char *peer_id = test_peer(i);
+
+		test_store(peer_id);
+	}
+
+	/* Peers loaded from storage are evicted in the order last used */
+	test_store("new0");
+	assert(!l_settings_has_group(test_cache, "older"));
+	assert(l_settings_has_group(test_cache, "old"));
+
+	test_store("new1");
+	assert(!l_settings_has_group(test_cache, "old"));
+	assert(l_settings_has_group(test_cache, "unknown"));
+
+	test_check_consistent(TEST_CACHE_MAX);
+
+	test_teardown();
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("/eap-tls-common/session-cache/store",
+			test_store_sync, NULL);
+	l_test_add("/eap-tls-common/session-cache/lru-eviction",
+			test_lru_eviction, NULL);
+	l_test_add("/eap-tls-common/session-cache/index",
+			test_index_consistency, NULL);
+	l_test_add("/eap-tls-common/session-cache/debounce",
+			test_debounce, NULL);
+	l_test_add("/eap-tls-common/session-cache/forget",
+			test_forget, NULL);
+	l_test_add("/eap-tls-common/session-cache/last-used",
+			test_last_used, NULL);
+	l_test_add("/eap-tls-common/session-cache/last-used-order",
+			test_last_used_order, NULL);
+
+	return l_test_run();
+}
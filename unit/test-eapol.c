@@ -26,6 +26,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 #include <assert.h>
 #include <linux/if_ether.h>
 #include <ell/ell.h>
@@ -36,6 +37,7 @@
 #include "src/ie.h"
 #include "src/eap.h"
 #include "src/eap-private.h"
+#include "src/eap-tls-common.h"
 #include "src/handshake.h"
 
 /* Our nonce to use + its size */
@@ -1822,6 +1824,116 @@ static void eapol_4way_test(const void *data)
 	l_free(ptk);
 }
 
+#define BENCH_HANDSHAKES	10000
+
+/*
+ * Run the MIC and key data work of BENCH_HANDSHAKES 4-Way Handshakes using
+ * the frames and PTK from eapol_4way_test, once with a checksum created per
+ * frame and a heap copy of the key data, and once with a checksum shared by
+ * all frames of a handshake and the key data unwrapped onto the stack.
+ * Only timings are reported so this runs only when IWD_EAPOL_BENCH is set.
+ */
+static void eapol_4way_bench_test(const void *data)
+{
+	uint8_t aa[] = { 0x24, 0xa2, 0xe1, 0xec, 0x17, 0x04 };
+	uint8_t spa[] = { 0xa0, 0xa8, 0xcd, 0x1c, 0x7e, 0xc9 };
+	const char *passphrase = "EasilyGuessedPassword";
+	const char *ssid = "TestWPA";
+	unsigned char psk[32];
+	uint8_t ptk[48];
+	uint8_t mic[16];
+	const struct eapol_key *expected_step2;
+	struct eapol_key *step2;
+	const struct eapol_key *step3;
+	const struct eapol_key *step4;
+	uint8_t key_data[sizeof(eapol_key_data_5)];
+	uint64_t start_time;
+	uint64_t oneshot_usec;
+	uint64_t reuse_usec;
+	unsigned int i;
+
+	expected_step2 = eapol_key_validate(eapol_key_data_4,
+					sizeof(eapol_key_data_4), 16);
+	assert(expected_step2);
+	step3 = eapol_key_validate(eapol_key_data_5,
+					sizeof(eapol_key_data_5), 16);
+	assert(step3);
+	step4 = eapol_key_validate(eapol_key_data_6,
+					sizeof(eapol_key_data_6), 16);
+	assert(step4);
+
+	assert(!crypto_psk_from_passphrase(passphrase, (uint8_t *) ssid,
+						strlen(ssid), psk));
+	assert(crypto_derive_pairwise_ptk(psk, sizeof(psk), aa, spa,
+					step3->key_nonce,
+					expected_step2->key_nonce, ptk,
+					sizeof(ptk), L_CHECKSUM_SHA1));
+
+	step2 = eapol_create_ptk_2_of_4(EAPOL_PROTOCOL_VERSION_2001,
+				EAPOL_KEY_DESCRIPTOR_VERSION_HMAC_SHA1_AES,
+				eapol_key_test_4.key_replay_counter,
+				expected_step2->key_nonce,
+				eapol_key_test_4.key_data_len,
+				eapol_key_data_4 + EAPOL_FRAME_LEN(16),
+				false, 16, false);
+	assert(step2);
+
+	start_time = l_time_now();
+
+	for (i = 0; i < BENCH_HANDSHAKES; i++) {
+		uint8_t *decrypted;
+		size_t decrypted_len;
+
+		assert(eapol_calculate_mic(IE_RSN_AKM_SUITE_PSK, ptk, step2,
+						mic, 16));
+		assert(!memcmp(mic, expected_step2->key_data, 16));
+
+		assert(eapol_verify_mic(IE_RSN_AKM_SUITE_PSK, ptk, step3, 16));
+		decrypted = eapol_decrypt_key_data(IE_RSN_AKM_SUITE_PSK,
+						ptk + 16, step3,
+						&decrypted_len, 16);
+		assert(decrypted && decrypted[0] == 48);
+		explicit_bzero(decrypted, decrypted_len);
+		l_free(decrypted);
+
+		assert(eapol_verify_mic(IE_RSN_AKM_SUITE_PSK, ptk, step4, 16));
+	}
+
+	oneshot_usec = l_time_diff(start_time, l_time_now());
+	start_time = l_time_now();
+
+	for (i = 0; i < BENCH_HANDSHAKES; i++) {
+		struct l_checksum *checksum;
+		ssize_t decrypted_len;
+
+		checksum = eapol_mic_checksum_new(IE_RSN_AKM_SUITE_PSK, ptk,
+				EAPOL_KEY_DESCRIPTOR_VERSION_HMAC_SHA1_AES, 16);
+		assert(checksum);
+
+		assert(eapol_calculate_mic_checksum(checksum, step2, mic, 16));
+		assert(!memcmp(mic, expected_step2->key_data, 16));
+
+		assert(eapol_verify_mic_checksum(checksum, step3, 16));
+		decrypted_len = eapol_decrypt_key_data_into(
+						IE_RSN_AKM_SUITE_PSK,
+						ptk + 16, step3, 16, key_data);
+		assert(decrypted_len > 0 && key_data[0] == 48);
+		explicit_bzero(key_data, decrypted_len);
+
+		assert(eapol_verify_mic_checksum(checksum, step4, 16));
+
+		l_checksum_free(checksum);
+	}
+
+	reuse_usec = l_time_diff(start_time, l_time_now());
+
+	printf("%u handshakes: %" PRIu64 " usec one-shot, "
+		"%" PRIu64 " usec reused context\n",
+		BENCH_HANDSHAKES, oneshot_usec, reuse_usec);
+
+	l_free(step2);
+}
+
 static void eapol_wpa2_handshake_test(const void *data)
 {
 	uint8_t anonce[32];
@@ -3189,6 +3301,62 @@ static void eapol_sm_test_eap_tls_embedded(const void *data)
 	l_settings_free(config);
 }
 
+static void eap_tls_cert_cache_overflow_test(const void *data)
+{
+	struct l_settings *settings = l_settings_new();
+	char dots[2 * 100 + 1] = "";
+	struct l_certchain *chain;
+	unsigned int hits, misses;
+	unsigned int start_hits, start_misses;
+	unsigned int i;
+
+	eap_tls_cert_cache_flush();
+	__eap_tls_cert_cache_get_stats(&start_hits, &start_misses);
+
+	/*
+	 * Every extra "./" makes for a different cache key for the same
+	 * file, go well past the cache size to make sure the loads keep
+	 * working and hitting the cache after it has been flushed.
+	 */
+	for (i = 0; i < 100; i++) {
+		_auto_(l_free) char *value = NULL;
+
+		strcat(dots, "./");
+		value = l_strdup_printf(CERTDIR "%scert-client.pem", dots);
+
+		chain = eap_tls_load_client_cert(settings, value, NULL, NULL);
+		assert(chain);
+		l_certchain_free(chain);
+
+		__eap_tls_cert_cache_get_stats(&hits, &misses);
+		assert(hits == start_hits + i);
+		assert(misses == start_misses + i + 1);
+
+		/* Now from the cache */
+		chain = eap_tls_load_client_cert(settings, value, NULL, NULL);
+		assert(chain);
+		assert(l_certchain_get_leaf(chain));
+		l_certchain_free(chain);
+
+		__eap_tls_cert_cache_get_stats(&hits, &misses);
+		assert(hits == start_hits + i + 1);
+		assert(misses == start_misses + i + 1);
+	}
+
+	/* The first file's entry was flushed along the way */
+	chain = eap_tls_load_client_cert(settings, CERTDIR "./cert-client.pem",
+						NULL, NULL);
+	assert(chain);
+	l_certchain_free(chain);
+
+	__eap_tls_cert_cache_get_stats(&hits, &misses);
+	assert(hits == start_hits + 100);
+	assert(misses == start_misses + 101);
+
+	eap_tls_cert_cache_flush();
+	l_settings_free(settings);
+}
+
 static void eapol_sm_test_eap_tls_subject_good(const void *data)
 {
 	static const char *config_8021x = "[Security]\n"
@@ -3991,6 +4159,10 @@ int main(int argc, char *argv[])
 	l_test_add("EAPoL/WPA2 4-Way Handshake",
 			&eapol_4way_test, NULL);
 
+	if (getenv("IWD_EAPOL_BENCH"))
+		l_test_add("EAPoL/WPA2 4-Way Handshake benchmark",
+				&eapol_4way_bench_test, NULL);
+
 	l_test_add("EAPoL/WPA2 4-Way & GTK Handshake",
 			&eapol_wpa2_handshake_test, NULL);
 
@@ -4033,6 +4205,8 @@ int main(int argc, char *argv[])
 				&eapol_sm_test_eap_tls_subject_bad, NULL);
 		l_test_add("EAPoL/8021x EAP-TLS embedded certs",
 				&eapol_sm_test_eap_tls_embedded, NULL);
+		l_test_add("EAP-TLS certificate cache overflow",
+				&eap_tls_cert_cache_overflow_test, NULL);
 	}
 
 	l_test_add("EAPoL/FT-Using-PSK 4-Way Handshake",
@@ -0,0 +1,393 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  iwd contributors. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <ell/ell.h>
+
+#include "src/module.h"
+#include "src/storage.h"
+#include "src/erp.h"
+
+/*
+ * The ERP key cache is persisted through the real storage.c functions
+ * into a temporary state directory, restarting it runs the module exit
+ * and init like a daemon restart would.  l_time_now and l_timeout are
+ * wrapped so that the tests control the key lifetime and the batched
+ * writes.
+ */
+
+#define TEST_SYNC_DELAY		10
+#define TEST_LIFETIME		(24 * 3600)
+
+struct test_timeout {
+	l_timeout_notify_cb_t callback;
+	void *user_data;
+	l_timeout_destroy_cb_t destroy;
+	uint64_t expiry;
+};
+
+static const uint8_t test_key[] = "system key";
+static const uint8_t test_other_key[] = "another system key";
+static const uint8_t test_session_id[] = {
+	0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+};
+
+static char test_dir[] = "/tmp/iwd-test-erp-XXXXXX";
+static unsigned int test_syncs;
+static struct l_queue *test_timeouts;
+static uint64_t test_now;
+
+uint64_t __wrap_l_time_now(void);
+struct l_timeout *__wrap_l_timeout_create(unsigned int seconds,
+					l_timeout_notify_cb_t callback,
+					void *user_data,
+					l_timeout_destroy_cb_t destroy);
+void __wrap_l_timeout_remove(struct l_timeout *timeout);
+
+uint64_t __wrap_l_time_now(void)
+{
+	return test_now;
+}
+
+struct l_timeout *__wrap_l_timeout_create(unsigned int seconds,
+					l_timeout_notify_cb_t callback,
+					void *user_data,
+					l_timeout_destroy_cb_t destroy)
+{
+	struct test_timeout *timeout = l_new(struct test_timeout, 1);
+
+	timeout->callback = callback;
+	timeout->user_data = user_data;
+	timeout->destroy = destroy;
+	timeout->expiry = test_now + seconds * L_USEC_PER_SEC;
+	l_queue_push_tail(test_timeouts, timeout);
+
+	return (struct l_timeout *) timeout;
+}
+
+void __wrap_l_timeout_remove(struct l_timeout *timeout)
+{
+	struct test_timeout *t = (struct test_timeout *) timeout;
+
+	if (!t)
+		return;
+
+	l_queue_remove(test_timeouts, t);
+
+	if (t->destroy)
+		t->destroy(t->user_data);
+
+	l_free(t);
+}
+
+static bool test_timeout_expired(const void *data, const void *user_data)
+{
+	const struct test_timeout *timeout = data;
+
+	return timeout->expiry && timeout->expiry <= test_now;
+}
+
+static void test_advance(unsigned int seconds)
+{
+	struct test_timeout *timeout;
+
+	test_now += seconds * L_USEC_PER_SEC;
+
+	while ((timeout = l_queue_find(test_timeouts, test_timeout_expired,
+					NULL))) {
+		timeout->expiry = 0;
+		timeout->callback((struct l_timeout *) timeout,
+					timeout->user_data);
+	}
+}
+
+static void test_sync(const struct l_settings *cache)
+{
+	test_syncs++;
+	storage_erp_cache_sync(cache);
+}
+
+extern struct iwd_module_desc __start___iwd_module[];
+extern struct iwd_module_desc __stop___iwd_module[];
+
+static struct iwd_module_desc *test_module(const char *name)
+{
+	struct iwd_module_desc *desc;
+
+	for (desc = __start___iwd_module; desc < __stop___iwd_module; desc++)
+		if (!strcmp(desc->name, name))
+			return desc;
+
+	return NULL;
+}
+
+static void test_restart(void)
+{
+	test_module("erp")->exit();
+	assert(test_module("erp")->init() == 0);
+}
+
+static void test_setup(void)
+{
+	assert(mkdtemp(test_dir));
+	assert(!setenv("STATE_DIRECTORY", test_dir, 1));
+	assert(storage_create_dirs());
+	assert(storage_init(test_key, sizeof(test_key)));
+
+	test_timeouts = l_queue_new();
+	test_now = 5000 * L_USEC_PER_SEC;
+	test_syncs = 0;
+
+	erp_set_cache_ops(storage_erp_cache_load, test_sync);
+	assert(test_module("erp")->init() == 0);
+}
+
+static void test_teardown(void)
+{
+	_auto_(l_free) char *path = storage_get_path(".erp-cache");
+	_auto_(l_free) char *hotspot = storage_get_hotspot_path(NULL);
+	_auto_(l_free) char *ap = storage_get_path("ap");
+
+	test_module("erp")->exit();
+	erp_set_cache_ops(NULL, NULL);
+
+	assert(l_queue_isempty(test_timeouts));
+	l_queue_destroy(test_timeouts, NULL);
+	test_timeouts = NULL;
+
+	storage_exit();
+	unlink(path);
+	rmdir(hotspot);
+	rmdir(ap);
+	rmdir(test_dir);
+	storage_cleanup_dirs();
+
+	memcpy(test_dir + strlen(test_dir) - 6, "XXXXXX", 6);
+}
+
+static void test_emsk(uint8_t *emsk, uint8_t seed)
+{
+	unsigned int i;
+
+	for (i = 0; i < 64; i++)
+		emsk[i] = seed + i;
+}
+
+static void test_add(const char *id, const char *ssid, uint8_t seed)
+{
+	uint8_t emsk[64];
+
+	test_emsk(emsk, seed);
+	erp_cache_add(id, test_session_id, sizeof(test_session_id),
+			emsk, sizeof(emsk), (const uint8_t *) ssid,
+			strlen(ssid));
+}
+
+static bool test_cached(const char *id, const char *ssid)
+{
+	struct erp_cache_entry *cache = erp_cache_get(id, ssid);
+
+	if (!cache)
+		return false;
+
+	assert(!strcmp(erp_cache_entry_get_identity(cache), id));
+	erp_cache_put(cache);
+
+	return true;
+}
+
+static char *test_group(const char *id, const char *ssid)
+{
+	_auto_(l_free) char *id_hex = l_util_hexstring(id, strlen(id));
+	_auto_(l_free) char *ssid_hex = l_util_hexstring(ssid, strlen(ssid));
+
+	return l_strdup_printf("%s:%s", ssid_hex, id_hex);
+}
+
+static void test_key_by_identity(const void *data)
+{
+	test_setup();
+
+	test_add("alice@example.com", "Enterprise", 0);
+	test_add("bob@example.com", "Enterprise", 0x40);
+
+	assert(test_cached("alice@example.com", "Enterprise"));
+	assert(test_cached("bob@example.com", "Enterprise"));
+	assert(!test_cached("carol@example.com", "Enterprise"));
+	assert(!test_cached("alice@example.com", "Other"));
+
+	/* A new key for the same identity and SSID replaces the old one */
+	test_add("alice@example.com", "Enterprise", 0x80);
+	test_restart();
+
+	assert(test_cached("alice@example.com", "Enterprise"));
+	assert(test_cached("bob@example.com", "Enterprise"));
+
+	test_teardown();
+}
+
+static void test_debounce(const void *data)
+{
+	test_setup();
+
+	test_add("alice@example.com", "Enterprise", 0);
+	test_add("bob@example.com", "Enterprise", 0);
+	assert(test_syncs == 0);
+	assert(l_queue_length(test_timeouts) == 1);
+
+	test_advance(TEST_SYNC_DELAY);
+	assert(test_syncs == 1);
+	assert(l_queue_isempty(test_timeouts));
+
+	test_add("alice@example.com", "Other", 0);
+	test_advance(TEST_SYNC_DELAY - 1);
+	test_add("bob@example.com", "Other", 0);
+	assert(test_syncs == 1);
+
+	/* Further changes don't push the write out */
+	test_advance(1);
+	assert(test_syncs == 2);
+
+	/* A pending batch is written out on exit */
+	test_add("carol@example.com", "Other", 0);
+	test_restart();
+	assert(test_syncs == 3);
+	assert(test_cached("carol@example.com", "Other"));
+
+	test_teardown();
+}
+
+static void test_round_trip(const void *data)
+{
+	_auto_(l_free) char *group = test_group("alice@example.com",
+						"Enterprise");
+	_auto_(l_free) char *path = NULL;
+	_auto_(l_free) char *contents = NULL;
+	_auto_(l_free) char *emsk_hex = NULL;
+	_auto_(l_free) uint8_t *emsk = NULL;
+	_auto_(l_free) uint8_t *session_id = NULL;
+	struct l_settings *cache;
+	uint8_t expected[64];
+	size_t len;
+
+	test_setup();
+
+	test_add("alice@example.com", "Enterprise", 0);
+	test_restart();
+
+	/* Neither the EMSK nor the identity are stored in the clear */
+	test_emsk(expected, 0);
+	emsk_hex = l_util_hexstring(expected, sizeof(expected));
+	path = storage_get_path(".erp-cache");
+	contents = l_file_get_contents(path, &len);
+	assert(contents);
+	contents = l_realloc(contents, len + 1);
+	contents[len] = '\0';
+	assert(!strstr(contents, emsk_hex));
+	assert(!strstr(contents, group));
+
+	cache = storage_erp_cache_load();
+	assert(cache);
+	emsk = l_settings_get_bytes(cache, group, "EMSK", &len);
+	assert(emsk && len == sizeof(expected));
+	assert(!memcmp(emsk, expected, len));
+	session_id = l_settings_get_bytes(cache, group, "SessionId", &len);
+	assert(session_id && len == sizeof(test_session_id));
+	assert(!memcmp(session_id, test_session_id, len));
+	l_settings_free(cache);
+
+	assert(test_cached("alice@example.com", "Enterprise"));
+
+	test_teardown();
+}
+
+static void test_expiry_restart(const void *data)
+{
+	test_setup();
+
+	test_add("alice@example.com", "Enterprise", 0);
+	test_advance(TEST_SYNC_DELAY);
+	assert(test_syncs == 1);
+
+	/*
+	 * The monotonic clock starts over after a reboot, the remaining
+	 * lifetime is carried over through the stored wall clock expiry.
+	 */
+	test_module("erp")->exit();
+	test_now = 10 * L_USEC_PER_SEC;
+	assert(test_module("erp")->init() == 0);
+
+	/* The cache is loaded on first use */
+	assert(!test_cached("bob@example.com", "Enterprise"));
+
+	test_advance(TEST_LIFETIME - TEST_SYNC_DELAY - 60);
+	assert(test_cached("alice@example.com", "Enterprise"));
+
+	test_advance(120);
+	assert(!test_cached("alice@example.com", "Enterprise"));
+
+	/* And expired keys are not written back */
+	test_add("bob@example.com", "Enterprise", 0);
+	test_restart();
+	assert(!test_cached("alice@example.com", "Enterprise"));
+	assert(test_cached("bob@example.com", "Enterprise"));
+
+	test_teardown();
+}
+
+static void test_wrong_key(const void *data)
+{
+	test_setup();
+
+	test_add("alice@example.com", "Enterprise", 0);
+	test_module("erp")->exit();
+
+	/* A cache written with a different system key is ignored */
+	storage_exit();
+	assert(storage_init(test_other_key, sizeof(test_other_key)));
+	assert(!storage_erp_cache_load());
+
+	assert(test_module("erp")->init() == 0);
+	assert(!test_cached("alice@example.com", "Enterprise"));
+
+	test_teardown();
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("/erp/cache/key", test_key_by_identity, NULL);
+	l_test_add("/erp/cache/debounce", test_debounce, NULL);
+	l_test_add("/erp/cache/round-trip", test_round_trip, NULL);
+	l_test_add("/erp/cache/expiry-restart", test_expiry_restart, NULL);
+	l_test_add("/erp/cache/wrong-key", test_wrong_key, NULL);
+
+	return l_test_run();
+}
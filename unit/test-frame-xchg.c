@@ -0,0 +1,394 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  iwd contributors. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/uio.h>
+#include <ell/ell.h>
+
+#include "linux/nl80211.h"
+#include "src/module.h"
+#include "src/mpdu.h"
+#include "src/netdev.h"
+#include "src/wiphy.h"
+#include "src/frame-xchg.h"
+#include "unit/fake-genl.h"
+
+/*
+ * frame-xchg is tested on the radio work queue of a wiphy that was never
+ * populated from the kernel, with the nl80211 commands it sends captured
+ * by unit/fake-genl.c instead of going to the kernel.  The TX status and
+ * RX frame events are fed to the handlers it registers.
+ */
+
+#define TEST_WDEV_ID	1
+#define TEST_FREQ	2437
+#define TEST_FRAME_LEN	29
+
+static struct wiphy *test_wiphy;
+
+static const uint8_t own_addr[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+static const uint8_t peer1[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 };
+static const uint8_t peer2[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x03 };
+static const uint8_t peer3[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x04 };
+
+/* Public Action, Vendor Specific */
+static const uint8_t action_prefix[] = { 0x04, 0x09 };
+
+static struct frame_xchg_prefix resp_prefix = {
+	.frame_type = 0x00d0,
+	.data = action_prefix,
+	.len = sizeof(action_prefix),
+};
+
+struct netdev *netdev_find(int ifindex)
+{
+	return NULL;
+}
+
+const uint8_t *netdev_get_address(struct netdev *netdev)
+{
+	return NULL;
+}
+
+extern struct iwd_module_desc __start___iwd_module[];
+extern struct iwd_module_desc __stop___iwd_module[];
+
+static struct iwd_module_desc *test_module(const char *name)
+{
+	struct iwd_module_desc *desc;
+
+	for (desc = __start___iwd_module; desc < __stop___iwd_module; desc++)
+		if (!strcmp(desc->name, name))
+			return desc;
+
+	return NULL;
+}
+
+static void test_setup(void)
+{
+	fake_genl_init();
+
+	assert(test_module("wiphy")->init() == 0);
+	test_wiphy = wiphy_create(0, "phy0");
+	assert(test_wiphy);
+
+	assert(test_module("frame_xchg")->init() == 0);
+}
+
+static void test_teardown(void)
+{
+	test_module("frame_xchg")->exit();
+
+	/* Like a wiphy going away with work still queued */
+	assert(wiphy_destroy(test_wiphy));
+	test_module("wiphy")->exit();
+
+	fake_genl_exit();
+}
+
+static void test_build_frame(uint8_t *buf, const uint8_t *da,
+				const uint8_t *sa)
+{
+	memset(buf, 0, 24);
+	buf[0] = 0xd0;
+	memcpy(buf + 4, da, 6);
+	memcpy(buf + 10, sa, 6);
+	memcpy(buf + 16, da, 6);
+	buf[24] = 0x04;
+	buf[25] = 0x09;
+	buf[26] = 0x50;
+	buf[27] = 0x6f;
+	buf[28] = 0x9a;
+}
+
+struct test_xchg {
+	uint32_t id;
+	bool done;
+	int err;
+	bool destroyed;
+	bool resp_done;
+};
+
+static void test_xchg_cb(int err, void *user_data)
+{
+	struct test_xchg *xchg = user_data;
+
+	assert(!xchg->done);
+	xchg->done = true;
+	xchg->err = err;
+}
+
+static void test_xchg_destroy(void *user_data)
+{
+	struct test_xchg *xchg = user_data;
+
+	xchg->destroyed = true;
+}
+
+static bool test_xchg_resp_cb(const struct mmpdu_header *mpdu,
+				const void *body, size_t body_len,
+				int rssi, void *user_data)
+{
+	struct test_xchg *xchg = user_data;
+
+	xchg->resp_done = true;
+	return true;
+}
+
+static void test_xchg_start(struct test_xchg *xchg, const uint8_t *peer,
+				unsigned int retry_interval,
+				unsigned int resp_timeout)
+{
+	uint8_t frame[TEST_FRAME_LEN];
+	struct iovec iov[2];
+
+	test_build_frame(frame, peer, own_addr);
+	iov[0].iov_base = frame;
+	iov[0].iov_len = sizeof(frame);
+	iov[1].iov_base = NULL;
+
+	memset(xchg, 0, sizeof(*xchg));
+	xchg->id = frame_xchg_start(TEST_WDEV_ID, iov, TEST_FREQ,
+					retry_interval, resp_timeout, 0, 0,
+					test_xchg_cb, xchg, test_xchg_destroy,
+					&resp_prefix, test_xchg_resp_cb, NULL);
+	assert(xchg->id);
+}
+
+static struct fake_genl_cmd *test_sent_frame(unsigned int n)
+{
+	return fake_genl_get(NL80211_CMD_FRAME, n);
+}
+
+static const uint8_t *test_sent_peer(const struct fake_genl_cmd *cmd)
+{
+	struct l_genl_attr attr;
+	uint16_t type, len;
+	const void *data;
+
+	assert(l_genl_attr_init(&attr, cmd->msg));
+
+	while (l_genl_attr_next(&attr, &type, &len, &data))
+		if (type == NL80211_ATTR_FRAME)
+			return ((const struct mmpdu_header *) data)->address_1;
+
+	assert(false);
+	return NULL;
+}
+
+static uint32_t test_sent_duration(const struct fake_genl_cmd *cmd)
+{
+	struct l_genl_attr attr;
+	uint16_t type, len;
+	const void *data;
+
+	assert(l_genl_attr_init(&attr, cmd->msg));
+
+	while (l_genl_attr_next(&attr, &type, &len, &data))
+		if (type == NL80211_ATTR_DURATION)
+			return l_get_u32(data);
+
+	return 0;
+}
+
+/* The kernel's reply to NL80211_CMD_FRAME carrying the frame's cookie */
+static void test_frame_sent(struct fake_genl_cmd *cmd, uint64_t cookie)
+{
+	struct l_genl_msg *msg = l_genl_msg_new(NL80211_CMD_FRAME);
+
+	l_genl_msg_append_attr(msg, NL80211_ATTR_COOKIE, 8, &cookie);
+	fake_genl_reply(cmd, msg);
+	l_genl_msg_unref(msg);
+}
+
+static void test_tx_status(uint64_t cookie, bool ack)
+{
+	struct l_genl_msg *msg = l_genl_msg_new(NL80211_CMD_FRAME_TX_STATUS);
+	uint64_t wdev_id = TEST_WDEV_ID;
+
+	l_genl_msg_append_attr(msg, NL80211_ATTR_WDEV, 8, &wdev_id);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_COOKIE, 8, &cookie);
+
+	if (ack)
+		l_genl_msg_append_attr(msg, NL80211_ATTR_ACK, 0, NULL);
+
+	fake_genl_notify("mlme", msg);
+	l_genl_msg_unref(msg);
+}
+
+static void test_rx_frame(const uint8_t *peer)
+{
+	struct l_genl_msg *msg = l_genl_msg_new(NL80211_CMD_FRAME);
+	uint64_t wdev_id = TEST_WDEV_ID;
+	uint8_t frame[TEST_FRAME_LEN];
+
+	test_build_frame(frame, own_addr, peer);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_WDEV, 8, &wdev_id);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_FRAME, sizeof(frame), frame);
+	fake_genl_unicast(msg);
+	l_genl_msg_unref(msg);
+}
+
+static void test_pipeline_done(const void *data)
+{
+	struct test_xchg a;
+	struct test_xchg b;
+
+	test_setup();
+
+	test_xchg_start(&a, peer1, 0, 300);
+	test_xchg_start(&b, peer2, 0, 100);
+	assert(fake_genl_count(NL80211_CMD_FRAME) == 1);
+	assert(test_sent_duration(test_sent_frame(0)) == 300);
+
+	/* Once A's frame is out, B is started on A's channel time */
+	test_frame_sent(test_sent_frame(0), 1);
+	assert(fake_genl_count(NL80211_CMD_FRAME) == 2);
+	assert(!memcmp(test_sent_peer(test_sent_frame(1)), peer2, 6));
+	assert(test_sent_duration(test_sent_frame(1)) == 0);
+
+	test_frame_sent(test_sent_frame(1), 2);
+	test_tx_status(2, true);
+	test_tx_status(1, true);
+
+	test_rx_frame(peer1);
+	assert(a.resp_done && !b.resp_done);
+
+	/* A holds on to the radio until B is done too */
+	assert(wiphy_radio_work_is_running(test_wiphy, a.id) == 1);
+	assert(!a.destroyed);
+
+	test_rx_frame(peer2);
+	assert(b.resp_done && b.destroyed);
+
+	/* ...and only releases it once out of B's destroy callback */
+	assert(wiphy_radio_work_is_running(test_wiphy, a.id) == 1);
+	l_main_iterate(0);
+	assert(a.destroyed);
+	assert(wiphy_radio_work_is_running(test_wiphy, a.id) == -ENOENT);
+	assert(wiphy_radio_work_is_running(test_wiphy, b.id) == -ENOENT);
+
+	test_teardown();
+}
+
+static void test_pipeline_cancel(const void *data)
+{
+	struct test_xchg a;
+	struct test_xchg b;
+	struct fake_genl_cmd *cmd;
+
+	test_setup();
+
+	test_xchg_start(&a, peer1, 0, 300);
+	test_xchg_start(&b, peer2, 0, 100);
+	test_frame_sent(test_sent_frame(0), 1);
+	assert(fake_genl_count(NL80211_CMD_FRAME) == 2);
+
+	/*
+	 * B can't keep using the channel once A's radio work is gone, it's
+	 * stopped and restarted when its own work item runs.
+	 */
+	frame_xchg_cancel(a.id);
+	assert(a.destroyed && !a.done);
+	assert(test_sent_frame(1)->cancelled);
+	assert(wiphy_radio_work_is_running(test_wiphy, b.id) == 1);
+	assert(fake_genl_count(NL80211_CMD_FRAME) == 3);
+
+	cmd = test_sent_frame(2);
+	assert(!memcmp(test_sent_peer(cmd), peer2, 6));
+	assert(test_sent_duration(cmd) == 100);
+
+	test_frame_sent(cmd, 2);
+	test_tx_status(2, true);
+	test_rx_frame(peer2);
+	assert(b.resp_done && b.destroyed);
+	assert(wiphy_radio_work_is_running(test_wiphy, a.id) == -ENOENT);
+	assert(wiphy_radio_work_is_running(test_wiphy, b.id) == -ENOENT);
+
+	test_teardown();
+}
+
+static void test_pipeline_tx_status(const void *data)
+{
+	struct test_xchg a;
+	struct test_xchg b;
+	struct test_xchg c;
+
+	test_setup();
+
+	test_xchg_start(&a, peer1, 0, 300);
+	test_xchg_start(&b, peer2, 100, 100);
+	test_xchg_start(&c, peer3, 0, 0);
+
+	test_frame_sent(test_sent_frame(0), 1);
+	test_frame_sent(test_sent_frame(1), 2);
+	assert(fake_genl_count(NL80211_CMD_FRAME) == 3);
+
+	/* B wasn't ACKed and is now waiting to retry without a cookie */
+	test_tx_status(2, false);
+	assert(!b.done);
+
+	/*
+	 * C's TX status arrives before its cookie, like on brcmfmac, and
+	 * must not be taken for B's.
+	 */
+	test_tx_status(3, true);
+	test_frame_sent(test_sent_frame(2), 3);
+	assert(c.done && !c.err);
+	assert(!b.done);
+
+	frame_xchg_cancel(b.id);
+	frame_xchg_cancel(a.id);
+	assert(a.destroyed && b.destroyed && c.destroyed);
+	assert(wiphy_radio_work_is_running(test_wiphy, a.id) == -ENOENT);
+	assert(wiphy_radio_work_is_running(test_wiphy, b.id) == -ENOENT);
+	assert(wiphy_radio_work_is_running(test_wiphy, c.id) == -ENOENT);
+
+	test_teardown();
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	l_test_init(&argc, &argv);
+
+	if (!l_main_init())
+		return -1;
+
+	l_test_add("/frame-xchg/pipeline/done", test_pipeline_done, NULL);
+	l_test_add("/frame-xchg/pipeline/cancel", test_pipeline_cancel, NULL);
+	l_test_add("/frame-xchg/pipeline/tx-status",
+			test_pipeline_tx_status, NULL);
+
+	ret = l_test_run();
+
+	l_main_exit();
+
+	return ret;
+}
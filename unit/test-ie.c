@@ -311,6 +311,102 @@ static void ie_test_writer_extended(const void *data)
 	assert(!memcmp(builder.buf, expected, builder_len));
 }
 
+static void ie_test_index(const void *data)
+{
+	struct ie_index index;
+	const struct ie_index_entry *entry;
+	static const uint8_t test_buf[] = {
+		0x00, 0x03, 'i', 'w', 'd',			/* SSID */
+		0xdd, 0x05, 0x00, 0x50, 0xf2, 0x04, 0x10,	/* WSC */
+		0x30, 0x02, 0x01, 0x00,				/* RSN */
+		0xff, 0x02, 0x0a, 0xaa,			/* Extended Request */
+		0xdd, 0x04, 0x50, 0x6f, 0x9a, 0x09,		/* P2P */
+		0x30, 0x00,					/* RSN */
+		0xdd, 0x03, 0x00, 0x50, 0xf2,			/* Short */
+		0x2d, 0x1a, 0x00,				/* Truncated */
+	};
+	static const uint8_t wfd_oui[] = { 0x50, 0x6f, 0x9a };
+
+	ie_index_init(&index, test_buf, L_ARRAY_SIZE(test_buf));
+
+	/* The truncated tail isn't indexed, same as with ie_tlv_iter */
+	assert(index.n_entries == 7);
+	assert(!ie_index_find(&index, IE_TYPE_HT_CAPABILITIES));
+
+	assert(index.entries[0].tag == IE_TYPE_SSID);
+	assert(index.entries[0].len == 3);
+	assert(index.entries[0].data == test_buf + 2);
+
+	entry = ie_index_find(&index, IE_TYPE_RSN);
+	assert(entry == &index.entries[2]);
+	entry = ie_index_next(&index, entry);
+	assert(entry == &index.entries[5]);
+	assert(entry->len == 0);
+	assert(!ie_index_next(&index, entry));
+
+	entry = ie_index_find(&index, IE_TYPE_EXTENDED_REQUEST);
+	assert(entry && entry->len == 1 && entry->data == test_buf + 19);
+	assert(!ie_index_next(&index, entry));
+
+	entry = ie_index_find_vendor(&index, microsoft_oui, 0x04);
+	assert(entry == &index.entries[1]);
+	entry = ie_index_find_vendor(&index, wifi_alliance_oui, 0x09);
+	assert(entry == &index.entries[4]);
+	assert(!ie_index_find_vendor(&index, wfd_oui, 0x0a));
+
+	assert(!ie_index_find(&index, IE_INDEX_MAX_TAG));
+
+	ie_index_free(&index);
+}
+
+static void ie_test_index_large(const void *data)
+{
+	struct ie_index index;
+	struct ie_tlv_iter iter;
+	uint8_t buf[1024];
+	unsigned int count = 0;
+	unsigned int i;
+	size_t len = 0;
+
+	/* Enough elements to spill out of the inline entries */
+	while (len + 4 <= sizeof(buf)) {
+		buf[len++] = count % 7 == 6 ? IE_TYPE_EXTENSION : count % 5;
+		buf[len++] = 2;
+		buf[len++] = count;
+		buf[len++] = count >> 8;
+		count++;
+	}
+
+	ie_index_init(&index, buf, len);
+	assert(index.n_entries == count);
+	assert(index.n_entries > IE_INDEX_INLINE_ENTRIES);
+
+	ie_tlv_iter_init(&iter, buf, len);
+
+	for (i = 0; ie_tlv_iter_next(&iter); i++) {
+		const struct ie_index_entry *entry = &index.entries[i];
+		const struct ie_index_entry *next;
+		unsigned int j;
+
+		assert(entry->tag == ie_tlv_iter_get_tag(&iter));
+		assert(entry->len == ie_tlv_iter_get_length(&iter));
+		assert(entry->data == ie_tlv_iter_get_data(&iter));
+
+		/* The chain must point at the next element with this tag */
+		for (j = i + 1; j < count; j++)
+			if (index.entries[j].tag == entry->tag)
+				break;
+
+		next = ie_index_next(&index, entry);
+		assert(j == count ? !next : next == &index.entries[j]);
+	}
+
+	assert(i == count);
+
+	ie_index_free(&index);
+}
+
+
 struct ie_rsne_info_test {
 	const unsigned char *data;
 	size_t data_len;
@@ -665,6 +761,72 @@ static void ie_test_concat_wsc(const void *data)
 	l_free(res);
 }
 
+static void ie_test_concat_vendor_wsc(const void *data)
+{
+	const struct ie_tlv_concat_test *test = data;
+	struct ie_vendor_payloads vendor;
+	uint8_t scratch[test->len];
+
+	assert(ie_tlv_extract_vendor_payloads(test->ies, test->len, scratch,
+						test->len, &vendor) == 0);
+
+	assert(vendor.wsc_len == test->expected_len);
+
+	if (vendor.wsc_len > 0)
+		assert(!memcmp(vendor.wsc, test->expected_data,
+				vendor.wsc_len));
+	else
+		assert(vendor.wsc == NULL);
+
+	assert(!vendor.p2p && vendor.p2p_len == -ENOENT);
+	assert(!vendor.wfd && vendor.wfd_len == -ENOENT);
+}
+
+static void ie_test_concat_vendor_mixed(const void *data)
+{
+	static const uint8_t ies[] = {
+		0xdd, 0x06, 0x50, 0x6f, 0x9a, 0x09, 0x02, 0x03,	/* P2P */
+		0xdd, 0x05, 0x00, 0x50, 0xf2, 0x04, 0x10,	/* WSC */
+		0xdd, 0x05, 0x50, 0x6f, 0x9a, 0x10, 0x00,	/* HS2.0 */
+		0xdd, 0x04, 0x50, 0x6f, 0x9a, 0x0a,		/* WFD */
+		0xdd, 0x05, 0x50, 0x6f, 0x9a, 0x09, 0x04,	/* P2P */
+		0xdd, 0x04, 0x50, 0x6f, 0x9a, 0x1e,		/* DPP */
+		0x00, 0x01, 'a',				/* SSID */
+		0xdd, 0x0c, 0x50, 0x6f, 0x9a, 0x1c, 0x02, 0x00,	/* OWE */
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0xdd, 0x06, 0x00, 0x50, 0xf2, 0x04, 0x4a, 0x00,	/* WSC */
+		0xdd, 0x05, 0x50, 0x6f, 0x9a, 0x10, 0x10,	/* HS2.0 */
+	};
+	struct ie_vendor_payloads vendor;
+	uint8_t scratch[sizeof(ies)];
+	uint8_t *legacy;
+	ssize_t legacy_len;
+
+	assert(ie_tlv_extract_vendor_payloads(ies, sizeof(ies), scratch, 3,
+						&vendor) == -EMSGSIZE);
+	assert(ie_tlv_extract_vendor_payloads(ies, sizeof(ies), scratch,
+						sizeof(ies), &vendor) == 0);
+
+	legacy = ie_tlv_extract_wsc_payload(ies, sizeof(ies), &legacy_len);
+	assert(legacy && vendor.wsc_len == legacy_len && legacy_len == 3);
+	assert(!memcmp(vendor.wsc, legacy, legacy_len));
+	l_free(legacy);
+
+	legacy = ie_tlv_extract_p2p_payload(ies, sizeof(ies), &legacy_len);
+	assert(legacy && vendor.p2p_len == legacy_len && legacy_len == 3);
+	assert(!memcmp(vendor.p2p, legacy, legacy_len));
+	l_free(legacy);
+
+	/* Present but empty, ie_tlv_extract_wfd_payload returns 0 too */
+	legacy = ie_tlv_extract_wfd_payload(ies, sizeof(ies), &legacy_len);
+	assert(!legacy && legacy_len == 0);
+	assert(!vendor.wfd && vendor.wfd_len == 0);
+
+	assert(vendor.hs20_indication == ies + 15);
+	assert(vendor.dpp_configurator_connectivity == ies + 35);
+	assert(vendor.owe_transition == ies + 44);
+}
+
 static void ie_test_encapsulate_wsc(const void *data)
 {
 	const struct ie_tlv_concat_test *test = data;
@@ -708,6 +870,9 @@ int main(int argc, char *argv[])
 	l_test_add("/ie/reader/extended", ie_test_reader_extended, NULL);
 	l_test_add("/ie/writer/extended", ie_test_writer_extended, NULL);
 
+	l_test_add("/ie/index/basic", ie_test_index, NULL);
+	l_test_add("/ie/index/large", ie_test_index_large, NULL);
+
 	l_test_add("/ie/RSN Info Parser/Test Case 1",
 				ie_test_rsne_info, &ie_rsne_info_test_1);
 	l_test_add("/ie/RSN Info Parser/Test Case 2",
@@ -751,6 +916,18 @@ int main(int argc, char *argv[])
 	l_test_add("/ie/Concatenation/WSC/Test Case 3",
 				ie_test_concat_wsc, &ie_tlv_concat_test_data_3);
 
+	l_test_add("/ie/Concatenation/Vendor/Test Case 1",
+				ie_test_concat_vendor_wsc,
+				&ie_tlv_concat_test_data_1);
+	l_test_add("/ie/Concatenation/Vendor/Test Case 2",
+				ie_test_concat_vendor_wsc,
+				&ie_tlv_concat_test_data_2);
+	l_test_add("/ie/Concatenation/Vendor/Test Case 3",
+				ie_test_concat_vendor_wsc,
+				&ie_tlv_concat_test_data_3);
+	l_test_add("/ie/Concatenation/Vendor/Mixed",
+				ie_test_concat_vendor_mixed, NULL);
+
 	l_test_add("/ie/Encapsulation/WSC/Test Case 1",
 				ie_test_encapsulate_wsc,
 				&ie_tlv_concat_test_data_1);
@@ -0,0 +1,197 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  iwd contributors. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <ell/ell.h>
+
+#include "src/lease-db.h"
+
+#define POOL_START	0x0a000001	/* 10.0.0.1 */
+#define POOL_END	0x0a00fffe	/* 10.0.255.254 */
+#define MANY_CLIENTS	4096
+
+static char *lease_db_tmp_path(void)
+{
+	char *path = l_strdup("/tmp/iwd-test-lease-db-XXXXXX");
+	int fd = mkstemp(path);
+
+	assert(fd >= 0);
+	close(fd);
+
+	return path;
+}
+
+static void client_mac(unsigned int n, uint8_t *mac)
+{
+	mac[0] = 0x02;
+	mac[1] = 0x00;
+	mac[2] = n >> 24;
+	mac[3] = n >> 16;
+	mac[4] = n >> 8;
+	mac[5] = n;
+}
+
+static void test_basic(const void *data)
+{
+	static const uint8_t mac1[6] = { 0x02, 0, 0, 0, 0, 1 };
+	static const uint8_t mac2[6] = { 0x02, 0, 0, 0, 0, 2 };
+	struct lease_db *db = lease_db_new(0xc0a80102, 0xc0a80104);
+	const struct lease_db_entry *entry;
+
+	assert(db);
+	assert(!lease_db_lookup(db, mac1));
+
+	assert(lease_db_set(db, mac1, 0xc0a80102, 100));
+	/* Outside of the pool */
+	assert(!lease_db_set(db, mac2, 0xc0a80105, 100));
+
+	assert(lease_db_set(db, mac2, 0xc0a80104, 100));
+	assert(lease_db_count(db) == 2);
+
+	/* Moving a client to a new address */
+	assert(lease_db_set(db, mac1, 0xc0a80103, 200));
+	entry = lease_db_lookup(db, mac1);
+	assert(entry && entry->addr == 0xc0a80103 && entry->expiry == 200);
+
+	/* mac1's old address is free and can go to mac2 */
+	assert(lease_db_set(db, mac2, 0xc0a80102, 100));
+	assert(lease_db_count(db) == 2);
+
+	/* An address given to another client drops the stale lease */
+	assert(lease_db_set(db, mac2, 0xc0a80103, 300));
+	assert(!lease_db_lookup(db, mac1));
+	entry = lease_db_lookup(db, mac2);
+	assert(entry && entry->addr == 0xc0a80103 && entry->expiry == 300);
+	assert(lease_db_count(db) == 1);
+
+	assert(lease_db_set(db, mac1, 0xc0a80102, 100));
+	assert(lease_db_remove(db, mac1));
+	assert(!lease_db_remove(db, mac1));
+	assert(lease_db_count(db) == 1);
+
+	lease_db_free(db);
+}
+
+static void test_persist(const void *data)
+{
+	static const uint8_t mac1[6] = { 0x02, 0, 0, 0, 0, 1 };
+	static const uint8_t mac2[6] = { 0x02, 0, 0, 0, 0, 2 };
+	static const uint8_t mac3[6] = { 0x02, 0, 0, 0, 0, 3 };
+	_auto_(l_free) char *path = lease_db_tmp_path();
+	struct lease_db *db = lease_db_new(0xc0a80102, 0xc0a801fe);
+	const struct lease_db_entry *entry;
+
+	assert(lease_db_open(db, path, 1000) == 0);
+	assert(lease_db_count(db) == 0);
+
+	assert(lease_db_set(db, mac1, 0xc0a80110, 5000));
+	assert(lease_db_set(db, mac2, 0xc0a80111, 1500));
+	assert(lease_db_set(db, mac3, 0xc0a80112, 5000));
+	assert(lease_db_remove(db, mac3));
+	assert(lease_db_set(db, mac1, 0xc0a80120, 6000));
+	lease_db_free(db);
+
+	/* mac2's lease expires before the reopen, mac3 was released */
+	db = lease_db_new(0xc0a80102, 0xc0a801fe);
+	assert(lease_db_open(db, path, 2000) == 0);
+	assert(lease_db_count(db) == 1);
+
+	entry = lease_db_lookup(db, mac1);
+	assert(entry && entry->addr == 0xc0a80120 && entry->expiry == 6000);
+	assert(!lease_db_lookup(db, mac2));
+	assert(!lease_db_lookup(db, mac3));
+	lease_db_free(db);
+
+	/* Leases outside of a shrunk pool are dropped */
+	db = lease_db_new(0xc0a80102, 0xc0a8011f);
+	assert(lease_db_open(db, path, 2000) == 0);
+	assert(lease_db_count(db) == 0);
+	lease_db_free(db);
+
+	unlink(path);
+}
+
+/*
+ * Store a lease for each of MANY_CLIENTS clients and renew every one of them,
+ * then make sure the whole lease set survives a restart.  The compaction
+ * threshold is crossed many times on the way.
+ */
+static void test_many_clients(const void *data)
+{
+	_auto_(l_free) char *path = lease_db_tmp_path();
+	struct lease_db *db = lease_db_new(POOL_START, POOL_END);
+	unsigned int i;
+	uint8_t mac[6];
+
+	assert(lease_db_open(db, path, 1000) == 0);
+
+	for (i = 0; i < MANY_CLIENTS; i++) {
+		client_mac(i, mac);
+		assert(!lease_db_lookup(db, mac));
+		assert(lease_db_set(db, mac, POOL_START + i, 10000));
+	}
+
+	for (i = 0; i < MANY_CLIENTS; i++) {
+		const struct lease_db_entry *entry;
+
+		client_mac(i, mac);
+		entry = lease_db_lookup(db, mac);
+		assert(entry);
+		assert(lease_db_set(db, mac, entry->addr, 20000));
+	}
+
+	lease_db_free(db);
+
+	db = lease_db_new(POOL_START, POOL_END);
+	assert(lease_db_open(db, path, 15000) == 0);
+	assert(lease_db_count(db) == MANY_CLIENTS);
+
+	for (i = 0; i < MANY_CLIENTS; i++) {
+		const struct lease_db_entry *entry;
+
+		client_mac(i, mac);
+		entry = lease_db_lookup(db, mac);
+		assert(entry && entry->addr == POOL_START + i);
+		assert(entry->expiry == 20000);
+	}
+
+	lease_db_free(db);
+	unlink(path);
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("/lease-db/basic", test_basic, NULL);
+	l_test_add("/lease-db/persist", test_persist, NULL);
+	l_test_add("/lease-db/many-clients", test_many_clients, NULL);
+
+	return l_test_run();
+}
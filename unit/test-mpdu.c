@@ -175,6 +175,102 @@ static void ie_order_test(const void *data)
 	assert(!!mpdu_validate(frame->data, frame->len) == frame->good);
 }
 
+struct header_test_data {
+	const uint8_t *data;
+	size_t len;
+	bool header_good;
+	bool good;
+};
+
+static const uint8_t data_frame[] = {
+	0x08, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x01, 0x00, 0x02, 0x00,
+	0x00, 0x00, 0x03, 0x00, 0x02, 0x00, 0x00, 0x00, 0x01, 0x00, 0x50, 0x64,
+	0xaa, 0xaa, 0x03, 0x00, 0x00, 0x00, 0x88, 0x8e,
+};
+
+/* Open System Authentication, transaction 1 */
+static const uint8_t auth_frame[] = {
+	0xb0, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x01, 0x00, 0x02, 0x00,
+	0x00, 0x00, 0x03, 0x00, 0x02, 0x00, 0x00, 0x00, 0x01, 0x00, 0x50, 0x64,
+	0x00, 0x00, 0x01, 0x00, 0x00, 0x00,
+};
+
+/* Same with an unknown authentication algorithm */
+static const uint8_t auth_frame_bad_algo[] = {
+	0xb0, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x01, 0x00, 0x02, 0x00,
+	0x00, 0x00, 0x03, 0x00, 0x02, 0x00, 0x00, 0x00, 0x01, 0x00, 0x50, 0x64,
+	0x42, 0x00, 0x01, 0x00, 0x00, 0x00,
+};
+
+/* Order bit set, HT Control field missing */
+static const uint8_t probe_req_no_ht_control[] = {
+	0x40, 0x80, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x02, 0x00,
+	0x00, 0x00, 0x03, 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x50, 0x64,
+	0x00, 0x00,
+};
+
+static const struct header_test_data header_good = {
+	probe_req_good2, sizeof(probe_req_good2), true, true
+};
+
+static const struct header_test_data header_truncated = {
+	probe_req_good2, 23, false, false
+};
+
+static const struct header_test_data header_auth = {
+	auth_frame, sizeof(auth_frame), true, true
+};
+
+/* The header is fine, the fixed Authentication fields are cut short */
+static const struct header_test_data header_truncated_body = {
+	auth_frame, 24 + 2, true, false
+};
+
+static const struct header_test_data header_bad_algo = {
+	auth_frame_bad_algo, sizeof(auth_frame_bad_algo), true, false
+};
+
+static const struct header_test_data header_duplicate_ie = {
+	probe_req_ie_duplicate1, sizeof(probe_req_ie_duplicate1), true, false
+};
+
+static const struct header_test_data header_data_frame = {
+	data_frame, sizeof(data_frame), false, false
+};
+
+static const struct header_test_data header_no_ht_control = {
+	probe_req_no_ht_control, sizeof(probe_req_no_ht_control), false, false
+};
+
+static const struct header_test_data header_too_short = {
+	probe_req_good2, 1, false, false
+};
+
+/*
+ * mpdu_validate_header() is used to route frames before their body is
+ * looked at, the full validation only happens once a watch matched.  It
+ * must reject anything with a bad header and accept everything that
+ * passes the full validation.
+ */
+static void header_test(const void *data)
+{
+	const struct header_test_data *test = data;
+	const struct mmpdu_header *mpdu;
+
+	mpdu = mpdu_validate_header(test->data, test->len);
+	assert(!!mpdu == test->header_good);
+
+	if (mpdu)
+		assert((const uint8_t *) mpdu == test->data);
+
+	assert(!!mpdu_validate(test->data, test->len) == test->good);
+}
+
+static void header_null_test(const void *data)
+{
+	assert(!mpdu_validate_header(NULL, 24));
+}
+
 static void ie_sort_test(const void *data)
 {
 	static uint8_t ie_fils_session[] = { IE_TYPE_EXTENSION, 1, 4 };
@@ -232,5 +328,20 @@ int main(int argc, char *argv[])
 
 	l_test_add("/IE order/Sorting", ie_sort_test, NULL);
 
+	l_test_add("/Header/Good", header_test, &header_good);
+	l_test_add("/Header/Truncated header", header_test,
+				&header_truncated);
+	l_test_add("/Header/Authentication", header_test, &header_auth);
+	l_test_add("/Header/Truncated body", header_test,
+				&header_truncated_body);
+	l_test_add("/Header/Bad algorithm", header_test, &header_bad_algo);
+	l_test_add("/Header/Duplicate IE", header_test,
+				&header_duplicate_ie);
+	l_test_add("/Header/Data frame", header_test, &header_data_frame);
+	l_test_add("/Header/Missing HT Control", header_test,
+				&header_no_ht_control);
+	l_test_add("/Header/Too short", header_test, &header_too_short);
+	l_test_add("/Header/NULL", header_null_test, NULL);
+
 	return l_test_run();
 }
@@ -0,0 +1,301 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  iwd contributors. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <assert.h>
+#include <ell/ell.h>
+
+#include "src/prefix-trie.h"
+
+struct watch {
+	uint16_t frame_type;
+	const uint8_t *prefix;
+	size_t prefix_len;
+};
+
+#define WATCH(type, ...)						\
+	{ type, (const uint8_t []) { __VA_ARGS__ },			\
+		sizeof((const uint8_t []) { __VA_ARGS__ }) }
+
+/*
+ * The watches a station interface doing P2P, DPP and RRM, or an AP
+ * interface, typically ends up registering in the default frame watch group.
+ */
+static const struct watch watches[] = {
+	{ 0x0040, NULL, 0 },					/* Probe Req */
+	WATCH(0x00d0, 0x05, 0x05),				/* Neighbor Rep */
+	WATCH(0x00d0, 0x08, 0x01),				/* SA Query Resp */
+	WATCH(0x00d0, 0x08, 0x00),				/* SA Query Req */
+	WATCH(0x00d0, 0x06, 0x02),				/* FT Response */
+	WATCH(0x00b0, 0x02, 0x00),				/* FT Auth */
+	WATCH(0x00d0, 0x01, 0x04),				/* QoS Map */
+	WATCH(0x00d0, 0x05, 0x00),				/* Radio Meas */
+	WATCH(0x00d0, 0x04, 0x09, 0x50, 0x6f, 0x9a, 0x1a, 0x01), /* DPP */
+	WATCH(0x00d0, 0x04, 0x0b),				/* GAS Resp */
+	WATCH(0x00d0, 0x04, 0x0a),				/* GAS Req */
+	WATCH(0x00d0, 0x04, 0x09, 0x50, 0x6f, 0x9a, 0x09),	/* P2P Public */
+	WATCH(0x00d0, 0x7f, 0x50, 0x6f, 0x9a, 0x09),		/* P2P Action */
+	WATCH(0x00d0, 0x04, 0x0d),				/* GAS Comeback */
+	{ 0x0000, NULL, 0 },					/* Assoc Req */
+	{ 0x0020, NULL, 0 },					/* Reassoc Req */
+	{ 0x00a0, NULL, 0 },					/* Disassoc */
+	{ 0x00b0, NULL, 0 },					/* Auth */
+	{ 0x00c0, NULL, 0 },					/* Deauth */
+};
+
+struct frame {
+	uint16_t frame_type;
+	const uint8_t *body;
+	size_t body_len;
+};
+
+#define FRAME(type, ...)						\
+	{ type, (const uint8_t []) { __VA_ARGS__ },			\
+		sizeof((const uint8_t []) { __VA_ARGS__ }) }
+
+static const struct frame frames[] = {
+	FRAME(0x0040, 0x00, 0x04, 't', 'e', 's', 't'),
+	FRAME(0x00d0, 0x04, 0x09, 0x50, 0x6f, 0x9a, 0x1a, 0x01, 0x00),
+	FRAME(0x00d0, 0x04, 0x09, 0x50, 0x6f, 0x9a, 0x09, 0x00, 0x01),
+	FRAME(0x00d0, 0x04, 0x09, 0x50, 0x6f, 0x9a, 0x10, 0x00),
+	FRAME(0x00d0, 0x04, 0x0b, 0x01, 0x00, 0x00),
+	FRAME(0x00d0, 0x05, 0x05, 0x01),
+	FRAME(0x00d0, 0x05, 0x00, 0x01, 0x00, 0x00),
+	FRAME(0x00d0, 0x08, 0x00, 0x12, 0x34),
+	FRAME(0x00d0, 0x06, 0x02),
+	FRAME(0x00d0, 0x06),
+	FRAME(0x00d0, 0x7f, 0x50, 0x6f, 0x9a, 0x09, 0x00),
+	FRAME(0x00d0, 0x0a, 0x07),
+	FRAME(0x00b0, 0x02, 0x00, 0x02, 0x00),
+	FRAME(0x00b0, 0x00, 0x00, 0x01, 0x00),
+	FRAME(0x0000, 0x31, 0x04, 0x0a, 0x00),
+};
+
+struct index {
+	uint16_t frame_type;
+	struct prefix_trie *trie;
+};
+
+static struct index *build_index(unsigned int *out_n)
+{
+	struct index *index = l_new(struct index, L_ARRAY_SIZE(watches));
+	unsigned int n = 0;
+	unsigned int i;
+	unsigned int j;
+
+	for (i = 0; i < L_ARRAY_SIZE(watches); i++) {
+		for (j = 0; j < n; j++)
+			if (index[j].frame_type == watches[i].frame_type)
+				break;
+
+		if (j == n) {
+			index[n].frame_type = watches[i].frame_type;
+			index[n++].trie = prefix_trie_new();
+		}
+
+		prefix_trie_insert(index[j].trie, watches[i].prefix,
+					watches[i].prefix_len,
+					(void *) &watches[i]);
+	}
+
+	*out_n = n;
+	return index;
+}
+
+static void free_index(struct index *index, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		prefix_trie_free(index[i].trie);
+
+	l_free(index);
+}
+
+static struct prefix_trie *index_lookup(struct index *index, unsigned int n,
+					uint16_t frame_type)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		if (index[i].frame_type == frame_type)
+			return index[i].trie;
+
+	return NULL;
+}
+
+/* Same comparison frame_watch_match_prefix used to do for every watch */
+static bool linear_match(const struct watch *watch, const struct frame *frame)
+{
+	return watch->frame_type == frame->frame_type &&
+		watch->prefix_len <= frame->body_len &&
+		(watch->prefix_len == 0 ||
+		 !memcmp(watch->prefix, frame->body, watch->prefix_len));
+}
+
+static void mark_match(void *value, void *user_data)
+{
+	bool *matched = user_data;
+	const struct watch *watch = value;
+
+	matched[watch - watches] = true;
+}
+
+static void count_match(void *value, void *user_data)
+{
+	unsigned int *count = user_data;
+
+	(*count)++;
+}
+
+static void test_equivalence(const void *data)
+{
+	unsigned int n;
+	struct index *index = build_index(&n);
+	unsigned int i;
+	unsigned int j;
+
+	for (i = 0; i < L_ARRAY_SIZE(frames); i++) {
+		bool matched[L_ARRAY_SIZE(watches)] = {};
+		struct prefix_trie *trie = index_lookup(index, n,
+							frames[i].frame_type);
+
+		if (trie)
+			prefix_trie_foreach_match(trie, frames[i].body,
+							frames[i].body_len,
+							mark_match, matched);
+
+		for (j = 0; j < L_ARRAY_SIZE(watches); j++)
+			assert(matched[j] == linear_match(&watches[j],
+								&frames[i]));
+	}
+
+	free_index(index, n);
+}
+
+static void test_remove(const void *data)
+{
+	static const uint8_t p1[] = { 0x04, 0x09 };
+	static const uint8_t p2[] = { 0x04, 0x09, 0x50 };
+	static const uint8_t frame[] = { 0x04, 0x09, 0x50, 0x6f };
+	struct prefix_trie *trie = prefix_trie_new();
+	int a, b, c;
+	unsigned int count = 0;
+
+	assert(prefix_trie_isempty(trie));
+
+	prefix_trie_insert(trie, NULL, 0, &a);
+	prefix_trie_insert(trie, p1, sizeof(p1), &b);
+	prefix_trie_insert(trie, p2, sizeof(p2), &c);
+	prefix_trie_insert(trie, p2, sizeof(p2), &a);
+
+	assert(prefix_trie_foreach_match(trie, frame, sizeof(frame),
+						count_match, &count) == 4);
+	assert(count == 4);
+	assert(prefix_trie_foreach_match(trie, frame, 2, count_match,
+						&count) == 2);
+
+	assert(!prefix_trie_remove(trie, p1, sizeof(p1), &c));
+	assert(!prefix_trie_remove(trie, frame, sizeof(frame), &c));
+	assert(prefix_trie_remove(trie, p2, sizeof(p2), &c));
+	assert(prefix_trie_remove(trie, p2, sizeof(p2), &a));
+	assert(prefix_trie_foreach_match(trie, frame, sizeof(frame),
+						count_match, &count) == 2);
+
+	assert(prefix_trie_remove(trie, NULL, 0, &a));
+	assert(!prefix_trie_isempty(trie));
+	assert(prefix_trie_remove(trie, p1, sizeof(p1), &b));
+	assert(prefix_trie_isempty(trie));
+
+	prefix_trie_free(trie);
+}
+
+#define BENCH_ROUNDS 200000
+
+/*
+ * Compare dispatching a realistic mix of management frames against the full
+ * watch list using the per-watch comparison versus the trie lookup.
+ */
+static void test_benchmark(const void *data)
+{
+	unsigned int n;
+	struct index *index = build_index(&n);
+	unsigned int linear_count = 0;
+	unsigned int trie_count = 0;
+	uint64_t start;
+	uint64_t linear_time;
+	uint64_t trie_time;
+	unsigned int r;
+	unsigned int i;
+	unsigned int j;
+
+	start = l_time_now();
+
+	for (r = 0; r < BENCH_ROUNDS; r++)
+		for (i = 0; i < L_ARRAY_SIZE(frames); i++)
+			for (j = 0; j < L_ARRAY_SIZE(watches); j++)
+				if (linear_match(&watches[j], &frames[i]))
+					linear_count++;
+
+	linear_time = l_time_diff(start, l_time_now());
+	start = l_time_now();
+
+	for (r = 0; r < BENCH_ROUNDS; r++)
+		for (i = 0; i < L_ARRAY_SIZE(frames); i++) {
+			struct prefix_trie *trie = index_lookup(index, n,
+							frames[i].frame_type);
+
+			if (trie)
+				prefix_trie_foreach_match(trie, frames[i].body,
+							frames[i].body_len,
+							count_match,
+							&trie_count);
+		}
+
+	trie_time = l_time_diff(start, l_time_now());
+
+	assert(linear_count == trie_count);
+
+	printf("%u frames against %zu watches: linear %" PRIu64 " usec, "
+		"trie %" PRIu64 " usec\n",
+		BENCH_ROUNDS * (unsigned int) L_ARRAY_SIZE(frames),
+		L_ARRAY_SIZE(watches), linear_time, trie_time);
+
+	free_index(index, n);
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("/prefix-trie/equivalence", test_equivalence, NULL);
+	l_test_add("/prefix-trie/remove", test_remove, NULL);
+	l_test_add("/prefix-trie/benchmark", test_benchmark, NULL);
+
+	return l_test_run();
+}
@@ -0,0 +1,489 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  iwd contributors. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <assert.h>
+#include <ell/ell.h>
+
+#include "linux/nl80211.h"
+#include "src/iwd.h"
+#include "src/module.h"
+#include "src/wiphy.h"
+#include "src/common.h"
+#include "src/knownnetworks.h"
+#include "src/nl80211util.h"
+#include "src/util.h"
+#include "src/band.h"
+#include "src/scan.h"
+#include "unit/fake-genl.h"
+
+/*
+ * scan is tested on the radio work queue of a wiphy that was never
+ * populated from the kernel, with the nl80211 commands it sends captured
+ * by unit/fake-genl.c instead of going to the kernel.  The wiphy's
+ * frequencies and features that scan looks at are faked through the
+ * wrapped getters below.  The tests reply to the trigger commands, feed
+ * the NEW_SCAN_RESULTS events to scan and complete the GET_SURVEY and
+ * GET_SCAN dumps without any results.
+ */
+
+#define TEST_WDEV_ID	1
+
+static struct wiphy *test_wiphy;
+static struct scan_freq_set *test_freqs;
+static int test_6ghz_disabled;
+
+struct test_scan {
+	uint32_t id;
+	bool done;
+	int err;
+	struct scan_freq_set *freqs;
+};
+
+struct test_work {
+	struct wiphy_radio_work_item item;
+	bool started;
+};
+
+bool known_networks_foreach(known_networks_foreach_func_t function,
+				void *user_data)
+{
+	return true;
+}
+
+bool known_networks_has_hidden(void)
+{
+	return false;
+}
+
+int __wrap_wiphy_band_is_disabled(const struct wiphy *wiphy,
+					enum band_freq band);
+const struct scan_freq_set *__wrap_wiphy_get_supported_freqs(
+						const struct wiphy *wiphy);
+bool __wrap_wiphy_has_feature(struct wiphy *wiphy, uint32_t feature);
+uint8_t __wrap_wiphy_get_max_num_ssids_per_scan(struct wiphy *wiphy);
+
+int __wrap_wiphy_band_is_disabled(const struct wiphy *wiphy,
+					enum band_freq band)
+{
+	if (band != BAND_FREQ_6_GHZ)
+		return 0;
+
+	return test_6ghz_disabled;
+}
+
+const struct scan_freq_set *__wrap_wiphy_get_supported_freqs(
+						const struct wiphy *wiphy)
+{
+	return test_freqs;
+}
+
+bool __wrap_wiphy_has_feature(struct wiphy *wiphy, uint32_t feature)
+{
+	return feature == NL80211_FEATURE_SCAN_FLUSH;
+}
+
+uint8_t __wrap_wiphy_get_max_num_ssids_per_scan(struct wiphy *wiphy)
+{
+	return 4;
+}
+
+extern struct iwd_module_desc __start___iwd_module[];
+extern struct iwd_module_desc __stop___iwd_module[];
+
+static struct iwd_module_desc *test_module(const char *name)
+{
+	struct iwd_module_desc *desc;
+
+	for (desc = __start___iwd_module; desc < __stop___iwd_module; desc++)
+		if (!strcmp(desc->name, name))
+			return desc;
+
+	return NULL;
+}
+
+static void test_setup(const uint32_t *freqs, unsigned int n_freqs,
+			int band_6ghz_disabled)
+{
+	unsigned int i;
+
+	test_freqs = scan_freq_set_new();
+	test_6ghz_disabled = band_6ghz_disabled;
+
+	for (i = 0; i < n_freqs; i++)
+		scan_freq_set_add(test_freqs, freqs[i]);
+
+	fake_genl_init();
+
+	assert(test_module("wiphy")->init() == 0);
+	test_wiphy = wiphy_create(0, "phy0");
+	assert(test_wiphy);
+
+	assert(test_module("scan")->init() == 0);
+	assert(scan_wdev_add(TEST_WDEV_ID));
+}
+
+static void test_teardown(void)
+{
+	assert(scan_wdev_remove(TEST_WDEV_ID));
+	test_module("scan")->exit();
+
+	assert(wiphy_destroy(test_wiphy));
+	test_module("wiphy")->exit();
+
+	fake_genl_exit();
+	scan_freq_set_free(test_freqs);
+}
+
+static bool test_scan_notify(int err, struct l_queue *bss_list,
+				const struct scan_freq_set *freqs,
+				void *userdata)
+{
+	struct test_scan *scan = userdata;
+
+	scan->done = true;
+	scan->err = err;
+	scan->freqs = freqs ? scan_freq_set_clone(freqs, BAND_FREQ_2_4_GHZ |
+							BAND_FREQ_5_GHZ |
+							BAND_FREQ_6_GHZ) : NULL;
+
+	return false;
+}
+
+static bool test_cmd_flushes(const struct fake_genl_cmd *cmd)
+{
+	uint32_t flags;
+
+	if (nl80211_parse_attrs(cmd->msg, NL80211_ATTR_SCAN_FLAGS, &flags,
+				NL80211_ATTR_UNSPEC) < 0)
+		return false;
+
+	return flags & NL80211_SCAN_FLAG_FLUSH;
+}
+
+static struct scan_freq_set *test_cmd_freqs(const struct fake_genl_cmd *cmd)
+{
+	struct scan_freq_set *freqs = scan_freq_set_new();
+	struct l_genl_attr attr, nested;
+	uint16_t type, len;
+	const void *data;
+
+	assert(l_genl_attr_init(&attr, cmd->msg));
+
+	while (l_genl_attr_next(&attr, &type, &len, &data)) {
+		if (type != NL80211_ATTR_SCAN_FREQUENCIES)
+			continue;
+
+		assert(l_genl_attr_recurse(&attr, &nested));
+
+		while (l_genl_attr_next(&nested, &type, &len, &data)) {
+			assert(len == 4);
+			scan_freq_set_add(freqs, l_get_u32(data));
+		}
+	}
+
+	return freqs;
+}
+
+static void assert_freqs(const struct scan_freq_set *freqs,
+				const uint32_t *expected, unsigned int n)
+{
+	struct scan_freq_set *set = scan_freq_set_clone(freqs,
+							BAND_FREQ_2_4_GHZ |
+							BAND_FREQ_5_GHZ |
+							BAND_FREQ_6_GHZ);
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		assert(scan_freq_set_contains(set, expected[i]));
+		scan_freq_set_remove(set, expected[i]);
+	}
+
+	assert(scan_freq_set_isempty(set));
+	scan_freq_set_free(set);
+}
+
+/*
+ * Acknowledges the last TRIGGER_SCAN and reports it as finished with a
+ * NEW_SCAN_RESULTS event for the frequencies it requested
+ */
+static void test_trigger_done(struct fake_genl_cmd *cmd)
+{
+	struct l_genl_msg *msg;
+	struct scan_freq_set *freqs = test_cmd_freqs(cmd);
+	struct scan_freq_set_iter iter;
+	uint64_t wdev_id = TEST_WDEV_ID;
+	uint32_t wiphy_id = 0;
+	uint32_t freq;
+	int count = 0;
+
+	assert(l_genl_msg_get_command(cmd->msg) == NL80211_CMD_TRIGGER_SCAN);
+
+	msg = l_genl_msg_new(NL80211_CMD_TRIGGER_SCAN);
+	fake_genl_reply(cmd, msg);
+	l_genl_msg_unref(msg);
+
+	msg = l_genl_msg_new(NL80211_CMD_NEW_SCAN_RESULTS);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_WIPHY, 4, &wiphy_id);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_WDEV, 8, &wdev_id);
+	l_genl_msg_enter_nested(msg, NL80211_ATTR_SCAN_FREQUENCIES);
+
+	scan_freq_set_iter_init(&iter, freqs);
+
+	while (scan_freq_set_iter_next(&iter, &freq))
+		l_genl_msg_append_attr(msg, count++, 4, &freq);
+
+	l_genl_msg_leave_nested(msg);
+
+	fake_genl_notify("scan", msg);
+	l_genl_msg_unref(msg);
+	scan_freq_set_free(freqs);
+}
+
+/* Completes the GET_SURVEY and GET_SCAN dumps without any results */
+static void test_get_results(void)
+{
+	struct fake_genl_cmd *cmd = fake_genl_last();
+
+	assert(l_genl_msg_get_command(cmd->msg) == NL80211_CMD_GET_SURVEY);
+	fake_genl_reply(cmd, NULL);
+
+	cmd = fake_genl_last();
+	assert(l_genl_msg_get_command(cmd->msg) == NL80211_CMD_GET_SCAN);
+	fake_genl_reply(cmd, NULL);
+}
+
+static const uint32_t freqs_2g[] = { 2412, 2437 };
+static const uint32_t freqs_5g[] = { 5180, 5240 };
+static const uint32_t freqs_6g[] = { 5955 };
+static const uint32_t freqs_all[] = { 2412, 2437, 5180, 5240, 5955 };
+static const uint32_t freqs_2g_5g[] = { 2412, 2437, 5180, 5240 };
+
+static uint32_t test_scan_start(struct test_scan *scan, bool chunked)
+{
+	struct scan_parameters params = {};
+
+	params.flush = true;
+	params.chunked = chunked;
+
+	scan->id = scan_active_full(TEST_WDEV_ID, &params, NULL,
+					test_scan_notify, scan, NULL);
+	assert(scan->id);
+
+	return scan->id;
+}
+
+static void test_chunked_bands(const void *data)
+{
+	struct test_scan scan = {};
+	struct fake_genl_cmd *cmd;
+	struct scan_freq_set *freqs;
+
+	test_setup(freqs_2g_5g, L_ARRAY_SIZE(freqs_2g_5g), -ENOTSUP);
+	test_scan_start(&scan, true);
+
+	cmd = fake_genl_last();
+	freqs = test_cmd_freqs(cmd);
+	assert_freqs(freqs, freqs_2g, L_ARRAY_SIZE(freqs_2g));
+	scan_freq_set_free(freqs);
+	assert(test_cmd_flushes(cmd));
+
+	test_trigger_done(cmd);
+	assert(!scan.done);
+
+	/* The kernel keeps the 2.4GHz results, don't flush them */
+	cmd = fake_genl_last();
+	freqs = test_cmd_freqs(cmd);
+	assert_freqs(freqs, freqs_5g, L_ARRAY_SIZE(freqs_5g));
+	scan_freq_set_free(freqs);
+	assert(!test_cmd_flushes(cmd));
+
+	test_trigger_done(cmd);
+	assert(!scan.done);
+
+	test_get_results();
+	assert(scan.done && !scan.err);
+	assert_freqs(scan.freqs, freqs_2g_5g, L_ARRAY_SIZE(freqs_2g_5g));
+	scan_freq_set_free(scan.freqs);
+
+	/* Two triggers, one survey and a single GET_SCAN */
+	assert(fake_genl_count(0) == 4);
+
+	test_teardown();
+}
+
+static void test_chunked_6ghz(const void *data)
+{
+	struct test_scan scan = {};
+	struct fake_genl_cmd *cmd;
+	struct scan_freq_set *freqs;
+
+	test_setup(freqs_all, L_ARRAY_SIZE(freqs_all), 0);
+	test_scan_start(&scan, true);
+
+	test_trigger_done(fake_genl_last());
+	test_trigger_done(fake_genl_last());
+
+	cmd = fake_genl_last();
+	freqs = test_cmd_freqs(cmd);
+	assert_freqs(freqs, freqs_6g, L_ARRAY_SIZE(freqs_6g));
+	scan_freq_set_free(freqs);
+	assert(!test_cmd_flushes(cmd));
+
+	test_trigger_done(cmd);
+	test_get_results();
+	assert(scan.done && !scan.err);
+	assert_freqs(scan.freqs, freqs_all, L_ARRAY_SIZE(freqs_all));
+	scan_freq_set_free(scan.freqs);
+
+	test_teardown();
+}
+
+static bool test_work_do_work(struct wiphy_radio_work_item *item)
+{
+	struct test_work *work = l_container_of(item, struct test_work, item);
+
+	work->started = true;
+	return false;
+}
+
+static void test_work_destroy(struct wiphy_radio_work_item *item)
+{
+}
+
+static const struct wiphy_radio_work_item_ops test_work_ops = {
+	.do_work = test_work_do_work,
+	.destroy = test_work_destroy,
+};
+
+static void test_chunked_yield(const void *data)
+{
+	struct test_scan scan = {};
+	struct test_work connect = {};
+	struct test_work periodic = {};
+	struct fake_genl_cmd *cmd;
+	struct scan_freq_set *freqs;
+
+	test_setup(freqs_2g_5g, L_ARRAY_SIZE(freqs_2g_5g), -ENOTSUP);
+	test_scan_start(&scan, true);
+
+	wiphy_radio_work_insert(test_wiphy, &periodic.item, 1,
+				WIPHY_WORK_PRIORITY_PERIODIC_SCAN,
+				&test_work_ops);
+	wiphy_radio_work_insert(test_wiphy, &connect.item, 1,
+				WIPHY_WORK_PRIORITY_CONNECT, &test_work_ops);
+	assert(!connect.started);
+
+	/* The connect gets the radio between the two bands */
+	cmd = fake_genl_last();
+	test_trigger_done(cmd);
+	assert(connect.started && !periodic.started);
+	assert(fake_genl_last() == cmd);
+	assert(wiphy_radio_work_is_running(test_wiphy, scan.id) == 0);
+
+	/* And the scan resumes with the 5GHz band once it's done */
+	wiphy_radio_work_done(test_wiphy, connect.item.id);
+	cmd = fake_genl_last();
+	freqs = test_cmd_freqs(cmd);
+	assert_freqs(freqs, freqs_5g, L_ARRAY_SIZE(freqs_5g));
+	scan_freq_set_free(freqs);
+	assert(!test_cmd_flushes(cmd));
+
+	/* Lower priority work waits for the whole scan */
+	test_trigger_done(cmd);
+	test_get_results();
+	assert(scan.done && !scan.err);
+	assert_freqs(scan.freqs, freqs_2g_5g, L_ARRAY_SIZE(freqs_2g_5g));
+	scan_freq_set_free(scan.freqs);
+	assert(periodic.started);
+
+	wiphy_radio_work_done(test_wiphy, periodic.item.id);
+
+	test_teardown();
+}
+
+static void test_unchunked(const void *data)
+{
+	struct test_scan scan = {};
+	struct fake_genl_cmd *cmd;
+	struct scan_freq_set *freqs;
+
+	test_setup(freqs_2g_5g, L_ARRAY_SIZE(freqs_2g_5g), -ENOTSUP);
+	test_scan_start(&scan, false);
+
+	cmd = fake_genl_last();
+	freqs = test_cmd_freqs(cmd);
+	assert_freqs(freqs, freqs_2g_5g, L_ARRAY_SIZE(freqs_2g_5g));
+	scan_freq_set_free(freqs);
+	assert(test_cmd_flushes(cmd));
+
+	test_trigger_done(cmd);
+	test_get_results();
+	assert(scan.done && !scan.err);
+	scan_freq_set_free(scan.freqs);
+	assert(fake_genl_count(0) == 3);
+
+	test_teardown();
+}
+
+static void test_split_6ghz_flush(const void *data)
+{
+	struct test_scan scan = {};
+	struct fake_genl_cmd *cmd;
+
+	/* 6GHz may be enabled by the regdom, split even if not chunked */
+	test_setup(freqs_2g_5g, L_ARRAY_SIZE(freqs_2g_5g), 1);
+	test_scan_start(&scan, false);
+
+	cmd = fake_genl_last();
+	assert(test_cmd_flushes(cmd));
+	test_trigger_done(cmd);
+
+	cmd = fake_genl_last();
+	assert(!test_cmd_flushes(cmd));
+	test_trigger_done(cmd);
+
+	test_get_results();
+	assert(scan.done && !scan.err);
+	assert_freqs(scan.freqs, freqs_2g_5g, L_ARRAY_SIZE(freqs_2g_5g));
+	scan_freq_set_free(scan.freqs);
+
+	test_teardown();
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("/scan/chunked/bands", test_chunked_bands, NULL);
+	l_test_add("/scan/chunked/6ghz", test_chunked_6ghz, NULL);
+	l_test_add("/scan/chunked/yield", test_chunked_yield, NULL);
+	l_test_add("/scan/unchunked", test_unchunked, NULL);
+	l_test_add("/scan/split-6ghz/flush", test_split_6ghz_flush, NULL);
+
+	return l_test_run();
+}
@@ -33,6 +33,7 @@
 
 #include "src/defs.h"
 #include "src/util.h"
+#include "src/band.h"
 
 struct ssid_test_data {
 	size_t len;
@@ -184,6 +185,166 @@ static void ip_prefix_test(const void *data)
 	}
 }
 
+static void scan_freq_set_test(const void *data)
+{
+	static const uint32_t expected[] = {
+		5180, 5500, 5825, 5955, 7115, 2412, 2484,
+	};
+	struct scan_freq_set *set = scan_freq_set_new();
+	struct scan_freq_set *other = scan_freq_set_new();
+	struct scan_freq_set *clone;
+	struct scan_freq_set_iter iter;
+	uint32_t *freqs;
+	uint32_t freq;
+	size_t len;
+	unsigned int i;
+
+	assert(scan_freq_set_isempty(set));
+	assert(!scan_freq_set_get_bands(set));
+	assert(!scan_freq_set_to_fixed_array(set, &len));
+
+	/* Not a valid channel */
+	assert(!scan_freq_set_add(set, 2413));
+
+	for (i = 0; i < L_ARRAY_SIZE(expected); i++)
+		assert(scan_freq_set_add(set, expected[i]));
+
+	assert(scan_freq_set_size(set) == L_ARRAY_SIZE(expected));
+	assert(scan_freq_set_get_bands(set) == (BAND_FREQ_2_4_GHZ |
+						BAND_FREQ_5_GHZ |
+						BAND_FREQ_6_GHZ));
+
+	/* 5GHz, 6GHz then 2.4GHz, ascending within each band */
+	scan_freq_set_iter_init(&iter, set);
+
+	for (i = 0; scan_freq_set_iter_next(&iter, &freq); i++)
+		assert(freq == expected[i]);
+
+	assert(i == L_ARRAY_SIZE(expected));
+
+	freqs = scan_freq_set_to_fixed_array(set, &len);
+	assert(len == L_ARRAY_SIZE(expected));
+	assert(!memcmp(freqs, expected, sizeof(expected)));
+	l_free(freqs);
+
+	clone = scan_freq_set_clone(set, BAND_FREQ_5_GHZ);
+	assert(scan_freq_set_get_bands(clone) == BAND_FREQ_5_GHZ);
+	assert(scan_freq_set_size(clone) == 3);
+
+	scan_freq_set_add(other, 5500);
+	scan_freq_set_add(other, 2412);
+	scan_freq_set_add(other, 5240);
+
+	scan_freq_set_constrain(clone, other);
+	assert(scan_freq_set_size(clone) == 1);
+	assert(scan_freq_set_contains(clone, 5500));
+
+	scan_freq_set_subtract(set, other);
+	assert(scan_freq_set_size(set) == L_ARRAY_SIZE(expected) - 2);
+	assert(!scan_freq_set_contains(set, 5500));
+	assert(!scan_freq_set_contains(set, 2412));
+	assert(scan_freq_set_contains(set, 2484));
+
+	scan_freq_set_merge(set, other);
+	assert(scan_freq_set_size(set) == L_ARRAY_SIZE(expected) + 1);
+	assert(scan_freq_set_contains(set, 5240));
+
+	assert(scan_freq_set_remove(set, 7115));
+	assert(!scan_freq_set_contains(set, 7115));
+	assert(scan_freq_set_contains(set, 5955));
+
+	scan_freq_set_free(clone);
+	scan_freq_set_free(other);
+	scan_freq_set_free(set);
+}
+
+static unsigned int databuf_n_segs(const struct databuf *databuf)
+{
+	const struct databuf_seg *seg;
+	unsigned int n = 0;
+
+	for (seg = databuf->head; seg; seg = seg->next)
+		n++;
+
+	return n;
+}
+
+#define CHAIN_LEN	32768
+#define TLS_RECORD_LEN	16384
+#define EAP_FRAG_LEN	1398
+
+/*
+ * Buffer a 32KB certificate chain the way EAP-TLS does: as TLS records
+ * handed over by l_tls on transmit and as EAP fragments on receive, then
+ * check that the data is intact and count the allocations it took.
+ */
+static void databuf_test(const void *data)
+{
+	static const size_t tail_records[] = { 70, 262, 6, 45 };
+	uint8_t *chain = l_malloc(CHAIN_LEN);
+	uint8_t frag[EAP_FRAG_LEN];
+	struct databuf *databuf;
+	const uint8_t *flat;
+	size_t offset;
+	size_t total;
+	unsigned int i;
+
+	for (i = 0; i < CHAIN_LEN; i++)
+		chain[i] = i * 7 + (i >> 8);
+
+	/* Transmit: allocated for the first record, grows per record */
+	databuf = databuf_new(TLS_RECORD_LEN);
+
+	for (offset = 0; offset < CHAIN_LEN; offset += TLS_RECORD_LEN)
+		databuf_append(databuf, chain + offset, TLS_RECORD_LEN);
+
+	total = CHAIN_LEN;
+
+	for (i = 0; i < L_ARRAY_SIZE(tail_records); i++) {
+		databuf_append(databuf, chain, tail_records[i]);
+		total += tail_records[i];
+	}
+
+	assert(databuf->len == total);
+	assert(databuf_n_segs(databuf) == 3);
+
+	/* The small trailing records share one segment */
+	assert(databuf->tail->capacity == 4096);
+
+	for (offset = 0; offset < CHAIN_LEN; offset += EAP_FRAG_LEN) {
+		size_t len = L_MIN(EAP_FRAG_LEN, CHAIN_LEN - offset);
+
+		assert(databuf_copy(databuf, offset, frag, len) == len);
+		assert(!memcmp(frag, chain + offset, len));
+	}
+
+	assert(databuf_copy(databuf, total - 10, frag, sizeof(frag)) == 10);
+	assert(!memcmp(frag + 4, chain + tail_records[3] - 6, 6));
+
+	flat = databuf_flatten(databuf);
+	assert(databuf_n_segs(databuf) == 1);
+	assert(!memcmp(flat, chain, CHAIN_LEN));
+
+	databuf_free(databuf);
+
+	/* Receive: the L bit gives the size, fragments land in place */
+	databuf = databuf_new(CHAIN_LEN);
+
+	for (offset = 0; offset < CHAIN_LEN; offset += EAP_FRAG_LEN)
+		databuf_append(databuf, chain + offset,
+				L_MIN(EAP_FRAG_LEN, CHAIN_LEN - offset));
+
+	assert(databuf_n_segs(databuf) == 1);
+	assert(databuf->len == CHAIN_LEN);
+	assert(databuf_flatten(databuf) == databuf->head->data);
+	assert(!memcmp(databuf->head->data, chain, CHAIN_LEN));
+
+	databuf_free(databuf);
+
+	assert(!databuf_new(0));
+	l_free(chain);
+}
+
 int main(int argc, char *argv[])
 {
 	l_test_init(&argc, &argv);
@@ -192,6 +353,8 @@ int main(int argc, char *argv[])
 	l_test_add("/util/get_domain/", get_domain_test, NULL);
 	l_test_add("/util/get_username/", get_username_test, NULL);
 	l_test_add("/util/ip_prefix/", ip_prefix_test, NULL);
+	l_test_add("/util/scan_freq_set/", scan_freq_set_test, NULL);
+	l_test_add("/util/databuf/", databuf_test, NULL);
 
 	return l_test_run();
 }
@@ -0,0 +1,430 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  iwd contributors. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <assert.h>
+#include <ell/ell.h>
+
+#include "src/module.h"
+#include "src/wiphy.h"
+
+/*
+ * The radio work queue is tested on a wiphy that was never populated from
+ * the kernel, with l_time_now wrapped so that the tests control how long
+ * work items wait.
+ */
+
+struct test_work {
+	struct wiphy_radio_work_item item;
+	const char *name;
+	uint64_t wdev_id;
+	bool finish;
+	unsigned int started;
+	bool destroyed;
+};
+
+static uint64_t test_now;
+static struct test_work *run_order[16];
+static unsigned int n_run;
+
+uint64_t __wrap_l_time_now(void);
+
+uint64_t __wrap_l_time_now(void)
+{
+	return test_now;
+}
+
+extern struct iwd_module_desc __start___iwd_module[];
+extern struct iwd_module_desc __stop___iwd_module[];
+
+static struct iwd_module_desc *test_module(void)
+{
+	struct iwd_module_desc *desc;
+
+	for (desc = __start___iwd_module; desc < __stop___iwd_module; desc++)
+		if (!strcmp(desc->name, "wiphy"))
+			return desc;
+
+	return NULL;
+}
+
+static bool test_do_work(struct wiphy_radio_work_item *item)
+{
+	struct test_work *work = l_container_of(item, struct test_work, item);
+
+	work->started++;
+
+	assert(n_run < L_ARRAY_SIZE(run_order));
+	run_order[n_run++] = work;
+
+	return work->finish;
+}
+
+static void test_destroy(struct wiphy_radio_work_item *item)
+{
+	struct test_work *work = l_container_of(item, struct test_work, item);
+
+	work->destroyed = true;
+}
+
+static const struct wiphy_radio_work_item_ops test_work_ops = {
+	.do_work = test_do_work,
+	.destroy = test_destroy,
+};
+
+static void test_insert(struct wiphy *wiphy, struct test_work *work,
+			const char *name, int priority)
+{
+	work->name = name;
+	wiphy_radio_work_insert(wiphy, &work->item,
+				work->wdev_id ? work->wdev_id : 1,
+				priority, &test_work_ops);
+}
+
+static struct wiphy *test_setup(void)
+{
+	struct wiphy *wiphy;
+
+	test_now = 1000 * L_USEC_PER_SEC;
+	n_run = 0;
+
+	assert(test_module()->init() == 0);
+
+	wiphy = wiphy_create(0, "phy0");
+	assert(wiphy);
+
+	return wiphy;
+}
+
+static void test_teardown(struct wiphy *wiphy)
+{
+	assert(wiphy_destroy(wiphy));
+	test_module()->exit();
+}
+
+static void test_advance_ms(unsigned int ms)
+{
+	test_now += ms * L_USEC_PER_MSEC;
+}
+
+static void assert_run_order(const char *expected)
+{
+	char **names = l_strsplit(expected, ' ');
+	unsigned int i;
+
+	for (i = 0; names[i]; i++) {
+		assert(i < n_run);
+		assert(!strcmp(run_order[i]->name, names[i]));
+	}
+
+	assert(i == n_run);
+	l_strfreev(names);
+}
+
+static void test_priority(const void *data)
+{
+	struct wiphy *wiphy = test_setup();
+	struct test_work a = {}, p = {}, s = {}, f = {};
+
+	test_insert(wiphy, &a, "a", WIPHY_WORK_PRIORITY_CONNECT);
+	test_insert(wiphy, &p, "p", WIPHY_WORK_PRIORITY_PERIODIC_SCAN);
+	test_insert(wiphy, &s, "s", WIPHY_WORK_PRIORITY_SCAN);
+	test_insert(wiphy, &f, "f", WIPHY_WORK_PRIORITY_FT);
+	assert_run_order("a");
+	assert(wiphy_radio_work_is_running(wiphy, a.item.id) == 1);
+	assert(wiphy_radio_work_is_running(wiphy, f.item.id) == 0);
+
+	wiphy_radio_work_done(wiphy, a.item.id);
+	assert(a.destroyed);
+	wiphy_radio_work_done(wiphy, f.item.id);
+	wiphy_radio_work_done(wiphy, s.item.id);
+	wiphy_radio_work_done(wiphy, p.item.id);
+	assert_run_order("a f s p");
+	assert(p.destroyed);
+
+	test_teardown(wiphy);
+}
+
+static void test_aging(const void *data)
+{
+	struct wiphy *wiphy = test_setup();
+	struct test_work a = {}, p = {}, c = {};
+	struct test_work b = {}, q = {}, f = {};
+
+	test_insert(wiphy, &a, "a", WIPHY_WORK_PRIORITY_CONNECT);
+	test_insert(wiphy, &p, "p", WIPHY_WORK_PRIORITY_PERIODIC_SCAN);
+
+	/* Aged by two levels, ties with connect which was queued first */
+	test_advance_ms(10000);
+	test_insert(wiphy, &c, "c", WIPHY_WORK_PRIORITY_CONNECT);
+	wiphy_radio_work_done(wiphy, a.item.id);
+	assert_run_order("a c");
+	wiphy_radio_work_done(wiphy, c.item.id);
+	wiphy_radio_work_done(wiphy, p.item.id);
+
+	/* Aged by three levels, runs ahead of the new connect work */
+	test_insert(wiphy, &b, "b", WIPHY_WORK_PRIORITY_CONNECT);
+	test_insert(wiphy, &q, "q", WIPHY_WORK_PRIORITY_PERIODIC_SCAN);
+	test_advance_ms(15000);
+	test_insert(wiphy, &c, "c", WIPHY_WORK_PRIORITY_CONNECT);
+	wiphy_radio_work_done(wiphy, b.item.id);
+	assert_run_order("a c p b q");
+	wiphy_radio_work_done(wiphy, q.item.id);
+	wiphy_radio_work_done(wiphy, c.item.id);
+	assert_run_order("a c p b q c");
+
+	/* Aging stops at FT priority, so FT work still goes first */
+	test_insert(wiphy, &a, "a", WIPHY_WORK_PRIORITY_CONNECT);
+	test_insert(wiphy, &p, "p", WIPHY_WORK_PRIORITY_PERIODIC_SCAN);
+	test_advance_ms(60000);
+	test_insert(wiphy, &f, "f", WIPHY_WORK_PRIORITY_FT);
+	wiphy_radio_work_done(wiphy, a.item.id);
+	wiphy_radio_work_done(wiphy, f.item.id);
+	wiphy_radio_work_done(wiphy, p.item.id);
+	assert_run_order("a c p b q c a f p");
+	assert(p.destroyed);
+
+	test_teardown(wiphy);
+}
+
+static void test_deadline(const void *data)
+{
+	struct wiphy *wiphy = test_setup();
+	struct test_work a = {}, c = {}, f1 = {}, f2 = {};
+	uint64_t late = wiphy_radio_work_stat_get(
+					WIPHY_WORK_PRIORITY_CONNECT)->late;
+
+	test_insert(wiphy, &a, "a", WIPHY_WORK_PRIORITY_SCAN);
+	test_insert(wiphy, &c, "c", WIPHY_WORK_PRIORITY_CONNECT);
+	wiphy_radio_work_set_deadline(wiphy, c.item.id, 1000);
+	test_insert(wiphy, &f1, "f1", WIPHY_WORK_PRIORITY_FRAME);
+	test_insert(wiphy, &f2, "f2", WIPHY_WORK_PRIORITY_FRAME);
+
+	/* Not possible once the item is running */
+	wiphy_radio_work_set_deadline(wiphy, a.item.id, 1000);
+	assert(!a.item.deadline);
+
+	test_advance_ms(999);
+	wiphy_radio_work_done(wiphy, a.item.id);
+	assert_run_order("a f1");
+
+	test_advance_ms(1);
+	wiphy_radio_work_done(wiphy, f1.item.id);
+	assert_run_order("a f1 c");
+	assert(wiphy_radio_work_stat_get(
+			WIPHY_WORK_PRIORITY_CONNECT)->late == late + 1);
+
+	wiphy_radio_work_done(wiphy, c.item.id);
+	wiphy_radio_work_done(wiphy, f2.item.id);
+	assert_run_order("a f1 c f2");
+
+	test_teardown(wiphy);
+}
+
+static void test_yield(const void *data)
+{
+	struct wiphy *wiphy = test_setup();
+	struct test_work s = {}, p = {}, c = {};
+	uint64_t yields = wiphy_radio_work_stat_get(
+					WIPHY_WORK_PRIORITY_SCAN)->yields;
+
+	test_insert(wiphy, &s, "s", WIPHY_WORK_PRIORITY_SCAN);
+	assert(!wiphy_radio_work_yield(wiphy, s.item.id,
+					WIPHY_WORK_PRIORITY_SCAN));
+
+	/* Lower priority work doesn't preempt */
+	test_insert(wiphy, &p, "p", WIPHY_WORK_PRIORITY_PERIODIC_SCAN);
+	assert(!wiphy_radio_work_yield(wiphy, s.item.id,
+					WIPHY_WORK_PRIORITY_SCAN));
+	assert(!wiphy_radio_work_yield(wiphy, p.item.id,
+					WIPHY_WORK_PRIORITY_PERIODIC_SCAN));
+
+	test_insert(wiphy, &c, "c", WIPHY_WORK_PRIORITY_CONNECT);
+	assert(wiphy_radio_work_yield(wiphy, s.item.id,
+					WIPHY_WORK_PRIORITY_SCAN));
+	assert_run_order("s c");
+	assert(!s.destroyed);
+	assert(wiphy_radio_work_is_running(wiphy, s.item.id) == 0);
+
+	/* The scan resumes ahead of the periodic scan */
+	wiphy_radio_work_done(wiphy, c.item.id);
+	assert_run_order("s c s");
+	assert(s.started == 2);
+
+	/* Work past its deadline preempts regardless of priority */
+	wiphy_radio_work_set_deadline(wiphy, p.item.id, 100);
+	test_advance_ms(99);
+	assert(!wiphy_radio_work_yield(wiphy, s.item.id,
+					WIPHY_WORK_PRIORITY_SCAN));
+	test_advance_ms(1);
+	assert(wiphy_radio_work_yield(wiphy, s.item.id,
+					WIPHY_WORK_PRIORITY_SCAN));
+	assert_run_order("s c s p");
+
+	wiphy_radio_work_done(wiphy, p.item.id);
+	assert_run_order("s c s p s");
+	wiphy_radio_work_done(wiphy, s.item.id);
+	assert(s.destroyed && s.started == 3);
+
+	assert(wiphy_radio_work_stat_get(
+			WIPHY_WORK_PRIORITY_SCAN)->yields == yields + 2);
+
+	test_teardown(wiphy);
+}
+
+static void test_yield_aged(const void *data)
+{
+	struct wiphy *wiphy = test_setup();
+	struct test_work s = {}, p = {}, c = {};
+
+	test_insert(wiphy, &s, "s", WIPHY_WORK_PRIORITY_SCAN);
+	test_insert(wiphy, &p, "p", WIPHY_WORK_PRIORITY_PERIODIC_SCAN);
+
+	/* Aged to the scan's own priority, not enough to preempt it */
+	test_advance_ms(5000);
+	assert(!wiphy_radio_work_yield(wiphy, s.item.id,
+					WIPHY_WORK_PRIORITY_SCAN));
+
+	/*
+	 * The connect work triggers no yield of its own here, the periodic
+	 * scan has been aged past it and is the one that gets the radio.
+	 */
+	test_advance_ms(10000);
+	test_insert(wiphy, &c, "c", WIPHY_WORK_PRIORITY_CONNECT);
+	assert(wiphy_radio_work_yield(wiphy, s.item.id,
+					WIPHY_WORK_PRIORITY_SCAN));
+	assert_run_order("s p");
+	assert(wiphy_radio_work_is_running(wiphy, p.item.id) == 1);
+	assert(wiphy_radio_work_is_running(wiphy, s.item.id) == 0);
+	assert(wiphy_radio_work_is_running(wiphy, c.item.id) == 0);
+
+	wiphy_radio_work_done(wiphy, p.item.id);
+	wiphy_radio_work_done(wiphy, c.item.id);
+	wiphy_radio_work_done(wiphy, s.item.id);
+	assert_run_order("s p c s");
+
+	test_teardown(wiphy);
+}
+
+static void test_fairness(const void *data)
+{
+	struct wiphy *wiphy = test_setup();
+	struct test_work a = {}, b = {}, c = {};
+	struct test_work x = { .wdev_id = 2 }, y = { .wdev_id = 2 };
+
+	test_insert(wiphy, &a, "a", WIPHY_WORK_PRIORITY_SCAN);
+	test_insert(wiphy, &b, "b", WIPHY_WORK_PRIORITY_SCAN);
+	test_insert(wiphy, &c, "c", WIPHY_WORK_PRIORITY_SCAN);
+	test_insert(wiphy, &x, "x", WIPHY_WORK_PRIORITY_SCAN);
+	test_insert(wiphy, &y, "y", WIPHY_WORK_PRIORITY_SCAN);
+
+	/* The two wdevs take turns, each in FIFO order */
+	wiphy_radio_work_done(wiphy, a.item.id);
+	wiphy_radio_work_done(wiphy, x.item.id);
+	wiphy_radio_work_done(wiphy, b.item.id);
+	wiphy_radio_work_done(wiphy, y.item.id);
+	wiphy_radio_work_done(wiphy, c.item.id);
+	assert_run_order("a x b y c");
+
+	/* Priority still comes first */
+	test_insert(wiphy, &a, "a", WIPHY_WORK_PRIORITY_SCAN);
+	test_insert(wiphy, &b, "b", WIPHY_WORK_PRIORITY_CONNECT);
+	test_insert(wiphy, &x, "x", WIPHY_WORK_PRIORITY_SCAN);
+	wiphy_radio_work_done(wiphy, a.item.id);
+	wiphy_radio_work_done(wiphy, b.item.id);
+	wiphy_radio_work_done(wiphy, x.item.id);
+	assert_run_order("a x b y c a b x");
+
+	test_teardown(wiphy);
+}
+
+static void test_stats(const void *data)
+{
+	struct wiphy *wiphy = test_setup();
+	struct test_work a = {}, p = {}, r = {}, s = {};
+	struct wiphy_radio_work_stat_info connect = *wiphy_radio_work_stat_get(
+						WIPHY_WORK_PRIORITY_CONNECT);
+	struct wiphy_radio_work_stat_info periodic = *wiphy_radio_work_stat_get(
+					WIPHY_WORK_PRIORITY_PERIODIC_SCAN);
+	const struct wiphy_radio_work_stat_info *info;
+
+	assert(!wiphy_radio_work_stat_get(__WIPHY_WORK_PRIORITY_MAX));
+
+	test_insert(wiphy, &a, "a", WIPHY_WORK_PRIORITY_CONNECT);
+	test_insert(wiphy, &p, "p", WIPHY_WORK_PRIORITY_PERIODIC_SCAN);
+	test_insert(wiphy, &r, "r", WIPHY_WORK_PRIORITY_PERIODIC_SCAN);
+
+	/* Removed before it ever started */
+	test_advance_ms(100);
+	wiphy_radio_work_done(wiphy, r.item.id);
+	assert(r.destroyed && !r.started);
+
+	test_advance_ms(100);
+	wiphy_radio_work_done(wiphy, a.item.id);
+	test_advance_ms(50);
+	wiphy_radio_work_done(wiphy, p.item.id);
+	assert_run_order("a p");
+
+	info = wiphy_radio_work_stat_get(WIPHY_WORK_PRIORITY_CONNECT);
+	assert(info->count == connect.count + 1);
+	assert(info->total_wait_usec == connect.total_wait_usec);
+	assert(info->wait_histogram[0] == connect.wait_histogram[0] + 1);
+	assert(info->total_run_usec == connect.total_run_usec + 200000);
+	assert(info->max_run_usec >= 200000);
+
+	info = wiphy_radio_work_stat_get(WIPHY_WORK_PRIORITY_PERIODIC_SCAN);
+	assert(info->count == periodic.count + 1);
+	assert(info->total_wait_usec == periodic.total_wait_usec + 200000);
+	assert(info->max_wait_usec >= 200000);
+	assert(info->wait_histogram[8] == periodic.wait_histogram[8] + 1);
+	assert(info->total_run_usec == periodic.total_run_usec + 50000);
+
+	/* Work that completes synchronously counts as started */
+	s.finish = true;
+	test_insert(wiphy, &s, "s", WIPHY_WORK_PRIORITY_CONNECT);
+	assert(s.destroyed);
+	info = wiphy_radio_work_stat_get(WIPHY_WORK_PRIORITY_CONNECT);
+	assert(info->count == connect.count + 2);
+
+	wiphy_radio_work_stats_log();
+
+	test_teardown(wiphy);
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("/wiphy/radio-work/priority", test_priority, NULL);
+	l_test_add("/wiphy/radio-work/aging", test_aging, NULL);
+	l_test_add("/wiphy/radio-work/deadline", test_deadline, NULL);
+	l_test_add("/wiphy/radio-work/yield", test_yield, NULL);
+	l_test_add("/wiphy/radio-work/yield-aged", test_yield_aged, NULL);
+	l_test_add("/wiphy/radio-work/fairness", test_fairness, NULL);
+	l_test_add("/wiphy/radio-work/stats", test_stats, NULL);
+
+	return l_test_run();
+}